@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <signal.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/random.h>
@@ -44,6 +45,8 @@ DEFINE_int32(workers, 16, "Number of network worker threads");
 DEFINE_int32(flush, 30, "Number of seconds before writing changes to disk");
 DEFINE_int32(ping, 30, "Number of seconds between keep-alive pings");
 DEFINE_string(datadir, ".", "Data directory for collaborations");
+DEFINE_int32(backlog, 16, "Maximum output backlog in MB for slow clients");
+DEFINE_int32(compact, 4, "Update log size in MB before compacting case");
 
 // Collaboration protocol opcodes.
 enum CollabOpcode {
@@ -174,7 +177,12 @@ class CollabWriter {
   }
 
   Output *output() { return &output_; }
-  Slice packet() { return stream_.data(); }
+
+  // Return packet data.
+  Slice packet() {
+    output_.Flush();
+    return stream_.data();
+  }
 
  private:
   // Packet output stream.
@@ -189,6 +197,9 @@ class CollabCase {
  public:
   CollabCase() : store_(commons) {}
   CollabCase(int caseid) : store_(commons), caseid_(caseid) {}
+  ~CollabCase() {
+    if (log_ != nullptr) log_->Close();
+  }
 
   // Read case file from input packet.
   bool Parse(CollabReader *reader) {
@@ -314,12 +325,208 @@ class CollabCase {
     MutexLock lock(&mu_);
     int next = casefile_.GetInt(n_next);
     casefile_.Set(n_next, Handle::Integer(next + 1));
+
+    // Log topic id allocation.
+    CollabWriter writer;
+    writer.WriteInt(COLLAB_NEWID);
+    AppendLog(writer.packet());
+    dirty_ = true;
     return next;
   }
 
-  // Update collaboration.
+  // Update collaboration and add update to log.
   bool Update(CollabReader *reader) {
     MutexLock lock(&mu_);
+    if (!ApplyUpdate(reader)) return false;
+    AppendLog(reader->packet());
+    return true;
+  }
+
+  // Broadcast packet to clients. Do not send packet to source.
+  void Broadcast(CollabClient *source, const Slice &packet);
+
+  // Send pings to clients to keep connections alive.
+  void SendKeepAlivePings();
+
+  // Read case from snapshot and replay updates from log.
+  bool ReadCase() {
+    MutexLock lock(&mu_);
+
+    // Complete compaction if it was interrupted after the new snapshot was
+    // written. The new snapshot contains all the updates in the compacted log.
+    string snapshot = CaseFileName(caseid_);
+    if (File::Exists(snapshot + ".new")) {
+      LOG(WARNING) << "Completing compaction of case #" << caseid_;
+      if (File::Exists(CompactingLogFileName(caseid_))) {
+        File::Delete(CompactingLogFileName(caseid_));
+      }
+      Status st = File::Rename(snapshot + ".new", snapshot);
+      if (!st.ok()) {
+        LOG(ERROR) << "Error renaming snapshot for case #" << caseid_
+                   << ": " << st;
+        return false;
+      }
+    }
+
+    // Open case file.
+    File *f;
+    Status st = File::Open(snapshot, "r", &f);
+    if (!st.ok()) {
+      LOG(ERROR) << "Error opening case# " << caseid() << ": " << st;
+      return false;
+    }
+
+    // Decode case.
+    FileInputStream stream(f);
+    Input input(&stream);
+    Decoder decoder(&store_, &input);
+    casefile_ = decoder.DecodeAll().AsFrame();
+    if (casefile_.IsNil() || casefile_.IsError()) return false;
+
+    // Get main author for case.
+    Frame main = casefile_.GetFrame(n_main);
+    if (!main.valid()) return false;
+    author_ = main.GetHandle(n_author);
+    if (author_.IsNil()) return false;
+
+    // Get topics and folders.
+    topics_ = casefile_.Get(n_topics).AsArray();
+    folders_ = casefile_.GetFrame(n_folders);
+
+    // Replay updates from a log that was being compacted followed by updates
+    // from the current log. The case is compacted on the next checkpoint if
+    // a compaction was interrupted.
+    log_size_ = 0;
+    compact_ = File::Exists(CompactingLogFileName(caseid_));
+    if (compact_ && !ReplayLog(CompactingLogFileName(caseid_))) return false;
+    if (!ReplayLog(LogFileName(caseid_))) return false;
+
+    dirty_ = false;
+    return true;
+  }
+
+  // Read participants from file.
+  bool ReadParticipants() {
+    MutexLock lock(&mu_);
+
+    // Read user file.
+    string content;
+    Status st = File::ReadContents(UserFileName(caseid_), &content);
+    if (!st) return false;
+
+    // Parse users.
+    participants_.clear();
+    for (Text &line : Text(content).split('\n')) {
+      auto fields = line.split(' ');
+      CHECK_EQ(fields.size(), 2);
+      auto id = fields[0].trim();
+      auto credentials = fields[1].trim();
+      participants_.emplace_back(id.str(), credentials.str());
+    }
+
+    return true;
+  }
+
+  // Write participants to file.
+  void WriteParticipants() {
+    MutexLock lock(&mu_);
+    File *f = File::OpenOrDie(UserFileName(caseid_), "w");
+    for (const User &user : participants_) {
+      f->WriteLine(user.id + " " + user.credentials);
+    }
+    f->Close();
+  }
+
+  // Flush changes to disk. Updates are already in the update log, so this
+  // normally just syncs the log. The case is written to a new snapshot and the
+  // log is truncated when the log grows too big, when the case has no
+  // snapshot, or when compaction is forced.
+  void Flush(bool compact = false) {
+    if (!dirty_ && !(compact && log_size_ > 0)) return;
+    MutexLock flush_lock(&flush_mu_);
+    mu_.Lock();
+
+    // Update modification timestamp in case.
+    time_t now = time(nullptr);
+    char modtime[128];
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(modtime, sizeof modtime, "%Y-%m-%dT%H:%M:%SZ", &tm);
+    casefile_.Set(n_modified, modtime);
+
+    // Save message is also logged for updating the modification timestamp.
+    CollabWriter writer;
+    writer.WriteInt(COLLAB_UPDATE);
+    writer.WriteInt(CCU_SAVE);
+    writer.WriteString(modtime);
+
+    // Determine if case should be compacted.
+    if (log_size_ >= static_cast<uint64>(FLAGS_compact) << 20) compact = true;
+    if (compact_ || !Exists(caseid_)) compact = true;
+
+    string snapshot;
+    if (compact) {
+      // Encode case snapshot and start new log. The snapshot is written to
+      // disk after the case has been unlocked.
+      LOG(INFO) << "Compact case #" << caseid_;
+      StringOutputStream stream(&snapshot);
+      {
+        Output output(&stream);
+        Encoder encoder(&store_, &output);
+        Serialize(&encoder);
+      }
+      RotateLog();
+    } else {
+      // Write save record to log and sync it to disk.
+      LOG(INFO) << "Save case #" << caseid_;
+      AppendLog(writer.packet());
+      if (log_ != nullptr) {
+        Status st = log_->Flush();
+        if (!st.ok()) {
+          LOG(ERROR) << "Error syncing log for case #" << caseid_
+                     << ": " << st;
+          compact_ = true;
+        }
+      }
+    }
+    dirty_ = false;
+    mu_.Unlock();
+
+    // Write new snapshot.
+    if (compact) WriteSnapshot(snapshot);
+
+    // Broadcast save.
+    Broadcast(nullptr, writer.packet());
+  }
+
+  // Check for existing case.
+  static bool Exists(int caseid) {
+    return File::Exists(CaseFileName(caseid));
+  }
+
+ private:
+  // Return case filename.
+  static string CaseFileName(int caseid) {
+    return FLAGS_datadir + "/" + std::to_string(caseid) + ".sling";
+  }
+
+  // Return case filename.
+  static string UserFileName(int caseid) {
+    return FLAGS_datadir + "/" + std::to_string(caseid) + ".access";
+  }
+
+  // Return update log filename.
+  static string LogFileName(int caseid) {
+    return FLAGS_datadir + "/" + std::to_string(caseid) + ".log";
+  }
+
+  // Return filename for update log being compacted.
+  static string CompactingLogFileName(int caseid) {
+    return LogFileName(caseid) + ".compacting";
+  }
+
+  // Apply case update.
+  bool ApplyUpdate(CollabReader *reader) {
     int type = reader->ReadInt();
     switch (type) {
       case CCU_TOPIC: {
@@ -419,6 +626,13 @@ class CollabCase {
         break;
       }
 
+      case CCU_SAVE: {
+        // Update modification timestamp.
+        string modtime = reader->ReadString();
+        casefile_.Set(n_modified, modtime);
+        break;
+      }
+
       default:
         LOG(ERROR) << "Invalid case update type " << type;
     }
@@ -426,118 +640,147 @@ class CollabCase {
     return true;
   }
 
-  // Broadcast packet to clients. Do not send packet to source.
-  void Broadcast(CollabClient *source, const Slice &packet);
-
-  // Send pings to clients to keep connections alive.
-  void SendKeepAlivePings();
-
-  // Read case from file.
-  bool ReadCase() {
-    MutexLock lock(&mu_);
+  // Append update packet to log. Each log record has a 32-bit size followed by
+  // the packet. If the update cannot be logged, the case will be compacted on
+  // the next checkpoint instead.
+  void AppendLog(const Slice &packet) {
+    if (log_ == nullptr) {
+      Status st = File::Open(LogFileName(caseid_), "a", &log_);
+      if (!st.ok()) {
+        LOG(ERROR) << "Error opening log for case #" << caseid_ << ": " << st;
+        log_ = nullptr;
+        compact_ = true;
+        return;
+      }
+    }
 
-    // Open case file.
-    File *f;
-    Status st = File::Open(CaseFileName(caseid_), "r", &f);
+    string record;
+    uint32 size = packet.size();
+    record.append(reinterpret_cast<const char *>(&size), sizeof(uint32));
+    record.append(packet.data(), packet.size());
+    Status st = log_->Write(record.data(), record.size());
     if (!st.ok()) {
-      LOG(ERROR) << "Error opening case# " << caseid() << ": " << st;
-      return false;
+      LOG(ERROR) << "Error writing log for case #" << caseid_ << ": " << st;
+      compact_ = true;
     }
-
-    // Decode case.
-    FileInputStream stream(f);
-    Input input(&stream);
-    Decoder decoder(&store_, &input);
-    casefile_ = decoder.DecodeAll().AsFrame();
-    if (casefile_.IsNil() || casefile_.IsError()) return false;
-
-    // Get main author for case.
-    Frame main = casefile_.GetFrame(n_main);
-    if (!main.valid()) return false;
-    author_ = main.GetHandle(n_author);
-    if (author_.IsNil()) return false;
-
-    // Get topics and folders.
-    topics_ = casefile_.Get(n_topics).AsArray();
-    folders_ = casefile_.GetFrame(n_folders);
-
-    dirty_ = false;
-    return true;
+    log_size_ += record.size();
   }
 
-  // Read participants from file.
-  bool ReadParticipants() {
-    MutexLock lock(&mu_);
-
-    // Read user file.
-    string content;
-    Status st = File::ReadContents(UserFileName(caseid_), &content);
-    if (!st) return false;
-
-    // Parse users.
-    participants_.clear();
-    for (Text &line : Text(content).split('\n')) {
-      auto fields = line.split(' ');
-      CHECK_EQ(fields.size(), 2);
-      auto id = fields[0].trim();
-      auto credentials = fields[1].trim();
-      participants_.emplace_back(id.str(), credentials.str());
+  // Replay updates from log. A partially written record at the end of the log
+  // is truncated.
+  bool ReplayLog(const string &filename) {
+    if (!File::Exists(filename)) return true;
+    string log;
+    Status st = File::ReadContents(filename, &log);
+    if (!st.ok()) {
+      LOG(ERROR) << "Error reading log for case #" << caseid_ << ": " << st;
+      return false;
     }
 
+    size_t pos = 0;
+    int updates = 0;
+    while (pos + sizeof(uint32) <= log.size()) {
+      uint32 size;
+      memcpy(&size, log.data() + pos, sizeof(uint32));
+      if (pos + sizeof(uint32) + size > log.size()) break;
+      const char *packet = log.data() + pos + sizeof(uint32);
+      CollabReader reader(reinterpret_cast<const uint8 *>(packet), size);
+      switch (reader.ReadInt()) {
+        case COLLAB_UPDATE:
+          ApplyUpdate(&reader);
+          break;
+        case COLLAB_NEWID: {
+          int next = casefile_.GetInt(n_next);
+          casefile_.Set(n_next, Handle::Integer(next + 1));
+          break;
+        }
+        default:
+          LOG(ERROR) << "Invalid log record in case #" << caseid_;
+      }
+      pos += sizeof(uint32) + size;
+      updates++;
+    }
+    log_size_ += pos;
+    VLOG(1) << "Replayed " << updates << " updates for case #" << caseid_;
+
+    if (pos != log.size()) {
+      LOG(WARNING) << "Truncating partial log record for case #" << caseid_;
+      File *f;
+      st = File::Open(filename, "r+", &f);
+      if (st.ok()) {
+        st = f->Resize(pos);
+        f->Close();
+      }
+      if (!st.ok()) {
+        LOG(ERROR) << "Error truncating log for case #" << caseid_
+                   << ": " << st;
+        return false;
+      }
+    }
     return true;
   }
 
-  // Write participants to file.
-  void WriteParticipants() {
-    MutexLock lock(&mu_);
-    File *f = File::OpenOrDie(UserFileName(caseid_), "w");
-    for (const User &user : participants_) {
-      f->WriteLine(user.id + " " + user.credentials);
+  // Move current log out of the way for compaction, so new updates go to a
+  // new log. If an earlier compaction failed, the current log is appended to
+  // the log that is already being compacted.
+  void RotateLog() {
+    if (log_ != nullptr) {
+      log_->Close();
+      log_ = nullptr;
+    }
+    log_size_ = 0;
+    string logfn = LogFileName(caseid_);
+    string compacting = CompactingLogFileName(caseid_);
+    if (!File::Exists(logfn)) return;
+    Status st;
+    if (File::Exists(compacting)) {
+      string log;
+      st = File::ReadContents(logfn, &log);
+      if (st.ok()) {
+        File *f;
+        st = File::Open(compacting, "a", &f);
+        if (st.ok()) {
+          st = f->Write(log.data(), log.size());
+          if (st.ok()) st = f->Flush();
+          f->Close();
+        }
+      }
+      if (st.ok()) st = File::Delete(logfn);
+    } else {
+      st = File::Rename(logfn, compacting);
+    }
+    if (!st.ok()) {
+      LOG(ERROR) << "Error rotating log for case #" << caseid_ << ": " << st;
     }
-    f->Close();
-  }
-
-  // Flush changes to disk.
-  void Flush() {
-    if (!dirty_) return;
-    mu_.Lock();
-
-    // Update modification timestamp in case.
-    time_t now = time(nullptr);
-    char modtime[128];
-    struct tm tm;
-    gmtime_r(&now, &tm);
-    strftime(modtime, sizeof modtime, "%Y-%m-%dT%H:%M:%SZ", &tm);
-    casefile_.Set(n_modified, modtime);
-
-    // Write case to file.
-    LOG(INFO) << "Save case #" << caseid_;
-    WriteCase();
-    dirty_ = false;
-
-    // Broadcast save.
-    CollabWriter writer;
-    writer.WriteInt(COLLAB_UPDATE);
-    writer.WriteInt(CCU_SAVE);
-    writer.WriteString(modtime);
-    mu_.Unlock();
-    Broadcast(nullptr, writer.packet());
-  }
-
-  // Check for existing case.
-  static bool Exists(int caseid) {
-    return File::Exists(CaseFileName(caseid));
-  }
-
- private:
-  // Return case filename.
-  static string CaseFileName(int caseid) {
-    return FLAGS_datadir + "/" + std::to_string(caseid) + ".sling";
   }
 
-  // Return case filename.
-  static string UserFileName(int caseid) {
-    return FLAGS_datadir + "/" + std::to_string(caseid) + ".access";
+  // Write case snapshot. The snapshot is first written to a temporary file
+  // and then renamed to a new snapshot. The log that has been compacted into
+  // the snapshot is then deleted, and the new snapshot replaces the old one.
+  void WriteSnapshot(const string &snapshot) {
+    string filename = CaseFileName(caseid_);
+    string tmpfn = filename + ".tmp";
+    File *f;
+    Status st = File::Open(tmpfn, "w", &f);
+    if (st.ok()) {
+      st = f->Write(snapshot.data(), snapshot.size());
+      if (st.ok()) st = f->Flush();
+      f->Close();
+    }
+    if (st.ok()) st = File::Rename(tmpfn, filename + ".new");
+    if (st.ok() && File::Exists(CompactingLogFileName(caseid_))) {
+      st = File::Delete(CompactingLogFileName(caseid_));
+    }
+    if (st.ok()) st = File::Rename(filename + ".new", filename);
+    if (!st.ok()) {
+      LOG(ERROR) << "Error writing snapshot for case #" << caseid_
+                 << ": " << st;
+      MutexLock lock(&mu_);
+      compact_ = true;
+      return;
+    }
+    MutexLock lock(&mu_);
+    compact_ = false;
   }
 
   // Check if user is a participant.
@@ -554,14 +797,6 @@ class CollabCase {
     return false;
   }
 
-  // Write case to file.
-  void WriteCase() {
-    FileOutputStream stream(CaseFileName(caseid_));
-    Output output(&stream);
-    Encoder encoder(&store_, &output);
-    Serialize(&encoder);
-  }
-
   // Serialize collaboration case.
   void Serialize(Encoder *encoder) {
     Array topics = casefile_.Get(n_topics).AsArray();
@@ -591,9 +826,21 @@ class CollabCase {
   // Case folders.
   Frame folders_;
 
-  // Whether there are changes that have not been written to disk.
+  // Whether there are changes that have not been checkpointed.
   bool dirty_ = false;
 
+  // Update log for changes since last snapshot.
+  File *log_ = nullptr;
+
+  // Number of bytes in update logs since last snapshot.
+  uint64 log_size_ = 0;
+
+  // Whether the case needs to be compacted on the next checkpoint.
+  bool compact_ = false;
+
+  // Mutex for serializing checkpoints.
+  Mutex flush_mu_;
+
   // User id and credentials.
   struct User {
     User(const string &id, const string &credentials)
@@ -630,8 +877,8 @@ class CollabService {
     terminate_ = true;
     monitor_.Join();
 
-    // Flush changes to disk.
-    Flush();
+    // Compact all cases.
+    Flush(true);
   }
 
   // Register collaboration service in HTTP server.
@@ -705,11 +952,11 @@ class CollabService {
     }
   }
 
-  void Flush() {
+  void Flush(bool compact = false) {
     // Flush changes to disk.
     MutexLock lock(&mu_);
     for (CollabCase *collab : collaborations_) {
-      collab->Flush();
+      collab->Flush(compact);
     }
   }
 
@@ -973,10 +1220,20 @@ void CollabService::Process(HTTPRequest *request, HTTPResponse *response) {
 }
 
 void CollabCase::Broadcast(CollabClient *source, const Slice &packet) {
+  // Frame packet once and queue it to all the clients. Clients that cannot
+  // keep up with the updates are disconnected, since skipping updates would
+  // leave them with an inconsistent case. The client will reload the case
+  // when it reconnects.
+  auto frame = WebSocket::Frame(packet);
+  size_t limit = static_cast<size_t>(FLAGS_backlog) << 20;
   MutexLock lock(&mu_);
   for (CollabClient *client : clients_) {
     if (client != source) {
-      client->Send(packet);
+      if (!client->SendFrame(frame, limit)) {
+        LOG(WARNING) << "Disconnect slow client " << client->userid()
+                     << " from case #" << caseid_;
+        client->Disconnect();
+      }
     }
   }
 }
@@ -23,6 +23,7 @@ Date = api.Date
 WikiConverter = api.WikiConverter
 FactExtractor = api.FactExtractor
 PlausibilityModel = api.PlausibilityModel
+EmbeddingIndex = api.EmbeddingIndex
 WebArchive = api.WebArchive
 WebsiteAnalysis = api.WebsiteAnalysis
 
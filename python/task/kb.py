@@ -253,9 +253,11 @@ class KnowledgeBaseWorkflow:
                 "prune_wiki_links": True,
                 "prune_category_members": True})
 
-      # Collect frames into knowledge base store.
+      # Collect frames into knowledge base store. The store is written in
+      # segments so it can be decoded in parallel when it is loaded.
       return self.wf.write(pruned_items, self.data.knowledge_base(),
-                           params={"string_buckets": 32 * 1024 * 1024})
+                           params={"string_buckets": 32 * 1024 * 1024,
+                                   "segment_size": 4 * 1024 * 1024})
 
   def load_items(self):
     """Task for loading items into database."""
@@ -31,7 +31,7 @@ int main(int argc, char *argv[]) {
   CHECK(index.Open(FLAGS_index));
 
   VLOG(1) << "epoch: " << index.epoch();
-  VLOG(1) << "capacity: " << index.epoch();
+  VLOG(1) << "capacity: " << index.capacity();
   VLOG(1) << "limit: " << index.limit();
   VLOG(1) << "records: " << index.num_records();
   VLOG(1) << "deleted: " << index.num_deleted();
@@ -39,6 +39,18 @@ int main(int argc, char *argv[]) {
   // Check index integrity.
   index.Check(FLAGS_fix);
 
+  // Report probe lengths.
+  DatabaseIndex::ProbeStats stats;
+  index.GetProbeStats(&stats);
+  LOG(INFO) << "load factor: "
+            << static_cast<double>(stats.entries) / index.capacity();
+  LOG(INFO) << "hit probe length: " << stats.hit_length
+            << " avg, " << stats.hit_max << " max, "
+            << stats.hit_groups << " tag groups";
+  LOG(INFO) << "miss probe length: " << stats.miss_length
+            << " avg, " << stats.miss_max << " max, "
+            << stats.miss_groups << " tag groups";
+
   // Close index.
   CHECK(index.Close());
 
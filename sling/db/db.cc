@@ -15,14 +15,211 @@
 #include "sling/db/db.h"
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
 #include "sling/string/numbers.h"
+#include "sling/util/city.h"
 #include "sling/util/fingerprint.h"
+#include "sling/util/thread.h"
 
 namespace sling {
 
+// Recovery entry for a data record. Keys are identified by the fingerprint
+// together with a secondary hash, so records for different keys with the same
+// fingerprint can be told apart without reading back the keys. Deletion
+// records are marked in the top bit of the record id.
+struct RecoveryEntry {
+  uint64 fp;      // key fingerprint
+  uint64 check;   // secondary key hash
+  uint64 recid;   // record id and deletion flag
+};
+
+typedef std::vector<RecoveryEntry> RecoveryPartition;
+typedef std::vector<RecoveryPartition> RecoveryPartitions;
+
+// Deletion flag for recovery entry.
+static const uint64 kDeleted = 1ULL << 63;
+
+// The scan of a data shard is checkpointed every time this many bytes have
+// been read.
+static const uint64 kCheckpointInterval = 1ULL << 30;
+
+// Recovery checkpoint file header. The header is followed by blocks with the
+// recovery entries for the records scanned since the previous block. Each
+// block starts with a CheckpointBlock header.
+struct CheckpointHeader {
+  uint32 magic;   // magic number for identifying checkpoint file
+  uint32 shard;   // data shard number
+  uint64 start;   // start position of shard scan
+};
+
+struct CheckpointBlock {
+  uint64 end;     // shard position after the last record in block
+  uint64 count;   // number of recovery entries in block
+};
+
+static const uint32 kCheckpointMagic = 0x50434552;  // RECP
+
+// Compute secondary hash for key.
+static uint64 KeyCheck(const Slice &key) {
+  return CityHash64(key.data(), key.size());
+}
+
+// Read recovery checkpoint for shard. Returns the position after the last
+// verified record and the length of the valid part of the checkpoint file, or
+// zero if there is no usable checkpoint.
+static uint64 ReadCheckpoint(const string &filename, int shard, uint64 start,
+                             uint64 size, uint64 *position,
+                             RecoveryPartition *entries) {
+  if (!File::Exists(filename)) return 0;
+  File *file;
+  if (!File::Open(filename, "r", &file).ok()) return 0;
+  uint64 length = 0;
+  CheckpointHeader header;
+  if (file->Read(&header, sizeof(header)).ok() &&
+      header.magic == kCheckpointMagic &&
+      header.shard == shard &&
+      header.start == start) {
+    length = sizeof(header);
+    uint64 file_size = file->Size();
+    CheckpointBlock block;
+    while (file->Read(&block, sizeof(block)).ok()) {
+      // Stop at the first incomplete or inconsistent block.
+      uint64 bytes = block.count * sizeof(RecoveryEntry);
+      if (block.end <= *position || block.end > size) break;
+      if (length + sizeof(block) + bytes > file_size) break;
+      size_t offset = entries->size();
+      entries->resize(offset + block.count);
+      if (!file->Read(entries->data() + offset, bytes).ok()) {
+        entries->resize(offset);
+        break;
+      }
+      *position = block.end;
+      length += sizeof(block) + bytes;
+    }
+  }
+  file->Close();
+  return length;
+}
+
+// Scan data shard from the start position and collect recovery entries for
+// the records, partitioned on the top bits of the key fingerprints. Only the
+// record keys are read. The scan is checkpointed, and a previous scan of the
+// shard is resumed from the last checkpoint.
+static Status ScanShard(const string &datafile,
+                        const RecordFileOptions &options,
+                        int shard, uint64 start,
+                        const string &checkpoint, int bits,
+                        RecoveryPartitions *partitions) {
+  CHECK_LT(shard, 1 << 15);
+  partitions->resize(1 << bits);
+  auto distribute = [&](const RecoveryPartition &entries) {
+    for (const RecoveryEntry &entry : entries) {
+      int partition = bits == 0 ? 0 : entry.fp >> (64 - bits);
+      (*partitions)[partition].push_back(entry);
+    }
+  };
+  RecordReader reader(datafile, options);
+
+  // Resume from checkpoint if possible.
+  RecoveryPartition entries;
+  uint64 position = 0;
+  uint64 length = ReadCheckpoint(checkpoint, shard, start, reader.size(),
+                                 &position, &entries);
+  distribute(entries);
+  entries.clear();
+
+  // Open checkpoint file for appending new blocks.
+  Status st;
+  File *file;
+  if (length > 0) {
+    st = File::Open(checkpoint, "r+", &file);
+    if (!st.ok()) return st;
+    st = file->Resize(length);
+    if (st.ok()) st = file->Seek(length);
+  } else {
+    st = File::Open(checkpoint, "w", &file);
+    if (!st.ok()) return st;
+    CheckpointHeader header;
+    header.magic = kCheckpointMagic;
+    header.shard = shard;
+    header.start = start;
+    st = file->Write(&header, sizeof(header));
+  }
+
+  // Seek to start position for scan.
+  if (st.ok()) {
+    if (position != 0) {
+      LOG(INFO) << "Resume recovery of shard " << shard << " at " << position;
+      st = reader.Seek(position);
+    } else if (start != 0) {
+      st = reader.Seek(start);
+    } else {
+      st = reader.Rewind();
+    }
+  }
+
+  // Read all record keys in the rest of the shard.
+  Record record;
+  uint64 next_checkpoint = reader.Tell() + kCheckpointInterval;
+  while (st.ok() && !reader.Done()) {
+    st = reader.ReadKey(&record);
+    if (!st.ok()) break;
+    RecoveryEntry entry;
+    entry.fp = Fingerprint(record.key.data(), record.key.size());
+    entry.check = KeyCheck(record.key);
+    entry.recid = Database::RecordID(shard, record.position);
+    if (record.value.empty()) entry.recid |= kDeleted;
+    entries.push_back(entry);
+
+    // Write checkpoint block.
+    if (reader.Tell() >= next_checkpoint || reader.Done()) {
+      CheckpointBlock block;
+      block.end = reader.Tell();
+      block.count = entries.size();
+      st = file->Write(&block, sizeof(block));
+      if (st.ok()) {
+        size_t bytes = entries.size() * sizeof(RecoveryEntry);
+        st = file->Write(entries.data(), bytes);
+      }
+      if (st.ok()) st = file->Flush();
+      distribute(entries);
+      entries.clear();
+      next_checkpoint = reader.Tell() + kCheckpointInterval;
+    }
+  }
+
+  Status cst = file->Close();
+  if (st.ok()) st = cst;
+  return st;
+}
+
+// Keep only the latest recovery entry for each key. Record ids increase in
+// record order, so the entries for a key are ordered by record id. Deletions
+// are only kept for incremental recovery.
+static void ResolveLatest(RecoveryPartition *entries, bool deletions) {
+  std::sort(entries->begin(), entries->end(),
+    [](const RecoveryEntry &a, const RecoveryEntry &b) {
+      if (a.fp != b.fp) return a.fp < b.fp;
+      if (a.check != b.check) return a.check < b.check;
+      return (a.recid & ~kDeleted) < (b.recid & ~kDeleted);
+    });
+  size_t size = 0;
+  size_t n = entries->size();
+  RecoveryEntry *e = entries->data();
+  for (size_t i = 0; i < n; ++i) {
+    // Skip entry if there is a later entry for the same key.
+    if (i + 1 < n && e[i].fp == e[i + 1].fp && e[i].check == e[i + 1].check) {
+      continue;
+    }
+    if (!deletions && (e[i].recid & kDeleted)) continue;
+    e[size++] = e[i];
+  }
+  entries->resize(size);
+}
+
 Database::~Database() {
   // Close writer.
   delete writer_;
@@ -85,7 +282,7 @@ Status Database::Open(const string &dbdir, bool recover) {
   }
 
   // Open database index.
-  index_ = new DatabaseIndex();
+  index_ = new DatabaseIndex(config_.huge_pages);
   if (File::Exists(IndexFile())) {
     Status st = index_->Open(IndexFile());
     if (!st.ok()) {
@@ -156,7 +353,7 @@ Status Database::Create(const string &dbdir, const string &config) {
   }
 
   // Create database index.
-  index_ = new DatabaseIndex();
+  index_ = new DatabaseIndex(config_.huge_pages);
   uint64 capacity = config_.initial_index_capacity;
   uint64 limit = capacity * config_.index_load_factor;
   st = index_->Create(IndexFile(), capacity, limit);
@@ -192,10 +389,10 @@ Status Database::Bulk(bool enable) {
   bulk_ = enable;
 
   // Switch index. Use memory-based index in bulk mode.
-  DatabaseIndex *newidx = new DatabaseIndex();
+  DatabaseIndex *newidx = new DatabaseIndex(config_.huge_pages);
   Status st = newidx->Create(IndexFile(), index_->capacity(), index_->limit());
   if (!st.ok()) return st;
-  newidx->CopyFrom(index_);
+  newidx->CopyFrom(index_, config_.index_threads);
   delete index_;
   index_ = newidx;
 
@@ -475,6 +672,14 @@ string Database::DataFile(int shard) const {
   }
 }
 
+string Database::CheckpointFile(int shard) const {
+  string fn = dbdir_ + "/recovery-";
+  string number = std::to_string(shard);
+  for (int z = 0; z < 8 - number.size(); ++z) fn.push_back('0');
+  fn.append(number);
+  return fn;
+}
+
 Status Database::ReadRecord(uint64 recid, Record *record, bool with_value) {
   Status st;
   uint64 shard = Shard(recid);
@@ -533,7 +738,7 @@ Status Database::ExpandIndex(uint64 capacity) {
   // Rehash index by copying it to a new larger index.
   Status st;
   LOG(INFO) << "Expand index to " << capacity << " entries for db " << dbdir_;
-  DatabaseIndex *new_index = new DatabaseIndex();
+  DatabaseIndex *new_index = new DatabaseIndex(config_.huge_pages);
 
   // Unlink current index.
   if (!bulk_) {
@@ -581,12 +786,13 @@ Status Database::Recover(uint64 capacity) {
   // Recover index into a memory index first to avoid excessive paging during
   // recovery.
   Status st;
-  DatabaseIndex idx;
+  DatabaseIndex idx(config_.huge_pages);
   CHECK(index_ == nullptr);
   dirty_ = true;
 
   // Use index backup if available.
-  if (File::Exists(IndexBackupFile())) {
+  bool incremental = File::Exists(IndexBackupFile());
+  if (incremental) {
     // Copy index backup to memory index.
     DatabaseIndex backup;
     st = backup.Open(IndexBackupFile());
@@ -598,102 +804,178 @@ Status Database::Recover(uint64 capacity) {
               << "starting at " << Position(idx.epoch()) << " in shard "
               << Shard(idx.epoch());
   } else {
-    // Create new memory-based database index for recovery.
-    if (capacity < config_.initial_index_capacity) {
-      capacity = config_.initial_index_capacity;
-    }
-    uint64 limit = capacity * config_.index_load_factor;
-    st = idx.Create("", capacity, limit);
-    if (!st.ok()) return st;
-    LOG(INFO) << "Recover from scratch with capacity " << capacity;
+    LOG(INFO) << "Recover from scratch";
   }
 
   // Find starting point for recovery.
-  int start_shard = Shard(idx.epoch());
-  uint64 start_pos = Position(idx.epoch());
+  uint64 start = incremental ? idx.epoch() : 0;
+  int start_shard = Shard(start);
+  uint64 start_pos = Position(start);
+
+  // Split the keys into a power-of-two number of partitions with at least one
+  // partition per thread.
+  int threads = std::max(config_.index_threads, 1);
+  int bits = 0;
+  while ((1 << bits) < threads) bits++;
+  int num_partitions = 1 << bits;
+
+  // Scan data shards in parallel.
+  int num_shards = readers_.size() - start_shard;
+  if (num_shards < 0) num_shards = 0;
+  std::vector<RecoveryPartitions> scans(num_shards);
+  std::vector<Status> status(num_shards);
+  std::atomic<int> next_shard(0);
+  WorkerPool scanners;
+  scanners.Start(std::max(std::min(threads, num_shards), 1), [&](int index) {
+    for (;;) {
+      int i = next_shard++;
+      if (i >= num_shards) break;
+      int shard = start_shard + i;
+      LOG(INFO) << "Recover shard " << shard << " of db " << dbdir_;
+      status[i] = ScanShard(DataFile(shard), config_.record, shard,
+                            i == 0 ? start_pos : 0, CheckpointFile(shard),
+                            bits, &scans[i]);
+    }
+  });
+  scanners.Join();
+  for (const Status &s : status) {
+    if (!s.ok()) return s;
+  }
 
-  // Replay all records from the data shards to restore the index.
-  Record record;
-  for (int shard = start_shard; shard < readers_.size(); ++shard) {
-    LOG(INFO) << "Recover shard " << shard << " of db " << dbdir_;
-    RecordReader *reader = readers_[shard];
-    if (shard == start_shard && start_pos != 0) {
-      st = reader->Seek(start_pos);
-      if (!st.ok()) return st;
-    } else {
-      st = reader->Rewind();
-      if (!st.ok()) return st;
+  // Resolve the latest record for each key in each partition.
+  std::vector<RecoveryPartition> latest(num_partitions);
+  WorkerPool resolvers;
+  resolvers.Start(num_partitions, [&](int index) {
+    RecoveryPartition &entries = latest[index];
+    size_t size = 0;
+    for (auto &scan : scans) size += scan[index].size();
+    entries.reserve(size);
+    for (auto &scan : scans) {
+      entries.insert(entries.end(), scan[index].begin(), scan[index].end());
+      RecoveryPartition().swap(scan[index]);
     }
-    while (!reader->Done()) {
-      // Expand index if needed.
-      if (idx.full()) {
-        // Create new index.
-        DatabaseIndex newidx;
-        uint64 capacity = idx.capacity() * 2;
-        uint64 limit = capacity * config_.index_load_factor;
-        st = newidx.Create("", capacity, limit);
-        if (!st.ok()) return st;
-
-        // Transfer all entries to the new index and switch to new index.
-        idx.TransferTo(&newidx);
-        st = idx.Close();
-        if (!st.ok()) return st;
-        std::swap(idx, newidx);
-      }
+    ResolveLatest(&entries, incremental);
+  });
+  resolvers.Join();
+  scans.clear();
+
+  if (incremental) {
+    // Apply the changes since the backup to the index. The keys of existing
+    // index entries need to be read from the data shards, so this is done
+    // sequentially.
+    Record record;
+    for (auto &entries : latest) {
+      for (const RecoveryEntry &entry : entries) {
+        // Expand index if needed.
+        if (idx.full()) {
+          // Create new index.
+          DatabaseIndex newidx(config_.huge_pages);
+          uint64 capacity = idx.capacity() * 2;
+          uint64 limit = capacity * config_.index_load_factor;
+          st = newidx.Create("", capacity, limit);
+          if (!st.ok()) return st;
 
-      // Read next record key.
-      st = reader->ReadKey(&record);
-      if (!st.ok()) return st;
-      uint64 fp = Fingerprint(record.key.data(), record.key.size());
-      uint64 recid = RecordID(shard, record.position);
-
-      // Empty record indicates deletion.
-      if (record.value.empty()) {
-        idx.Delete(fp, recid);
-      } else {
-        // Try to locate exising record for key in index.
+          // Transfer all entries to the new index and switch to new index.
+          idx.TransferTo(&newidx);
+          st = idx.Close();
+          if (!st.ok()) return st;
+          std::swap(idx, newidx);
+        }
+
+        // Try to locate existing record for key in index.
         uint64 val = DatabaseIndex::NVAL;
         uint64 pos = DatabaseIndex::NPOS;
-        string key = record.key.str();
         for (;;) {
           // Get next match in index.
-          val = idx.Get(fp, &pos);
+          val = idx.Get(entry.fp, &pos);
           if (val == DatabaseIndex::NVAL) break;
 
-          // Save current position in reader.
-          uint64 current = reader->Tell();
-
-          // Read record key from data file.
+          // Read record key from data file and check if key matches.
           st = ReadRecord(val, &record, false);
           if (!st.ok()) return st;
-
-          // Restore current position in reader.
-          st = reader->Seek(current);
-          if (!st.ok()) return st;
-
-          // Check if key matches.
-          if (record.key == Slice(key)) break;
+          if (KeyCheck(record.key) == entry.check) break;
         }
 
-        // If an existing record with the same key is found, update the index
-        // entry, otherwise add a new entry.
-        if (val == DatabaseIndex::NVAL) {
-          idx.Add(fp, recid);
+        // Empty record indicates deletion. Otherwise, update the index entry
+        // if an existing record with the same key is found, or else add a new
+        // entry.
+        uint64 recid = entry.recid & ~kDeleted;
+        if (entry.recid & kDeleted) {
+          if (val != DatabaseIndex::NVAL) idx.Delete(entry.fp, val);
+        } else if (val == DatabaseIndex::NVAL) {
+          idx.Add(entry.fp, recid);
         } else {
-          idx.Update(fp, val, recid);
+          idx.Update(entry.fp, val, recid);
         }
       }
     }
+  } else {
+    // Create new memory-based database index for recovery with room for all
+    // the active keys.
+    uint64 num_keys = 0;
+    for (auto &entries : latest) num_keys += entries.size();
+    if (capacity < config_.initial_index_capacity) {
+      capacity = config_.initial_index_capacity;
+    }
+    while (capacity < num_partitions) capacity *= 2;
+    while (capacity * config_.index_load_factor <= num_keys) capacity *= 2;
+    uint64 limit = capacity * config_.index_load_factor;
+    st = idx.Create("", capacity, limit);
+    if (!st.ok()) return st;
+    LOG(INFO) << "Recover " << num_keys << " keys with capacity " << capacity;
+
+    // Assign the keys to regions of the index table. Each partition is split
+    // into one part per region and the parts are then merged for each region.
+    std::vector<std::vector<std::vector<DatabaseIndex::Entry>>> parts(
+        num_partitions);
+    WorkerPool splitters;
+    splitters.Start(num_partitions, [&](int index) {
+      auto &part = parts[index];
+      part.resize(num_partitions);
+      for (const RecoveryEntry &entry : latest[index]) {
+        int region = idx.Partition(entry.fp, num_partitions);
+        part[region].push_back({entry.fp, entry.recid});
+      }
+      RecoveryPartition().swap(latest[index]);
+    });
+    splitters.Join();
+
+    std::vector<std::vector<DatabaseIndex::Entry>> regions(num_partitions);
+    WorkerPool mergers;
+    mergers.Start(num_partitions, [&](int index) {
+      auto &region = regions[index];
+      size_t size = 0;
+      for (auto &part : parts) size += part[index].size();
+      region.reserve(size);
+      for (auto &part : parts) {
+        region.insert(region.end(), part[index].begin(), part[index].end());
+        std::vector<DatabaseIndex::Entry>().swap(part[index]);
+      }
+    });
+    mergers.Join();
+    parts.clear();
+
+    // Build index with one thread per region.
+    idx.AddPartitioned(regions);
   }
 
   // Create new index from the memory index.
-  index_ = new DatabaseIndex();
+  index_ = new DatabaseIndex(config_.huge_pages);
   st = index_->Create(IndexFile(), idx.capacity(), idx.limit());
   if (!st.ok()) return st;
-  index_->CopyFrom(&idx);
+  index_->CopyFrom(&idx, threads);
   st = index_->Flush(epoch());
   if (!st.ok()) return st;
 
+  // Remove recovery checkpoints.
+  for (int shard = 0; shard < readers_.size(); ++shard) {
+    string checkpoint = CheckpointFile(shard);
+    if (File::Exists(checkpoint)) {
+      st = File::Delete(checkpoint);
+      if (!st.ok()) return st;
+    }
+  }
+
   LOG(INFO) << "Recovery successful for: " << dbdir_;
   return Status::OK;
 }
@@ -789,15 +1071,41 @@ bool Database::ParseConfig(Text config) {
       config_.record.chunk_size = n;
     } else if (key == "compression") {
       int n = ParseNumber(value);
-      if (n != RecordFile::UNCOMPRESSED && n != RecordFile::SNAPPY) {
+      if (n != RecordFile::UNCOMPRESSED &&
+          n != RecordFile::SNAPPY &&
+          n != RecordFile::DEFLATE) {
         LOG(ERROR) << "Invalid compression: " << line;
         return false;
       }
       config_.record.compression = static_cast<RecordFile::CompressionType>(n);
+    } else if (key == "compression_level") {
+      int n = ParseNumber(value);
+      if (n < 1 || n > 9) {
+        LOG(ERROR) << "Invalid compression level: " << line;
+        return false;
+      }
+      config_.record.compression_level = n;
+    } else if (key == "dictionary") {
+      // The dictionary is only used for new data shards; existing shards
+      // keep the dictionary stored in the shard.
+      Status st = File::ReadContents(value.str(), &config_.record.dictionary);
+      if (!st.ok()) {
+        LOG(ERROR) << "Cannot read dictionary: " << st;
+        return false;
+      }
     } else if (key == "read_only") {
       config_.read_only = ParseBool(value, false);
     } else if (key == "timestamped") {
       config_.timestamped = ParseBool(value, false);
+    } else if (key == "huge_pages") {
+      config_.huge_pages = ParseBool(value, false);
+    } else if (key == "index_threads") {
+      int n = ParseNumber(value);
+      if (n <= 0) {
+        LOG(ERROR) << "Invalid number of index threads: " << line;
+        return false;
+      }
+      config_.index_threads = n;
     } else {
       LOG(ERROR) << "Unknown configuration parameter: " << line;
       return false;
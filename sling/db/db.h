@@ -59,6 +59,13 @@ class Database {
 
     // Record version number is timestamp.
     bool timestamped = false;
+
+    // Number of threads for building the index in recovery and bulk mode.
+    int index_threads = 8;
+
+    // Use huge pages for the index. This mostly helps the memory index used
+    // in bulk mode and recovery.
+    bool huge_pages = false;
   };
 
   // Database performance metrics.
@@ -89,7 +96,8 @@ class Database {
   Status Flush();
 
   // Enable or disable bulk mode. In bulk mode, a memory-based index is used to
-  // avoid excessive paging during database loading.
+  // avoid excessive paging during database loading. When leaving bulk mode,
+  // the memory index is copied to the index file in parallel.
   Status Bulk(bool enable);
 
   // Back up database by making a snapshot of the index.
@@ -166,16 +174,6 @@ class Database {
   // Return database performance counter.
   uint64 counter(Metric metric) const { return counter_[metric]; }
 
-  // Error codes.
-  enum Errors {
-    E_DB_NOT_FOUND = 1000,  // database not found
-    E_NO_DATA_FILES,        // no data files for database
-    E_STALE_INDEX,          // database index is not up-to-date
-    E_DB_ALREADY_EXISTS,    // database already exists
-    E_CONFIG,               // invalid configuration file
-  };
-
- private:
   // Record IDs encode a shard and a position within the shard. The upper
   // 16 bits are used for the shard, and the lower 48 bits are used for the
   // position.
@@ -189,6 +187,16 @@ class Database {
     return recid & ((1ULL << 48) - 1);
   }
 
+  // Error codes.
+  enum Errors {
+    E_DB_NOT_FOUND = 1000,  // database not found
+    E_NO_DATA_FILES,        // no data files for database
+    E_STALE_INDEX,          // database index is not up-to-date
+    E_DB_ALREADY_EXISTS,    // database already exists
+    E_CONFIG,               // invalid configuration file
+  };
+
+ private:
   // Return the current shard for writing to the database.
   int CurrentShard() const {
     return readers_.size() - 1;
@@ -213,6 +221,9 @@ class Database {
   // Return filename for (new) data shard.
   string DataFile(int shard) const;
 
+  // Return filename for recovery checkpoint for data shard.
+  string CheckpointFile(int shard) const;
+
   // Read data record (key).
   Status ReadRecord(uint64 recid, Record *record, bool with_value);
 
@@ -225,7 +236,10 @@ class Database {
   // Expand database for next record.
   Status Expand();
 
-  // Recover index from data files.
+  // Recover index from data files. The data shards are scanned in parallel
+  // reading only the record keys, and the scan of each shard is checkpointed
+  // so an interrupted recovery can resume from the last verified position.
+  // The index is then built with one thread per key partition.
   Status Recover(uint64 capacity);
 
   // Increment value for performance counters.
@@ -15,9 +15,11 @@
 #include "sling/db/dbclient.h"
 
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
+#include <algorithm>
 
 namespace sling {
 
@@ -295,6 +297,53 @@ Status DBClient::Epoch(uint64 *epoch) {
   });
 }
 
+Status DBClient::Subscribe(DBIterator *iterator) {
+  return Transact([&]() -> Status {
+    request_.Clear();
+    uint8 flags = 0;
+    if (iterator->deletions) flags |= DBNEXT_DELETIONS;
+    if (iterator->novalue) flags |= DBNEXT_NOVALUE;
+    request_.Write(&flags, 1);
+    request_.Write(&iterator->position, 8);
+    request_.Write(&iterator->batch, 4);
+    Status st = Send(DBSUBSCRIBE);
+    if (!st.ok()) return st;
+
+    // Changes can be pushed right after the reply, so the reply is received
+    // through the stream buffer.
+    stream_.Clear();
+    return Receive(&response_, -1);
+  });
+}
+
+Status DBClient::Changes(DBIterator *iterator,
+                         std::vector<DBRecord> *records,
+                         int timeout) {
+  IOBuffer *buffer = iterator->buffer ? iterator->buffer : &response_;
+  records->clear();
+  Status st = Receive(buffer, timeout);
+
+  // Reconnect and resubscribe if connection closed.
+  if (st.code() == EPIPE) {
+    VLOG(1) << "Resubscribe to " << database_;
+    Close();
+    st = Connect(database_, agent_);
+    if (st.ok()) st = Subscribe(iterator);
+    if (st.ok()) st = Receive(buffer, timeout);
+  }
+  if (!st.ok()) return st;
+
+  // Read records from update.
+  DBRecord record;
+  while (buffer->available() > 8) {
+    st = ReadRecord(&record, buffer);
+    if (!st.ok()) return st;
+    records->push_back(record);
+  }
+  if (!buffer->Read(&iterator->position, 8)) return Truncated();
+  return Status::OK;
+}
+
 void DBClient::WriteKey(const Slice &key) {
   uint32 size = key.size();
   request_.Write(&size, 4);
@@ -385,8 +434,7 @@ Status DBClient::Transact(Transaction tx) {
   return st;
 }
 
-Status DBClient::Do(DBVerb verb, IOBuffer *buffer) {
-  // Send request.
+Status DBClient::Send(DBVerb verb) {
   DBHeader reqhdr;
   reqhdr.verb = verb;
   reqhdr.size = request_.available();
@@ -403,6 +451,13 @@ Status DBClient::Do(DBVerb verb, IOBuffer *buffer) {
   if (rc == 0) return Status(EPIPE, "Connection closed");
   if (rc < 0) return Error("send");
   if (rc != bufsize) return Status(EMSGSIZE, "Send truncated");
+  return Status::OK;
+}
+
+Status DBClient::Do(DBVerb verb, IOBuffer *buffer) {
+  // Send request.
+  Status st = Send(verb);
+  if (!st.ok()) return st;
 
   // Receive response.
   if (buffer == nullptr) buffer = &response_;
@@ -436,5 +491,46 @@ Status DBClient::Do(DBVerb verb, IOBuffer *buffer) {
   return Status::OK;
 }
 
-}  // namespace sling
+Status DBClient::Receive(IOBuffer *buffer, int timeout) {
+  // Receive data until there is a complete packet in the stream buffer.
+  for (;;) {
+    size_t size = sizeof(DBHeader);
+    if (stream_.available() >= size) {
+      size += DBHeader::from(stream_.begin())->size;
+      if (stream_.available() >= size) break;
+    }
+
+    // Wait for data from server.
+    if (timeout >= 0) {
+      struct pollfd pfd;
+      pfd.fd = sock_;
+      pfd.events = POLLIN;
+      int rc = poll(&pfd, 1, timeout);
+      if (rc < 0) return Error("poll");
+      if (rc == 0) return Status(ETIMEDOUT, "No changes received");
+    }
 
+    // Receive as much data as possible.
+    stream_.Flush();
+    stream_.Ensure(std::max<size_t>(size - stream_.available(), 1 << 16));
+    int rc = recv(sock_, stream_.end(), stream_.remaining(), 0);
+    if (rc == 0) return Status(EPIPE, "Connection closed");
+    if (rc < 0) return Error("recv");
+    stream_.Append(rc);
+  }
+
+  // Move packet to buffer.
+  DBHeader *hdr = stream_.consume<DBHeader>();
+  reply_ = hdr->verb;
+  buffer->Clear();
+  buffer->Write(stream_.Consume(hdr->size), hdr->size);
+
+  // Check for errors.
+  if (reply_ == DBERROR) {
+    return Status(EINVAL, buffer->Consume(hdr->size), hdr->size);
+  }
+
+  return Status::OK;
+}
+
+}  // namespace sling
@@ -102,6 +102,26 @@ class DBClient {
   // value for reading new records from the database.
   Status Epoch(uint64 *epoch);
 
+  // Subscribe to changes in database starting from the iterator position. If
+  // the position is -1, only changes made after subscribing are received. The
+  // batch size is the maximum number of records per update. After
+  // subscribing, the connection can only be used for receiving changes, e.g.
+  //   DBIterator iterator;
+  //   db->Epoch(&iterator.position);
+  //   db->Subscribe(&iterator);
+  //   std::vector<DBRecord> records;
+  //   while (db->Changes(&iterator, &records)) { ... }
+  Status Subscribe(DBIterator *iterator);
+
+  // Wait for the next update from the subscription. The iterator position is
+  // updated to the position after the last change received. If the connection
+  // has been closed, the client reconnects and resubscribes from the iterator
+  // position. Returns ETIMEDOUT if no changes have been received within the
+  // timeout (in milliseconds). A negative timeout waits forever.
+  Status Changes(DBIterator *iterator,
+                 std::vector<DBRecord> *records,
+                 int timeout = -1);
+
   // Check if client is connected to database server.
   bool connected() const { return sock_ != -1; }
 
@@ -124,9 +144,15 @@ class DBClient {
   // Execute database operation, reconnecting if connection has been closed.
   Status Transact(Transaction tx);
 
+  // Send request to server.
+  Status Send(DBVerb verb);
+
   // Send request to server and receive reply.
   Status Do(DBVerb verb, IOBuffer *buffer = nullptr);
 
+  // Receive pushed packet from server into buffer.
+  Status Receive(IOBuffer *buffer, int timeout);
+
   // Database name.
   string database_;
 
@@ -142,6 +168,10 @@ class DBClient {
 
   // Reply verb from last request.
   DBVerb reply_ = DBOK;
+
+  // Buffer for data pushed from server for subscription. This can hold
+  // several packets.
+  IOBuffer stream_;
 };
 
 }  // namespace sling
@@ -14,6 +14,17 @@
 
 #include "sling/db/dbindex.h"
 
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <vector>
+
+#include "sling/util/memory.h"
+#include "sling/util/thread.h"
+
 namespace sling {
 
 // Returns true iff value is a power of 2.
@@ -35,20 +46,27 @@ Status DatabaseIndex::Open(const string &filename) {
   if (mapped_addr_ == nullptr) {
     return Status(E_MEMMAP, "Unable to map index into memory: ", filename);
   }
+  if (huge_pages_) AdviseHugePages(mapped_addr_, mapped_size_);
   header_ = reinterpret_cast<Header *>(mapped_addr_);
 
-  // Check that index is valid.
+  // Check that index is valid. Version 1 index files have no tag table.
   if (header_->magic != MAGIC) {
     return Status(E_NOT_INDEX, "Not an index file: ", filename);
   }
-  if (header_->version != VERSION) {
+  if (header_->version != VERSION && header_->version != 1) {
     return Status(E_NOT_SUPPORTED, "Unsupported index file version");
   }
   if (header_->offset < sizeof(Header) || header_->offset > mapped_size_) {
     return Status(E_POSITION, "Invalid position of index entries");
   }
-
-  if (header_->offset + header_->capacity * sizeof(Entry) > mapped_size_) {
+  uint64 table_size = header_->capacity * sizeof(Entry);
+  if (header_->version == VERSION) {
+    if (header_->capacity < GROUP_SIZE) {
+      return Status(E_CAPACITY, "Index capacity too small");
+    }
+    table_size = TableSize(header_->capacity);
+  }
+  if (header_->offset + table_size > mapped_size_) {
     return Status(E_TRUNCATED, "Index file truncated");
   }
   if (!IsPowerOfTwo32(header_->capacity)) {
@@ -61,13 +79,50 @@ Status DatabaseIndex::Open(const string &filename) {
     return Status(E_LOAD_FACTOR, "Invalid index load factor");
   }
 
-  // Set up index entry table.
+  // Set up index entry and tag tables.
   entries_ = reinterpret_cast<Entry *>(mapped_addr_ + header_->offset);
   mask_ = header_->capacity - 1;
 
+  // Convert version 1 index to current version and reopen it.
+  if (header_->version != VERSION) {
+    LOG(INFO) << "Migrating index " << filename << " to version " << VERSION;
+    st = Migrate(filename);
+    if (!st.ok()) return st;
+    return Open(filename);
+  }
+  tags_ = reinterpret_cast<uint8 *>(entries_ + header_->capacity);
+
   return Status::OK;
 }
 
+Status DatabaseIndex::Migrate(const string &filename) {
+  // Build new index from the active entries in the old index. The new index
+  // keeps the epoch of the old index.
+  string tmpfile = filename + ".migrate";
+  DatabaseIndex index(huge_pages_);
+  uint64 capacity = std::max<uint64>(header_->capacity, GROUP_SIZE);
+  uint64 limit = std::min(header_->limit, capacity - 1);
+  Status st = index.Create(tmpfile, capacity, limit);
+  if (!st.ok()) return st;
+  Entry *entry = entries_;
+  Entry *end = entries_ + header_->capacity;
+  while (entry < end) {
+    if (entry->key != EMPTY && entry->key != TOMBSTONE) {
+      index.Add(entry->key, entry->value);
+    }
+    entry++;
+  }
+  st = index.Flush(header_->epoch);
+  if (!st.ok()) return st;
+  st = index.Close();
+  if (!st.ok()) return st;
+
+  // Replace old index with the new index.
+  st = Close();
+  if (!st.ok()) return st;
+  return File::Rename(tmpfile, filename);
+}
+
 Status DatabaseIndex::Create(const string &filename,
                              int64 capacity, int64 limit) {
   // Get memory page size.
@@ -83,6 +138,9 @@ Status DatabaseIndex::Create(const string &filename,
   if (!IsPowerOfTwo32(capacity)) {
     return Status(E_CAPACITY, "Capacity must be power of two");
   }
+  if (capacity < GROUP_SIZE) {
+    return Status(E_CAPACITY, "Index capacity too small");
+  }
 
   // Create index file. If filename is empty, a memory index without
   // file-backing is created.
@@ -95,10 +153,11 @@ Status DatabaseIndex::Create(const string &filename,
     file_ = nullptr;
   }
 
-  // Compute size of index file.
+  // Compute size of index file. The entry and tag tables are zero-filled,
+  // i.e. all entries are empty.
   uint64 offset = 0;
   while (offset < sizeof(Header)) offset += page_size;
-  mapped_size_ = offset + capacity * sizeof(Entry);
+  mapped_size_ = offset + TableSize(capacity);
 
   // Create file mapping.
   if (file_ != nullptr) {
@@ -110,8 +169,15 @@ Status DatabaseIndex::Create(const string &filename,
     if (mapped_addr_ == nullptr) {
       return Status(E_MEMMAP, "Unable to map index into memory: ", filename);
     }
+    if (huge_pages_) AdviseHugePages(mapped_addr_, mapped_size_);
+  } else if (huge_pages_) {
+    mapped_addr_ = static_cast<char *>(AllocateMemory(mapped_size_, true));
+    if (mapped_addr_ == nullptr) {
+      return Status(E_MEMMAP, "Unable to allocate memory index");
+    }
+    anonymous_ = true;
   } else {
-    mapped_addr_ = static_cast<char *>(malloc(mapped_size_));
+    mapped_addr_ = static_cast<char *>(calloc(mapped_size_, 1));
     if (mapped_addr_ == nullptr) {
       return Status(E_MEMMAP, "Unable to allocate memory index");
     }
@@ -128,8 +194,9 @@ Status DatabaseIndex::Create(const string &filename,
   header_->limit = limit;
   header_->deletions = 0;
 
-  // Set up index entry table.
+  // Set up index entry and tag tables.
   entries_ = reinterpret_cast<Entry *>(mapped_addr_ + offset);
+  tags_ = reinterpret_cast<uint8 *>(entries_ + capacity);
   mask_ = capacity - 1;
 
   return Status::OK;
@@ -137,9 +204,9 @@ Status DatabaseIndex::Create(const string &filename,
 
 Status DatabaseIndex::Flush(uint64 epoch) {
   if (file_ != nullptr) {
-    // Flush index table to disk.
-    uint64 entry_table_size = header_->capacity * sizeof(Entry);
-    Status st = File::FlushMappedMemory(entries_, entry_table_size);
+    // Flush entry and tag tables to disk.
+    uint64 table_size = TableSize(header_->capacity);
+    Status st = File::FlushMappedMemory(entries_, table_size);
     if (!st.ok()) return st;
 
     // Update epoch in header and flush it to disk.
@@ -168,6 +235,11 @@ Status DatabaseIndex::Close() {
       file_ = nullptr;
       if (!st.ok()) return st;
     }
+  } else if (anonymous_) {
+    // Deallocate huge page memory index.
+    FreeMemory(mapped_addr_, mapped_size_);
+    mapped_addr_ = nullptr;
+    anonymous_ = false;
   } else {
     // Deallocate memory index.
     free(mapped_addr_);
@@ -177,33 +249,71 @@ Status DatabaseIndex::Close() {
   return Status::OK;
 }
 
-uint64 DatabaseIndex::Get(uint64 key, uint64 *pos) const {
-  // Compute position of (first) key.
-  if (*pos == NPOS) *pos = key & mask_;
+uint32 DatabaseIndex::Match(uint64 pos, uint8 tag) const {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128(reinterpret_cast<__m128i *>(tags_ + pos));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+  uint32 match = 0;
+  for (int i = 0; i < GROUP_SIZE; ++i) {
+    if (tags_[pos + i] == tag) match |= 1 << i;
+  }
+  return match;
+#endif
+}
+
+uint64 DatabaseIndex::Find(uint64 key, uint64 pos) const {
+  // Check the entries in the cache line of the start position first, since
+  // most keys are found there or the probe sequence ends there. The tags for
+  // the rest of the probe sequence are fetched in the meantime, so only probe
+  // sequences extending past the cache line need to access the tag table.
+  uint64 end = (pos | (ENTRIES_PER_LINE - 1)) + 1;
+  __builtin_prefetch(tags_ + (end & mask_));
+  for (; pos < end; ++pos) {
+    uint64 k = entries_[pos].key;
+    if (k == key) return pos;
+    if (k == EMPTY) return NPOS;
+  }
+  pos &= mask_;
+
+  uint8 tag = Tag(key);
   for (;;) {
-    Entry &e = entries_[*pos];
-    *pos = (*pos + 1) & mask_;
-    if (e.key == key) {
-      // Return match.
-      return e.value;
-    } else if (e.key == EMPTY) {
-      // Stop when the first empty index slot is found.
-      return NVAL;
+    // Only consider tag matches before the first empty entry in the group.
+    uint32 empty = Match(pos, EMPTY_TAG);
+    uint32 match = Match(pos, tag);
+    if (empty) match &= (empty & -empty) - 1;
+
+    // Check candidate entries.
+    while (match) {
+      uint64 candidate = (pos + __builtin_ctz(match)) & mask_;
+      if (entries_[candidate].key == key) return candidate;
+      match &= match - 1;
     }
+
+    // Stop when an empty index slot is found.
+    if (empty) return NPOS;
+    pos = (pos + GROUP_SIZE) & mask_;
   }
 }
 
+uint64 DatabaseIndex::Get(uint64 key, uint64 *pos) const {
+  // Compute position of (first) key.
+  if (*pos == NPOS) *pos = key & mask_;
+  uint64 match = Find(key, *pos);
+  if (match == NPOS) return NVAL;
+  *pos = (match + 1) & mask_;
+  return entries_[match].value;
+}
+
 bool DatabaseIndex::Exists(uint64 key, uint64 value) {
+  return Locate(key, value) != NPOS;
+}
+
+uint64 DatabaseIndex::Locate(uint64 key, uint64 value) const {
   uint64 pos = key & mask_;
   for (;;) {
-    Entry &e = entries_[pos];
-    if (e.key == key && e.value == value) {
-      // Match found.
-      return true;
-    } else if (e.key == EMPTY) {
-      // No match found.
-      return false;
-    }
+    pos = Find(key, pos);
+    if (pos == NPOS || entries_[pos].value == value) return pos;
     pos = (pos + 1) & mask_;
   }
 }
@@ -212,54 +322,45 @@ uint64 DatabaseIndex::Add(uint64 key, uint64 value) {
   DCHECK(key != EMPTY && key != TOMBSTONE);
   uint64 pos = key & mask_;
   for (;;) {
-    Entry &e = entries_[pos];
-    if (e.key == EMPTY || e.key == TOMBSTONE) {
-      if (e.key == TOMBSTONE) {
-        header_->deletions--;
-      } else {
-        header_->size++;
-      }
-      e.key = key;
-      e.value = value;
+    uint32 empty = Match(pos, EMPTY_TAG);
+    if (empty) {
+      pos = (pos + __builtin_ctz(empty)) & mask_;
+      Set(pos, Entry{key, value});
+      header_->size++;
       return pos;
     }
-    pos = (pos + 1) & mask_;
+    pos = (pos + GROUP_SIZE) & mask_;
   }
 };
 
 uint64 DatabaseIndex::Update(uint64 key, uint64 oldval, uint64 newval) {
   DCHECK(key != EMPTY && key != TOMBSTONE);
-  uint64 pos = key & mask_;
-  for (;;) {
-    Entry &e = entries_[pos];
-    if (e.key == key && e.value == oldval) {
-      // Match found.
-      e.value = newval;
-      return pos;
-    } else if (e.key == EMPTY) {
-      // No match found.
-      return NPOS;
-    }
-    pos = (pos + 1) & mask_;
-  }
+  uint64 pos = Locate(key, oldval);
+  if (pos != NPOS) entries_[pos].value = newval;
+  return pos;
 }
 
 uint64 DatabaseIndex::Delete(uint64 key, uint64 value) {
   DCHECK(key != EMPTY && key != TOMBSTONE);
-  uint64 pos = key & mask_;
-  for (;;) {
-    Entry &e = entries_[pos];
-    if (e.key == key && e.value == value) {
-      // Match found.
-      e.key = TOMBSTONE;
-      header_->deletions++;
-      return pos;
-    } else if (e.value == EMPTY) {
-      // No match found.
-      return NVAL;
+  uint64 pos = Locate(key, value);
+  if (pos == NPOS) return NPOS;
+
+  // Shift the following entries in the probe sequence back to fill the hole.
+  // An entry can be moved to the hole if the hole is between its home
+  // position and its current position.
+  uint64 hole = pos;
+  uint64 next = (hole + 1) & mask_;
+  while (entries_[next].key != EMPTY) {
+    uint64 home = entries_[next].key & mask_;
+    if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+      Set(hole, entries_[next]);
+      hole = next;
     }
-    pos = (pos + 1) & mask_;
+    next = (next + 1) & mask_;
   }
+  Set(hole, Entry{EMPTY, 0});
+  header_->size--;
+  return pos;
 }
 
 void DatabaseIndex::TransferTo(DatabaseIndex *index) const {
@@ -267,20 +368,70 @@ void DatabaseIndex::TransferTo(DatabaseIndex *index) const {
   Entry *entry = entries_;
   Entry *end = entries_ + header_->capacity;
   while (entry < end) {
-    if (entry->key != EMPTY && entry->key != TOMBSTONE) {
-      index->Add(entry->key, entry->value);
-    }
+    if (entry->key != EMPTY) index->Add(entry->key, entry->value);
     entry++;
   }
 }
 
-void DatabaseIndex::CopyFrom(const DatabaseIndex *index) {
+void DatabaseIndex::AddPartitioned(
+    const std::vector<std::vector<Entry>> &partitions) {
+  int num_partitions = partitions.size();
+  uint64 region_size = header_->capacity / num_partitions;
+  CHECK_EQ(region_size * num_partitions, header_->capacity);
+  uint64 total = 0;
+  for (auto &partition : partitions) total += partition.size();
+  CHECK_LT(header_->size + total, header_->capacity);
+
+  // Fill each region of the entry table in a separate thread.
+  std::vector<std::vector<Entry>> overflow(num_partitions);
+  std::vector<uint64> added(num_partitions);
+  WorkerPool pool;
+  pool.Start(num_partitions, [&](int index) {
+    uint64 end = (index + 1) * region_size;
+    for (const Entry &entry : partitions[index]) {
+      DCHECK(entry.key != EMPTY && entry.key != TOMBSTONE);
+      DCHECK_EQ(Partition(entry.key, num_partitions), index);
+      uint64 pos = entry.key & mask_;
+      while (pos < end && entries_[pos].key != EMPTY) pos++;
+      if (pos == end) {
+        overflow[index].push_back(entry);
+      } else {
+        Set(pos, entry);
+        added[index]++;
+      }
+    }
+  });
+  pool.Join();
+  for (uint64 n : added) header_->size += n;
+
+  // Add the entries that did not fit into their own region.
+  for (auto &entries : overflow) {
+    for (const Entry &entry : entries) Add(entry.key, entry.value);
+  }
+}
+
+void DatabaseIndex::CopyFrom(const DatabaseIndex *index, int threads) {
   // Check that index sizes match.
   CHECK_EQ(mapped_size_, index->mapped_size_);
   CHECK_EQ(mask_, index->mask_);
 
   // Copy content from the other index.
-  memcpy(mapped_addr_, index->mapped_addr_, mapped_size_);
+  if (threads <= 1) {
+    memcpy(mapped_addr_, index->mapped_addr_, mapped_size_);
+    return;
+  }
+
+  // Split copying into page-aligned chunks, one per thread.
+  uint64 page_size = File::PageSize();
+  uint64 chunk = (mapped_size_ / threads + page_size - 1) & ~(page_size - 1);
+  WorkerPool pool;
+  pool.Start(threads, [&](int worker) {
+    uint64 begin = worker * chunk;
+    uint64 end = std::min(begin + chunk, mapped_size_);
+    if (begin >= end) return;
+    memcpy(mapped_addr_ + begin, index->mapped_addr_ + begin, end - begin);
+  });
+  pool.Join();
 }
 
 Status DatabaseIndex::Write(File *file) const {
@@ -288,20 +439,19 @@ Status DatabaseIndex::Write(File *file) const {
 }
 
 bool DatabaseIndex::Check(bool fix) {
-  // Count the number of active entries and tombstones in index.
-  Entry *entry = entries_;
-  Entry *end = entries_ + header_->capacity;
-  uint64 num_used = 0;
-  uint64 num_tombstones = 0;
-  while (entry < end) {
-    if (entry->key == TOMBSTONE) {
-      num_tombstones++;
-    } else if (entry->key != EMPTY) {
-      num_used++;
+  // Count the number of active entries in index and check the tags.
+  uint64 size = 0;
+  uint64 bad_tags = 0;
+  for (uint64 pos = 0; pos < header_->capacity + GROUP_SIZE; ++pos) {
+    const Entry &entry = entries_[pos & mask_];
+    uint8 tag = entry.key == EMPTY ? EMPTY_TAG : Tag(entry.key);
+    if (pos < header_->capacity && entry.key != EMPTY) size++;
+    if (tags_[pos] != tag) {
+      bad_tags++;
+      if (fix) tags_[pos] = tag;
     }
-    entry++;
   }
-  uint64 size = num_used + num_tombstones;
+  bool ok = true;
 
   // Check if index size in header is correct.
   if (size != header_->size) {
@@ -311,10 +461,56 @@ bool DatabaseIndex::Check(bool fix) {
       // Correct index size header.
       header_->size = size;
     }
-    return false;
-  } else {
-    return true;
+    ok = false;
+  }
+
+  // Check if tags match the keys in the entries.
+  if (bad_tags != 0) {
+    LOG(WARNING) << bad_tags << " index tags do not match entry keys";
+    ok = false;
+  }
+
+  return ok;
+}
+
+void DatabaseIndex::GetProbeStats(ProbeStats *stats) const {
+  *stats = ProbeStats();
+  uint64 capacity = header_->capacity;
+
+  // Compute probe lengths for all the keys in the index.
+  uint64 hit_length = 0;
+  uint64 hit_groups = 0;
+  for (uint64 pos = 0; pos < capacity; ++pos) {
+    uint64 key = entries_[pos].key;
+    if (key == EMPTY) continue;
+    uint64 distance = (pos - (key & mask_)) & mask_;
+    stats->entries++;
+    hit_length += distance + 1;
+    hit_groups += distance / GROUP_SIZE + 1;
+    stats->hit_max = std::max(stats->hit_max, distance + 1);
+  }
+  if (stats->entries > 0) {
+    stats->hit_length = static_cast<double>(hit_length) / stats->entries;
+    stats->hit_groups = static_cast<double>(hit_groups) / stats->entries;
+  }
+
+  // A missing key probes from its home position until the next empty entry.
+  // Compute the distance to the next empty entry for all positions by scanning
+  // backwards from an empty entry.
+  uint64 empty = 0;
+  while (entries_[empty].key != EMPTY) empty++;
+  uint64 miss_length = 0;
+  uint64 miss_groups = 0;
+  uint64 distance = 0;
+  for (uint64 i = 0; i < capacity; ++i) {
+    uint64 pos = (empty - i) & mask_;
+    distance = entries_[pos].key == EMPTY ? 0 : distance + 1;
+    miss_length += distance + 1;
+    miss_groups += distance / GROUP_SIZE + 1;
+    stats->miss_max = std::max(stats->miss_max, distance + 1);
   }
+  stats->miss_length = static_cast<double>(miss_length) / capacity;
+  stats->miss_groups = static_cast<double>(miss_groups) / capacity;
 }
 
 }  // namespace sling
@@ -16,6 +16,7 @@
 #define SLING_DB_DBINDEX_H_
 
 #include <string>
+#include <vector>
 
 #include "sling/base/logging.h"
 #include "sling/base/status.h"
@@ -27,6 +28,20 @@ namespace sling {
 // Database index. The index is implemented as a file-backed hash table with
 // linear probing. The index allows multiple keys with the same value. Index
 // keys 0 and 1 are reserved.
+//
+// Besides the entry table, the index has a tag table with one byte per entry.
+// The tag for a used entry has the high bit set and the low seven bits taken
+// from the top of the key, and the tag for an empty entry is zero. Lookups
+// first check the entries in the cache line of the home position of the key,
+// which resolves most lookups at moderate load factors with a single cache
+// line. Longer probe sequences continue in the tag table, where each cache line
+// covers 64 entries, and the tags for 16 consecutive entries are compared at a
+// time using SIMD instructions, so only entries with matching tags are read.
+//
+// Entries are deleted by shifting the following entries in the probe sequence
+// backwards (backward-shift deletion), so the index has no tombstones and the
+// probe sequences do not degrade with deletions. Index files in the old
+// format without tags are migrated automatically when opened.
 class DatabaseIndex {
  public:
   // Invalid index position.
@@ -35,6 +50,17 @@ class DatabaseIndex {
   // Invalid value.
   const static uint64 NVAL = -1;
 
+  // Index entry. If key is EMPTY, the entry is unused.
+  struct Entry {
+    uint64 key;       // key for entry
+    uint64 value;     // value for entry
+  };
+
+  // Initialize index. If huge_pages is true, the index table is backed by
+  // huge pages if possible to reduce TLB misses on random lookups. Memory
+  // indices are allocated with huge pages, but for a mapped index file this is
+  // only a hint that most file systems ignore.
+  explicit DatabaseIndex(bool huge_pages = false) : huge_pages_(huge_pages) {}
   ~DatabaseIndex() { Close(); }
 
   // Open existing index file.
@@ -75,9 +101,24 @@ class DatabaseIndex {
   // Transfer all used index entries to another index.
   void TransferTo(DatabaseIndex *index) const;
 
+  // Return the partition for a key when the entry table is split into a number
+  // of equal-sized contiguous regions. The number of partitions must be a
+  // power of two not larger than the capacity.
+  int Partition(uint64 key, int partitions) const {
+    return (key & mask_) / (header_->capacity / partitions);
+  }
+
+  // Add entries to index in parallel with one thread per partition. All the
+  // keys in partition i must belong to region i of the entry table (see
+  // Partition()). Each thread only probes its own region, and the entries
+  // that would overflow into the next region are added after the threads are
+  // done. The caller must ensure that the index has room for all entries.
+  void AddPartitioned(const std::vector<std::vector<Entry>> &partitions);
+
   // Copy index from another index. This requires that the other index has the
-  // same capacity as this index.
-  void CopyFrom(const DatabaseIndex *index);
+  // same capacity as this index. The copying can be split between a number of
+  // threads to speed up the page faults for file-backed indices.
+  void CopyFrom(const DatabaseIndex *index, int threads = 1);
 
   // Write index to file.
   Status Write(File *file) const;
@@ -85,9 +126,25 @@ class DatabaseIndex {
   // Check index integrity. Return false if index is corrupted.
   bool Check(bool fix);
 
+  // Probe length statistics. The probe length is the number of entries
+  // examined from the home position of a key, and the number of tag groups
+  // is the number of SIMD tag comparisons needed.
+  struct ProbeStats {
+    uint64 entries = 0;        // number of used entries
+    double hit_length = 0.0;   // average probe length for keys in index
+    uint64 hit_max = 0;        // maximum probe length for keys in index
+    double hit_groups = 0.0;   // average tag groups for keys in index
+    double miss_length = 0.0;  // average probe length for keys not in index
+    uint64 miss_max = 0;       // maximum probe length for keys not in index
+    double miss_groups = 0.0;  // average tag groups for keys not in index
+  };
+
+  // Compute probe length statistics for index.
+  void GetProbeStats(ProbeStats *stats) const;
+
   // Check for index overflow, i.e. the fill factor is above the limit.
   bool full() const {
-    return header_->size + header_->deletions >= header_->limit;
+    return header_->size >= header_->limit;
   }
 
   // Return current epoch for index.
@@ -100,9 +157,10 @@ class DatabaseIndex {
   uint64 limit() const { return header_ != nullptr ? header_->limit : 0; }
 
   // Return number of active records.
-  uint64 num_records() const { return header_->size - header_->deletions; }
+  uint64 num_records() const { return header_->size; }
 
-  // Return number of deleted records.
+  // Return number of deleted records. Deleted entries are removed from the
+  // index, so this is always zero.
   uint64 num_deleted() const { return header_->deletions; }
 
   // Error codes.
@@ -122,29 +180,67 @@ class DatabaseIndex {
  private:
   // Magic number and version for identifying database index file.
   static const uint32 MAGIC = 0x46584449;  // IDXF
-  static const uint32 VERSION = 1;
+  static const uint32 VERSION = 2;
 
-  // Special keys for empty and deleted entries in the index.
+  // Special keys for empty entries in the index, and for deleted entries in
+  // version 1 index files.
   static const uint64 EMPTY = 0;
   static const uint64 TOMBSTONE = 1;
 
+  // Number of tags compared at a time.
+  static const int GROUP_SIZE = 16;
+
+  // Number of entries in a cache line.
+  static const int ENTRIES_PER_LINE = 64 / sizeof(Entry);
+
+  // Tag for empty entry.
+  static const uint8 EMPTY_TAG = 0;
+
+  // Return tag for key.
+  static uint8 Tag(uint64 key) { return 0x80 | (key >> 57); }
+
+  // Set entry and tag at position.
+  void Set(uint64 pos, const Entry &entry) {
+    entries_[pos] = entry;
+    SetTag(pos, entry.key == EMPTY ? EMPTY_TAG : Tag(entry.key));
+  }
+
+  // Set tag at position. The tags for the first group are mirrored after the
+  // end of the tag table, so tag groups can wrap around.
+  void SetTag(uint64 pos, uint8 tag) {
+    tags_[pos] = tag;
+    if (pos < GROUP_SIZE) tags_[header_->capacity + pos] = tag;
+  }
+
+  // Return bit mask for the entries in the tag group starting at position that
+  // have the tag.
+  uint32 Match(uint64 pos, uint8 tag) const;
+
+  // Return position of the first entry with key at or after position in the
+  // probe sequence, or NPOS if the key is not found.
+  uint64 Find(uint64 key, uint64 pos) const;
+
+  // Return position of key/value pair, or NPOS if it is not in the index.
+  uint64 Locate(uint64 key, uint64 value) const;
+
+  // Return the size of the entry and tag tables.
+  static uint64 TableSize(uint64 capacity) {
+    return capacity * sizeof(Entry) + capacity + GROUP_SIZE;
+  }
+
+  // Migrate version 1 index file to the current version.
+  Status Migrate(const string &filename);
+
   // Index file header.
   struct Header {
     uint32 magic;     // magic number for identifying database index file
     uint32 version;   // index file format version
     uint64 offset;    // offset of entry table in index
     uint64 epoch;     // epoch when index was created/updated
-    uint64 size;      // number of used entries in index incl. tombstones
+    uint64 size;      // number of used entries in index
     uint64 capacity;  // maximum capacity of index
     uint64 limit;     // index size limit, i.e. capacity * load factor
-    uint64 deletions; // number of deleted entries (tombstones) in index
-  };
-
-  // Index entry. If key is EMPTY, the entry is unused, and if the key is
-  // TOMBSTONE, the entry has been deleted.
-  struct Entry {
-    uint64 key;       // key for entry
-    uint64 value;     // value for entry
+    uint64 deletions; // number of tombstones in version 1 index
   };
 
   // Index file.
@@ -162,8 +258,17 @@ class DatabaseIndex {
   // Pointer to index entries.
   Entry *entries_ = nullptr;
 
+  // Pointer to entry tags.
+  uint8 *tags_ = nullptr;
+
   // Index position mask, i.e. capacity - 1.
   uint64 mask_;
+
+  // Use huge pages for index table.
+  bool huge_pages_;
+
+  // Memory index has been allocated with AllocateMemory().
+  bool anonymous_ = false;
 };
 
 }  // namespace sling
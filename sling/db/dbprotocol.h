@@ -35,6 +35,7 @@ enum DBVerb : uint32 {
   DBEPOCH     = 6,     // get epoch for database
   DBHEAD      = 7,     // check for existence of key(s)
   DBNEXT2     = 8,     // retrieve the next record(s), version 2
+  DBSUBSCRIBE = 9,     // subscribe to changes in database
 
   // Reply verbs.
   DBOK        = 128,   // success reply
@@ -157,6 +158,20 @@ struct DBHeader {
 //     vsize:uint32;
 //   }
 //
+// DBSUBSCRIBE flags:uint8 recid:uint64 num:uint32 -> DBOK
+//
+// Subscribe to changes in the database starting from recid, e.g. the epoch
+// returned by DBEPOCH. If recid is -1, only changes made after the
+// subscription are returned. After the DBOK reply, the server pushes the
+// changes to the client as they are committed. All records from recid up to
+// the current epoch are pushed first. The changes are pushed as DBRECORD (or
+// DBKEY) packets with up to num records each, using the same format as
+// DBNEXT2 replies, i.e. the records are followed by the recid for resuming
+// the subscription. The DBNEXT_DELETIONS and DBNEXT_NOVALUE flags are
+// supported. The server stops pushing changes when the client falls too far
+// behind in receiving them, and continues when the client has caught up. The
+// connection cannot be used for other requests after subscribing.
+//
 // DBBULK enable:uint32 -> DBOK
 //
 // Enable/disable bulk mode for database. In bulk mode, there is no periodical
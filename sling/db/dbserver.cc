@@ -16,6 +16,8 @@
 
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -468,6 +470,9 @@ void DBService::Put(HTTPRequest *request, HTTPResponse *response) {
 
   // Update last modification time.
   l.mount()->last_update = time(0);
+
+  // Push change to subscribers.
+  Publish(l.mount());
 }
 
 void DBService::Delete(HTTPRequest *request, HTTPResponse *response) {
@@ -494,6 +499,9 @@ void DBService::Delete(HTTPRequest *request, HTTPResponse *response) {
 
   // Update last modification time.
   l.mount()->last_update = time(0);
+
+  // Push change to subscribers.
+  Publish(l.mount());
 }
 
 void DBService::Options(HTTPRequest *request, HTTPResponse *response) {
@@ -612,9 +620,16 @@ void DBService::Unmount(HTTPRequest *request, HTTPResponse *response) {
   DBMount *mount = f->second;
   mount->Acquire();
 
-  // Release database from active clients.
+  // Release database from active clients. Subscribers are disconnected.
   for (auto *client = clients_; client != nullptr; client = client->next_) {
-    if (client->mount_ == mount) client->mount_ = nullptr;
+    if (client->mount_ == mount) {
+      if (client->subscribed_) {
+        client->subscribed_ = false;
+        client->lagging_ = false;
+        client->conn_->Shutdown();
+      }
+      client->mount_ = nullptr;
+    }
   }
 
   // Shut down database.
@@ -686,6 +701,10 @@ void DBService::Statusz(HTTPRequest *request, HTTPResponse *response) {
   response->set_content_type("text/json");
 }
 
+void DBService::Publish(DBMount *mount) {
+  for (DBSession *subscriber : mount->subscribers) subscriber->Pump();
+}
+
 bool DBService::ValidDatabaseName(const string &name) {
   if (name.empty() || name.size() > MAX_DBNAME_SIZE) return false;
   if (name[0] == '_' || name[0] == '-') return false;
@@ -774,6 +793,13 @@ DBSession::DBSession(DBService *dbs, SocketConnection *conn, const char *ua)
 DBSession::~DBSession() {
   // Remove client from client list.
   MutexLock lock(&dbs_->mu_);
+  if (subscribed_ && mount_ != nullptr) {
+    MutexLock l(&mount_->mu);
+    auto &subscribers = mount_->subscribers;
+    subscribers.erase(
+        std::remove(subscribers.begin(), subscribers.end(), this),
+        subscribers.end());
+  }
   if (prev_ != nullptr) prev_->next_ = next_;
   if (next_ != nullptr) next_->prev_ = prev_;
   if (this == dbs_->clients_) dbs_->clients_ = next_;
@@ -806,6 +832,7 @@ DBSession::Continuation DBSession::Process(SocketConnection *conn) {
   // Dispatch request.
   req->Consume(sizeof(DBHeader));
   if (req->available() != hdr->size) return TERMINATE;
+  if (subscribed_) return TERMINATE;
   Continuation cont = TERMINATE;
   switch (hdr->verb) {
     case DBUSE: cont = Use(); break;
@@ -817,6 +844,7 @@ DBSession::Continuation DBSession::Process(SocketConnection *conn) {
     case DBEPOCH: cont = Epoch(); break;
     case DBHEAD: cont = Head(); break;
     case DBNEXT2: cont = Next(2); break;
+    case DBSUBSCRIBE: cont = Subscribe(); break;
     default: return Error("command verb not supported");
   }
 
@@ -938,6 +966,7 @@ DBSession::Continuation DBSession::Put() {
   }
 
   l.mount()->last_update = time(0);
+  dbs_->Publish(l.mount());
   return Response(DBRESULT);
 }
 
@@ -956,6 +985,7 @@ DBSession::Continuation DBSession::Delete() {
   }
 
   l.mount()->last_update = time(0);
+  dbs_->Publish(l.mount());
   return Response(DBOK);
 }
 
@@ -997,6 +1027,17 @@ DBSession::Continuation DBSession::Next(int version) {
     }
     if (iterator == -1) return Error("error fetching next record");
 
+    // Stop if the record starts at or after the limit. This can happen when
+    // the iteration moves on to the next shard.
+    if (limit != -1) {
+      uint64 shard = Database::Shard(iterator);
+      if (Database::RecordID(shard, record.position) >= limit) {
+        iterator = limit;
+        if (n == 0) return Response(DBDONE);
+        break;
+      }
+    }
+
     // Add record to response.
     WriteRecord(record, with_value);
     l.Yield();
@@ -1014,6 +1055,90 @@ DBSession::Continuation DBSession::Epoch() {
   return Response(DBRECID);
 }
 
+DBSession::Continuation DBSession::Subscribe() {
+  // Supported subscription flags.
+  static const uint8 supports =
+    DBNEXT_DELETIONS |
+    DBNEXT_NOVALUE;
+
+  if (mount_ == nullptr) return Error("no database");
+  DBLock l(mount_);
+  auto *req = conn_->request();
+
+  uint8 flags;
+  if (!req->Read(&flags, 1)) return TERMINATE;
+  if (flags & ~supports) return Error("not supported");
+  uint64 recid;
+  if (!req->Read(&recid, 8)) return TERMINATE;
+  uint32 num;
+  if (!req->Read(&num, 4)) return TERMINATE;
+
+  // Add session to subscribers for database.
+  subscribed_ = true;
+  subflags_ = flags;
+  subbatch_ = std::max(num, 1u);
+  cursor_ = recid == -1 ? l.db()->epoch() : recid;
+  l.mount()->subscribers.push_back(this);
+
+  // Queue changes up to the current epoch. These are sent after the reply.
+  Pump();
+
+  return Response(DBOK);
+}
+
+void DBSession::Pump() {
+  // The subscriber is marked as lagging while pumping, so it will be pumped
+  // again if the output queue is drained before all changes have been queued.
+  lagging_ = true;
+  Database *db = &mount_->db;
+  bool deletions = (subflags_ & DBNEXT_DELETIONS) != 0;
+  bool with_value = !(subflags_ & DBNEXT_NOVALUE);
+  Record record;
+  while (conn_->queued() < MAX_QUEUED) {
+    // Build packet with next batch of changes.
+    packet_.Clear();
+    packet_.append<DBHeader>();
+    int n = 0;
+    while (n < subbatch_) {
+      uint64 iterator = cursor_;
+      if (!db->Next(&record, &iterator, deletions, with_value)) break;
+      if (iterator == -1) break;
+      WriteRecord(record, with_value, &packet_);
+      cursor_ = iterator;
+      n++;
+    }
+
+    // Stop when the subscriber has caught up.
+    if (n == 0) {
+      lagging_ = false;
+      return;
+    }
+
+    // Queue packet for sending to client.
+    packet_.Write(&cursor_, 8);
+    DBHeader *hdr = DBHeader::from(packet_.begin());
+    hdr->verb = with_value ? DBRECORD : DBKEY;
+    hdr->size = packet_.available() - sizeof(DBHeader);
+    conn_->Enqueue(std::make_shared<string>(packet_.begin(),
+                                            packet_.available()));
+  }
+}
+
+void DBSession::Drained(SocketConnection *conn) {
+  if (!lagging_) return;
+
+  // Lock the database while holding the global lock to prevent the database
+  // from being unmounted.
+  dbs_->mu_.Lock();
+  if (!subscribed_ || mount_ == nullptr) {
+    dbs_->mu_.Unlock();
+    return;
+  }
+  DBLock l(mount_);
+  dbs_->mu_.Unlock();
+  Pump();
+}
+
 DBSession::Continuation DBSession::Error(const char *msg) {
   // Clear existing (partial) response.
   conn_->response_header()->Clear();
@@ -1072,8 +1197,9 @@ bool DBSession::ReadRecord(Record *record) {
   return true;
 }
 
-void DBSession::WriteRecord(const Record &record, bool with_value) {
-  auto *rsp = conn_->response_body();
+void DBSession::WriteRecord(const Record &record, bool with_value,
+                            IOBuffer *out) {
+  auto *rsp = out != nullptr ? out : conn_->response_body();
   uint32 ksize = record.key.size() << 1;
   if (record.version != 0) ksize |= 1;
   rsp->Write(&ksize, 4);
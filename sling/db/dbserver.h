@@ -15,8 +15,10 @@
 #ifndef SLING_DB_DBSERVER_H_
 #define SLING_DB_DBSERVER_H_
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "sling/base/types.h"
 #include "sling/db/db.h"
@@ -97,6 +99,9 @@ class DBService {
   // Return database statistics.
   void Statusz(HTTPRequest *request, HTTPResponse *response);
 
+  // Push new changes in database to subscribers. The database must be locked.
+  void Publish(DBMount *mount);
+
   // Check that database name is valid.
   static bool ValidDatabaseName(const string &name);
 
@@ -147,6 +152,9 @@ struct DBMount {
   Mutex mu;             // mutex for serializing access to database
   time_t last_update;   // time of last database update
   time_t last_flush;    // time of last database flush
+
+  // Sessions subscribed to changes in database.
+  std::vector<DBSession *> subscribers;
 };
 
 // Lock on database.
@@ -194,6 +202,9 @@ class DBSession : public SocketSession {
   // Process SLINGDB database request.
   Continuation Process(SocketConnection *conn) override;
 
+  // Push more changes to subscriber when output queue has been drained.
+  void Drained(SocketConnection *conn) override;
+
  private:
   // Switch to using another database.
   Continuation Use();
@@ -219,6 +230,13 @@ class DBSession : public SocketSession {
   // Return current epoch for database.
   Continuation Epoch();
 
+  // Subscribe to changes in database.
+  Continuation Subscribe();
+
+  // Push pending changes to subscriber until it has caught up or the output
+  // queue is full. The database must be locked.
+  void Pump();
+
   // Return error message to client.
   Continuation Error(const char *msg);
 
@@ -231,14 +249,29 @@ class DBSession : public SocketSession {
   // Read record from request.
   bool ReadRecord(Record *record);
 
-  // Write record to response.
-  void WriteRecord(const Record &record, bool with_value = true);
+  // Write record to response or buffer.
+  void WriteRecord(const Record &record, bool with_value = true,
+                   IOBuffer *out = nullptr);
 
   DBService *dbs_;                // database server
   SocketConnection *conn_;        // client connection
   DBMount *mount_ = nullptr;      // active database for client
   char *agent_ = nullptr;         // user agent
 
+  // Subscription to database changes. The subscription state is protected by
+  // the database lock. The subscriber is lagging when there are changes that
+  // have not yet been queued for sending to the client.
+  bool subscribed_ = false;       // session is subscribed to changes
+  uint8 subflags_ = 0;            // DBNEXT flags for subscription
+  uint32 subbatch_ = 0;           // maximum number of records per packet
+  uint64 cursor_ = 0;             // position of next change to push
+  std::atomic<bool> lagging_{false};
+  IOBuffer packet_;               // buffer for building change packets
+
+  // Maximum number of bytes queued for a subscriber before the server stops
+  // pushing changes until the client has caught up.
+  static const size_t MAX_QUEUED = 4 << 20;
+
   // Client list.
   DBSession *next_;
   DBSession *prev_;
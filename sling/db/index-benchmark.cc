@@ -0,0 +1,91 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/db/dbindex.h"
+#include "sling/file/file.h"
+#include "sling/util/random.h"
+
+DEFINE_int32(capacity_bits, 26, "Index capacity (log2)");
+DEFINE_double(load_factor, 0.5, "Fraction of index entries used");
+DEFINE_int32(lookups, 10000000, "Number of lookups per run");
+DEFINE_string(index, "", "Index file (default is memory index)");
+
+using namespace sling;
+
+// Compute key for entry. Keys 0 and 1 are reserved.
+static uint64 Key(uint64 i) {
+  uint64 z = i + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return z < 2 ? z + 2 : z;
+}
+
+// Fill index and time random lookups of existing and missing keys.
+void Run(bool huge_pages) {
+  uint64 capacity = 1ULL << FLAGS_capacity_bits;
+  uint64 size = capacity * FLAGS_load_factor;
+  DatabaseIndex index(huge_pages);
+  CHECK(index.Create(FLAGS_index, capacity, capacity - 1));
+
+  for (uint64 i = 0; i < size; ++i) index.Add(Key(i), i);
+  Random rnd;
+  rnd.seed(1);
+
+  // Look up existing keys.
+  Clock clock;
+  uint64 found = 0;
+  clock.start();
+  for (int i = 0; i < FLAGS_lookups; ++i) {
+    if (index.Get(Key(rnd.UniformInt(size))) != DatabaseIndex::NVAL) found++;
+  }
+  clock.stop();
+  double hit_ns = clock.ns() / FLAGS_lookups;
+  CHECK_EQ(found, FLAGS_lookups);
+
+  // Look up keys which are not in the index.
+  clock.start();
+  for (int i = 0; i < FLAGS_lookups; ++i) {
+    uint64 missing = size + rnd.UniformInt(size);
+    if (index.Get(Key(missing)) != DatabaseIndex::NVAL) found++;
+  }
+  clock.stop();
+  double miss_ns = clock.ns() / FLAGS_lookups;
+
+  std::cout << (FLAGS_index.empty() ? "memory" : "file") << " index"
+            << ", huge pages: " << (huge_pages ? "yes" : "no")
+            << ", capacity: " << capacity
+            << ", hit: " << hit_ns << " ns"
+            << ", miss: " << miss_ns << " ns\n";
+  std::cout.flush();
+
+  CHECK(index.Close());
+  if (!FLAGS_index.empty()) CHECK(File::Delete(FLAGS_index));
+}
+
+// Compare random index lookups with and without huge pages. For large indices,
+// the lookup time is dominated by TLB misses. Use --index to time a mapped
+// index file instead of a memory index.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+  Run(false);
+  Run(true);
+  return 0;
+}
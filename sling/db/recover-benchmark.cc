@@ -0,0 +1,127 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/db/db.h"
+#include "sling/file/file.h"
+#include "sling/util/random.h"
+
+DEFINE_string(dbdir, "", "Directory for benchmark databases");
+DEFINE_int32(records, 1000000, "Number of keys in database");
+DEFINE_int32(value_size, 100, "Size of record values");
+DEFINE_double(updates, 0.2, "Fraction of keys updated after loading");
+DEFINE_double(deletions, 0.05, "Fraction of keys deleted after loading");
+DEFINE_int32(max_shards, 8, "Maximum number of data shards");
+DEFINE_int32(threads, 8, "Number of threads for parallel recovery");
+
+using namespace sling;
+
+// Write database configuration.
+void Configure(const string &dbdir, uint64 shard_size, int threads) {
+  string config;
+  config.append("data_shard_size: " + std::to_string(shard_size) + "\n");
+  config.append("index_threads: " + std::to_string(threads) + "\n");
+  CHECK(File::WriteContents(dbdir + "/config", config));
+}
+
+// Create database with records spread over a number of shards and return the
+// number of active records.
+uint64 Build(const string &dbdir, uint64 shard_size) {
+  Database db;
+  string config = "data_shard_size: " + std::to_string(shard_size) + "\n";
+  CHECK(db.Create(dbdir, config));
+
+  Random rnd;
+  rnd.seed(shard_size);
+  string value(FLAGS_value_size, ' ');
+  for (char &c : value) c = 'a' + rnd.UniformInt(26);
+  for (int i = 0; i < FLAGS_records; ++i) {
+    string key = "Q" + std::to_string(i);
+    CHECK_NE(db.Put(Record(key, 0, value)), DatabaseIndex::NVAL);
+  }
+  int updates = FLAGS_records * FLAGS_updates;
+  for (int i = 0; i < updates; ++i) {
+    string key = "Q" + std::to_string(rnd.UniformInt(FLAGS_records));
+    value[rnd.UniformInt(value.size())] = 'a' + rnd.UniformInt(26);
+    CHECK_NE(db.Put(Record(key, 0, value)), DatabaseIndex::NVAL);
+  }
+  int deletions = FLAGS_records * FLAGS_deletions;
+  for (int i = 0; i < deletions; ++i) {
+    db.Delete("Q" + std::to_string(rnd.UniformInt(FLAGS_records)));
+  }
+  CHECK(db.Flush());
+  return db.num_records();
+}
+
+// Remove database index and time recovery.
+double Recover(const string &dbdir, uint64 shard_size, int threads,
+               uint64 expected) {
+  CHECK(File::Delete(dbdir + "/index"));
+  Configure(dbdir, shard_size, threads);
+
+  Clock clock;
+  clock.start();
+  Database db;
+  CHECK(db.Open(dbdir, true));
+  clock.stop();
+  CHECK_EQ(db.num_records(), expected);
+  return clock.secs();
+}
+
+// Remove database files and directory.
+void Cleanup(const string &dbdir) {
+  for (const string &filename : File::Match(dbdir + "/*")) {
+    CHECK(File::Delete(filename));
+  }
+  CHECK(File::Rmdir(dbdir));
+}
+
+// Time recovery of database index with an increasing number of data shards,
+// both single-threaded and with parallel recovery.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  string basedir = FLAGS_dbdir;
+  if (basedir.empty()) CHECK(File::CreateTempDir(&basedir));
+  uint64 total = static_cast<uint64>(FLAGS_records) *
+                 (1.0 + FLAGS_updates + FLAGS_deletions) *
+                 (FLAGS_value_size + 16);
+
+  for (int shards = 1; shards <= FLAGS_max_shards; shards *= 2) {
+    string dbdir = basedir + "/shards-" + std::to_string(shards);
+    uint64 shard_size = total / shards + 1;
+    uint64 records = Build(dbdir, shard_size);
+    int num_shards = File::Match(dbdir + "/data-*").size();
+
+    double sequential = Recover(dbdir, shard_size, 1, records);
+    double parallel = Recover(dbdir, shard_size, FLAGS_threads, records);
+    std::cout << "shards: " << num_shards
+              << ", records: " << records
+              << ", 1 thread: " << sequential << " secs"
+              << ", " << FLAGS_threads << " threads: " << parallel << " secs"
+              << ", speedup: " << sequential / parallel << "\n";
+    std::cout.flush();
+    Cleanup(dbdir);
+  }
+
+  if (FLAGS_dbdir.empty()) CHECK(File::Rmdir(basedir));
+  return 0;
+}
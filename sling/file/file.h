@@ -77,6 +77,10 @@ class File {
                           bool writable = false,
                           bool preload = true);
 
+  // Return operating system file descriptor for zero-copy I/O. Returns -1 if
+  // the file is not backed by a file descriptor.
+  virtual int Descriptor() { return -1; }
+
   // Resize file.
   virtual Status Resize(uint64 size) = 0;
 
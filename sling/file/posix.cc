@@ -123,6 +123,8 @@ class PosixFile : public File {
     return mapping == MAP_FAILED ? nullptr : mapping;
   }
 
+  int Descriptor() override { return fd_; }
+
   Status Resize(uint64 size) override {
     if (ftruncate(fd_, size) == -1) return IOError(filename_, errno);
     return Status::OK;
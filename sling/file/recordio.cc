@@ -15,6 +15,8 @@
 #include "sling/file/recordio.h"
 
 #include <algorithm>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "sling/base/logging.h"
@@ -22,6 +24,7 @@
 #include "sling/util/fingerprint.h"
 #include "sling/util/snappy.h"
 #include "sling/util/varint.h"
+#include "third_party/zlib/zlib.h"
 
 namespace sling {
 
@@ -84,6 +87,112 @@ class BufferSink : public snappy::Sink {
 
 }  // namespace
 
+// Codec for DEFLATE compression of record values. A compressed record value
+// consists of the uncompressed length as a varint followed by a raw DEFLATE
+// stream. The zlib streams are reused between records, and the preset
+// dictionary is installed before each record.
+class DeflateCodec {
+ public:
+  DeflateCodec(const string &dictionary, int level)
+      : dictionary_(dictionary), level_(level) {}
+
+  ~DeflateCodec() {
+    if (deflating_) deflateEnd(&deflate_);
+    if (inflating_) inflateEnd(&inflate_);
+  }
+
+  // Compress value into output buffer.
+  bool Compress(const Slice &value, IOBuffer *output) {
+    if (!deflating_) {
+      memset(&deflate_, 0, sizeof(z_stream));
+      int rc = deflateInit2(&deflate_, level_, Z_DEFLATED, -MAX_WBITS, 8,
+                            Z_DEFAULT_STRATEGY);
+      if (rc != Z_OK) return false;
+      deflating_ = true;
+    } else {
+      if (deflateReset(&deflate_) != Z_OK) return false;
+    }
+    if (!dictionary_.empty()) {
+      int rc = deflateSetDictionary(
+          &deflate_, reinterpret_cast<const Bytef *>(dictionary_.data()),
+          dictionary_.size());
+      if (rc != Z_OK) return false;
+    }
+
+    // Write uncompressed length.
+    output->Clear();
+    output->Ensure(Varint::kMax32);
+    char *end = Varint::Encode32(output->end(), value.size());
+    output->Append(end - output->end());
+
+    // Compress value.
+    size_t bound = deflateBound(&deflate_, value.size());
+    output->Ensure(bound);
+    deflate_.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(value.data()));
+    deflate_.avail_in = value.size();
+    deflate_.next_out = reinterpret_cast<Bytef *>(output->end());
+    deflate_.avail_out = bound;
+    if (deflate(&deflate_, Z_FINISH) != Z_STREAM_END) return false;
+    output->Append(bound - deflate_.avail_out);
+    return true;
+  }
+
+  // Decompress value into output buffer.
+  bool Decompress(const Slice &data, IOBuffer *output) {
+    return Decompress(data, dictionary_, output);
+  }
+
+  // Decompress value into output buffer using preset dictionary.
+  bool Decompress(const Slice &data, const string &dictionary,
+                  IOBuffer *output) {
+    // Get uncompressed length.
+    uint32 length;
+    const char *end = data.data() + data.size();
+    const char *p = Varint::Parse32WithLimit(data.data(), end, &length);
+    if (p == nullptr) return false;
+
+    if (!inflating_) {
+      memset(&inflate_, 0, sizeof(z_stream));
+      if (inflateInit2(&inflate_, -MAX_WBITS) != Z_OK) return false;
+      inflating_ = true;
+    } else {
+      if (inflateReset(&inflate_) != Z_OK) return false;
+    }
+    if (!dictionary.empty()) {
+      int rc = inflateSetDictionary(
+          &inflate_, reinterpret_cast<const Bytef *>(dictionary.data()),
+          dictionary.size());
+      if (rc != Z_OK) return false;
+    }
+
+    // Decompress value.
+    output->Clear();
+    output->Ensure(length);
+    inflate_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+    inflate_.avail_in = end - p;
+    inflate_.next_out = reinterpret_cast<Bytef *>(output->end());
+    inflate_.avail_out = length;
+    int rc = inflate(&inflate_, Z_FINISH);
+    if (rc != Z_STREAM_END || inflate_.avail_out != 0) return false;
+    output->Append(length);
+    return true;
+  }
+
+ private:
+  // Preset dictionary.
+  string dictionary_;
+
+  // Compression level.
+  int level_;
+
+  // Compression and decompression streams.
+  z_stream deflate_;
+  z_stream inflate_;
+  bool deflating_ = false;
+  bool inflating_ = false;
+};
+
 RecordFile::IndexPage::IndexPage(uint64 pos, const Slice &data) {
   position = pos;
   size_t bytes = data.size();
@@ -165,6 +274,54 @@ size_t RecordFile::WriteHeader(const Header &header, char *data) {
   return p - data;
 }
 
+string RecordFile::TrainDictionary(const std::vector<string> &samples,
+                                   int size) {
+  // Count the number of samples containing each segment.
+  const int kSegmentSize = 32;
+  const int kStep = 8;
+  struct Segment {
+    const char *data;
+    int count;
+    uint64 last;
+  };
+  std::unordered_map<uint64, Segment> segments;
+  for (uint64 i = 0; i < samples.size(); ++i) {
+    const string &sample = samples[i];
+    for (int pos = 0; pos + kSegmentSize <= sample.size(); pos += kStep) {
+      const char *data = sample.data() + pos;
+      uint64 fp = Fingerprint(data, kSegmentSize);
+      auto f = segments.find(fp);
+      if (f == segments.end()) {
+        segments[fp] = Segment{data, 1, i};
+      } else if (f->second.last != i) {
+        f->second.count++;
+        f->second.last = i;
+      }
+    }
+  }
+
+  // Select the segments occurring in the most samples.
+  std::vector<const Segment *> selected;
+  for (auto &it : segments) {
+    if (it.second.count > 1) selected.push_back(&it.second);
+  }
+  std::sort(selected.begin(), selected.end(),
+    [](const Segment *a, const Segment *b) {
+      return a->count > b->count;
+    }
+  );
+  if (size > MAX_DICTIONARY_SIZE) size = MAX_DICTIONARY_SIZE;
+  int max_segments = size / kSegmentSize;
+  if (selected.size() > max_segments) selected.resize(max_segments);
+
+  // Put the most frequent segments at the end of the dictionary.
+  string dictionary;
+  for (int i = selected.size() - 1; i >= 0; --i) {
+    dictionary.append(selected[i]->data, kSegmentSize);
+  }
+  return dictionary;
+}
+
 RecordReader::RecordReader(File *file,
                            const RecordFileOptions &options,
                            bool owned)
@@ -189,6 +346,13 @@ RecordReader::RecordReader(File *file,
   input_.Consume(hdrlen);
   position_ = hdrlen;
 
+  // Read compression dictionary.
+  if (info_.flags & FLAG_DICTIONARY) ReadDictionary();
+  start_ = position_;
+  if (info_.compression == DEFLATE) {
+    codec_ = new DeflateCodec(dictionary_, 0);
+  }
+
   // Get size of file. The index records are always at the end of the file.
   if (info_.index_start != 0) {
     size_ = info_.index_start;
@@ -209,6 +373,19 @@ RecordReader::RecordReader(const string &filename)
 
 RecordReader::~RecordReader() {
   CHECK(Close());
+  delete codec_;
+}
+
+void RecordReader::ReadDictionary() {
+  if (input_.available() < MAX_HEADER_LEN) CHECK(Fill(MAX_HEADER_LEN));
+  Header hdr;
+  ssize_t hdrsize = ReadHeader(input_.begin(), &hdr);
+  CHECK(hdrsize > 0 && hdr.record_type == DICTIONARY_RECORD)
+      << "Missing compression dictionary: " << file_->filename();
+  input_.Consume(hdrsize);
+  CHECK(Ensure(hdr.record_size));
+  dictionary_.assign(input_.Consume(hdr.record_size), hdr.record_size);
+  position_ += hdrsize + hdr.record_size;
 }
 
 Status RecordReader::Close() {
@@ -280,6 +457,10 @@ Status RecordReader::Read(Record *record) {
       Status s = Skip(hdr.record_size);
       if (!s.ok()) return s;
       continue;
+    } else if (hdr.record_type == DICTIONARY_RECORD) {
+      Status s = Skip(hdrsize + hdr.record_size);
+      if (!s.ok()) return s;
+      continue;
     } else {
       input_.Consume(hdrsize);
       record->position = position_;
@@ -308,6 +489,13 @@ Status RecordReader::Read(Record *record) {
       BufferSink sink(&buffer_);
       CHECK(snappy::Uncompress(&source, &sink));
       record->value = buffer_.data();
+    } else if (info_.compression == DEFLATE) {
+      // Decompress record value.
+      Slice data(input_.Consume(value_size), value_size);
+      if (!codec_->Decompress(data, &buffer_)) {
+        return Status(1, "Corrupt compressed record");
+      }
+      record->value = buffer_.data();
     } else if (info_.compression == UNCOMPRESSED) {
       record->value = Slice(input_.Consume(value_size), value_size);
     } else {
@@ -339,6 +527,10 @@ Status RecordReader::ReadKey(Record *record) {
       Status s = Skip(hdr.record_size);
       if (!s.ok()) return s;
       continue;
+    } else if (hdr.record_type == DICTIONARY_RECORD) {
+      Status s = Skip(hdrsize + hdr.record_size);
+      if (!s.ok()) return s;
+      continue;
     } else {
       input_.Consume(hdrsize);
       record->position = position_;
@@ -366,14 +558,21 @@ Status RecordReader::ReadKey(Record *record) {
       // Get the uncompressed length of the record value and skip the rest of
       // the record value.
       size_t vsize;
-      if (info_.compression == SNAPPY) {
+      if (info_.compression == SNAPPY || info_.compression == DEFLATE) {
         // Get decompressed length. The length is stored as a 32-bit varint at
         // the beginning of the compressed value.
         size_t l = Varint::kMax32;
         if (l > value_size) l = value_size;
         Status s = Ensure(l);
         if (!s.ok()) return s;
-        CHECK(snappy::GetUncompressedLength(input_.Consume(l), l, &vsize));
+        const char *data = input_.Consume(l);
+        if (info_.compression == SNAPPY) {
+          CHECK(snappy::GetUncompressedLength(data, l, &vsize));
+        } else {
+          uint32 length;
+          CHECK(Varint::Parse32WithLimit(data, data + l, &length) != nullptr);
+          vsize = length;
+        }
         position_ += l;
 
         // Skip remaining part of record value.
@@ -401,7 +600,7 @@ Status RecordReader::ReadKey(Record *record) {
 
 Status RecordReader::Seek(uint64 pos) {
   // Check if we can skip to position in input buffer.
-  if (pos == 0) pos = info_.hdrlen;
+  if (pos == 0) pos = start_;
   if (pos == position_) return Status::OK;
   int64 offset = pos - position_;
   position_ = pos;
@@ -500,6 +699,148 @@ RecordFile::IndexPage *RecordIndex::GetIndexPage(uint64 position) {
   return page;
 }
 
+RecordMap::RecordMap(const string &filename) {
+  // Map record file into memory.
+  File *file = File::OpenOrDie(filename, "r");
+  size_ = file->Size();
+  void *mapping = file->MapMemory(0, size_, false, false);
+  CHECK(mapping != nullptr) << "Cannot map record file: " << filename;
+  data_ = static_cast<const char *>(mapping);
+
+  // Read file header and index.
+  RecordReader reader(file);
+  info_ = reader.info();
+  dictionary_ = reader.dictionary();
+  LoadIndex(&reader);
+}
+
+RecordMap::~RecordMap() {
+  CHECK(File::FreeMappedMemory(const_cast<char *>(data_), size_));
+}
+
+void RecordMap::LoadIndex(RecordReader *reader) {
+  Index entries;
+  if (info_.index_root != 0 && info_.index_depth == 3) {
+    // Read all the leaf pages of the index.
+    std::unique_ptr<IndexPage> root(reader->ReadIndexPage(info_.index_root));
+    for (int l1 = 0; l1 < root->size; ++l1) {
+      uint64 dirpos = root->entries[l1].position;
+      std::unique_ptr<IndexPage> dir(reader->ReadIndexPage(dirpos));
+      for (int l2 = 0; l2 < dir->size; ++l2) {
+        uint64 leafpos = dir->entries[l2].position;
+        std::unique_ptr<IndexPage> leaf(reader->ReadIndexPage(leafpos));
+        for (int l3 = 0; l3 < leaf->size; ++l3) {
+          entries.push_back(leaf->entries[l3]);
+        }
+      }
+    }
+  } else {
+    // Build index by scanning all the records in the file.
+    CHECK(reader->Rewind());
+    Record record;
+    while (!reader->Done()) {
+      CHECK(reader->ReadKey(&record));
+      uint64 fp = Fingerprint(record.key.data(), record.key.size());
+      entries.emplace_back(fp, record.position);
+    }
+  }
+
+  // Sort entries by fingerprint. The entries from the index pages are already
+  // sorted.
+  auto order = [](const IndexEntry &a, const IndexEntry &b) {
+    return a.fingerprint < b.fingerprint;
+  };
+  if (!std::is_sorted(entries.begin(), entries.end(), order)) {
+    std::stable_sort(entries.begin(), entries.end(), order);
+  }
+
+  // Store fingerprints and positions in separate arrays to make the binary
+  // search more cache-friendly.
+  fingerprints_.resize(entries.size());
+  positions_.resize(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    fingerprints_[i] = entries[i].fingerprint;
+    positions_[i] = entries[i].position;
+  }
+
+  // Build directory with around four entries per bucket.
+  int bits = 1;
+  while (bits < 24 && (4ULL << bits) < entries.size()) bits++;
+  shift_ = 64 - bits;
+  int buckets = 1 << bits;
+  directory_.resize(buckets + 1);
+  size_t i = 0;
+  for (int b = 0; b < buckets; ++b) {
+    directory_[b] = i;
+    while (i < fingerprints_.size() && (fingerprints_[i] >> shift_) == b) i++;
+  }
+  directory_[buckets] = i;
+}
+
+bool RecordMap::Lookup(const Slice &key, Record *record, uint64 fp,
+                       IOBuffer *buffer) const {
+  // Find first entry with matching fingerprint.
+  uint64 bucket = fp >> shift_;
+  auto begin = fingerprints_.begin() + directory_[bucket];
+  auto end = fingerprints_.begin() + directory_[bucket + 1];
+  auto it = std::lower_bound(begin, end, fp);
+
+  // Multiple keys can have the same fingerprint so we move forward until a
+  // match is found.
+  for (; it != end && *it == fp; ++it) {
+    uint64 position = positions_[it - fingerprints_.begin()];
+    if (!Read(position, record, buffer)) return false;
+    if (record->key == key) return true;
+  }
+  return false;
+}
+
+bool RecordMap::Lookup(const Slice &key, Record *record,
+                       IOBuffer *buffer) const {
+  return Lookup(key, record, Fingerprint(key.data(), key.size()), buffer);
+}
+
+bool RecordMap::Read(uint64 position, Record *record, IOBuffer *buffer) const {
+  // Read record header.
+  if (position >= size_) return false;
+  Header hdr;
+  ssize_t hdrsize = ReadHeader(data_ + position, &hdr);
+  if (hdrsize < 0) return false;
+  if (position + hdrsize + hdr.record_size > size_) return false;
+  record->position = position;
+  record->type = hdr.record_type;
+  record->version = hdr.version;
+
+  // Get record key.
+  const char *p = data_ + position + hdrsize;
+  record->key = Slice(p, hdr.key_size);
+  p += hdr.key_size;
+
+  // Get record value.
+  size_t value_size = hdr.record_size - hdr.key_size;
+  if (info_.compression == SNAPPY) {
+    buffer->Clear();
+    snappy::ByteArraySource source(p, value_size);
+    BufferSink sink(buffer);
+    if (!snappy::Uncompress(&source, &sink)) return false;
+    record->value = buffer->data();
+  } else if (info_.compression == DEFLATE) {
+    // The decompression stream cannot be shared between threads, so each
+    // thread has its own stream which is reset for each record.
+    static thread_local DeflateCodec codec("", 0);
+    if (!codec.Decompress(Slice(p, value_size), dictionary_, buffer)) {
+      return false;
+    }
+    record->value = buffer->data();
+  } else if (info_.compression == UNCOMPRESSED) {
+    record->value = Slice(p, value_size);
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
 RecordDatabase::RecordDatabase(const string &filepattern,
                                const RecordFileOptions &options) {
   std::vector<string> filenames;
@@ -510,6 +851,7 @@ RecordDatabase::RecordDatabase(const string &filepattern,
     RecordIndex *index = new RecordIndex(reader, options);
     reader->Rewind();
     shards_.push_back(index);
+    if (options.memory_mapped) maps_.push_back(new RecordMap(filename));
   }
   Forward();
 }
@@ -521,6 +863,7 @@ RecordDatabase::RecordDatabase(const std::vector<string> &filenames,
     RecordIndex *index = new RecordIndex(reader, options);
     reader->Rewind();
     shards_.push_back(index);
+    if (options.memory_mapped) maps_.push_back(new RecordMap(filename));
   }
   Forward();
 }
@@ -530,6 +873,7 @@ RecordDatabase::~RecordDatabase() {
     delete s->reader();
     delete s;
   }
+  for (auto *m : maps_) delete m;
 }
 
 void RecordDatabase::Forward() {
@@ -550,9 +894,20 @@ bool RecordDatabase::Lookup(const Slice &key, Record *record) {
   // Compute key fingerprint and shard number.
   uint64 fp = Fingerprint(key.data(), key.size());
   current_shard_ = fp % shards_.size();
+  if (!maps_.empty()) {
+    return maps_[current_shard_]->Lookup(key, record, fp, &buffer_);
+  }
   return shards_[current_shard_]->Lookup(key, record, fp);
 }
 
+bool RecordDatabase::Lookup(const Slice &key, Record *record,
+                            IOBuffer *buffer) const {
+  CHECK(!maps_.empty()) << "Record database is not memory-mapped";
+  uint64 fp = Fingerprint(key.data(), key.size());
+  int shard = fp % maps_.size();
+  return maps_[shard]->Lookup(key, record, fp, buffer);
+}
+
 bool RecordDatabase::Next(Record *record) {
   CHECK(!Done());
   RecordReader *reader = shards_[current_shard_]->reader();
@@ -588,6 +943,17 @@ RecordWriter::RecordWriter(File *file, const RecordFileOptions &options)
     CHECK_EQ(info_.hdrlen, sizeof(FileHeader));
     CHECK(info_.index_start == 0) << "Cannot append to indexed record file";
 
+    // Read existing compression dictionary.
+    string dictionary;
+    if (info_.flags & FLAG_DICTIONARY) {
+      CHECK(file->Seek(0));
+      RecordReader reader(file, options, false);
+      dictionary = reader.dictionary();
+    }
+    if (info_.compression == DEFLATE) {
+      codec_ = new DeflateCodec(dictionary, options.compression_level);
+    }
+
     // Seek to end of file.
     CHECK(file_->Seek(size));
     position_ = size;
@@ -601,8 +967,32 @@ RecordWriter::RecordWriter(File *file, const RecordFileOptions &options)
     if (options.indexed) {
       info_.index_page_size = options.index_page_size;
     }
+
+    // Only the last 32KB of the dictionary can be used for compression.
+    string dictionary;
+    if (options.compression == DEFLATE) {
+      dictionary = options.dictionary;
+      if (dictionary.size() > MAX_DICTIONARY_SIZE) {
+        dictionary.erase(0, dictionary.size() - MAX_DICTIONARY_SIZE);
+      }
+      codec_ = new DeflateCodec(dictionary, options.compression_level);
+    }
+    if (!dictionary.empty()) info_.flags |= FLAG_DICTIONARY;
     output_.Write(&info_, sizeof(info_));
     position_ += sizeof(info_);
+
+    // Write uncompressed dictionary after file header.
+    if (!dictionary.empty()) {
+      Header hdr;
+      hdr.record_type = DICTIONARY_RECORD;
+      hdr.record_size = dictionary.size();
+      hdr.key_size = 0;
+      output_.Ensure(MAX_HEADER_LEN);
+      size_t hdrsize = WriteHeader(hdr, output_.end());
+      output_.Append(hdrsize);
+      output_.Write(dictionary);
+      position_ += hdrsize + dictionary.size();
+    }
   }
 }
 
@@ -626,11 +1016,15 @@ RecordWriter::RecordWriter(RecordReader *reader,
   if (options.indexed) {
     info_.index_page_size = options.index_page_size;
   }
+  if (info_.compression == DEFLATE) {
+    codec_ = new DeflateCodec(reader->dictionary(), options.compression_level);
+  }
   position_ = reader->size();
 }
 
 RecordWriter::~RecordWriter() {
   CHECK(Close());
+  delete codec_;
 }
 
 Status RecordWriter::Close() {
@@ -679,6 +1073,12 @@ Status RecordWriter::Write(const Record &record, uint64 *position) {
     BufferSink sink(&buffer_);
     snappy::Compress(&source, &sink);
     value = buffer_.data();
+  } else if (info_.compression == DEFLATE) {
+    // Compress record value.
+    if (!codec_->Compress(record.value, &buffer_)) {
+      return Status(1, "Record compression failed");
+    }
+    value = buffer_.data();
   } else if (info_.compression == UNCOMPRESSED) {
     // Store uncompressed record value.
     value = record.value;
@@ -15,6 +15,7 @@
 #ifndef SLING_FILE_RECORDIO_H_
 #define SLING_FILE_RECORDIO_H_
 
+#include <string>
 #include <vector>
 
 #include "sling/base/slice.h"
@@ -31,12 +32,16 @@ enum RecordType {
   FILLER_RECORD = 2,     // filler record to avoid records crossing chunks
   INDEX_RECORD  = 3,     // index page
   VDATA_RECORD = 4,      // versioned data record
+  DICTIONARY_RECORD = 5, // compression dictionary
 };
 
 inline bool ValidRecordType(RecordType type) {
-  return type >= DATA_RECORD && type <= VDATA_RECORD;
+  return type >= DATA_RECORD && type <= DICTIONARY_RECORD;
 }
 
+// Codec for DEFLATE compression of record values.
+class DeflateCodec;
+
 // Record with key and value.
 struct Record {
   Record() {}
@@ -68,8 +73,15 @@ class RecordFile {
   enum CompressionType {
     UNCOMPRESSED = 0,
     SNAPPY = 1,
+    DEFLATE = 2,
   };
 
+  // File header flags.
+  static const uint16 FLAG_DICTIONARY = 1;  // dictionary follows header
+
+  // Maximum dictionary size. DEFLATE can only refer back 32KB.
+  static const int MAX_DICTIONARY_SIZE = 32768;
+
   // File header information.
   struct FileHeader {
     uint32 magic;
@@ -121,6 +133,13 @@ class RecordFile {
 
   // Write header to data. Returns number of bytes written.
   static size_t WriteHeader(const Header &header, char *data);
+
+  // Build compression dictionary from sample record values. The dictionary
+  // consists of the most frequent segments in the samples, with the most
+  // frequent segments at the end where they can be referenced with the
+  // shortest distances.
+  static string TrainDictionary(const std::vector<string> &samples,
+                                int size = MAX_DICTIONARY_SIZE);
 };
 
 // Configuration options for record file.
@@ -134,6 +153,13 @@ struct RecordFileOptions {
   // Record compression.
   RecordFile::CompressionType compression = RecordFile::SNAPPY;
 
+  // Compression level for DEFLATE compression (1=fastest, 9=best).
+  int compression_level = 6;
+
+  // Preset dictionary for DEFLATE compression. The dictionary is stored in
+  // the record file right after the file header.
+  string dictionary;
+
   // Record files can be indexed for fast retrieval by key.
   bool indexed = false;
 
@@ -145,6 +171,9 @@ struct RecordFileOptions {
 
   // Number of pages in index page cache.
   int index_cache_size = 256;
+
+  // Memory-map record files in record databases for concurrent lookups.
+  bool memory_mapped = false;
 };
 
 // Reader for reading records from a record file.
@@ -176,7 +205,7 @@ class RecordReader : public RecordFile {
   Status Seek(uint64 pos);
 
   // Seek to first record in record file.
-  Status Rewind() { return Seek(info_.hdrlen); }
+  Status Rewind() { return Seek(start_); }
 
   // Skip bytes in input. The offset can be negative.
   Status Skip(int64 n) { return Seek(position_ + n); }
@@ -193,7 +222,13 @@ class RecordReader : public RecordFile {
   // File size.
   uint64 size() const { return size_; }
 
+  // Compression dictionary for record file.
+  const string &dictionary() const { return dictionary_; }
+
  private:
+  // Read compression dictionary following the file header.
+  void ReadDictionary();
+
   // Fill input buffer.
   Status Fill(uint64 needed);
 
@@ -212,6 +247,9 @@ class RecordReader : public RecordFile {
   // Current position in record file.
   uint64 position_;
 
+  // Position of first record in record file.
+  uint64 start_;
+
   // In readahead mode the input buffer is filled to prefetch the next records.
   // The readahead flag is cleared when seeking to a new position in the file.
   bool readahead_ = true;
@@ -225,6 +263,10 @@ class RecordReader : public RecordFile {
   // Buffer for decompressed record data.
   IOBuffer buffer_;
 
+  // Compression dictionary and codec for DEFLATE compression.
+  string dictionary_;
+  DeflateCodec *codec_ = nullptr;
+
   friend class RecordWriter;
 };
 
@@ -267,8 +309,61 @@ class RecordIndex : public RecordFile {
   std::vector<RecordFile::IndexPage *> cache_;
 };
 
+// Memory-mapped record file for concurrent lookups by key. The file is mapped
+// into memory and the complete three-level fingerprint index is loaded into a
+// flat sorted array, so lookups do not need any seeks or locks and can be done
+// from multiple threads at the same time. Record files without an index are
+// indexed by scanning the records when the file is opened.
+class RecordMap : public RecordFile {
+ public:
+  explicit RecordMap(const string &filename);
+  ~RecordMap();
+
+  // Look up record by key. Compressed record values are decompressed into the
+  // buffer, so each thread should use its own buffer. Returns false if no
+  // matching record is found.
+  bool Lookup(const Slice &key, Record *record, uint64 fp,
+              IOBuffer *buffer) const;
+  bool Lookup(const Slice &key, Record *record, IOBuffer *buffer) const;
+
+  // Read record at position.
+  bool Read(uint64 position, Record *record, IOBuffer *buffer) const;
+
+  // Record file header information.
+  const FileHeader &info() const { return info_; }
+
+  // Number of records in index.
+  size_t size() const { return fingerprints_.size(); }
+
+ private:
+  // Load index entries from index pages or by scanning the record file.
+  void LoadIndex(RecordReader *reader);
+
+  // Mapped record file.
+  const char *data_ = nullptr;
+  uint64 size_ = 0;
+
+  // Record file meta information.
+  FileHeader info_;
+
+  // Compression dictionary.
+  string dictionary_;
+
+  // Sorted key fingerprints and the corresponding record positions.
+  std::vector<uint64> fingerprints_;
+  std::vector<uint64> positions_;
+
+  // The high bits of the fingerprints are used for indexing into the
+  // directory of start positions in the fingerprint array to narrow the
+  // binary search.
+  int shift_ = 64;
+  std::vector<uint32> directory_;
+};
+
 // A record database is a sharded set of indexed record files where records can
-// be looked up by key. The records must be sharded by key fingerprint.
+// be looked up by key. The records must be sharded by key fingerprint. If the
+// database is opened with the memory_mapped option, the shards are also mapped
+// into memory for thread-safe lookups.
 class RecordDatabase {
  public:
   // Open record database.
@@ -283,6 +378,12 @@ class RecordDatabase {
   // Look up record by key. Returns false if no matching record is found.
   bool Lookup(const Slice &key, Record *record);
 
+  // Look up record by key in memory-mapped shards. This can be called from
+  // multiple threads concurrently as long as each thread uses its own buffer
+  // for decompressing record values. The database must be opened with the
+  // memory_mapped option.
+  bool Lookup(const Slice &key, Record *record, IOBuffer *buffer) const;
+
   // Retrieve the next record from the current shard.
   bool Next(Record *record);
 
@@ -302,6 +403,12 @@ class RecordDatabase {
   // Shards in record database.
   std::vector<RecordIndex *> shards_;
 
+  // Memory-mapped shards for concurrent lookups.
+  std::vector<RecordMap *> maps_;
+
+  // Buffer for single-threaded lookups in memory-mapped shards.
+  IOBuffer buffer_;
+
   // Current shard for retrieving the next document.
   int current_shard_ = 0;
 };
@@ -378,6 +485,9 @@ class RecordWriter : public RecordFile {
   // Buffer for compressed record data.
   IOBuffer buffer_;
 
+  // Codec for DEFLATE compression.
+  DeflateCodec *codec_ = nullptr;
+
   // Index entries for building index.
   Index index_;
 
@@ -14,12 +14,17 @@
 
 #include "sling/frame/decoder.h"
 
+#include <string.h>
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "sling/frame/object.h"
 #include "sling/frame/store.h"
 #include "sling/frame/wire.h"
 #include "sling/stream/input.h"
+#include "sling/stream/memory.h"
+#include "sling/util/thread.h"
 
 namespace sling {
 
@@ -113,6 +118,22 @@ Handle Decoder::DecodeObject() {
         case WIRE_QSTRING:
           handle = DecodeQString();
           break;
+        case WIRE_SEGMENT: {
+          // Reset references to the segment prelude and decode the first
+          // object in the segment.
+          uint64 size;
+          uint32 objects;
+          if (!input_->ReadVarint64(&size)) return Handle::error();
+          if (!input_->ReadVarint32(&objects)) return Handle::error();
+          if (prelude_ == -1) prelude_ = references_.length();
+          references_.set_end(references_.base() + prelude_);
+          return DecodeObject();
+        }
+        case WIRE_PRELUDE:
+          // Start of segment prelude.
+          segmented_ = true;
+          if (input_->done()) return Handle::nil();
+          return DecodeObject();
         default:
           handle = Handle::error();
       }
@@ -122,6 +143,10 @@ Handle Decoder::DecodeObject() {
   return handle;
 }
 
+bool Decoder::segment() {
+  return input_->Peek() == (WIRE_SPECIAL | (WIRE_SEGMENT << 3));
+}
+
 Handle Decoder::DecodeFrame(int slots, int replace) {
   // Pre-allocate frame unless we are resolving a link.
   Handle handle;
@@ -207,6 +232,17 @@ Handle Decoder::DecodeFrame(int slots, int replace) {
   if (replace == -1) {
     store_->UpdateFrame(handle, begin, end);
   } else {
+    // A frame in a segment encodes the id used for linking it as a reference
+    // to the link. If the link is to an existing frame instead of a proxy,
+    // the id is replaced by the link symbol.
+    if (!store_->Deref(handle)->IsProxy()) {
+      for (Slot *s = begin; s < end; ++s) {
+        if (s->name.IsId() && s->value == handle) {
+          s->value = LinkSymbol(handle);
+          if (s->value.IsNil()) return Handle::error();
+        }
+      }
+    }
     handle = store_->AllocateFrame(begin, end, handle);
   }
 
@@ -302,16 +338,336 @@ Handle Decoder::DecodeSymbol(int name_size) {
 Handle Decoder::DecodeLink(int name_size) {
   // Read symbol name and resolve bound symbol reference.
   const char *data;
+  string buffer;
+  Text name;
   if (input_->TryRead(name_size, &data)) {
     // Fast case.
-    return store_->Lookup(Text(data, name_size));
+    name = Text(data, name_size);
   } else {
     // Slow case.
-    string name;
-    if (!input_->ReadString(name_size, &name)) return Handle::error();
-    return store_->Lookup(name);
+    if (!input_->ReadString(name_size, &buffer)) return Handle::error();
+    name = buffer;
+  }
+  Handle handle = store_->Lookup(name);
+
+  // Keep track of the symbols for links to existing frames in the segment
+  // prelude, so these frames can be replaced by frames in segments.
+  if (segmented_ && prelude_ == -1 && handle.IsRef() && !handle.IsNil() &&
+      store_->Owned(handle) && !store_->Deref(handle)->IsProxy()) {
+    link_symbols_[handle] = store_->Symbol(name);
   }
+  return handle;
 }
 
-}  // namespace sling
+ParallelDecoder::ParallelDecoder(Store *store, Input *input, int threads,
+                                 bool marker)
+    : store_(store), input_(input), prelude_(store, input, marker),
+      threads_(threads) {}
+
+bool ParallelDecoder::DecodeAll() {
+  // Decode prelude. Local stores are decoded sequentially.
+  bool parallel = threads_ > 1 && store_->globals() == nullptr;
+  while (!prelude_.done() && !(parallel && prelude_.segment())) {
+    if (prelude_.DecodeObject().IsError()) return false;
+  }
+  if (prelude_.done()) return true;
+
+  // Decode segments in batches. The next batch is read while the current batch
+  // is being decoded.
+  store_->LockGC();
+  std::vector<Worker> workers(threads_);
+  std::vector<Segment *> batch;
+  bool ok = ReadBatch(&batch);
+  while (ok && !batch.empty()) {
+    // Decode segments in batch in parallel.
+    ReserveHandles(batch);
+    std::atomic<int> next{0};
+    std::atomic<bool> success{true};
+    WorkerPool pool;
+    pool.Start(threads_, [&](int index) {
+      for (;;) {
+        int i = next++;
+        if (i >= batch.size()) break;
+        if (!DecodeSegment(&workers[index], batch[i])) success = false;
+      }
+    });
+    std::vector<Segment *> next_batch;
+    ok = ReadBatch(&next_batch);
+    pool.Join();
+    if (!success) ok = false;
+
+    // Add new worker heaps to store.
+    for (Worker &worker : workers) {
+      for (Heap *heap : worker.heaps) {
+        store_->last_heap_->set_next(heap);
+        store_->last_heap_ = heap;
+      }
+      worker.heaps.clear();
+    }
+
+    for (Segment *segment : batch) delete segment;
+    batch.swap(next_batch);
+  }
+  for (Segment *segment : batch) delete segment;
+  store_->UnlockGC();
+
+  // All input after the prelude must be in segments.
+  return ok && prelude_.done();
+}
+
+bool ParallelDecoder::ReadBatch(std::vector<Segment *> *batch) {
+  int size = threads_ * 2;
+  while (batch->size() < size && !prelude_.done() && prelude_.segment()) {
+    uint64 tag;
+    uint64 length;
+    Segment *segment = new Segment();
+    batch->push_back(segment);
+    if (!input_->ReadVarint64(&tag)) return false;
+    if (!input_->ReadVarint64(&length)) return false;
+    if (!input_->ReadVarint32(&segment->objects)) return false;
+    if (!input_->ReadString(length, &segment->data)) return false;
+    segment->prelude = &prelude_.references();
+  }
+  return true;
+}
+
+void ParallelDecoder::ReserveHandles(const std::vector<Segment *> &batch) {
+  // Expand handle table if needed.
+  auto &handles = store_->handles_;
+  size_t needed = handles.size();
+  for (Segment *segment : batch) {
+    needed += segment->objects * sizeof(Store::Reference);
+  }
+  if (needed > handles.capacity()) {
+    CHECK_LE(needed, Store::kMaxHandlesSize) << "Handle overflow";
+    size_t newsize = handles.capacity();
+    while (newsize < needed) newsize *= 2;
+    if (newsize > Store::kMaxHandlesSize) newsize = Store::kMaxHandlesSize;
+    handles.reserve(newsize);
+    store_->pools_[store_->store_tag_] = handles.base();
+  }
+
+  // Reserve consecutive handles for each segment.
+  for (Segment *segment : batch) {
+    Store::Reference *ref;
+    size_t size = segment->objects * sizeof(Store::Reference);
+    CHECK(handles.consume(size, &ref));
+    memset(ref, 0, size);
+    segment->next = handles.index(ref);
+    segment->end = segment->next + segment->objects;
+  }
+}
+
+bool ParallelDecoder::DecodeSegment(Worker *worker, Segment *segment) {
+  ArrayInputStream stream(segment->data.data(), segment->data.size());
+  Input input(&stream);
+  segment->input = &input;
+  while (!input.done()) {
+    if (DecodeObject(worker, segment).IsError()) return false;
+  }
+
+  // All reserved handles must be used.
+  return segment->next == segment->end;
+}
+
+Handle ParallelDecoder::DecodeObject(Worker *worker, Segment *segment) {
+  // Decode next tag from input. Symbols are not allowed in segments since
+  // these would need to be added to the symbol table.
+  Input *input = segment->input;
+  uint64 tag;
+  if (!input->ReadVarint64(&tag)) return Handle::error();
+  uint64 arg = tag >> 3;
+
+  switch (tag & 7) {
+    case WIRE_REF: return Reference(segment, arg);
+    case WIRE_FRAME: return DecodeFrame(worker, segment, arg, -1);
+    case WIRE_STRING: return DecodeString(worker, segment, arg);
+    case WIRE_INTEGER: return Handle::Integer(arg);
+    case WIRE_FLOAT: return Handle::FromFloatBits(arg);
+    case WIRE_SPECIAL:
+      switch (arg) {
+        case WIRE_NIL: return Handle::nil();
+        case WIRE_ID: return Handle::id();
+        case WIRE_ISA: return Handle::isa();
+        case WIRE_IS: return Handle::is();
+        case WIRE_ARRAY: return DecodeArray(worker, segment);
+        case WIRE_INDEX: {
+          uint32 index;
+          if (!input->ReadVarint32(&index)) return Handle::error();
+          return Handle::Index(index);
+        }
+        case WIRE_RESOLVE: {
+          uint32 slots;
+          uint32 replace;
+          if (!input->ReadVarint32(&slots)) return Handle::error();
+          if (!input->ReadVarint32(&replace)) return Handle::error();
+          if (replace >= segment->prelude->length()) return Handle::error();
+          return DecodeFrame(worker, segment, slots, replace);
+        }
+        case WIRE_QSTRING: return DecodeQString(worker, segment);
+      }
+  }
 
+  return Handle::error();
+}
+
+Handle ParallelDecoder::DecodeFrame(Worker *worker, Segment *segment,
+                                    int slots, int replace) {
+  // Pre-allocate frame unless we are resolving a link.
+  Handle handle;
+  FrameDatum *frame = nullptr;
+  if (replace == -1) {
+    frame = Allocate(worker, FRAME, slots * sizeof(Slot))->AsFrame();
+    handle = Assign(segment, frame);
+    if (handle.IsError()) return handle;
+    segment->references.push_back(handle);
+  } else {
+    handle = Reference(segment, replace);
+  }
+
+  // Decode slots for frame and store them temporarily on the stack.
+  Space<Handle> &stack = worker->stack;
+  Word mark = stack.offset(stack.end());
+  for (int i = 0; i < slots; ++i) {
+    Handle name = DecodeObject(worker, segment);
+    if (name.IsError()) return Handle::error();
+    *stack.push() = name;
+    Handle value = DecodeObject(worker, segment);
+    if (value.IsError()) return Handle::error();
+    *stack.push() = value;
+  }
+  Slot *begin = reinterpret_cast<Slot *>(stack.address(mark));
+  Slot *end = reinterpret_cast<Slot *>(stack.end());
+
+  if (replace == -1) {
+    // Anonymous frames cannot have ids in segments.
+    Slot *t = frame->begin();
+    for (Slot *s = begin; s < end; ++s, ++t) {
+      if (s->name.IsId()) return Handle::error();
+      t->assign(s->name, s->value);
+    }
+  } else {
+    // Replace proxy or existing frame for link with new frame. Each frame has
+    // its own link, so the replaced object and the id symbols for the frame
+    // are only updated by the thread decoding the frame.
+    if (!handle.IsRef() || handle.IsNil()) return Handle::error();
+    Datum *existing = store_->Deref(handle);
+    if (!existing->IsFrame()) return Handle::error();
+    Handle link;
+    if (existing->IsProxy()) {
+      link = existing->AsProxy()->symbol;
+    } else {
+      // Unbind the ids of the existing frame like in Store::AllocateFrame().
+      link = prelude_.LinkSymbol(handle);
+      if (link.IsNil()) return Handle::error();
+      FrameDatum *original = existing->AsFrame();
+      for (Slot *s = original->begin(); s < original->end(); ++s) {
+        if (!s->name.IsId() || !s->value.IsRef()) continue;
+        Datum *id = store_->Deref(s->value);
+        if (!id->IsSymbol()) continue;
+        SymbolDatum *symbol = id->AsSymbol();
+        if (symbol->value == handle) symbol->value = Handle::nil();
+      }
+    }
+    frame = Allocate(worker, FRAME, slots * sizeof(Slot))->AsFrame();
+    Slot *t = frame->begin();
+    for (Slot *s = begin; s < end; ++s, ++t) {
+      Handle value = s->value;
+      if (s->name.IsId()) {
+        // Bind id symbol to frame. The id used for linking the frame is
+        // encoded as a reference to the link.
+        if (!value.IsRef() || value.IsNil()) return Handle::error();
+        if (value == handle) value = link;
+        Datum *id = store_->Deref(value);
+        if (!id->IsSymbol()) return Handle::error();
+        SymbolDatum *symbol = id->AsSymbol();
+        if (symbol->bound() && symbol->value != handle) return Handle::error();
+        symbol->value = handle;
+        value = symbol->self;
+        frame->AddFlags(PUBLIC);
+      }
+      t->assign(s->name, value);
+    }
+    store_->Replace(handle, frame);
+  }
+
+  // Remove slots from stack.
+  stack.set_end(stack.address(mark));
+
+  return handle;
+}
+
+Handle ParallelDecoder::DecodeString(Worker *worker, Segment *segment,
+                                     int size) {
+  StringDatum *str = Allocate(worker, STRING, size)->AsString();
+  Handle handle = Assign(segment, str);
+  if (handle.IsError()) return handle;
+  segment->references.push_back(handle);
+  if (!segment->input->Read(str->data(), size)) return Handle::error();
+  return handle;
+}
+
+Handle ParallelDecoder::DecodeQString(Worker *worker, Segment *segment) {
+  uint32 length;
+  if (!segment->input->ReadVarint32(&length)) return Handle::error();
+  StringDatum *str =
+      Allocate(worker, QSTRING, length + sizeof(Word))->AsString();
+  Handle handle = Assign(segment, str);
+  if (handle.IsError()) return handle;
+  if (!segment->input->Read(str->data(), length)) return Handle::error();
+  segment->references.push_back(handle);
+  Handle qual = DecodeObject(worker, segment);
+  if (qual.IsError()) return Handle::error();
+  str->set_qualifier(qual);
+  return handle;
+}
+
+Handle ParallelDecoder::DecodeArray(Worker *worker, Segment *segment) {
+  uint32 size;
+  if (!segment->input->ReadVarint32(&size)) return Handle::error();
+  ArrayDatum *array = Allocate(worker, ARRAY, size * sizeof(Handle))->AsArray();
+  Handle handle = Assign(segment, array);
+  if (handle.IsError()) return handle;
+  segment->references.push_back(handle);
+  for (Handle *e = array->begin(); e < array->end(); ++e) *e = Handle::nil();
+  for (Handle *e = array->begin(); e < array->end(); ++e) {
+    *e = DecodeObject(worker, segment);
+    if (e->IsError()) return Handle::error();
+  }
+  return handle;
+}
+
+Handle ParallelDecoder::Reference(Segment *segment, uint32 index) {
+  const HandleSpace *prelude = segment->prelude;
+  if (index < prelude->length()) return prelude->base()[index];
+  index -= prelude->length();
+  if (index >= segment->references.size()) return Handle::error();
+  return segment->references[index];
+}
+
+Datum *ParallelDecoder::Allocate(Worker *worker, Type type, Word size) {
+  // Allocate new heap for worker if the current heap is full.
+  Word bytes = Align(sizeof(Datum) + size);
+  CHECK_LT(bytes, kObjectSizeLimit) << "Object too big";
+  Datum *object;
+  if (worker->heap == nullptr || !worker->heap->consume(bytes, &object)) {
+    Word heap_size = store_->options()->maximum_heap_size;
+    while (heap_size < bytes) heap_size *= 2;
+    worker->heap = new Heap();
+    store_->AllocateHeap(worker->heap, heap_size);
+    worker->heaps.push_back(worker->heap);
+    CHECK(worker->heap->consume(bytes, &object));
+  }
+  object->info = size | type;
+  return object;
+}
+
+Handle ParallelDecoder::Assign(Segment *segment, Datum *object) {
+  if (segment->next == segment->end) return Handle::error();
+  Handle handle = Handle::Ref(segment->next++, store_->store_tag_);
+  store_->Assign(handle, object);
+  object->self = handle;
+  return handle;
+}
+
+}  // namespace sling
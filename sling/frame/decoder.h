@@ -16,6 +16,8 @@
 #define SLING_FRAME_DECODER_H_
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "sling/base/macros.h"
 #include "sling/frame/object.h"
@@ -46,6 +48,19 @@ class Decoder {
   // Skips frames in the input which are already in the store.
   void set_skip_known_frames(bool b) { skip_known_frames_ = b; }
 
+  // Returns true if the next object in the input is a segment.
+  bool segment();
+
+  // Returns references to previously decoded objects.
+  const HandleSpace &references() const { return references_; }
+
+  // Returns the symbol for a link to a frame that already existed in the
+  // store, or nil if there is no such link.
+  Handle LinkSymbol(Handle handle) const {
+    auto f = link_symbols_.find(handle);
+    return f == link_symbols_.end() ? Handle::nil() : f->second;
+  }
+
  private:
   // Decodes frame from input.
   Handle DecodeFrame(int slots, int replace);
@@ -99,12 +114,109 @@ class Decoder {
   // Stack for storing intermediate values while decoding objects.
   HandleSpace stack_;
 
+  // Symbols for links to frames that already existed in the store. A segment
+  // encodes the id used for linking a frame as a reference to the link, so
+  // the symbol is needed for replacing an existing frame.
+  std::unordered_map<Handle, Handle, HandleHash> link_symbols_;
+
   // Frames that already exist in the store can be skipped by the decoder.
   bool skip_known_frames_ = false;
 
+  // The input is a segmented encoding.
+  bool segmented_ = false;
+
+  // Number of references in the segment prelude (-1 if no segments yet).
+  int prelude_ = -1;
+
   DISALLOW_IMPLICIT_CONSTRUCTORS(Decoder);
 };
 
+// The parallel decoder decodes input with segments (see
+// Encoder::set_segment_size()). The prelude before the first segment is
+// decoded sequentially, and then the segments are decoded concurrently into
+// the store. The segments are read and decoded in batches. Before each batch
+// is decoded, handles are reserved for the new objects in each segment, so
+// the worker threads only need to allocate objects in their own heaps, which
+// are added to the store afterwards. Frames that already exist in the store
+// are replaced like in Store::AllocateFrame(). Only global stores can be
+// decoded in parallel. Other stores and input without segments are decoded
+// sequentially.
+class ParallelDecoder {
+ public:
+  // Initializes parallel decoder with store where objects should be stored and
+  // input where objects are read from.
+  ParallelDecoder(Store *store, Input *input, int threads, bool marker = true);
+
+  // Decodes all objects from the input. Returns false on decoding errors.
+  bool DecodeAll();
+
+ private:
+  // Segment with encoded objects.
+  struct Segment {
+    string data;           // encoded segment data
+    uint32 objects;        // number of new objects in segment
+    Word next;             // next reserved handle index for segment
+    Word end;              // end of reserved handle indices for segment
+    const HandleSpace *prelude;  // references to objects in prelude
+    std::vector<Handle> references;  // references to objects in segment
+    Input *input;          // input for decoding segment
+  };
+
+  // Worker state for decoding segments.
+  struct Worker {
+    Heap *heap = nullptr;      // current heap for allocating objects
+    std::vector<Heap *> heaps; // new heaps that have not been added to store
+    Space<Handle> stack;       // stack for intermediate values
+  };
+
+  // Reads next batch of segments from the input.
+  bool ReadBatch(std::vector<Segment *> *batch);
+
+  // Reserves handles for objects in segments.
+  void ReserveHandles(const std::vector<Segment *> &batch);
+
+  // Decodes segment.
+  bool DecodeSegment(Worker *worker, Segment *segment);
+
+  // Decodes object in segment.
+  Handle DecodeObject(Worker *worker, Segment *segment);
+
+  // Decodes frame in segment.
+  Handle DecodeFrame(Worker *worker, Segment *segment, int slots, int replace);
+
+  // Decodes string in segment.
+  Handle DecodeString(Worker *worker, Segment *segment, int size);
+
+  // Decodes qualified string in segment.
+  Handle DecodeQString(Worker *worker, Segment *segment);
+
+  // Decodes array in segment.
+  Handle DecodeArray(Worker *worker, Segment *segment);
+
+  // Returns handle for reference in segment.
+  Handle Reference(Segment *segment, uint32 index);
+
+  // Allocates object in worker heap.
+  Datum *Allocate(Worker *worker, Type type, Word size);
+
+  // Assigns reserved handle to new object in segment.
+  Handle Assign(Segment *segment, Datum *object);
+
+  // Object store for storing decoded objects.
+  Store *store_;
+
+  // Decoder input.
+  Input *input_;
+
+  // Decoder for segment prelude.
+  Decoder prelude_;
+
+  // Number of worker threads.
+  int threads_;
+
+  DISALLOW_IMPLICIT_CONSTRUCTORS(ParallelDecoder);
+};
+
 }  // namespace sling
 
 #endif  // SLING_FRAME_DECODER_H_
@@ -15,11 +15,13 @@
 #include "sling/frame/encoder.h"
 
 #include <string>
+#include <vector>
 
 #include "sling/base/logging.h"
 #include "sling/frame/object.h"
 #include "sling/frame/store.h"
 #include "sling/frame/wire.h"
+#include "sling/stream/memory.h"
 #include "sling/stream/output.h"
 
 namespace sling {
@@ -38,6 +40,11 @@ Encoder::Encoder(const Store *store, Output *output, bool marker)
 }
 
 void Encoder::EncodeAll() {
+  if (segment_size_ > 0) {
+    EncodeSegments();
+    return;
+  }
+
   const MapDatum *map = store_->GetMap(store_->symbols());
   for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
     Handle h = *bucket;
@@ -51,6 +58,125 @@ void Encoder::EncodeAll() {
   }
 }
 
+void Encoder::EncodeSegments() {
+  // All frames in the symbol table must be encoded by reference.
+  CHECK(shallow_) << "Segmented encoding requires shallow encoding";
+  WriteTag(WIRE_SPECIAL, WIRE_PRELUDE);
+
+  // Output links for all bound symbols in the prelude. Each frame is linked
+  // through one of its ids. The frames are then encoded as resolved links in
+  // the segments.
+  std::vector<Handle> frames;
+  const MapDatum *map = store_->GetMap(store_->symbols());
+  for (Handle *bucket = map->begin(); bucket < map->end(); ++bucket) {
+    Handle h = *bucket;
+    while (!h.IsNil()) {
+      const SymbolDatum *symbol = store_->GetSymbol(h);
+      if (symbol->bound()) {
+        Handle handle = symbol->value;
+        Reference &ref = references_[handle];
+        if (ref.status == UNRESOLVED) {
+          ref.index = NewReference(handle);
+          ref.status = LINKED;
+          EncodeSymbol(symbol, WIRE_LINK);
+          linked_.add(h);
+          if (!store_->IsProxy(handle)) frames.push_back(handle);
+        }
+      }
+      h = symbol->next;
+    }
+  }
+
+  // Output all other symbols used by the frames in the prelude, so the
+  // segments do not contain any symbols.
+  HandleSet visited;
+  std::vector<Handle> symbols;
+  for (Handle handle : frames) {
+    const FrameDatum *frame = store_->GetFrame(handle);
+    for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+      if (s->name.IsId() && linked_.has(s->value)) continue;
+      CollectSymbols(s->name, &visited, &symbols);
+      CollectSymbols(s->value, &visited, &symbols);
+    }
+  }
+  for (Handle handle : symbols) {
+    Reference &ref = references_[handle];
+    ref.index = NewReference(handle);
+    ref.status = ENCODED;
+    EncodeSymbol(store_->GetSymbol(handle), WIRE_SYMBOL);
+  }
+
+  // Encode frames in segments.
+  int prelude = next_index_;
+  Output *output = output_;
+  size_t next = 0;
+  while (next < frames.size()) {
+    // Encode frames into segment buffer.
+    string buffer;
+    StringOutputStream stream(&buffer);
+    Output segment(&stream);
+    output_ = &segment;
+    in_segment_ = true;
+    while (next < frames.size() && stream.ByteCount() < segment_size_) {
+      EncodeObject(frames[next++]);
+    }
+    segment.Flush();
+    output_ = output;
+    in_segment_ = false;
+
+    // Output segment header and data.
+    WriteTag(WIRE_SPECIAL, WIRE_SEGMENT);
+    output_->WriteVarint64(buffer.size());
+    output_->WriteVarint32(segment_handles_.size());
+    output_->Write(buffer);
+
+    // Remove references to objects in segment.
+    for (Handle handle : segment_handles_) references_.erase(handle);
+    segment_handles_.clear();
+    next_index_ = prelude;
+  }
+}
+
+void Encoder::CollectSymbols(Handle handle, HandleSet *visited,
+                             std::vector<Handle> *symbols) {
+  // Skip objects that have already been encoded or linked.
+  if (!handle.IsRef() || handle.IsNil()) return;
+  auto f = references_.find(handle);
+  if (f != references_.end() && f->second.status != UNRESOLVED) return;
+  if (!visited->insert(handle).second) return;
+
+  const Datum *datum = store_->GetObject(handle);
+  switch (datum->type()) {
+    case SYMBOL:
+      symbols->push_back(handle);
+      break;
+
+    case QSTRING:
+      CollectSymbols(datum->AsString()->qualifier(), visited, symbols);
+      break;
+
+    case FRAME: {
+      const FrameDatum *frame = datum->AsFrame();
+      for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+        CollectSymbols(s->name, visited, symbols);
+        CollectSymbols(s->value, visited, symbols);
+      }
+      break;
+    }
+
+    case ARRAY: {
+      const ArrayDatum *array = datum->AsArray();
+      for (Handle *e = array->begin(); e < array->end(); ++e) {
+        CollectSymbols(*e, visited, symbols);
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
 void Encoder::EncodeObject(Handle handle) {
   if (handle.IsRef()) {
     // Check if object has already been output.
@@ -70,7 +196,13 @@ void Encoder::EncodeObject(Handle handle) {
         output_->WriteVarint32(ref.index);
         for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
           EncodeLink(s->name);
-          EncodeLink(s->value);
+          if (s->name.IsId() && linked_.has(s->value)) {
+            // The id used for linking the frame in the segment prelude is
+            // encoded as a reference to the link.
+            WriteReference(ref);
+          } else {
+            EncodeLink(s->value);
+          }
         }
       }
     } else {
@@ -78,7 +210,7 @@ void Encoder::EncodeObject(Handle handle) {
       switch (datum->type()) {
         case STRING: {
           // Output string contents.
-          ref.index = next_index_++;
+          ref.index = NewReference(handle);
           ref.status = ENCODED;
           const StringDatum *str = datum->AsString();
           WriteTag(WIRE_STRING, str->length());
@@ -88,7 +220,7 @@ void Encoder::EncodeObject(Handle handle) {
 
         case QSTRING: {
           // Output qualified string.
-          ref.index = next_index_++;
+          ref.index = NewReference(handle);
           ref.status = ENCODED;
           const StringDatum *str = datum->AsString();
           WriteTag(WIRE_SPECIAL, WIRE_QSTRING);
@@ -101,14 +233,14 @@ void Encoder::EncodeObject(Handle handle) {
         case FRAME: {
           if (datum->IsProxy()) {
             // Output bound symbol for the proxy.
-            ref.index = next_index_++;
+            ref.index = NewReference(handle);
             ref.status = LINKED;
             const ProxyDatum *proxy = datum->AsProxy();
             const SymbolDatum *symbol = store_->GetSymbol(proxy->symbol);
             EncodeSymbol(symbol, WIRE_LINK);
           } else {
             // Output frame slots.
-            ref.index = next_index_++;
+            ref.index = NewReference(handle);
             ref.status = ENCODED;
             const FrameDatum *frame = datum->AsFrame();
             WriteTag(WIRE_FRAME, frame->slots());
@@ -122,14 +254,14 @@ void Encoder::EncodeObject(Handle handle) {
 
         case SYMBOL:
           // Output symbol name.
-          ref.index = next_index_++;
+          ref.index = NewReference(handle);
           ref.status = ENCODED;
           EncodeSymbol(datum->AsSymbol(), WIRE_SYMBOL);
           break;
 
         case ARRAY: {
           // Output array tag followed by array size and the elements.
-          ref.index = next_index_++;
+          ref.index = NewReference(handle);
           ref.status = ENCODED;
           const ArrayDatum *array = datum->AsArray();
           WriteTag(WIRE_SPECIAL, WIRE_ARRAY);
@@ -186,7 +318,7 @@ void Encoder::EncodeLink(Handle handle) {
     // Output link to object.
     Reference &ref = references_[handle];
     if (ref.status == UNRESOLVED) {
-      ref.index = next_index_++;
+      ref.index = NewReference(handle);
       ref.status = LINKED;
       EncodeSymbol(store_->GetSymbol(link), WIRE_LINK);
     } else {
@@ -196,6 +328,7 @@ void Encoder::EncodeLink(Handle handle) {
 }
 
 void Encoder::EncodeSymbol(const SymbolDatum *symbol, int type) {
+  DCHECK(!in_segment_) << "Symbols must be encoded in the segment prelude";
   WriteTag(type, symbol->length());
   output_->Write(symbol->data(), symbol->length());
 }
@@ -16,6 +16,7 @@
 #define SLING_FRAME_ENCODER_H_
 
 #include <string>
+#include <vector>
 
 #include "sling/base/macros.h"
 #include "sling/frame/object.h"
@@ -41,6 +42,12 @@ class Encoder {
   void set_shallow(bool shallow) { shallow_ = shallow; }
   void set_global(bool global) { global_ = global; }
 
+  // Encode all frames in segments of approximately this size in EncodeAll().
+  // The segments can be decoded in parallel by the ParallelDecoder. Anonymous
+  // objects shared between frames in different segments are encoded in each
+  // segment. Segmented encoding is disabled if the segment size is zero.
+  void set_segment_size(int size) { segment_size_ = size; }
+
  private:
   // Object encoding states.
   enum Status {
@@ -61,6 +68,20 @@ class Encoder {
     int index;      // reference number
   };
 
+  // Returns reference number for new object.
+  int NewReference(Handle handle) {
+    if (in_segment_) segment_handles_.push_back(handle);
+    return next_index_++;
+  }
+
+  // Encodes all frames in the symbol table of the store in segments.
+  void EncodeSegments();
+
+  // Collects symbols that are reachable from object without passing through
+  // other frames in the symbol table.
+  void CollectSymbols(Handle handle, HandleSet *visited,
+                      std::vector<Handle> *symbols);
+
   // Encodes object for handle.
   void EncodeObject(Handle handle);
 
@@ -97,6 +118,16 @@ class Encoder {
   // Output frames in the global store by value.
   bool global_;
 
+  // Approximate segment size for segmented encoding.
+  int segment_size_ = 0;
+
+  // Symbols used for linking frames in the prelude of segmented encoding.
+  HandleSet linked_;
+
+  // Objects with references in the current segment.
+  bool in_segment_ = false;
+  std::vector<Handle> segment_handles_;
+
   DISALLOW_IMPLICIT_CONSTRUCTORS(Encoder);
 };
 
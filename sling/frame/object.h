@@ -789,6 +789,9 @@ class Frame : public Object {
   // Dereferences frame reference.
   FrameDatum *frame() { return datum()->AsFrame(); }
   const FrameDatum *frame() const { return datum()->AsFrame(); }
+
+  // Returns slot index for frame, or null if the frame is not indexed.
+  const SlotIndex *slot_index() const { return store()->slot_index(handle()); }
 };
 
 // A builder is used for creating new frames in a store.
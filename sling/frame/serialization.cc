@@ -14,10 +14,14 @@
 
 #include "sling/frame/serialization.h"
 
+#include "sling/base/flags.h"
 #include "sling/base/logging.h"
 #include "sling/frame/snapshot.h"
 #include "sling/frame/wire.h"
 
+DEFINE_int32(store_decoder_threads, 8,
+             "Number of threads for decoding segmented store files");
+
 namespace sling {
 
 InputParser::InputParser(Store *store, InputStream *stream,
@@ -108,8 +112,8 @@ void LoadStore(const string &filename, Store *store) {
   FileInputStream stream(filename);
   Input input(&stream);
   if (input.Peek() == WIRE_BINARY_MARKER) {
-    Decoder decoder(store, &input);
-    decoder.DecodeAll();
+    ParallelDecoder decoder(store, &input, FLAGS_store_decoder_threads);
+    CHECK(decoder.DecodeAll()) << "Error decoding " << filename;
   } else {
     Reader reader(store, &input);
     while (!reader.done()) {
@@ -0,0 +1,112 @@
+// Copyright 2018 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <string>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/snapshot.h"
+#include "sling/frame/store.h"
+
+DEFINE_string(store, "", "Frame store to snapshot (synthetic if empty)");
+DEFINE_string(snapshot, "/tmp/snapshot-benchmark", "Snapshot file name");
+DEFINE_int32(size, 4, "Size of synthetic store in GB");
+DEFINE_int32(max_threads, 16, "Maximum number of threads");
+
+DECLARE_int32(snapshot_threads);
+
+using namespace sling;
+
+// Build synthetic store with frames that have a mix of string, symbol, and
+// integer slots.
+void BuildStore(Store *store, int64 size) {
+  Handle name = store->Lookup("name");
+  Handle value = store->Lookup("value");
+  Handle link = store->Lookup("link");
+  Handle prev = Handle::nil();
+  MemoryUsage usage;
+  for (int64 i = 0;; ++i) {
+    Builder b(store);
+    b.AddId("Q" + std::to_string(i));
+    b.Add(name, "synthetic frame number " + std::to_string(i));
+    for (int j = 0; j < 16; ++j) b.Add(value, Handle::Integer(i * j));
+    if (!prev.IsNil()) b.Add(link, prev);
+    prev = b.Create().handle();
+    if (i % 100000 == 0) {
+      store->GetMemoryUsage(&usage, true);
+      if (usage.memory_allocated() >= size) break;
+    }
+  }
+}
+
+// Time snapshot writing and loading with increasing number of threads. For
+// cold-cache load times, drop the page cache before each run, e.g. with
+// "echo 3 > /proc/sys/vm/drop_caches", and use --max_threads to pick the
+// number of threads.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Build store for snapshot.
+  Store store;
+  if (FLAGS_store.empty()) {
+    LOG(INFO) << "Building " << FLAGS_size << " GB synthetic store";
+    BuildStore(&store, static_cast<int64>(FLAGS_size) << 30);
+  } else {
+    LOG(INFO) << "Loading store from " << FLAGS_store;
+    LoadStore(FLAGS_store, &store);
+  }
+  store.Freeze();
+  MemoryUsage usage;
+  store.GetMemoryUsage(&usage, true);
+  std::cout << "store: " << usage.memory_allocated() << " bytes, "
+            << usage.num_heaps << " heaps, "
+            << usage.num_handles << " handles\n";
+
+  // Snapshots are only valid if they are newer than the store file.
+  CHECK(File::WriteContents(FLAGS_snapshot, "").ok());
+  double gb = usage.memory_allocated() / 1e9;
+
+  for (int threads = 1; threads <= FLAGS_max_threads; threads *= 2) {
+    FLAGS_snapshot_threads = threads;
+
+    Clock clock;
+    clock.start();
+    CHECK(Snapshot::Write(&store, FLAGS_snapshot));
+    clock.stop();
+    double write_secs = clock.secs();
+
+    Store loaded;
+    clock.start();
+    CHECK(Snapshot::Read(&loaded, FLAGS_snapshot));
+    clock.stop();
+    double read_secs = clock.secs();
+
+    std::cout << "threads: " << threads
+              << ", write: " << write_secs << " secs ("
+              << gb / write_secs << " GB/s)"
+              << ", read: " << read_secs << " secs ("
+              << gb / read_secs << " GB/s)\n";
+    std::cout.flush();
+  }
+
+  File::Delete(Snapshot::Filename(FLAGS_snapshot));
+  File::Delete(FLAGS_snapshot);
+  return 0;
+}
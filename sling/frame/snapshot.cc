@@ -14,14 +14,111 @@
 
 #include "sling/frame/snapshot.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "sling/base/flags.h"
 #include "sling/base/logging.h"
 #include "sling/base/status.h"
 #include "sling/base/types.h"
 #include "sling/file/file.h"
 #include "sling/frame/store.h"
+#include "sling/util/city.h"
+#include "sling/util/thread.h"
+
+DEFINE_int32(snapshot_threads, 8,
+             "Number of threads for reading and writing snapshots");
 
 namespace sling {
 
+// Heaps are read and written in chunks of this size.
+static const uint64 kChunkSize = 16 << 20;
+
+// Heap data is stored at file offsets that are multiples of the alignment.
+static const uint64 kAlignment = 4096;
+
+// Chunk of heap data for transfer to or from snapshot file.
+struct SnapshotChunk {
+  int heap;         // heap number for chunk
+  char *data;       // chunk data in heap
+  uint64 position;  // file position for chunk
+  uint64 size;      // chunk size in bytes
+  uint64 checksum;  // checksum of chunk data
+};
+
+// Round up file position to alignment.
+static uint64 Align(uint64 position) {
+  return (position + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+// Split heap into chunks.
+static void SplitHeap(int heap, char *data, uint64 position, uint64 size,
+                      std::vector<SnapshotChunk> *chunks) {
+  uint64 offset = 0;
+  while (offset < size) {
+    SnapshotChunk chunk;
+    chunk.heap = heap;
+    chunk.data = data + offset;
+    chunk.position = position + offset;
+    chunk.size = std::min(size - offset, kChunkSize);
+    chunk.checksum = 0;
+    chunks->push_back(chunk);
+    offset += chunk.size;
+  }
+}
+
+// Compute checksum for heap from its chunk checksums.
+static uint64 HeapChecksum(const std::vector<SnapshotChunk> &chunks,
+                           int heap, uint64 size) {
+  uint64 checksum = size;
+  for (const SnapshotChunk &chunk : chunks) {
+    if (chunk.heap == heap) checksum = CityHash64Mix(checksum, chunk.checksum);
+  }
+  return checksum;
+}
+
+// Run function on items in parallel and return the first error.
+static Status ParallelFor(int n, std::function<Status(int)> func) {
+  int threads = std::min(FLAGS_snapshot_threads, n);
+  if (threads < 1) threads = 1;
+  std::atomic<int> next{0};
+  std::vector<Status> status(threads);
+  WorkerPool pool;
+  pool.Start(threads, [&](int index) {
+    for (;;) {
+      int i = next++;
+      if (i >= n) break;
+      Status st = func(i);
+      if (!st.ok()) {
+        status[index] = st;
+        next = n;
+        break;
+      }
+    }
+  });
+  pool.Join();
+  for (const Status &st : status) {
+    if (!st.ok()) return st;
+  }
+  return Status::OK;
+}
+
+// Read data from file position, retrying on short reads.
+static Status ReadFully(File *file, uint64 position, char *data, uint64 size) {
+  while (size > 0) {
+    uint64 read;
+    Status st = file->PRead(position, data, size, &read);
+    if (!st.ok()) return st;
+    if (read == 0) return Status(1, "truncated snapshot", file->filename());
+    position += read;
+    data += read;
+    size -= read;
+  }
+  return Status::OK;
+}
+
 string Snapshot::Filename(const string &filename) {
   return filename + ".snap";
 }
@@ -53,52 +150,95 @@ Status Snapshot::Read(Store *store, const string &filename) {
     return Status(1, "local store cannot be loaded from snapshot");
   }
 
-  // Read snapshot header.
+  // Open snapshot file.
   File *file;
   Status st = File::Open(Filename(filename), "r", &file);
   if (!st.ok()) return st;
 
+  // Read snapshot and close the file, also when the snapshot is invalid.
+  st = Read(store, file, filename);
+  Status close = file->Close();
+  return st.ok() ? close : st;
+}
+
+Status Snapshot::Read(Store *store, File *file, const string &filename) {
+  // Read snapshot header.
   Header hdr;
-  st = file->Read(&hdr, sizeof(Header));
+  Status st = ReadFully(file, 0, reinterpret_cast<char *>(&hdr),
+                        sizeof(Header));
   if (!st.ok()) return st;
 
   if (hdr.magic != MAGIC) return Status(1, "invalid snapshot", filename);
   if (hdr.version != VERSION) return Status(1, "unsupported version", filename);
-
-  // Delete existing heaps.
-  Heap *heap = store->first_heap_;
-  while (heap != nullptr) {
-    Heap *next = heap->next();
-    delete heap;
-    heap = next;
+  if (store->symbols_.bits != hdr.symtab) {
+    return Status(1, "invalid symbol table handle", filename);
   }
-  store->first_heap_ = store->last_heap_ = store->current_heap_ = heap;
 
-  // Read heaps from snapshot.
+  // Read heap directory.
+  std::vector<HeapEntry> directory(hdr.heaps);
+  st = ReadFully(file, sizeof(Header),
+                 reinterpret_cast<char *>(directory.data()),
+                 hdr.heaps * sizeof(HeapEntry));
+  if (!st.ok()) return st;
+
+  // Allocate heaps for snapshot. The new heaps are not added to the store
+  // until all heaps have been read and verified, so the store is left intact
+  // if the snapshot cannot be loaded.
+  std::vector<Heap *> heaps;
+  std::vector<SnapshotChunk> chunks;
   Heap *symheap = nullptr;
   for (int i = 0; i < hdr.heaps; ++i) {
-    // Read heap size.
-    uint64 heapsize;
-    st = file->Read(&heapsize, sizeof(uint64));
-    if (!st.ok()) return st;
-
     // Allocate new heap.
+    uint64 heapsize = directory[i].size;
     Heap *heap = new Heap();
-    heap->reserve(heapsize);
-    store->current_heap_ = heap;
-    if (store->first_heap_ == nullptr) store->first_heap_ = heap;
-    if (store->last_heap_ != nullptr) store->last_heap_->set_next(heap);
-    store->last_heap_ = heap;
-
-    // Read heap into memory.
-    st = file->Read(heap->base(), heapsize);
-    if (!st.ok()) return st;
+    store->AllocateHeap(heap, heapsize);
+    heaps.push_back(heap);
 
     // Mark all space in heap as used.
     heap->set_end(heap->address(heapsize));
 
     // Check if this is the symbol table heap.
     if (hdr.symheap == i) symheap = heap;
+
+    // Split heap into chunks for reading.
+    SplitHeap(i, reinterpret_cast<char *>(heap->base()),
+              directory[i].offset, heapsize, &chunks);
+  }
+
+  // Read heaps into memory in parallel and compute checksums.
+  st = ParallelFor(chunks.size(), [&](int i) {
+    SnapshotChunk &chunk = chunks[i];
+    Status status = ReadFully(file, chunk.position, chunk.data, chunk.size);
+    if (!status.ok()) return status;
+    chunk.checksum = CityHash64(chunk.data, chunk.size);
+    return Status::OK;
+  });
+
+  // Verify heap checksums.
+  for (int i = 0; st.ok() && i < hdr.heaps; ++i) {
+    uint64 checksum = HeapChecksum(chunks, i, directory[i].size);
+    if (checksum != directory[i].checksum) {
+      st = Status(1, "snapshot checksum mismatch", filename);
+    }
+  }
+  if (!st.ok()) {
+    for (Heap *heap : heaps) delete heap;
+    return st;
+  }
+
+  // Replace existing heaps with the snapshot heaps.
+  Heap *heap = store->first_heap_;
+  while (heap != nullptr) {
+    Heap *next = heap->next();
+    delete heap;
+    heap = next;
+  }
+  store->first_heap_ = store->last_heap_ = store->current_heap_ = nullptr;
+  for (Heap *heap : heaps) {
+    if (store->first_heap_ == nullptr) store->first_heap_ = heap;
+    if (store->last_heap_ != nullptr) store->last_heap_->set_next(heap);
+    store->last_heap_ = heap;
+    store->current_heap_ = heap;
   }
 
   // Allocate handle table.
@@ -111,10 +251,12 @@ Status Snapshot::Read(Store *store, const string &filename) {
   // Clear handle table, leaving the nil entry intact.
   memset(handles.base() + 1, 0, (hdr.handles - 1) * sizeof(Store::Reference));
 
-  // Restore handle table from self handles in objects. If snapshot has a
+  // Restore handle table from self handles in objects. Each object has its own
+  // handle, so the heaps can be processed in parallel. If snapshot has a
   // separate heap for the symbol table, all the other heaps are frozen.
   store->free_handle_ = nullptr;
-  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
+  ParallelFor(heaps.size(), [&](int i) {
+    Heap *heap = heaps[i];
     bool freeze = (symheap != nullptr && heap != symheap);
     Datum *object = heap->base();
     Datum *end = heap->end();
@@ -131,16 +273,14 @@ Status Snapshot::Read(Store *store, const string &filename) {
       object = object->next();
     }
     if (freeze) heap->set_frozen(true);
-  }
+    return Status::OK;
+  });
 
   // Set up symbol table.
-  if (store->symbols_.bits != hdr.symtab) {
-    return Status(1, "invalid symbol table handle", filename);
-  }
   store->num_symbols_ = hdr.symbols;
   store->num_buckets_ = hdr.buckets;
 
-  return file->Close();
+  return Status::OK;
 }
 
 Status Snapshot::Write(Store *store, const string &filename) {
@@ -154,7 +294,7 @@ Status Snapshot::Write(Store *store, const string &filename) {
   Status st = File::Open(Filename(filename), "w", &file);
   if (!st.ok()) return st;
 
-  // Write header.
+  // Set up header.
   Header hdr;
   hdr.magic = MAGIC;
   hdr.version = VERSION;
@@ -169,25 +309,48 @@ Status Snapshot::Write(Store *store, const string &filename) {
     if (heap == symheap) hdr.symheap = hdr.heaps;
     hdr.heaps++;
   }
-  st = file->Write(&hdr, sizeof(Header));
+
+  // Assign aligned file positions to heaps.
+  std::vector<HeapEntry> directory(hdr.heaps);
+  std::vector<SnapshotChunk> chunks;
+  uint64 position = Align(sizeof(Header) + hdr.heaps * sizeof(HeapEntry));
+  int h = 0;
+  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
+    HeapEntry &entry = directory[h];
+    entry.offset = position;
+    entry.size = heap->size();
+    SplitHeap(h, reinterpret_cast<char *>(heap->base()), entry.offset,
+              entry.size, &chunks);
+    position = Align(position + entry.size);
+    h++;
+  }
+
+  // Write heaps in parallel and compute checksums.
+  st = ParallelFor(chunks.size(), [&](int i) {
+    SnapshotChunk &chunk = chunks[i];
+    chunk.checksum = CityHash64(chunk.data, chunk.size);
+    return file->PWrite(chunk.position, chunk.data, chunk.size);
+  });
   if (!st.ok()) {
     file->Close();
     return st;
   }
 
-  // Write heaps.
-  for (Heap *heap = store->first_heap_; heap != nullptr; heap = heap->next()) {
-    uint64 heapsize = heap->size();
-    st = file->Write(&heapsize, sizeof(uint64));
-    if (st.ok()) st = file->Write(heap->base(), heapsize);
-    if (!st) {
-      file->Close();
-      return st;
-    }
+  // Write header and heap directory.
+  for (int i = 0; i < hdr.heaps; ++i) {
+    directory[i].checksum = HeapChecksum(chunks, i, directory[i].size);
+  }
+  st = file->PWrite(0, &hdr, sizeof(Header));
+  if (st.ok()) {
+    st = file->PWrite(sizeof(Header), directory.data(),
+                      hdr.heaps * sizeof(HeapEntry));
+  }
+  if (!st.ok()) {
+    file->Close();
+    return st;
   }
 
   return file->Close();
 }
 
 }  // namespace sling
-
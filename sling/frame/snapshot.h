@@ -19,13 +19,17 @@
 
 #include "sling/base/status.h"
 #include "sling/base/types.h"
+#include "sling/file/file.h"
 #include "sling/frame/store.h"
 
 namespace sling {
 
 // Global frame stores can be snapshot and saved to .snap files. These can then
 // be loaded into a new empty global store. For large stores, this is faster
-// than reading the frame store in encoded format.
+// than reading the frame store in encoded format. The heaps are stored at
+// page-aligned file offsets recorded in a heap directory after the header, so
+// snapshots can be read and written in parallel with large positional reads
+// and writes. Each heap has a checksum that is verified when it is loaded.
 class Snapshot {
  public:
   // Filename for snapshot.
@@ -41,9 +45,12 @@ class Snapshot {
   static Status Write(Store *store, const string &filename);
 
  private:
+  // Read snapshot from open file into store.
+  static Status Read(Store *store, File *file, const string &filename);
+
   // Current magic and version for snapshots.
   static const int MAGIC = 0x50414e53;
-  static const int VERSION = 4;
+  static const int VERSION = 5;
 
   // Snapshot file header.
   struct Header {
@@ -56,6 +63,14 @@ class Snapshot {
     int buckets;    // number of hash buckets in the symbol table
     int symheap;    // heap for symbol table (-1 means no separate heap)
   };
+
+  // Heap directory entry. The directory has an entry for each heap and is
+  // stored right after the snapshot file header.
+  struct HeapEntry {
+    uint64 offset;    // file offset of heap data
+    uint64 size;      // heap size in bytes
+    uint64 checksum;  // checksum of heap data
+  };
 };
 
 }  // namespace sling
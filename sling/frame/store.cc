@@ -14,14 +14,25 @@
 
 #include "sling/frame/store.h"
 
+#include <algorithm>
 #include <string>
 
 #include "sling/base/clock.h"
+#include "sling/base/flags.h"
 #include "sling/base/logging.h"
 #include "sling/string/strcat.h"
 #include "sling/string/text.h"
 #include "sling/util/city.h"
 
+DEFINE_bool(store_huge_pages, false,
+            "Use huge pages for large heaps in global stores");
+DEFINE_int32(store_numa_placement, sling::NUMA_DEFAULT,
+             "NUMA placement for large heaps in global stores "
+             "(-1=default, -2=interleave, n=bind to node n)");
+DEFINE_int32(store_slot_index, 0,
+             "Minimum number of slots for frames to be indexed in the slot "
+             "index when global stores are frozen (0=disabled)");
+
 namespace sling {
 
 // Initial heap with standard symbols.
@@ -80,6 +91,23 @@ void Region::reserve(size_t bytes) {
   DCHECK(end_ <= limit_);
 }
 
+Heap::~Heap() {
+  if (mapped()) {
+    FreeMemory(base_, mapped_size_);
+    base_ = end_ = limit_ = nullptr;
+  }
+}
+
+void Heap::Map(size_t bytes, bool huge_pages, int placement) {
+  CHECK(base_ == nullptr);
+  void *data = AllocateMemory(bytes, huge_pages);
+  CHECK(data != nullptr) << "Unable to map heap of " << bytes << " bytes";
+  PlaceMemory(data, bytes, placement);
+  base_ = end_ = static_cast<Address>(data);
+  limit_ = base_ + bytes;
+  mapped_size_ = bytes;
+}
+
 Address Region::alloc(size_t bytes) {
   if (limit_ - end_ < bytes) reserve(size() + bytes);
   Address ptr = end_;
@@ -203,6 +231,9 @@ Store::~Store() {
   roots_.Unlink();
   externals_.Unlink();
 
+  // Delete slot index.
+  delete slot_index_;
+
   // Delete all object heaps.
   Heap *heap = first_heap_;
   while (heap != nullptr) {
@@ -1100,7 +1131,7 @@ Datum *Store::AllocateDatumSlow(Type type, Word size) {
 
   // Allocate new heap.
   current_heap_ = new Heap();
-  current_heap_->reserve(heap_size);
+  AllocateHeap(current_heap_, heap_size);
   last_heap_->set_next(current_heap_);
   last_heap_ = current_heap_;
 
@@ -1190,6 +1221,20 @@ Heap *Store::GetSymbolHeap() {
   return nullptr;
 }
 
+void Store::AllocateHeap(Heap *heap, size_t size) {
+  // Small heaps are not worth placing, and local stores are only used by one
+  // thread.
+  bool huge_pages = options_->huge_pages || FLAGS_store_huge_pages;
+  int placement = options_->numa_placement;
+  if (placement == NUMA_DEFAULT) placement = FLAGS_store_numa_placement;
+  if (globals_ != nullptr || size < kHugePageSize ||
+      (!huge_pages && placement == NUMA_DEFAULT)) {
+    heap->reserve(size);
+  } else {
+    heap->Map(size, huge_pages, placement);
+  }
+}
+
 void Store::AllocateSymbolHeap() {
   // Check if symbol table is already in a separate heap.
   if (GetSymbolHeap() != nullptr) return;
@@ -1487,6 +1532,12 @@ void Store::Freeze() {
   for (Heap *heap = first_heap_; heap != nullptr; heap = heap->next()) {
     // Shrink heap unless it is already full.
     if (!heap->full()) {
+      // Mapped heaps cannot be resized, so only the unused part is dropped.
+      if (heap->mapped()) {
+        heap->Trim();
+        continue;
+      }
+
       // Resize heap.
       Datum *base = heap->base();
       heap->reserve(heap->size());
@@ -1540,6 +1591,20 @@ void Store::Freeze() {
 
   // Store is now frozen.
   frozen_ = true;
+
+  // Build slot index for large frames.
+  int threshold = options_->slot_index_threshold;
+  if (threshold == 0) threshold = FLAGS_store_slot_index;
+  if (threshold > 0) {
+    slot_index_ = new SlotIndex(first_heap_, threshold);
+    if (slot_index_->num_frames() == 0) {
+      delete slot_index_;
+      slot_index_ = nullptr;
+    } else {
+      VLOG(1) << "Slot index for " << slot_index_->num_frames() << " frames, "
+              << slot_index_->memory() << " bytes";
+    }
+  }
 }
 
 void Store::CoalesceStrings(Word buckets) {
@@ -1705,5 +1770,96 @@ void Store::GetMemoryUsage(MemoryUsage *usage, bool quick) const {
   usage->gc_time = gc_time_;
 }
 
-}  // namespace sling
+SlotIndex::SlotIndex(const Heap *heaps, int threshold) {
+  if (threshold < kMinSlots) threshold = kMinSlots;
+  threshold_ = threshold;
+
+  // Find frames to index.
+  std::vector<const FrameDatum *> frames;
+  for (const Heap *heap = heaps; heap != nullptr; heap = heap->next()) {
+    const Datum *object = heap->base();
+    const Datum *end = heap->end();
+    while (object < end) {
+      if (!object->invalid() && object->IsFrame()) {
+        const FrameDatum *frame = object->AsFrame();
+        if (frame->slots() >= threshold) frames.push_back(frame);
+      }
+      object = object->next();
+    }
+  }
+
+  // Allocate directory with a load factor of at most 50%.
+  uint32 size = 1;
+  while (size < frames.size() * 2) size <<= 1;
+  directory_.resize(size);
+  for (Bucket &b : directory_) b.frame = nullptr;
+  directory_mask_ = size - 1;
+
+  // Build slot tables for frames.
+  for (const FrameDatum *frame : frames) Add(frame);
+}
+
+void SlotIndex::Add(const FrameDatum *frame) {
+  // Allocate slot table for frame with a load factor of at most 50%.
+  std::vector<Word> names;
+  for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+    names.push_back(s->name.raw());
+  }
+  std::sort(names.begin(), names.end());
+  int distinct = std::unique(names.begin(), names.end()) - names.begin();
+  uint32 size = 1;
+  while (size < distinct * 2) size <<= 1;
+  uint32 offset = entries_.size();
+  uint32 mask = size - 1;
+  entries_.resize(offset + size);
+  Entry *table = entries_.data() + offset;
+  for (uint32 i = 0; i < size; ++i) table[i].position = -1;
+
+  // Insert position of first slot for each name.
+  const Slot *begin = frame->begin();
+  for (const Slot *s = begin; s < frame->end(); ++s) {
+    uint32 i = HashName(s->name) & mask;
+    while (table[i].position != -1 && table[i].name != s->name.raw()) {
+      i = (i + 1) & mask;
+    }
+    if (table[i].position == -1) {
+      table[i].name = s->name.raw();
+      table[i].position = s - begin;
+    }
+  }
 
+  // Add frame to directory.
+  uint32 b = HashFrame(frame) & directory_mask_;
+  while (directory_[b].frame != nullptr) b = (b + 1) & directory_mask_;
+  directory_[b].frame = frame;
+  directory_[b].offset = offset;
+  directory_[b].mask = mask;
+  num_frames_++;
+}
+
+int SlotIndex::Find(const FrameDatum *frame, Handle name) const {
+  // All frames with at least threshold slots are indexed.
+  if (frame->slots() < threshold_) return kNotIndexed;
+
+  // Find slot table for frame in directory.
+  uint32 b = HashFrame(frame) & directory_mask_;
+  for (;;) {
+    const Bucket &bucket = directory_[b];
+    if (bucket.frame == frame) break;
+    if (bucket.frame == nullptr) return kNotIndexed;
+    b = (b + 1) & directory_mask_;
+  }
+
+  // Find first slot with name.
+  const Bucket &bucket = directory_[b];
+  const Entry *table = entries_.data() + bucket.offset;
+  uint32 i = HashName(name) & bucket.mask;
+  for (;;) {
+    const Entry &e = table[i];
+    if (e.position == -1) return -1;
+    if (e.name == name.raw()) return e.position;
+    i = (i + 1) & bucket.mask;
+  }
+}
+
+}  // namespace sling
@@ -20,12 +20,14 @@
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "sling/base/bitcast.h"
 #include "sling/base/logging.h"
 #include "sling/base/macros.h"
 #include "sling/base/types.h"
 #include "sling/string/text.h"
+#include "sling/util/memory.h"
 
 namespace sling {
 
@@ -387,6 +389,7 @@ struct HandleHash {
 // Forward declarations.
 class Store;
 class Snapshot;
+class Heap;
 struct StringDatum;
 struct FrameDatum;
 struct SymbolDatum;
@@ -651,6 +654,82 @@ struct Slot {
   Handle value;  // slot value
 };
 
+// Slot index for fast lookup of named slots in large frames in frozen stores.
+// Each indexed frame has a small open-addressed hash table that maps slot
+// names to the position of the first slot with that name in the frame. Frames
+// in frozen stores never move, so the tables for the indexed frames are found
+// through a directory keyed by frame address. The slot index is owned by the
+// frozen store and lives as long as the frames it indexes.
+class SlotIndex {
+ public:
+  // Frames with fewer slots than this are never indexed.
+  static const int kMinSlots = 16;
+
+  // Return value from Find() for frames that are not indexed.
+  static const int kNotIndexed = -2;
+
+  // Build slot index for all frames in the heaps that have at least threshold
+  // slots.
+  SlotIndex(const Heap *heaps, int threshold);
+
+  // Find the position of the first slot with the name in the frame. Returns -1
+  // if the frame does not have a slot with this name, or kNotIndexed if the
+  // frame is not in the slot index.
+  int Find(const FrameDatum *frame, Handle name) const;
+
+  // Number of indexed frames.
+  int num_frames() const { return num_frames_; }
+
+  // Number of bytes used by slot index.
+  int64 memory() const {
+    return directory_.size() * sizeof(Bucket) + entries_.size() * sizeof(Entry);
+  }
+
+ private:
+  // Entry in slot table for frame. Unused entries have position -1.
+  struct Entry {
+    Word name;
+    uint32 position;
+  };
+
+  // Directory bucket with slot table for frame. The table has mask + 1 entries
+  // starting at offset in the entry array.
+  struct Bucket {
+    const FrameDatum *frame;
+    uint32 offset;
+    uint32 mask;
+  };
+
+  // Add slot table for frame to index.
+  void Add(const FrameDatum *frame);
+
+  // Hash functions for frames and slot names.
+  static uint32 HashFrame(const FrameDatum *frame) {
+    uint64 h = reinterpret_cast<uint64>(frame) * 0x9E3779B97F4A7C15ULL;
+    return h >> 32;
+  }
+  static uint32 HashName(Handle name) {
+    uint32 h = name.raw() * 0x9E3779B1U;
+    return h ^ (h >> 16);
+  }
+
+  // Directory of indexed frames. This is an open-addressed hash table with a
+  // power-of-two number of buckets. Unused buckets have a null frame.
+  std::vector<Bucket> directory_;
+  uint32 directory_mask_ = 0;
+
+  // Slot tables for all indexed frames.
+  std::vector<Entry> entries_;
+
+  // Number of indexed frames.
+  int num_frames_ = 0;
+
+  // Minimum number of slots for indexed frames.
+  int threshold_;
+
+  DISALLOW_COPY_AND_ASSIGN(SlotIndex);
+};
+
 // A frame consists of an array of slots with names and values.
 struct FrameDatum : public Datum {
   // Range of slots for object.
@@ -670,8 +749,20 @@ struct FrameDatum : public Datum {
   // Returns the number of slots in the frame.
   int slots() const { return size() / sizeof(Slot); }
 
-  // Finds first value of named slot.
-  Handle get(Handle name) const {
+  // Finds the position of the first slot with name using the slot index for
+  // the store of the frame. Returns SlotIndex::kNotIndexed if there is no slot
+  // index or the frame is not indexed.
+  int find(Handle name, const SlotIndex *index) const {
+    if (index == nullptr) return SlotIndex::kNotIndexed;
+    return index->Find(this, name);
+  }
+
+  // Finds first value of named slot. The slot index is optional.
+  Handle get(Handle name, const SlotIndex *index = nullptr) const {
+    int pos = find(name, index);
+    if (pos != SlotIndex::kNotIndexed) {
+      return pos == -1 ? Handle::nil() : begin()[pos].value;
+    }
     for (const Slot *slot = begin(); slot < end(); ++slot) {
       if (slot->name == name) return slot->value;
     }
@@ -679,7 +770,9 @@ struct FrameDatum : public Datum {
   }
 
   // Checks if frame has named slot.
-  bool has(Handle name) const {
+  bool has(Handle name, const SlotIndex *index = nullptr) const {
+    int pos = find(name, index);
+    if (pos != SlotIndex::kNotIndexed) return pos != -1;
     for (const Slot *slot = begin(); slot < end(); ++slot) {
       if (slot->name == name) return true;
     }
@@ -687,8 +780,15 @@ struct FrameDatum : public Datum {
   }
 
   // Checks if frame has a slot with name and value.
-  bool has(Handle name, Handle value) const {
-    for (const Slot *slot = begin(); slot < end(); ++slot) {
+  bool has(Handle name, Handle value,
+           const SlotIndex *index = nullptr) const {
+    const Slot *start = begin();
+    int pos = find(name, index);
+    if (pos != SlotIndex::kNotIndexed) {
+      if (pos == -1) return false;
+      start += pos;
+    }
+    for (const Slot *slot = start; slot < end(); ++slot) {
       if (slot->name == name && slot->value == value) return true;
     }
     return false;
@@ -984,6 +1084,18 @@ struct MemoryUsage {
 class Heap : public Space<Datum> {
  public:
   Heap() : next_(nullptr), frozen_(false) {}
+  ~Heap();
+
+  // Allocates memory for the heap with an anonymous memory mapping instead of
+  // malloc(), so it can be backed by huge pages and placed on NUMA nodes. The
+  // size of a mapped heap cannot be changed with reserve().
+  void Map(size_t bytes, bool huge_pages, int placement);
+
+  // Makes the unused part of the heap unavailable for allocation.
+  void Trim() { limit_ = end_; }
+
+  // Returns true if the heap memory is mapped.
+  bool mapped() const { return mapped_size_ != 0; }
 
   // Next heap in store.
   Heap *next() const { return next_; }
@@ -1001,6 +1113,10 @@ class Heap : public Space<Datum> {
   // A heap can be frozen making the objects in the heap read-only.
   bool frozen_;
 
+  // Size of memory mapping for mapped heap, or zero if the heap memory has
+  // been allocated with malloc().
+  size_t mapped_size_ = 0;
+
   DISALLOW_COPY_AND_ASSIGN(Heap);
 };
 
@@ -1022,6 +1138,9 @@ class Store {
       string_buckets = 1 << 20;
       expansion_free_fraction = 20;
       symbol_rebinding = false;
+      slot_index_threshold = 0;
+      huge_pages = false;
+      numa_placement = NUMA_DEFAULT;
       local = this;
     }
 
@@ -1046,6 +1165,20 @@ class Store {
     // Allow symbols to be bound.
     bool symbol_rebinding;
 
+    // Minimum number of slots for frames to be indexed in the slot index when
+    // the store is frozen. If this is zero, the threshold is set with
+    // --store_slot_index, and the slot index is disabled if that is zero too.
+    int slot_index_threshold;
+
+    // Back large heaps in global stores with transparent huge pages. This can
+    // also be enabled for all stores with --store_huge_pages.
+    bool huge_pages;
+
+    // NUMA placement of large heaps in global stores. This can either be
+    // NUMA_DEFAULT, NUMA_INTERLEAVE, or a node number for binding the heaps to
+    // a node. The default placement is set with --store_numa_placement.
+    int numa_placement;
+
     // Options for local store.
     Options *local;
   };
@@ -1172,6 +1305,18 @@ class Store {
   // Returns true if the store has been frozen.
   bool frozen() const { return frozen_; }
 
+  // Slot index for large frames, or null if the store has no slot index.
+  const SlotIndex *slot_index() const { return slot_index_; }
+
+  // Slot index for looking up slots in frame in this store or its global
+  // store, or null if the frame is not in a store with a slot index.
+  const SlotIndex *slot_index(Handle handle) const {
+    if (handle.IsGlobalRef() && globals_ != nullptr) {
+      return globals_->slot_index_;
+    }
+    return slot_index_;
+  }
+
   // Global store for this store, or null if this is a global store.
   const Store *globals() const { return globals_; }
 
@@ -1335,6 +1480,11 @@ class Store {
   // Allocates separate heap for symbol table.
   void AllocateSymbolHeap();
 
+  // Allocates memory for a new heap. Large heaps in global stores are mapped
+  // and placed according to the huge page and NUMA options. Other heaps are
+  // allocated with malloc() and are never placed.
+  void AllocateHeap(Heap *heap, size_t size);
+
   // Iterator for enumerating all objects in the heaps. This will also iterate
   // over invalidated object in the heaps. The iterator will be invalidated by
   // any GCs. Please use this with care. This is primarily intended for
@@ -1470,6 +1620,9 @@ class Store {
   // store. When a store is frozen, it can no longer be changed.
   bool frozen_ = false;
 
+  // Slot index for large frames in frozen store.
+  SlotIndex *slot_index_ = nullptr;
+
   // Memory regions for storing object data. The heaps are linked together in
   // a linked list. The heaps are filled one by one until all the heaps are
   // full. Then the heaps needs to be garbage collected and if there is still
@@ -1525,8 +1678,9 @@ class Store {
   // Default configuration options.
   static const Options kDefaultOptions;
 
-  // Allow internal access for snapshots.
+  // Allow internal access for snapshots and parallel decoding.
   friend class Snapshot;
+  friend class ParallelDecoder;
 };
 
 // Utility class for GC locking in store.
@@ -39,8 +39,19 @@ enum WireSpecial {
   WIRE_INDEX    = 6,  // index value, followed by varint32 encoded integer
   WIRE_RESOLVE  = 7,  // resolve link, followed by slots and replacement index
   WIRE_QSTRING  = 8,  // qstring, followed by length, data, and qualifier
+  WIRE_SEGMENT  = 9,  // segment, followed by size, object count, and data
+  WIRE_PRELUDE  = 10, // start of segment prelude
 };
 
+// Segments are independently decodable parts of the encoding. The objects
+// before the first segment make up the prelude, and the references in each
+// segment are relative to the references in the prelude, i.e. the reference
+// table is reset to the prelude at the start of each segment. The segment
+// header has the size of the segment data in bytes and the number of new
+// objects in the segment. Segmented encodings start with a prelude marker so
+// the decoder knows that the links in the prelude can be replaced by frames in
+// the segments.
+
 // The binary marker (i.e. a nul character) is used for prefixing serialized
 // SLING objects to indicate that they are binary encoded. The textual encoding
 // will never contain a nul character. In binary encoding, a nul character is
@@ -15,6 +15,8 @@
 #include "sling/myelin/aot-linker.h"
 
 #include "sling/file/file.h"
+#include "sling/myelin/code-cache.h"
+#include "sling/util/fingerprint.h"
 
 namespace sling {
 namespace myelin {
@@ -44,6 +46,12 @@ AOTLinker::AOTLinker(const Options &options) : options_(options) {
           << "  return buffer;\n}\n";
 }
 
+void AOTLinker::BeginNetwork(Network *network) {
+  // The generated code also depends on the compiler options.
+  options_.model_hash = FingerprintCat(options_.model_hash,
+                                       FingerprintOptions(network->options()));
+}
+
 void AOTLinker::BeginCell(Cell *cell) {
   // Align code buffer before generating new cell computation function.
   code_.Align(64);
@@ -232,6 +240,7 @@ void AOTLinker::Link() {
   // Write epilogue for header file.
   auto *s = options_.external_data ? &bss_ : &rodata_;
   int size = s->offset();
+  WriteFingerprints();
   header_ << "extern char data[" << size << "];\n\n"
           << "}  // namespace " + options_.ns + "\n";
 
@@ -246,6 +255,54 @@ void AOTLinker::Link() {
   elf_.Update();
 }
 
+void AOTLinker::WriteFingerprints() {
+  // CPU features that can be checked at run time. The remaining features are
+  // either implied by these or not used for code generation.
+  static const struct {
+    jit::CpuFeature feature;
+    const char *name;
+  } checks[] = {
+    {jit::MMX, "mmx"},
+    {jit::SSE, "sse"},
+    {jit::SSE2, "sse2"},
+    {jit::SSE3, "sse3"},
+    {jit::SSSE3, "ssse3"},
+    {jit::SSE4_1, "sse4.1"},
+    {jit::SSE4_2, "sse4.2"},
+    {jit::F16C, "f16c"},
+    {jit::AVX, "avx"},
+    {jit::AVX2, "avx2"},
+    {jit::AVX512F, "avx512f"},
+    {jit::FMA3, "fma"},
+    {jit::BMI1, "bmi"},
+    {jit::BMI2, "bmi2"},
+    {jit::LZCNT, "lzcnt"},
+    {jit::POPCNT, "popcnt"},
+  };
+
+  // The generated code is only valid for the model and compiler options it
+  // was compiled with and for CPUs that support the features enabled at
+  // compile time.
+  unsigned features = jit::CPU::SupportedFeatures();
+  header_ << "// Fingerprints for source model, compiler options, and CPU "
+          << "features used for generating code.\n"
+          << "const uint64_t model_hash = 0x" << std::hex
+          << options_.model_hash << "ULL;\n"
+          << "const unsigned cpu_features = 0x" << features << ";\n\n"
+          << std::dec;
+
+  // Function for checking that the CPU supports the generated code.
+  header_ << "// Check if CPU supports the generated code.\n"
+          << "inline bool cpu_supported() {\n"
+          << "  return true";
+  for (auto &check : checks) {
+    if (features & (1u << check.feature)) {
+      header_ << " &&\n    __builtin_cpu_supports(\"" << check.name << "\")";
+    }
+  }
+  header_ << ";\n}\n\n";
+}
+
 void AOTLinker::Write(const string &filename) {
   elf_.Write(filename.c_str());
 }
@@ -40,12 +40,14 @@ class AOTLinker : public Linker {
     bool external_data = false;    // parameter data stored in external file
     bool uppercase_names = false;  // uppercase class names
     string ns;                     // C++ name space for generated code
+    uint64 model_hash = 0;         // fingerprint of source model
   };
 
   // Initialize ahead-of-time linker from linker options.
   AOTLinker(const Options &options);
 
   // Linker interface.
+  void BeginNetwork(Network *network) override;
   void BeginCell(Cell *cell) override;
   void EndCell(Cell *cell,
                jit::CodeGenerator *generator,
@@ -78,6 +80,9 @@ class AOTLinker : public Linker {
   // Return mangled symbol for name.
   string Mangled(const string &name, bool func);
 
+  // Write model and CPU feature fingerprints and CPU check to header file.
+  void WriteFingerprints();
+
   // Linker options.
   Options options_;
 
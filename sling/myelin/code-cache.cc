@@ -0,0 +1,894 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/myelin/code-cache.h"
+
+#include <elf.h>
+#include <link.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/string/printf.h"
+#include "sling/util/fingerprint.h"
+#include "third_party/jit/cpu.h"
+
+namespace sling {
+namespace myelin {
+
+// Cache file format.
+static const uint32 kCacheMagic = 0x54494a4d;  // MJIT
+static const uint32 kFlowMagic = 0x4f4c464d;   // MFLO
+static const uint32 kCacheVersion = 2;
+
+// Data source for variables in cached flow. Other values refer to the data
+// for a variable in the flow before analysis.
+static const uint32 kNoData = 0xffffffff;
+static const uint32 kStoredData = 0xfffffffe;
+
+namespace {
+
+// Loaded module (main program or shared object).
+struct Module {
+  string name;          // module file name (empty for main program)
+  uintptr_t base = 0;   // load address of module
+  string identity;      // build id or file size and modification time
+};
+
+// Search for module containing address or with name.
+struct ModuleSearch {
+  const void *address = nullptr;
+  const string *name = nullptr;
+  Module *module = nullptr;
+  bool found = false;
+};
+
+// Get identity for module from its build id note. Falls back to the size and
+// modification time of the module file if it has no build id.
+string ModuleIdentity(struct dl_phdr_info *info) {
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_NOTE) continue;
+    const char *note = reinterpret_cast<const char *>(
+        info->dlpi_addr + phdr.p_vaddr);
+    const char *end = note + phdr.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end) {
+      auto *nhdr = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      const char *name = note + sizeof(ElfW(Nhdr));
+      const uint8 *desc = reinterpret_cast<const uint8 *>(
+          name + ((nhdr->n_namesz + 3) & ~3));
+      if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          memcmp(name, "GNU", 4) == 0) {
+        string id = "build-id:";
+        for (int j = 0; j < nhdr->n_descsz; ++j) {
+          StringAppendF(&id, "%02x", desc[j]);
+        }
+        return id;
+      }
+      note = reinterpret_cast<const char *>(desc) +
+             ((nhdr->n_descsz + 3) & ~3);
+    }
+  }
+
+  const char *filename = info->dlpi_name;
+  if (*filename == 0) filename = "/proc/self/exe";
+  FileStat stat;
+  if (!File::Stat(filename, &stat).ok()) return "";
+  return StringPrintf("file:%llu:%llu",
+                      static_cast<unsigned long long>(stat.size),
+                      static_cast<unsigned long long>(stat.mtime));
+}
+
+// Callback for module search.
+int CheckModule(struct dl_phdr_info *info, size_t size, void *data) {
+  ModuleSearch *search = static_cast<ModuleSearch *>(data);
+  bool match = false;
+  if (search->name != nullptr) {
+    match = *search->name == info->dlpi_name;
+  } else {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(search->address);
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+      const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+      if (phdr.p_type != PT_LOAD) continue;
+      uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+      if (addr >= start && addr < start + phdr.p_memsz) {
+        match = true;
+        break;
+      }
+    }
+  }
+  if (!match) return 0;
+
+  search->module->name = info->dlpi_name;
+  search->module->base = info->dlpi_addr;
+  search->module->identity = ModuleIdentity(info);
+  search->found = true;
+  return 1;
+}
+
+// Find module containing address.
+bool FindModule(const void *address, Module *module) {
+  ModuleSearch search;
+  search.address = address;
+  search.module = module;
+  dl_iterate_phdr(CheckModule, &search);
+  return search.found;
+}
+
+// Find module by name.
+bool FindModule(const string &name, Module *module) {
+  ModuleSearch search;
+  search.name = &name;
+  search.module = module;
+  dl_iterate_phdr(CheckModule, &search);
+  return search.found;
+}
+
+// Output buffer for cache file.
+class CacheWriter {
+ public:
+  void Write(const void *data, size_t size) {
+    buffer_.append(static_cast<const char *>(data), size);
+  }
+  void WriteInt(uint32 n) { Write(&n, sizeof(uint32)); }
+  void WriteInt64(uint64 n) { Write(&n, sizeof(uint64)); }
+  void WriteString(const string &str) {
+    WriteInt(str.size());
+    buffer_.append(str);
+  }
+
+  const string &buffer() const { return buffer_; }
+
+ private:
+  string buffer_;
+};
+
+// Input parser for cache file.
+class CacheReader {
+ public:
+  CacheReader(const string &data)
+      : ptr_(data.data()), end_(data.data() + data.size()) {}
+
+  bool Read(void *data, size_t size) {
+    if (end_ - ptr_ < size) return false;
+    memcpy(data, ptr_, size);
+    ptr_ += size;
+    return true;
+  }
+  bool ReadInt(uint32 *n) { return Read(n, sizeof(uint32)); }
+  bool ReadInt64(uint64 *n) { return Read(n, sizeof(uint64)); }
+  bool ReadIndex(uint32 *n, uint32 limit) { return ReadInt(n) && *n < limit; }
+  bool ReadString(string *str) {
+    uint32 size;
+    if (!ReadInt(&size) || end_ - ptr_ < size) return false;
+    str->assign(ptr_, size);
+    ptr_ += size;
+    return true;
+  }
+
+  bool done() const { return ptr_ == end_; }
+  const char *current() const { return ptr_; }
+  size_t remaining() const { return end_ - ptr_; }
+
+ private:
+  const char *ptr_;
+  const char *end_;
+};
+
+// Write attribute list to cache file.
+void WriteAttributes(CacheWriter *writer, const Attributes &attrs) {
+  writer->WriteInt(attrs.size());
+  for (const Attribute &attr : attrs) {
+    writer->WriteString(attr.name);
+    writer->WriteString(attr.value);
+  }
+}
+
+// Read attribute list from cache file.
+void ReadAttributes(CacheReader *reader, Attributes *attrs) {
+  uint32 num_attrs;
+  CHECK(reader->ReadInt(&num_attrs));
+  for (int i = 0; i < num_attrs; ++i) {
+    string name, value;
+    CHECK(reader->ReadString(&name));
+    CHECK(reader->ReadString(&value));
+    attrs->SetAttr(name, value);
+  }
+}
+
+}  // namespace
+
+uint64 FingerprintOptions(const Options &options) {
+  string str = StringPrintf(
+      "order=%d debug=%d profiling=%d external_profiler=%d "
+      "global_profiler=%d dynamic_allocation=%d shared_tensors=%d "
+      "sync_steps=%d fast_math=%d aot=%d pic=%d sparse_threshold=%d "
+      "huge_pages=%d flops=%d",
+      options.parameter_element_order, options.debug, options.profiling,
+      options.external_profiler, options.global_profiler,
+      options.dynamic_allocation, options.shared_tensors, options.sync_steps,
+      options.fast_math, options.aot, options.pic, options.sparse_threshold,
+      options.huge_pages, options.flops_address != nullptr);
+  return Fingerprint(str.data(), str.size());
+}
+
+CodeCache::CodeCache(const string &dir, const Flow &flow) : dir_(dir) {
+  // Compute fingerprint for flow. Data loaded from a flow file is identified
+  // by the file and the offset of the data in the file, so only data that has
+  // not been loaded from a file needs to be fingerprinted.
+  string str;
+  uint64 fp = 0;
+  if (!flow.source().empty()) str.append("source " + flow.source() + "\n");
+  auto fingerprint_data = [&](const char *data, uint64 size) {
+    if (data == nullptr) return;
+    int64 offset = flow.SourceOffset(data);
+    if (offset != -1) {
+      StringAppendF(&str, " @%lld", static_cast<long long>(offset));
+    } else {
+      fp = FingerprintCat(fp, Fingerprint(data, size));
+    }
+  };
+  for (int i = 0; i < flow.vars().size(); ++i) {
+    const Flow::Variable *var = flow.vars()[i];
+    StringAppendF(&str, "var %s %d %d %s %d %llu",
+                  var->name.c_str(), var->flags, var->type,
+                  var->shape.ToString().c_str(), var->init,
+                  static_cast<unsigned long long>(var->size));
+    for (const string &alias : var->aliases) str.append(" " + alias);
+    for (const Attribute &attr : *var) {
+      str.append(" " + attr.name + "=" + attr.value);
+    }
+    fingerprint_data(var->data, var->size);
+    str.push_back('\n');
+    if (var->data != nullptr) {
+      raw_data_.push_back({var->data, var->size, static_cast<uint32>(i)});
+    }
+  }
+  std::sort(raw_data_.begin(), raw_data_.end(),
+            [](const RawData &a, const RawData &b) { return a.data < b.data; });
+  for (const Flow::Operation *op : flow.ops()) {
+    StringAppendF(&str, "op %s %s %d %d",
+                  op->name.c_str(), op->type.c_str(), op->flags, op->task);
+    for (const Flow::Variable *input : op->inputs) {
+      str.append(" in:" + input->name);
+    }
+    for (const Flow::Variable *output : op->outputs) {
+      str.append(" out:" + output->name);
+    }
+    for (const Attribute &attr : *op) {
+      str.append(" " + attr.name + "=" + attr.value);
+    }
+    str.push_back('\n');
+  }
+  for (const Flow::Function *func : flow.funcs()) {
+    StringAppendF(&str, "func %s %d", func->name.c_str(), func->flags);
+    for (const Flow::Operation *op : func->ops) str.append(" " + op->name);
+    for (const Flow::Variable *var : func->unused) str.append(" " + var->name);
+    str.push_back('\n');
+  }
+  for (const Flow::Connector *cnx : flow.cnxs()) {
+    StringAppendF(&str, "cnx %s", cnx->name.c_str());
+    for (const Flow::Variable *var : cnx->links) str.append(" " + var->name);
+    str.push_back('\n');
+  }
+  for (const Flow::Blob *blob : flow.blobs()) {
+    StringAppendF(&str, "blob %s %s %d %llu", blob->name.c_str(),
+                  blob->type.c_str(), blob->flags,
+                  static_cast<unsigned long long>(blob->size));
+    for (const Attribute &attr : *blob) {
+      str.append(" " + attr.name + "=" + attr.value);
+    }
+    fingerprint_data(blob->data, blob->size);
+    str.push_back('\n');
+  }
+  fp = FingerprintCat(fp, Fingerprint(str.data(), str.size()));
+
+  // The analyzed flow and the generated code depend on the CPU features used
+  // for code generation and the binary with the kernels.
+  Module self;
+  CHECK(FindModule(reinterpret_cast<void *>(&FingerprintOptions), &self));
+  string cpu = StringPrintf("cpu=%x cacheline=%u vzero=%d",
+                            jit::CPU::SupportedFeatures(),
+                            jit::CPU::CacheLineSize(),
+                            jit::CPU::VZeroNeeded());
+  fp = FingerprintCat(fp, Fingerprint(cpu.data(), cpu.size()));
+  fp = FingerprintCat(fp, Fingerprint(self.identity.data(),
+                                      self.identity.size()));
+  flow_fingerprint_ = FingerprintCat(fp, kCacheVersion);
+  flow_filename_ = StringPrintf("%s/%016llx.flow", dir_.c_str(),
+      static_cast<unsigned long long>(flow_fingerprint_));
+}
+
+bool CodeCache::LoadFlow(Flow *flow) {
+  string data;
+  if (!File::ReadContents(flow_filename_, &data).ok()) return false;
+
+  // Check that the flow cache file is intact before replacing the flow.
+  CacheReader reader(data);
+  uint32 magic, version;
+  uint64 checksum;
+  if (!reader.ReadInt(&magic) || magic != kFlowMagic ||
+      !reader.ReadInt(&version) || version != kCacheVersion ||
+      !reader.ReadInt64(&checksum) ||
+      checksum != Fingerprint(reader.current(), reader.remaining())) {
+    LOG(INFO) << "Invalidating flow cache file " << flow_filename_;
+    return false;
+  }
+
+  // Replace the flow with the analyzed flow. The data for constants refers
+  // to the data for variables in the flow before analysis, which is not
+  // released when the flow is cleared.
+  std::vector<Flow::Variable *> raw = flow->vars();
+  std::vector<const char *> rawdata(raw.size());
+  for (int i = 0; i < raw.size(); ++i) rawdata[i] = raw[i]->data;
+  flow->Clear();
+
+  // Read variables.
+  uint32 num_vars;
+  CHECK(reader.ReadInt(&num_vars));
+  std::vector<Flow::Variable *> vars(num_vars);
+  for (int i = 0; i < num_vars; ++i) {
+    uint32 flags, type, rank, init, source;
+    string name;
+    CHECK(reader.ReadInt(&flags));
+    CHECK(reader.ReadString(&name));
+    CHECK(reader.ReadInt(&type));
+    CHECK(reader.ReadInt(&rank));
+    Shape shape;
+    for (int d = 0; d < rank; ++d) {
+      uint32 dim;
+      CHECK(reader.ReadInt(&dim));
+      shape.add(dim);
+    }
+    Flow::Variable *var = flow->AddVariable(name, static_cast<Type>(type),
+                                            shape);
+    var->flags = flags;
+    ReadAttributes(&reader, var);
+    uint32 num_aliases;
+    CHECK(reader.ReadInt(&num_aliases));
+    var->aliases.resize(num_aliases);
+    for (string &alias : var->aliases) CHECK(reader.ReadString(&alias));
+    CHECK(reader.ReadInt(&init));
+    var->init = static_cast<Flow::Variable::Initialization>(init);
+    CHECK(reader.ReadInt64(&var->size));
+    CHECK(reader.ReadInt(&source));
+    if (source == kNoData) {
+      var->data = nullptr;
+    } else if (source == kStoredData) {
+      var->data = flow->AllocateMemory(var->size);
+      CHECK(reader.Read(var->data, var->size));
+    } else {
+      uint64 offset;
+      CHECK_LT(source, rawdata.size());
+      CHECK(reader.ReadInt64(&offset));
+      var->data = const_cast<char *>(rawdata[source]) + offset;
+    }
+    vars[i] = var;
+  }
+
+  // Read functions.
+  uint32 num_funcs;
+  CHECK(reader.ReadInt(&num_funcs));
+  std::vector<Flow::Function *> funcs(num_funcs);
+  for (int i = 0; i < num_funcs; ++i) {
+    string name;
+    CHECK(reader.ReadString(&name));
+    funcs[i] = flow->AddFunction(name);
+    CHECK(reader.ReadInt(&funcs[i]->flags));
+  }
+
+  // Read operations.
+  uint32 num_ops;
+  CHECK(reader.ReadInt(&num_ops));
+  std::vector<Flow::Operation *> ops(num_ops);
+  for (int i = 0; i < num_ops; ++i) {
+    string name, type;
+    CHECK(reader.ReadString(&name));
+    CHECK(reader.ReadString(&type));
+    Flow::Operation *op = flow->AddOperation(name, type);
+    CHECK(reader.ReadInt(&op->flags));
+    uint32 task, priority, num_inputs, num_outputs;
+    CHECK(reader.ReadInt(&task));
+    CHECK(reader.ReadInt(&priority));
+    op->task = task;
+    op->priority = priority;
+    CHECK(reader.ReadInt(&num_inputs));
+    for (int j = 0; j < num_inputs; ++j) {
+      uint32 input;
+      CHECK(reader.ReadIndex(&input, num_vars));
+      op->AddInput(vars[input]);
+    }
+    CHECK(reader.ReadInt(&num_outputs));
+    for (int j = 0; j < num_outputs; ++j) {
+      uint32 output;
+      CHECK(reader.ReadIndex(&output, num_vars));
+      op->AddOutput(vars[output]);
+    }
+    ReadAttributes(&reader, op);
+    ops[i] = op;
+  }
+
+  // Read the order of consumers for each variable.
+  for (Flow::Variable *var : vars) {
+    for (Flow::Operation *&consumer : var->consumers) {
+      uint32 index;
+      CHECK(reader.ReadIndex(&index, num_ops));
+      consumer = ops[index];
+    }
+  }
+
+  // Read operations and unused variables for functions.
+  for (Flow::Function *func : funcs) {
+    uint32 num_func_ops, num_unused;
+    CHECK(reader.ReadInt(&num_func_ops));
+    for (int j = 0; j < num_func_ops; ++j) {
+      uint32 index;
+      CHECK(reader.ReadIndex(&index, num_ops));
+      func->AddOperation(ops[index]);
+    }
+    CHECK(reader.ReadInt(&num_unused));
+    for (int j = 0; j < num_unused; ++j) {
+      uint32 index;
+      CHECK(reader.ReadIndex(&index, num_vars));
+      func->unused.push_back(vars[index]);
+    }
+  }
+
+  // Read connectors.
+  uint32 num_cnxs;
+  CHECK(reader.ReadInt(&num_cnxs));
+  for (int i = 0; i < num_cnxs; ++i) {
+    string name;
+    uint32 num_links;
+    CHECK(reader.ReadString(&name));
+    Flow::Connector *cnx = flow->AddConnector(name);
+    CHECK(reader.ReadInt(&cnx->flags));
+    CHECK(reader.ReadInt(&num_links));
+    for (int j = 0; j < num_links; ++j) {
+      uint32 index;
+      CHECK(reader.ReadIndex(&index, num_vars));
+      cnx->AddLink(vars[index]);
+    }
+  }
+  CHECK(reader.done());
+
+  VLOG(3) << "Loaded analyzed flow from " << flow_filename_;
+  return true;
+}
+
+void CodeCache::SaveFlow(const Flow &flow) {
+  // Index variables and operations.
+  std::unordered_map<const Flow::Variable *, uint32> varidx;
+  std::unordered_map<const Flow::Operation *, uint32> opidx;
+  for (int i = 0; i < flow.vars().size(); ++i) varidx[flow.vars()[i]] = i;
+  for (int i = 0; i < flow.ops().size(); ++i) opidx[flow.ops()[i]] = i;
+
+  // Write variables. Data for constants that is part of the data for a
+  // variable in the flow before analysis is stored as a reference to that
+  // variable. Only data computed by the analysis is stored in the cache file.
+  CacheWriter writer;
+  writer.WriteInt(flow.vars().size());
+  for (const Flow::Variable *var : flow.vars()) {
+    writer.WriteInt(var->flags);
+    writer.WriteString(var->name);
+    writer.WriteInt(var->type);
+    writer.WriteInt(var->shape.rank());
+    for (int d = 0; d < var->shape.rank(); ++d) {
+      writer.WriteInt(var->shape.dim(d));
+    }
+    WriteAttributes(&writer, *var);
+    writer.WriteInt(var->aliases.size());
+    for (const string &alias : var->aliases) writer.WriteString(alias);
+    writer.WriteInt(var->init);
+    writer.WriteInt64(var->size);
+    if (var->data == nullptr) {
+      writer.WriteInt(kNoData);
+      continue;
+    }
+    auto f = std::upper_bound(raw_data_.begin(), raw_data_.end(), var->data,
+        [](const char *data, const RawData &raw) { return data < raw.data; });
+    if (f != raw_data_.begin() &&
+        var->data + var->size <= (f - 1)->data + (f - 1)->size) {
+      writer.WriteInt((f - 1)->index);
+      writer.WriteInt64(var->data - (f - 1)->data);
+    } else {
+      writer.WriteInt(kStoredData);
+      writer.Write(var->data, var->size);
+    }
+  }
+
+  // Write functions.
+  writer.WriteInt(flow.funcs().size());
+  for (const Flow::Function *func : flow.funcs()) {
+    writer.WriteString(func->name);
+    writer.WriteInt(func->flags);
+  }
+
+  // Write operations.
+  writer.WriteInt(flow.ops().size());
+  for (const Flow::Operation *op : flow.ops()) {
+    writer.WriteString(op->name);
+    writer.WriteString(op->type);
+    writer.WriteInt(op->flags);
+    writer.WriteInt(op->task);
+    writer.WriteInt(op->priority);
+    writer.WriteInt(op->inputs.size());
+    for (const Flow::Variable *input : op->inputs) {
+      writer.WriteInt(varidx[input]);
+    }
+    writer.WriteInt(op->outputs.size());
+    for (const Flow::Variable *output : op->outputs) {
+      writer.WriteInt(varidx[output]);
+    }
+    WriteAttributes(&writer, *op);
+  }
+
+  // Write the order of consumers for each variable.
+  for (const Flow::Variable *var : flow.vars()) {
+    for (const Flow::Operation *consumer : var->consumers) {
+      writer.WriteInt(opidx[consumer]);
+    }
+  }
+
+  // Write operations and unused variables for functions.
+  for (const Flow::Function *func : flow.funcs()) {
+    writer.WriteInt(func->ops.size());
+    for (const Flow::Operation *op : func->ops) writer.WriteInt(opidx[op]);
+    writer.WriteInt(func->unused.size());
+    for (const Flow::Variable *var : func->unused) {
+      writer.WriteInt(varidx[var]);
+    }
+  }
+
+  // Write connectors.
+  writer.WriteInt(flow.cnxs().size());
+  for (const Flow::Connector *cnx : flow.cnxs()) {
+    writer.WriteString(cnx->name);
+    writer.WriteInt(cnx->flags);
+    writer.WriteInt(cnx->links.size());
+    for (const Flow::Variable *link : cnx->links) {
+      writer.WriteInt(varidx[link]);
+    }
+  }
+
+  // Write cache file header with checksum.
+  CacheWriter header;
+  const string &body = writer.buffer();
+  header.WriteInt(kFlowMagic);
+  header.WriteInt(kCacheVersion);
+  header.WriteInt64(Fingerprint(body.data(), body.size()));
+  header.Write(body.data(), body.size());
+
+  // Write cache file to temporary file and atomically replace the existing
+  // cache file.
+  File::Mkdir(dir_);
+  string tmpname = StringPrintf("%s.%d", flow_filename_.c_str(), getpid());
+  const string &data = header.buffer();
+  Status st = File::WriteContents(tmpname, data.data(), data.size());
+  if (st.ok()) st = File::Rename(tmpname, flow_filename_);
+  if (!st.ok()) {
+    LOG(WARNING) << "Error writing flow cache file " << flow_filename_ << ": "
+                 << st;
+    File::Delete(tmpname);
+  } else {
+    VLOG(3) << "Saved flow cache file " << flow_filename_;
+  }
+}
+
+void CodeCache::BeginNetwork(Network *network) {
+  network_ = network;
+
+  // The generated code depends on the flow, the CPU features, the binary, and
+  // the compiler options.
+  uint64 key = FingerprintCat(flow_fingerprint_,
+                              FingerprintOptions(network->options()));
+  filename_ = StringPrintf("%s/%016llx.jit", dir_.c_str(),
+                           static_cast<unsigned long long>(key));
+}
+
+void CodeCache::EndNetwork(Network *network) {
+  // Write cache file if new code was generated for the network.
+  if (generated_ == 0) return;
+  if (uncachable_) {
+    VLOG(3) << "Code for network cannot be cached";
+    return;
+  }
+  for (Cell *cell : network->cells()) {
+    if (cells_.find(cell->name()) == cells_.end()) return;
+  }
+  Write();
+}
+
+bool CodeCache::LoadCell(Cell *cell, jit::Code *code,
+                         std::vector<Step *> *noops) {
+  // Read cache file before loading the first cell. Tensor data has been
+  // allocated at this point, so the layout of the network is known.
+  if (!read_) {
+    read_ = true;
+    layout_ = LayoutFingerprint(network_);
+    if (!Read()) {
+      cells_.clear();
+      modules_.clear();
+    }
+  }
+
+  // Look up cell in cache.
+  auto f = cells_.find(cell->name());
+  if (f == cells_.end()) return false;
+  CellCode &cached = f->second;
+  if (cached.noops.size() != cell->steps().size()) return false;
+
+  // Relocate external references.
+  string buffer = cached.code;
+  for (const Relocation &reloc : cached.relocs) {
+    char *address = Relocate(reloc);
+    if (address == nullptr) {
+      LOG(WARNING) << "Cannot relocate " << reloc.target << " in cached code "
+                   << "for " << cell->name();
+      cells_.erase(f);
+      return false;
+    }
+    for (int32 ref : reloc.refs) {
+      if (ref < 0 || ref + sizeof(char *) > buffer.size()) {
+        cells_.erase(f);
+        return false;
+      }
+      memcpy(&buffer[ref], &address, sizeof(char *));
+    }
+  }
+
+  // Allocate executable code object for cell.
+  code->Allocate(&buffer[0], buffer.size());
+  for (int i = 0; i < cell->steps().size(); ++i) {
+    if (cached.noops[i]) noops->push_back(cell->steps()[i]);
+  }
+  loaded_++;
+  return true;
+}
+
+void CodeCache::EndCell(Cell *cell,
+                        jit::CodeGenerator *generator,
+                        jit::Code *code,
+                        int data_size) {
+  // Allocate executable code object in memory.
+  code->Allocate(generator);
+  generated_++;
+  if (uncachable_) return;
+
+  // Save code for cell with external references converted to relocations.
+  CellCode &cached = cells_[cell->name()];
+  cached.code.assign(reinterpret_cast<char *>(generator->begin()),
+                     generator->size());
+  cached.noops.clear();
+  for (Step *step : cell->steps()) cached.noops.push_back(step->noop());
+  cached.relocs.clear();
+  for (const jit::Extern &ext : generator->externs()) {
+    Relocation reloc;
+    if (!Resolve(ext.address, &reloc)) {
+      VLOG(3) << "Cannot relocate " << ext.symbol << " in " << cell->name();
+      uncachable_ = true;
+      return;
+    }
+    for (const jit::Extern::Ref &ref : ext.refs) {
+      if (ref.relative) {
+        uncachable_ = true;
+        return;
+      }
+      reloc.refs.push_back(ref.offset);
+      memset(&cached.code[ref.offset], 0, sizeof(uint64));
+    }
+    cached.relocs.push_back(reloc);
+  }
+}
+
+bool CodeCache::Resolve(const void *address, Relocation *reloc) {
+  // Try to resolve address to tensor object or global tensor data.
+  const char *addr = static_cast<const char *>(address);
+  for (Tensor *tensor : network_->globals()) {
+    if (address == tensor) {
+      reloc->type = RELOC_TENSOR_OBJECT;
+      reloc->target = tensor->name();
+      reloc->offset = 0;
+      return true;
+    }
+    if (tensor->shared() != nullptr || tensor->data() == nullptr) continue;
+    size_t size = std::max(tensor->space(), tensor->size());
+    if (addr >= tensor->data() && addr < tensor->data() + size) {
+      reloc->type = RELOC_TENSOR_DATA;
+      reloc->target = tensor->name();
+      reloc->offset = addr - tensor->data();
+      return true;
+    }
+  }
+  for (Tensor *tensor : network_->parameters()) {
+    if (address == tensor) {
+      reloc->type = RELOC_TENSOR_OBJECT;
+      reloc->target = tensor->name();
+      reloc->offset = 0;
+      return true;
+    }
+  }
+
+  // Try to resolve address to function or static data in loaded module.
+  Module module;
+  if (!FindModule(address, &module) || module.identity.empty()) return false;
+  reloc->type = RELOC_MODULE;
+  reloc->target = module.name;
+  reloc->offset = reinterpret_cast<uintptr_t>(address) - module.base;
+  modules_[module.name] = module.identity;
+  return true;
+}
+
+char *CodeCache::Relocate(const Relocation &reloc) {
+  switch (reloc.type) {
+    case RELOC_TENSOR_DATA: {
+      Tensor *tensor = network_->LookupParameter(reloc.target);
+      if (tensor == nullptr || tensor->data() == nullptr) return nullptr;
+      if (reloc.offset >= std::max(tensor->space(), tensor->size())) {
+        return nullptr;
+      }
+      return const_cast<char *>(tensor->data()) + reloc.offset;
+    }
+    case RELOC_TENSOR_OBJECT:
+      return reinterpret_cast<char *>(network_->LookupParameter(reloc.target));
+    case RELOC_MODULE: {
+      Module module;
+      if (!FindModule(reloc.target, &module)) return nullptr;
+      return reinterpret_cast<char *>(module.base + reloc.offset);
+    }
+  }
+  return nullptr;
+}
+
+bool CodeCache::Read() {
+  string data;
+  if (!File::ReadContents(filename_, &data).ok()) return false;
+
+  // Check that cache file matches network.
+  CacheReader reader(data);
+  uint32 magic, version;
+  uint64 layout;
+  if (!reader.ReadInt(&magic) || magic != kCacheMagic ||
+      !reader.ReadInt(&version) || version != kCacheVersion ||
+      !reader.ReadInt64(&layout) || layout != layout_) {
+    LOG(INFO) << "Invalidating code cache file " << filename_;
+    return false;
+  }
+
+  // Check that referenced modules have not changed.
+  uint32 num_modules;
+  if (!reader.ReadInt(&num_modules)) return false;
+  for (int i = 0; i < num_modules; ++i) {
+    string name, identity;
+    if (!reader.ReadString(&name) || !reader.ReadString(&identity)) {
+      return false;
+    }
+    Module module;
+    if (!FindModule(name, &module) || module.identity != identity) {
+      LOG(INFO) << "Invalidating code cache file " << filename_
+                << " for changed module " << name;
+      return false;
+    }
+    modules_[name] = identity;
+  }
+
+  // Read code for cells.
+  uint32 num_cells;
+  if (!reader.ReadInt(&num_cells)) return false;
+  for (int i = 0; i < num_cells; ++i) {
+    string name;
+    if (!reader.ReadString(&name)) return false;
+    CellCode &cached = cells_[name];
+    uint32 num_steps, num_relocs;
+    if (!reader.ReadString(&cached.code)) return false;
+    if (!reader.ReadInt(&num_steps)) return false;
+    for (int j = 0; j < num_steps; ++j) {
+      uint8 noop;
+      if (!reader.Read(&noop, 1)) return false;
+      cached.noops.push_back(noop != 0);
+    }
+    if (!reader.ReadInt(&num_relocs)) return false;
+    cached.relocs.resize(num_relocs);
+    for (Relocation &reloc : cached.relocs) {
+      uint32 type, num_refs;
+      if (!reader.ReadInt(&type)) return false;
+      reloc.type = type;
+      if (!reader.ReadString(&reloc.target)) return false;
+      if (!reader.ReadInt64(&reloc.offset)) return false;
+      if (!reader.ReadInt(&num_refs)) return false;
+      reloc.refs.resize(num_refs);
+      for (int32 &ref : reloc.refs) {
+        if (!reader.Read(&ref, sizeof(int32))) return false;
+      }
+    }
+  }
+
+  return reader.done();
+}
+
+void CodeCache::Write() {
+  CacheWriter writer;
+  writer.WriteInt(kCacheMagic);
+  writer.WriteInt(kCacheVersion);
+  writer.WriteInt64(layout_);
+  writer.WriteInt(modules_.size());
+  for (auto &it : modules_) {
+    writer.WriteString(it.first);
+    writer.WriteString(it.second);
+  }
+  writer.WriteInt(cells_.size());
+  for (auto &it : cells_) {
+    const CellCode &cached = it.second;
+    writer.WriteString(it.first);
+    writer.WriteString(cached.code);
+    writer.WriteInt(cached.noops.size());
+    for (bool noop : cached.noops) {
+      uint8 flag = noop;
+      writer.Write(&flag, 1);
+    }
+    writer.WriteInt(cached.relocs.size());
+    for (const Relocation &reloc : cached.relocs) {
+      writer.WriteInt(reloc.type);
+      writer.WriteString(reloc.target);
+      writer.WriteInt64(reloc.offset);
+      writer.WriteInt(reloc.refs.size());
+      for (int32 ref : reloc.refs) writer.Write(&ref, sizeof(int32));
+    }
+  }
+
+  // Write cache file to temporary file and atomically replace the existing
+  // cache file.
+  File::Mkdir(dir_);
+  string tmpname = StringPrintf("%s.%d", filename_.c_str(), getpid());
+  const string &data = writer.buffer();
+  Status st = File::WriteContents(tmpname, data.data(), data.size());
+  if (st.ok()) st = File::Rename(tmpname, filename_);
+  if (!st.ok()) {
+    LOG(WARNING) << "Error writing code cache file " << filename_ << ": "
+                 << st;
+    File::Delete(tmpname);
+  } else {
+    VLOG(3) << "Saved code cache file " << filename_;
+  }
+}
+
+uint64 CodeCache::LayoutFingerprint(Network *network) {
+  string str;
+  for (Cell *cell : network->cells()) {
+    StringAppendF(&str, "cell %s %zu %d %zu %d\n", cell->name().c_str(),
+                  cell->instance_size(), cell->instance_alignment(),
+                  cell->data_start(), cell->num_tasks());
+    for (Step *step : cell->steps()) {
+      StringAppendF(&str, "step %s %s %d\n", step->name().c_str(),
+                    step->kernel()->Name().c_str(), step->task_index());
+    }
+  }
+  std::vector<Tensor *> tensors = network->parameters();
+  for (Tensor *t : network->globals()) tensors.push_back(t);
+  for (Tensor *t : tensors) {
+    StringAppendF(&str, "tensor %s %d %s %s %s %zu %zu %zu %d %d %d %d\n",
+                  t->name().c_str(), t->type(),
+                  t->shape().ToString().c_str(),
+                  t->aligned().ToString().c_str(),
+                  t->stride().ToString().c_str(),
+                  t->offset(), t->space(), t->size(), t->ref(),
+                  t->dynamic(), t->IsLocal(), t->order());
+  }
+  return Fingerprint(str.data(), str.size());
+}
+
+}  // namespace myelin
+}  // namespace sling
@@ -0,0 +1,167 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_MYELIN_CODE_CACHE_H_
+#define SLING_MYELIN_CODE_CACHE_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sling/base/types.h"
+#include "sling/myelin/compute.h"
+#include "sling/myelin/flow.h"
+
+namespace sling {
+namespace myelin {
+
+// Compute fingerprint for compiler options that affect code generation.
+uint64 FingerprintOptions(const Options &options);
+
+// Linker that caches analyzed flows and JIT-generated code in a directory.
+// The cache files are keyed by a fingerprint of the flow, the enabled CPU
+// features, and the binary generating the code. The key for the code also
+// includes the compiler options. When the cache is created for the flow
+// before it is analyzed, the analyzed flow is also cached, so both analysis
+// and code generation can be skipped on a cache hit.
+// External references in the generated code are saved as relocations relative
+// to global tensors, tensor objects, or loaded modules, so cached code can be
+// linked into a later process. The cache file is validated against the tensor
+// and instance layout of the network, and a cache file that does not match is
+// regenerated and overwritten. Networks with references that cannot be
+// relocated, e.g. device or profiling data, are not cached.
+class CodeCache : public Linker {
+ public:
+  // Initialize code cache for compiling flow.
+  CodeCache(const string &dir, const Flow &flow);
+
+  // Replace flow with the analyzed flow from the cache. Returns false if the
+  // analyzed flow is not in the cache, in which case the flow is unchanged.
+  bool LoadFlow(Flow *flow);
+
+  // Save analyzed flow in the cache.
+  void SaveFlow(const Flow &flow);
+
+  // Compute cache key for network.
+  void BeginNetwork(Network *network) override;
+
+  // Save cache file if new code has been generated.
+  void EndNetwork(Network *network) override;
+
+  // Load cached code for cell.
+  bool LoadCell(Cell *cell, jit::Code *code,
+                std::vector<Step *> *noops) override;
+
+  // Allocate generated code and add it to the cache.
+  void EndCell(Cell *cell,
+               jit::CodeGenerator *generator,
+               jit::Code *code,
+               int data_size) override;
+
+  // Cache file names for code and analyzed flow.
+  const string &filename() const { return filename_; }
+  const string &flow_filename() const { return flow_filename_; }
+
+  // Number of cells loaded from cache and generated.
+  int loaded() const { return loaded_; }
+  int generated() const { return generated_; }
+
+ private:
+  // External reference types.
+  enum RelocationType {
+    RELOC_TENSOR_DATA = 0,    // address in global tensor data
+    RELOC_TENSOR_OBJECT = 1,  // address of tensor object
+    RELOC_MODULE = 2,         // address in loaded module
+  };
+
+  // Relocation of external reference in cell code.
+  struct Relocation {
+    int type;                  // relocation type
+    string target;             // tensor or module name
+    uint64 offset;             // offset relative to target
+    std::vector<int32> refs;   // absolute references in code
+  };
+
+  // Cached code for cell.
+  struct CellCode {
+    string code;                       // code for cell without relocations
+    std::vector<bool> noops;           // steps without generated code
+    std::vector<Relocation> relocs;    // external references
+  };
+
+  // Data for variable in flow before analysis.
+  struct RawData {
+    const char *data;          // start of data
+    uint64 size;               // size of data
+    uint32 index;              // variable index in flow
+  };
+
+  // Read cache file. Returns false if there is no valid cache file.
+  bool Read();
+
+  // Write cache file.
+  void Write();
+
+  // Resolve address to relocation. Returns false if the address cannot be
+  // relocated.
+  bool Resolve(const void *address, Relocation *reloc);
+
+  // Return address for relocation or null if it cannot be resolved.
+  char *Relocate(const Relocation &reloc);
+
+  // Compute fingerprint for tensor and instance layout of network.
+  static uint64 LayoutFingerprint(Network *network);
+
+  // Cache directory.
+  string dir_;
+
+  // Fingerprint for flow, CPU features, and binary.
+  uint64 flow_fingerprint_;
+
+  // Cache file name for analyzed flow.
+  string flow_filename_;
+
+  // Data for variables in flow before analysis sorted by address.
+  std::vector<RawData> raw_data_;
+
+  // Network being compiled.
+  Network *network_ = nullptr;
+
+  // Cache file name for network.
+  string filename_;
+
+  // Layout fingerprint for network.
+  uint64 layout_ = 0;
+
+  // Cache file has been read.
+  bool read_ = false;
+
+  // Code for cells in network.
+  std::unordered_map<string, CellCode> cells_;
+
+  // Identity of modules referenced by the code.
+  std::unordered_map<string, string> modules_;
+
+  // Some of the generated code cannot be cached.
+  bool uncachable_ = false;
+
+  // Statistics.
+  int loaded_ = 0;
+  int generated_ = 0;
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // SLING_MYELIN_CODE_CACHE_H_
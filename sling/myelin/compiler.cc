@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <memory>
 
 #include "sling/myelin/compiler.h"
 
@@ -22,6 +23,7 @@
 #include "sling/base/logging.h"
 #include "sling/base/perf.h"
 #include "sling/file/file.h"
+#include "sling/myelin/code-cache.h"
 #include "sling/myelin/compute.h"
 #include "sling/myelin/elf-linker.h"
 #include "sling/myelin/flow.h"
@@ -34,6 +36,7 @@
 
 DEFINE_string(cpu, "", "Enable/disable CPU features");
 DEFINE_bool(gpu, false, "Run kernels on GPU");
+DEFINE_bool(huge_pages, false, "Use huge pages for large parameters");
 DEFINE_bool(profile, false, "Profile neural network computations");
 DEFINE_string(input_flow, "", "File for saving raw input flow");
 DEFINE_string(final_flow, "", "File for saving final analyzed flow");
@@ -42,6 +45,7 @@ DEFINE_string(input_graph, "", "File for saving raw input flow as SVG file");
 DEFINE_string(graph, "", "File for saving analyzed flow as SVG file");
 DEFINE_string(dot, "", "File for saving analyzed flow as DOT file");
 DEFINE_string(jit_code, "", "File for saving JIT generated code");
+DEFINE_string(jit_cache, "", "Directory for caching JIT generated code");
 DEFINE_bool(dump_input_flow, false, "Dump raw input flow to log");
 DEFINE_bool(dump_flow, false, "Dump final analyzed flow to log");
 DEFINE_bool(dump_cells, false, "Dump cells after compilation");
@@ -120,8 +124,22 @@ void Compiler::Compile(Flow *flow, Network *net) {
   // Optionally output DOT file for input.
   WriteGraph(*flow, FLAGS_input_dot, FLAGS_input_graph);
 
-  // Analyze flow.
-  flow->Analyze(*library_);
+  // Use cached analyzed flow and code if code cache is enabled. The cache can
+  // only be used for JIT-compiled code that does not reference device or
+  // profiling data.
+  std::unique_ptr<CodeCache> cache;
+  bool dump = !FLAGS_jit_code.empty() || FLAGS_dump_code || FLAGS_dump_raw_code;
+  if (!FLAGS_jit_cache.empty() && !dump && runtime_ == nullptr &&
+      !FLAGS_mkl && !FLAGS_profile && !net->options().profiling &&
+      !net->options().aot && !net->options().pic) {
+    cache.reset(new CodeCache(FLAGS_jit_cache, *flow));
+  }
+
+  // Analyze flow unless the analyzed flow is in the code cache.
+  if (cache == nullptr || !cache->LoadFlow(flow)) {
+    flow->Analyze(*library_);
+    if (cache != nullptr) cache->SaveFlow(*flow);
+  }
 
   // Optionally dump final flow.
   if (FLAGS_dump_flow) {
@@ -168,8 +186,17 @@ void Compiler::Compile(Flow *flow, Network *net) {
   if (FLAGS_fast_math) net->options().fast_math = true;
   if (FLAGS_separate_tensors) net->options().shared_tensors = false;
   net->options().sparse_threshold = FLAGS_sparse_threshold;
+  if (FLAGS_huge_pages) net->options().huge_pages = true;
+
+  // Link cached code.
+  if (cache != nullptr) net->set_linker(cache.get());
 
   CHECK(net->Compile(*flow, *library_));
+  if (cache != nullptr) {
+    VLOG(1) << "Code cache " << cache->filename() << ": "
+            << cache->loaded() << " cells loaded, "
+            << cache->generated() << " cells generated";
+  }
 
   // Bind flow artifacts to network tensors, cells, and steps.
   net->Bind(flow);
@@ -26,6 +26,7 @@
 #include "sling/file/file.h"
 #include "sling/myelin/macro-assembler.h"
 #include "sling/string/printf.h"
+#include "sling/util/memory.h"
 
 namespace sling {
 namespace myelin {
@@ -1859,6 +1860,17 @@ bool Network::Compile(const Flow &flow, const Library &library) {
 
   // Compile each cell computation.
   for (Cell *cell : cells_) {
+    // Use previously generated code for cell if linker has it.
+    std::vector<Step *> noops;
+    if (linker_->LoadCell(cell, &cell->code_, &noops)) {
+      for (Step *step : noops) step->noop_ = true;
+      VLOG(5) << cell->name()
+              << " entry address: " << cell->code_.entry()
+              << " code size: " << cell->code_.size()
+              << " data size: " << cell->instance_size() << " (cached)";
+      continue;
+    }
+
     // Start code generation for cell.
     linker_->BeginCell(cell);
 
@@ -2238,8 +2250,14 @@ char *Network::AllocateTensor(Tensor *tensor) {
     alignment = jit::CPU::CacheLineSize();
   }
 
+  // Large parameter tensors can be aligned to huge page boundaries and backed
+  // by transparent huge pages to reduce TLB misses.
+  bool huge_pages = options_.huge_pages && tensor->size_ >= kHugePageSize;
+  if (huge_pages) alignment = kHugePageSize;
+
   // Allocate memory for tensor.
   char *data = MemAlloc(tensor->size_, alignment);
+  if (huge_pages) AdviseHugePages(data, tensor->size_);
   memset(data, 0, tensor->size_);
 
   // Copy data.
@@ -289,6 +289,14 @@ class Linker {
   // Compilation of network complete.
   virtual void EndNetwork(Network *network) {}
 
+  // Load previously generated code for cell instead of generating new code.
+  // Steps that did not generate any code are added to noops. Returns false if
+  // code needs to be generated for the cell.
+  virtual bool LoadCell(Cell *cell, jit::Code *code,
+                        std::vector<Step *> *noops) {
+    return false;
+  }
+
   // Start code generation for cell.
   virtual void BeginCell(Cell *cell) {}
 
@@ -1398,6 +1406,7 @@ struct Options {
   bool aot = false;                          // ahead-of-time compilation
   bool pic = false;                          // position-independent code
   int sparse_threshold = 64;                 // threshold for sparse update
+  bool huge_pages = false;                   // huge pages for parameters
   int64 *flops_address = nullptr;            // address of FLOPs counter
 
   bool ref_profiler() const { return external_profiler || global_profiler; }
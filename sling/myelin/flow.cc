@@ -974,6 +974,17 @@ Flow::~Flow() {
   for (auto *ptr : memory_) free(ptr);
 }
 
+void Flow::Clear() {
+  for (auto *op : ops_) delete op;
+  for (auto *var : vars_) delete var;
+  for (auto *func : funcs_) delete func;
+  for (auto *cnx : cnxs_) delete cnx;
+  ops_.clear();
+  vars_.clear();
+  funcs_.clear();
+  cnxs_.clear();
+}
+
 char *Flow::AllocateMemory(size_t size) {
   char *data = static_cast<char *>(malloc(size));
   memory_.push_back(data);
@@ -998,6 +1009,17 @@ Status Flow::Load(const string &filename) {
   st = file->Close();
   if (!st.ok()) return st;
 
+  // Keep track of the file contents, so the data in the flow can be
+  // identified by the file instead of by its contents.
+  FileStat stat;
+  if (File::Stat(filename, &stat).ok()) {
+    source_ = StringPrintf("%s:%llu:%llu", filename.c_str(),
+                           static_cast<unsigned long long>(stat.size),
+                           static_cast<unsigned long long>(stat.mtime));
+    source_data_ = data;
+    source_size_ = size;
+  }
+
   Read(data, size);
   return Status::OK;
 }
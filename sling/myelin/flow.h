@@ -730,6 +730,10 @@ class Flow {
     return AllocateMemory(str.data(), str.size());
   }
 
+  // Remove all variables, operations, functions, and connectors from flow.
+  // The data blocks and the memory owned by the flow are kept.
+  void Clear();
+
   // Load flow from file.
   Status Load(const string &filename);
 
@@ -740,6 +744,17 @@ class Flow {
   // Save flow to file.
   void Save(const string &filename, int version = VERSION) const;
 
+  // Identity of the file the flow was loaded from, i.e. its name, size, and
+  // modification time. This is empty if the flow was not loaded from a file.
+  const string &source() const { return source_; }
+
+  // Return offset of data in the file contents the flow was loaded from, or -1
+  // if the data is not part of the file contents.
+  int64 SourceOffset(const char *data) const {
+    if (data < source_data_ || data >= source_data_ + source_size_) return -1;
+    return data - source_data_;
+  }
+
   // Analyze flow.
   void Analyze(const Transformations &transformations);
 
@@ -912,6 +927,11 @@ class Flow {
   // Data areas owned by flow.
   std::vector<char *> memory_;
 
+  // File the flow was loaded from and its contents.
+  string source_;
+  const char *source_data_ = nullptr;
+  size_t source_size_ = 0;
+
   // Batch size.
   int batch_size_ = 1;
 };
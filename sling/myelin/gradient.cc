@@ -64,6 +64,7 @@ Gradients::Gradients(Flow *flow,
     } else {
       adjoints_[v] = dv;
     }
+    primals_.push_back(v);
   }
 
   // Gradients are only needed at training-time.
@@ -92,9 +93,8 @@ Flow::Variable *Gradients::GetReference(Flow::Variable *x) {
 }
 
 Flow::Function *Gradients::Finalize() {
-  for (auto &it : adjoints_) {
-    Flow::Variable *v = it.first;
-    Flow::Variable *dv = it.second;
+  for (Flow::Variable *v : primals_) {
+    Flow::Variable *dv = adjoints_[v];
     Flow::Variable *terms = terms_[dv];
     if (terms != nullptr) {
       // The gradients need to be summed when backpropagating through a
@@ -70,6 +70,11 @@ class Gradients : public FlowBuilder {
   // Mapping from primal variables to adjoint.
   std::unordered_map<Flow::Variable *, Flow::Variable *> adjoints_;
 
+  // Primal variables with adjoints in the order they were added. The gradient
+  // terms are finalized in this order so the gradient function is the same
+  // every time it is derived.
+  std::vector<Flow::Variable *> primals_;
+
   // Terms for adjoint.
   std::unordered_map<Flow::Variable *, Flow::Variable *> terms_;
 
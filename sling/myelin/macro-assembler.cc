@@ -1667,7 +1667,7 @@ void MacroAssembler::Reduce(Reduction op, Type type,
 
 void MacroAssembler::UpdateCounter(int64 *counter, int64 value) {
   CHECK(!rr_.used(rdi));
-  movp(rdi, counter);
+  load_extern(rdi, counter, "myelin_counter", options_.pic);
   lock();
   addq(Operand(rdi), Immediate(value));
 }
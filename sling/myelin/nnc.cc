@@ -27,6 +27,7 @@
 #include "sling/file/file.h"
 #include "sling/myelin/aot-linker.h"
 #include "sling/myelin/compiler.h"
+#include "sling/util/fingerprint.h"
 
 DEFINE_string(flow, "", "Myelin flow file");
 DEFINE_string(o, "", "ELF object output file for generated code");
@@ -67,6 +68,9 @@ int main(int argc, char *argv[]) {
   if (!FLAGS_data.empty()) linker_opts.external_data = true;
   linker_opts.uppercase_names = FLAGS_upper;
   linker_opts.flow_file = FLAGS_flow;
+  string content;
+  CHECK(File::ReadContents(FLAGS_flow, &content));
+  linker_opts.model_hash = Fingerprint(content.data(), content.size());
   AOTLinker linker(linker_opts);
 
   // Compile flow.
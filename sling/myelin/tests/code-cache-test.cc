@@ -0,0 +1,170 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/myelin/builder.h"
+#include "sling/myelin/code-cache.h"
+#include "sling/myelin/compiler.h"
+#include "sling/myelin/compute.h"
+#include "sling/myelin/flow.h"
+#include "sling/myelin/gradient.h"
+
+DEFINE_int32(layers, 8, "Number of hidden layers");
+DEFINE_int32(dim, 256, "Hidden layer dimension");
+DEFINE_string(cache, "", "Code cache directory (default: temporary directory)");
+
+DECLARE_string(jit_cache);
+
+using namespace sling;
+using namespace sling::myelin;
+
+// Build feed-forward network with gradient.
+void BuildFlow(Flow *flow) {
+  FlowBuilder f(flow, "mlp");
+  auto *x = f.Placeholder("x", DT_FLOAT, {1, FLAGS_dim});
+  auto *h = x;
+  for (int l = 0; l < FLAGS_layers; ++l) {
+    string n = std::to_string(l);
+    auto *W = f.RandomNormal(f.Parameter("W" + n, DT_FLOAT,
+                                         {FLAGS_dim, FLAGS_dim}));
+    auto *b = f.RandomNormal(f.Parameter("b" + n, DT_FLOAT, {FLAGS_dim}));
+    h = f.Relu(f.Add(f.MatMul(h, W), b));
+  }
+  f.Name(f.Tanh(h), "y")->set_out();
+  Gradient(flow, f.func());
+}
+
+// Compile network, optionally using code cache, and return the time for
+// compiling the analyzed flow in milliseconds. Returns the number of cells
+// loaded from the cache.
+double Compile(Network *net, const string &cachedir, int *loaded) {
+  Compiler compiler;
+  Flow flow;
+  BuildFlow(&flow);
+  flow.Analyze(*compiler.library());
+
+  Clock clock;
+  clock.start();
+  std::unique_ptr<CodeCache> cache;
+  if (!cachedir.empty()) {
+    cache.reset(new CodeCache(cachedir, flow));
+    net->set_linker(cache.get());
+  }
+  CHECK(net->Compile(flow, *compiler.library()));
+  clock.stop();
+  if (loaded != nullptr) *loaded = cache->loaded();
+  return clock.ms();
+}
+
+// Compile raw flow through the compiler, optionally using the code cache for
+// both the analyzed flow and the generated code, and return the time for
+// analyzing and compiling the flow in milliseconds.
+double CompileFlow(Network *net, const string &cachedir) {
+  Compiler compiler;
+  Flow flow;
+  BuildFlow(&flow);
+
+  Clock clock;
+  clock.start();
+  FLAGS_jit_cache = cachedir;
+  compiler.Compile(&flow, net);
+  FLAGS_jit_cache.clear();
+  clock.stop();
+  return clock.ms();
+}
+
+// Compute output for network.
+string Compute(Network *net) {
+  net->InitModelParameters(1);
+  Cell *cell = net->GetCell("mlp");
+  Instance data(cell);
+  float *x = data.Get<float>(net->GetParameter("mlp/x"));
+  for (int i = 0; i < FLAGS_dim; ++i) x[i] = (i % 7) * 0.1 - 0.3;
+  data.Compute();
+  Tensor *y = net->GetParameter("mlp/y");
+  return string(reinterpret_cast<char *>(data.Get<float>(y)), y->size());
+}
+
+// Check that code loaded from the code cache computes the same result as
+// freshly generated code.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Generate code without cache.
+  Network reference;
+  double generate = Compile(&reference, "", nullptr);
+  string expected = Compute(&reference);
+
+  // Compile network with code cache. The first compilation populates the
+  // cache unless it has been populated by a previous run.
+  string dir = FLAGS_cache;
+  if (dir.empty()) CHECK(File::CreateTempDir(&dir));
+  Network first;
+  int loaded;
+  double populate = Compile(&first, dir, &loaded);
+  CHECK(Compute(&first) == expected);
+
+  // Compile network again using the cached code.
+  Network cached;
+  double load = Compile(&cached, dir, &loaded);
+  CHECK_EQ(loaded, cached.cells().size());
+  for (int i = 0; i < reference.cells().size(); ++i) {
+    const jit::Code &code = reference.cells()[i]->code();
+    const jit::Code &loaded = cached.cells()[i]->code();
+    CHECK_EQ(code.size(), loaded.size());
+  }
+  CHECK(Compute(&cached) == expected);
+
+  std::cout << "compile " << generate << " ms"
+            << ", populate cache " << populate << " ms"
+            << ", cached " << load << " ms\n";
+
+  // Analyze and compile raw flow with and without the code cache. The second
+  // compilation with the cache loads the analyzed flow and the code.
+  string flowdir = dir + "/flow";
+  Network raw;
+  double analyze = CompileFlow(&raw, "");
+  CHECK(Compute(&raw) == expected);
+  Network first_flow;
+  double populate_flow = CompileFlow(&first_flow, flowdir);
+  CHECK(Compute(&first_flow) == expected);
+  CHECK_EQ(File::Match(flowdir + "/*.flow").size(), 1);
+  CHECK_EQ(File::Match(flowdir + "/*.jit").size(), 1);
+  Network cached_flow;
+  double load_flow = CompileFlow(&cached_flow, flowdir);
+  CHECK(Compute(&cached_flow) == expected);
+
+  std::cout << "analyze and compile " << analyze << " ms"
+            << ", populate cache " << populate_flow << " ms"
+            << ", cached " << load_flow << " ms\n";
+
+  if (FLAGS_cache.empty()) {
+    for (const string &file : File::Match(flowdir + "/*")) File::Delete(file);
+    File::Rmdir(flowdir);
+    for (const string &file : File::Match(dir + "/*")) File::Delete(file);
+    File::Rmdir(dir);
+  }
+  std::cout << "PASS\n";
+
+  return 0;
+}
@@ -0,0 +1,258 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/net/http-server.h"
+#include "sling/net/http-stats.h"
+#include "sling/net/static-content.h"
+#include "sling/util/thread.h"
+
+DEFINE_int32(port, 8091, "Port for benchmark HTTP server");
+DEFINE_int32(workers, 8, "Number of server worker threads");
+DEFINE_int32(clients, 16, "Number of client connections");
+DEFINE_int32(requests, 10000, "Number of small requests per connection");
+DEFINE_int32(large_requests, 100, "Number of large requests per connection");
+DEFINE_int32(pipeline, 16, "Number of pipelined requests per batch");
+DEFINE_int32(small_size, 128, "Size of small responses in bytes");
+DEFINE_int32(large_size, 4 << 20, "Size of large file responses in bytes");
+DEFINE_int32(idle_connections, 100, "Number of idle connections");
+DEFINE_int32(max_idle, 2, "Server idle timeout in seconds");
+
+using namespace sling;
+
+// HTTP client connection to the benchmark server.
+class Connection {
+ public:
+  explicit Connection(int port) {
+    sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(sock_ != -1);
+    int on = 1;
+    setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+    CHECK(connect(sock_, reinterpret_cast<sockaddr *>(&sin), sizeof(sin)) == 0)
+        << "Unable to connect to port " << port;
+  }
+
+  ~Connection() { close(sock_); }
+
+  // Send requests to server.
+  void Send(const string &requests) {
+    const char *data = requests.data();
+    size_t left = requests.size();
+    while (left > 0) {
+      int rc = write(sock_, data, left);
+      CHECK_GT(rc, 0);
+      data += rc;
+      left -= rc;
+    }
+  }
+
+  // Receive next response from server and return the size of the body. The
+  // body is discarded.
+  int64 Receive() {
+    // Read response header.
+    size_t eoh;
+    while ((eoh = buffer_.find("\r\n\r\n")) == string::npos) Read(kBufferSize);
+    CHECK_EQ(buffer_.compare(0, 12, "HTTP/1.1 200"), 0)
+        << buffer_.substr(0, buffer_.find("\r\n"));
+    int64 length = 0;
+    size_t pos = buffer_.find("Content-Length: ");
+    if (pos != string::npos && pos < eoh) length = atoll(&buffer_[pos + 16]);
+
+    // Skip response body. Only the remaining part of the body is read from
+    // the socket, so pipelined responses following it stay in the buffer.
+    size_t start = eoh + 4;
+    if (buffer_.size() - start >= length) {
+      buffer_.erase(0, start + length);
+    } else {
+      int64 left = length - (buffer_.size() - start);
+      buffer_.clear();
+      while (left > 0) {
+        left -= Read(left < kBufferSize ? left : kBufferSize);
+        buffer_.clear();
+      }
+    }
+    return length;
+  }
+
+  // Wait until the server closes the connection. Returns false on timeout.
+  bool WaitForClose(int timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = sock_;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) != 1) return false;
+    char data[256];
+    return read(sock_, data, sizeof(data)) <= 0;
+  }
+
+ private:
+  // Read up to size bytes into the buffer and return the number of bytes read.
+  int Read(int size) {
+    char data[kBufferSize];
+    int rc = read(sock_, data, size);
+    CHECK_GT(rc, 0) << "Connection closed";
+    buffer_.append(data, rc);
+    return rc;
+  }
+
+  static const int kBufferSize = 1 << 16;
+
+  int sock_;
+  string buffer_;
+};
+
+// Run clients that each send requests for the path on their own connection in
+// batches of pipelined requests. Reports the request rate, throughput, and
+// request latencies. The latency of a request is measured from the time its
+// batch is sent until its response has been received.
+void RunClients(const string &name, const string &path, int requests,
+                int pipeline) {
+  string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  LatencyHistogram latency;
+  std::vector<int64> bytes(FLAGS_clients);
+  std::vector<ClosureThread *> clients;
+  Clock clock;
+  clock.start();
+  for (int c = 0; c < FLAGS_clients; ++c) {
+    clients.push_back(new ClosureThread([&, c]() {
+      Connection conn(FLAGS_port);
+      string batch;
+      for (int i = 0; i < requests; i += pipeline) {
+        int n = std::min(pipeline, requests - i);
+        batch.clear();
+        for (int j = 0; j < n; ++j) batch.append(request);
+        Clock timer;
+        timer.start();
+        conn.Send(batch);
+        for (int j = 0; j < n; ++j) {
+          bytes[c] += conn.Receive();
+          timer.stop();
+          latency.Add(timer.us());
+        }
+      }
+    }));
+    clients.back()->SetJoinable(true);
+    clients.back()->Start();
+  }
+  for (ClosureThread *client : clients) {
+    client->Join();
+    delete client;
+  }
+  clock.stop();
+
+  int64 total = 0;
+  for (int64 b : bytes) total += b;
+  int64 n = latency.count();
+  std::cout << name << ": "
+            << static_cast<int64>(n / clock.secs()) << " requests/sec, "
+            << static_cast<int64>(total / clock.secs() / (1 << 20)) << " MB/s"
+            << ", latency p50 " << latency.Percentile(0.5) << " us"
+            << ", p99 " << latency.Percentile(0.99) << " us"
+            << ", p999 " << latency.Percentile(0.999) << " us\n";
+  std::cout.flush();
+}
+
+// Open idle connections and check that the server shuts them all down after
+// the idle timeout. Reports the time until the last connection was closed.
+void RunIdle() {
+  std::vector<Connection *> conns;
+  for (int i = 0; i < FLAGS_idle_connections; ++i) {
+    conns.push_back(new Connection(FLAGS_port));
+  }
+  Clock clock;
+  clock.start();
+  int closed = 0;
+  for (Connection *conn : conns) {
+    int waited = clock.elapsed() / Clock::hz() * 1000;
+    int timeout = (FLAGS_max_idle + 5) * 1000 - waited;
+    if (timeout > 0 && conn->WaitForClose(timeout)) closed++;
+    delete conn;
+  }
+  clock.stop();
+  std::cout << "idle: " << closed << "/" << FLAGS_idle_connections
+            << " connections closed after " << clock.secs() << " secs"
+            << " (timeout " << FLAGS_max_idle << " secs)\n";
+  std::cout.flush();
+  CHECK_EQ(closed, FLAGS_idle_connections);
+}
+
+// Run all benchmarks against a server in normal or sharded mode.
+void RunServer(bool sharded, const string &dir) {
+  SocketServerOptions options;
+  options.num_workers = FLAGS_workers;
+  options.max_idle = FLAGS_max_idle;
+  options.sharded = sharded;
+  HTTPServer http(options, "127.0.0.1", FLAGS_port);
+
+  string small(FLAGS_small_size, 'x');
+  http.Register("/small", [&small](HTTPRequest *req, HTTPResponse *rsp) {
+    rsp->set_content_type("text/plain");
+    rsp->Append(small);
+  });
+  StaticContent files("/files", dir);
+  files.Register(&http);
+  CHECK(http.Start());
+
+  std::cout << (sharded ? "sharded" : "shared") << " event loop, "
+            << FLAGS_workers << " workers, " << FLAGS_clients << " clients\n";
+  RunClients("small", "/small", FLAGS_requests, 1);
+  RunClients("small pipelined", "/small", FLAGS_requests, FLAGS_pipeline);
+  RunClients("large", "/files/large.bin", FLAGS_large_requests, 1);
+  RunIdle();
+
+  http.Shutdown();
+  http.Wait();
+}
+
+// HTTP server load generator. Runs small in-memory responses with and without
+// pipelining, large file responses sent with sendfile(), and idle connection
+// timeouts against an HTTP server with a shared event loop and with one event
+// loop per worker (SO_REUSEPORT).
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Create file for large responses.
+  string dir;
+  CHECK(File::CreateTempDir(&dir));
+  string large = dir + "/large.bin";
+  string data(FLAGS_large_size, '\0');
+  for (int i = 0; i < data.size(); ++i) data[i] = i * 7919 >> 5;
+  CHECK(File::WriteContents(large, data));
+
+  RunServer(false, dir);
+  RunServer(true, dir);
+
+  CHECK(File::Delete(large));
+  CHECK(File::Rmdir(dir));
+  return 0;
+}
@@ -14,7 +14,17 @@
 
 #include "sling/net/http-server.h"
 
+#include "sling/base/flags.h"
 #include "sling/string/numbers.h"
+#include "sling/util/json.h"
+
+DEFINE_int32(http_compress_min_size, 1024,
+             "Minimum response size for gzip compression (0=disabled)");
+DEFINE_int32(http_compress_level, 6, "Compression level for HTTP responses");
+DEFINE_int32(http_slow_request_ms, 0,
+             "Log requests that take longer than this (0=disabled)");
+DEFINE_int32(http_slow_request_sample, 1,
+             "Only log every n-th slow request for each context");
 
 namespace sling {
 
@@ -113,6 +123,12 @@ HTTPProtocol::HTTPProtocol() {
   Register("/helpz", this, &HTTPProtocol::HelpHandler);
   Register("/sockz", this, &HTTPProtocol::SocketHandler);
   Register("/healthz", this, &HTTPProtocol::HealthHandler);
+  Register("/statz", this, &HTTPProtocol::StatsHandler);
+  Register("/metricz", this, &HTTPProtocol::MetricsHandler);
+}
+
+HTTPProtocol::~HTTPProtocol() {
+  for (Context &c : contexts_) delete c.stats;
 }
 
 void HTTPProtocol::Register(const string &uri, const Handler &handler) {
@@ -124,7 +140,8 @@ SocketSession *HTTPProtocol::NewSession(SocketConnection *conn) {
   return new HTTPSession(this, conn);
 }
 
-HTTPProtocol::Handler HTTPProtocol::FindHandler(HTTPRequest *request) const {
+HTTPProtocol::Handler HTTPProtocol::FindHandler(HTTPRequest *request,
+                                                HTTPStats **stats) const {
   MutexLock lock(&mu_);
 
   // Return 503 if service not available.
@@ -150,6 +167,7 @@ HTTPProtocol::Handler HTTPProtocol::FindHandler(HTTPRequest *request) const {
     request->set_path(path + longest);
 
     // Return handler.
+    if (stats != nullptr) *stats = match->stats;
     return match->handler;
   } else {
     // No match found. Return 404 handler.
@@ -191,6 +209,30 @@ void HTTPProtocol::HealthHandler(HTTPRequest *req, HTTPResponse *rsp) {
   rsp->Append("OK");
 }
 
+void HTTPProtocol::StatsHandler(HTTPRequest *req, HTTPResponse *rsp) {
+  MutexLock lock(&mu_);
+  JSON::Object json;
+  JSON::Array *contexts = json.AddArray("contexts");
+  for (const Context &c : contexts_) {
+    c.stats->AddJSON(contexts->AddObject());
+  }
+  json.Write(rsp->buffer());
+  rsp->set_content_type("text/json");
+  rsp->set_status(200);
+}
+
+void HTTPProtocol::MetricsHandler(HTTPRequest *req, HTTPResponse *rsp) {
+  MutexLock lock(&mu_);
+  string metrics;
+  HTTPStats::WritePrometheusHeader(&metrics);
+  for (const Context &c : contexts_) {
+    c.stats->WritePrometheus(&metrics);
+  }
+  rsp->Append(metrics);
+  rsp->set_content_type("text/plain; version=0.0.4");
+  rsp->set_status(200);
+}
+
 HTTPSession::HTTPSession(HTTPProtocol *http, SocketConnection *conn)
     : http_(http), conn_(conn) {
 }
@@ -265,11 +307,17 @@ SocketSession::Continuation HTTPSession::Process(SocketConnection *conn) {
 
 void HTTPSession::Dispatch() {
   // Find handler for request.
-  HTTPProtocol::Handler handler = http_->FindHandler(request_);
+  HTTPStats *stats = nullptr;
+  HTTPProtocol::Handler handler = http_->FindHandler(request_, &stats);
 
   // Dispatch request to handler.
+  Clock::Timestamp start = Clock::now();
   handler(request_, response_);
 
+  // Compress response body if possible.
+  CompressResponse();
+  Clock::Timestamp end = Clock::now();
+
   // Use response body size as content length if it has not been set.
   if (response_->content_length() == 0 && !response_buffer()->empty()) {
     response_->set_content_length(response_buffer()->available());
@@ -296,6 +344,75 @@ void HTTPSession::Dispatch() {
 
   // Generate response header buffer.
   response_->WriteHeader(conn_->response_header());
+
+  // Update request statistics for context.
+  if (stats != nullptr) RecordStats(stats, start, end);
+}
+
+void HTTPSession::RecordStats(HTTPStats *stats,
+                              Clock::Timestamp start,
+                              Clock::Timestamp end) {
+  // Compute queue and handler time.
+  double mhz = Clock::mhz();
+  Clock::Timestamp received = conn_->request_start();
+  if (received == 0 || received > start) received = start;
+  int64 queue_us = (start - received) / mhz;
+  int64 handler_us = (end - start) / mhz;
+
+  // Compute request and response sizes.
+  int64 bytes_in = request_header_.consumed() + request_header_.available() +
+                   request_->content_size();
+  int64 bytes_out = conn_->response_header()->available() +
+                    response_->content_length();
+  int status = response_->status();
+  stats->Record(status, queue_us, handler_us, bytes_in, bytes_out);
+
+  // Log sampled slow requests.
+  if (FLAGS_http_slow_request_ms > 0 &&
+      queue_us + handler_us >= FLAGS_http_slow_request_ms * 1000LL) {
+    int64 slow = stats->AddSlow();
+    if (slow % FLAGS_http_slow_request_sample == 0) {
+      LOG(WARNING) << "Slow request: " << request_->method() << " "
+                   << request_->full_path() << " status " << status
+                   << ", queue " << queue_us / 1000.0 << " ms"
+                   << ", handler " << handler_us / 1000.0 << " ms"
+                   << ", in " << bytes_in << " bytes"
+                   << ", out " << bytes_out << " bytes"
+                   << " (" << slow << " slow requests)";
+    }
+  }
+}
+
+void HTTPSession::CompressResponse() {
+  // Only compress complete in-memory responses above the size threshold.
+  // Streamed file responses have a content length that differs from the
+  // size of the response buffer.
+  if (FLAGS_http_compress_min_size <= 0) return;
+  if (response_->status() != 200) return;
+  IOBuffer *body = response_buffer();
+  int size = body->available();
+  if (size < FLAGS_http_compress_min_size) return;
+  if (response_->content_length() != 0 &&
+      response_->content_length() != size) {
+    return;
+  }
+  if (response_->Get("Content-Encoding") != nullptr) return;
+  if (!CompressibleContentType(response_->content_type())) return;
+  if (!AcceptsEncoding(request_->Get("Accept-Encoding"), "gzip")) return;
+
+  // Only use the compressed response if it is smaller.
+  string compressed;
+  if (!GZipCompress(body->begin(), size, FLAGS_http_compress_level,
+                    &compressed)) {
+    return;
+  }
+  if (compressed.size() >= body->available()) return;
+
+  body->Clear();
+  body->Write(compressed);
+  response_->set_content_length(compressed.size());
+  response_->Set("Content-Encoding", "gzip");
+  response_->Set("Vary", "Accept-Encoding");
 }
 
 HTTPRequest::HTTPRequest(HTTPSession *session, IOBuffer *hdr)
@@ -19,6 +19,7 @@
 #include  <string>
 #include  <vector>
 
+#include "sling/net/http-stats.h"
 #include "sling/net/http-utils.h"
 #include "sling/net/socket-server.h"
 #include "sling/util/iobuffer.h"
@@ -38,6 +39,7 @@ class HTTPProtocol : public SocketProtocol {
 
   // Initialize HTTP protocol handler.
   HTTPProtocol();
+  ~HTTPProtocol() override;
 
   // Register handler for requests.
   void Register(const string &uri, const Handler &handler);
@@ -53,8 +55,9 @@ class HTTPProtocol : public SocketProtocol {
   const char *Name() override { return "HTTP"; }
   SocketSession *NewSession(SocketConnection *conn) override;
 
-  // Find handler for request.
-  Handler FindHandler(HTTPRequest *request) const;
+  // Find handler for request. The request statistics for the matching
+  // context are returned in stats if it is not null.
+  Handler FindHandler(HTTPRequest *request, HTTPStats **stats = nullptr) const;
 
   // Service availability.
   bool available() const { return available_; }
@@ -65,9 +68,11 @@ class HTTPProtocol : public SocketProtocol {
   struct Context {
     Context(const string &u, const Handler &h) : uri(u), handler(h) {
       if (uri == "/") uri = "";
+      stats = new HTTPStats(uri);
     }
     string uri;
     Handler handler;
+    HTTPStats *stats;
   };
 
   // Handler for /helpz.
@@ -79,6 +84,12 @@ class HTTPProtocol : public SocketProtocol {
   // Handler for /healthz.
   void HealthHandler(HTTPRequest *req, HTTPResponse *rsp);
 
+  // Handler for /statz.
+  void StatsHandler(HTTPRequest *req, HTTPResponse *rsp);
+
+  // Handler for /metricz.
+  void MetricsHandler(HTTPRequest *req, HTTPResponse *rsp);
+
   // Registered HTTP handlers.
   std::vector<Context> contexts_;
 
@@ -143,6 +154,13 @@ class HTTPSession : public SocketSession {
   // Dispatch request to handler.
   void Dispatch();
 
+  // Compress response body if the client accepts gzip content encoding.
+  void CompressResponse();
+
+  // Record request statistics and log slow requests.
+  void RecordStats(HTTPStats *stats, Clock::Timestamp start,
+                   Clock::Timestamp end);
+
   // Return HTTP request information.
   HTTPRequest *request() const { return request_; }
 
@@ -330,6 +348,11 @@ class HTTPResponse {
   // Set file for streaming response. This will take ownership of the file.
   void SendFile(File *file) { session_->SendFile(file); }
 
+  // Compress response body if the client accepts gzip content encoding. This
+  // is done for all responses after the handler returns, but handlers that
+  // need the final response body can compress it themselves.
+  void Compress() { session_->CompressResponse(); }
+
   // Return HTTP error message.
   void SendError(int status,
                  const char *title = nullptr,
@@ -0,0 +1,180 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/net/http-stats.h"
+
+#include <math.h>
+
+#include "sling/string/printf.h"
+
+namespace sling {
+
+// Percentiles reported for latencies.
+static const double kPercentiles[] = {0.5, 0.99, 0.999};
+static const char *kPercentileNames[] = {"p50", "p99", "p999"};
+
+// Histogram bucket limits for Prometheus output, in powers of two of
+// microseconds, i.e. from 16us to 64s.
+static const int kMinPrometheusBucket = 4;
+static const int kMaxPrometheusBucket = 26;
+
+LatencyHistogram::LatencyHistogram() {
+  for (int i = 0; i < kBuckets; ++i) buckets_[i] = 0;
+}
+
+int LatencyHistogram::Bucket(int64 us) {
+  if (us < kSubBuckets) return us < 0 ? 0 : us;
+  int msb = 63 - __builtin_clzll(us);
+  int sub = (us >> (msb - 2)) & (kSubBuckets - 1);
+  int bucket = (msb - 1) * kSubBuckets + sub;
+  return bucket < kBuckets ? bucket : kBuckets - 1;
+}
+
+int64 LatencyHistogram::UpperBound(int bucket) {
+  if (bucket < kSubBuckets) return bucket + 1;
+  int msb = bucket / kSubBuckets + 1;
+  int sub = bucket % kSubBuckets;
+  return static_cast<int64>(kSubBuckets + sub + 1) << (msb - 2);
+}
+
+void LatencyHistogram::Add(int64 us) {
+  buckets_[Bucket(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(us, std::memory_order_relaxed);
+}
+
+int64 LatencyHistogram::Percentile(double p) const {
+  int64 total = 0;
+  for (int i = 0; i < kBuckets; ++i) total += buckets_[i];
+  if (total == 0) return 0;
+  int64 target = ceil(p * total);
+  int64 cumulative = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    cumulative += buckets_[i];
+    if (cumulative >= target) return UpperBound(i);
+  }
+  return UpperBound(kBuckets - 1);
+}
+
+int64 LatencyHistogram::CountBelow(int64 limit) const {
+  int64 cumulative = 0;
+  for (int i = 0; i < kBuckets && UpperBound(i) <= limit; ++i) {
+    cumulative += buckets_[i];
+  }
+  return cumulative;
+}
+
+HTTPStats::HTTPStats(const string &uri) : uri_(uri) {
+  for (int i = 0; i < 5; ++i) status_[i] = 0;
+}
+
+void HTTPStats::Record(int status, int64 queue_us, int64 handler_us,
+                       int64 bytes_in, int64 bytes_out) {
+  total_.Add(queue_us + handler_us);
+  queue_.Add(queue_us);
+  handler_.Add(handler_us);
+  int cls = status / 100 - 1;
+  if (cls >= 0 && cls < 5) status_[cls]++;
+  bytes_in_ += bytes_in;
+  bytes_out_ += bytes_out;
+}
+
+// Add latency percentiles for histogram to JSON object.
+static void AddLatencies(JSON::Object *json, const char *name,
+                         const LatencyHistogram &histogram) {
+  JSON::Object *latency = json->AddObject(name);
+  for (int i = 0; i < 3; ++i) {
+    latency->Add(kPercentileNames[i], histogram.Percentile(kPercentiles[i]));
+  }
+  int64 count = histogram.count();
+  latency->Add("mean", count > 0 ? histogram.sum() / count : 0);
+}
+
+void HTTPStats::AddJSON(JSON::Object *json) const {
+  json->Add("context", uri_.empty() ? "/" : uri_);
+  json->Add("requests", total_.count());
+  JSON::Object *status = json->AddObject("status");
+  for (int i = 0; i < 5; ++i) {
+    status->Add(StringPrintf("%dxx", i + 1), status_[i].load());
+  }
+  json->Add("bytes_in", bytes_in_.load());
+  json->Add("bytes_out", bytes_out_.load());
+  json->Add("slow", slow_.load());
+  AddLatencies(json, "latency_us", total_);
+  AddLatencies(json, "queue_us", queue_);
+  AddLatencies(json, "handler_us", handler_);
+}
+
+void HTTPStats::WritePrometheusHeader(string *out) {
+  out->append(
+    "# HELP http_requests_total Number of HTTP requests by status class.\n"
+    "# TYPE http_requests_total counter\n"
+    "# HELP http_request_bytes_total Bytes received in HTTP requests.\n"
+    "# TYPE http_request_bytes_total counter\n"
+    "# HELP http_response_bytes_total Bytes sent in HTTP responses.\n"
+    "# TYPE http_response_bytes_total counter\n"
+    "# HELP http_request_duration_seconds HTTP request latency.\n"
+    "# TYPE http_request_duration_seconds histogram\n"
+    "# HELP http_request_queue_seconds Time from receipt to handler start.\n"
+    "# TYPE http_request_queue_seconds summary\n"
+    "# HELP http_request_handler_seconds Time spent in request handler.\n"
+    "# TYPE http_request_handler_seconds summary\n");
+}
+
+// Output latency summary for histogram in Prometheus format.
+static void WriteSummary(string *out, const char *name, const char *context,
+                         const LatencyHistogram &histogram) {
+  for (double p : kPercentiles) {
+    StringAppendF(out, "%s{context=\"%s\",quantile=\"%g\"} %g\n",
+                  name, context, p, histogram.Percentile(p) * 1e-6);
+  }
+  StringAppendF(out, "%s_sum{context=\"%s\"} %g\n",
+                name, context, histogram.sum() * 1e-6);
+  StringAppendF(out, "%s_count{context=\"%s\"} %lld\n",
+                name, context, static_cast<long long>(histogram.count()));
+}
+
+void HTTPStats::WritePrometheus(string *out) const {
+  const char *context = uri_.empty() ? "/" : uri_.c_str();
+  for (int i = 0; i < 5; ++i) {
+    StringAppendF(out, "http_requests_total{context=\"%s\",code=\"%dxx\"} "
+                  "%lld\n", context, i + 1,
+                  static_cast<long long>(status_[i].load()));
+  }
+  StringAppendF(out, "http_request_bytes_total{context=\"%s\"} %lld\n",
+                context, static_cast<long long>(bytes_in_.load()));
+  StringAppendF(out, "http_response_bytes_total{context=\"%s\"} %lld\n",
+                context, static_cast<long long>(bytes_out_.load()));
+
+  // Output cumulative latency histogram.
+  const char *name = "http_request_duration_seconds";
+  for (int b = kMinPrometheusBucket; b <= kMaxPrometheusBucket; ++b) {
+    int64 limit = 1LL << b;
+    StringAppendF(out, "%s_bucket{context=\"%s\",le=\"%g\"} %lld\n",
+                  name, context, limit * 1e-6,
+                  static_cast<long long>(total_.CountBelow(limit)));
+  }
+  StringAppendF(out, "%s_bucket{context=\"%s\",le=\"+Inf\"} %lld\n",
+                name, context, static_cast<long long>(total_.count()));
+  StringAppendF(out, "%s_sum{context=\"%s\"} %g\n",
+                name, context, total_.sum() * 1e-6);
+  StringAppendF(out, "%s_count{context=\"%s\"} %lld\n",
+                name, context, static_cast<long long>(total_.count()));
+
+  // Output queue and handler latency summaries.
+  WriteSummary(out, "http_request_queue_seconds", context, queue_);
+  WriteSummary(out, "http_request_handler_seconds", context, handler_);
+}
+
+}  // namespace sling
@@ -0,0 +1,115 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_NET_HTTP_STATS_H_
+#define SLING_NET_HTTP_STATS_H_
+
+#include <atomic>
+#include <string>
+
+#include "sling/base/types.h"
+#include "sling/util/iobuffer.h"
+#include "sling/util/json.h"
+
+namespace sling {
+
+// Histogram for latencies in microseconds. Each power of two is split into
+// four buckets, so percentiles are accurate to within 25%. Counters are
+// updated atomically, so latencies can be added concurrently.
+class LatencyHistogram {
+ public:
+  // Number of buckets per power of two.
+  static const int kSubBuckets = 4;
+
+  // Total number of buckets. Latencies above 2^33 us go into the last one.
+  static const int kBuckets = 32 * kSubBuckets;
+
+  LatencyHistogram();
+
+  // Add latency to histogram.
+  void Add(int64 us);
+
+  // Return the upper bound in microseconds for the latency at percentile p
+  // (0 < p <= 1).
+  int64 Percentile(double p) const;
+
+  // Return the number of latencies that are below the limit in microseconds.
+  // The limit must be a power of two.
+  int64 CountBelow(int64 limit) const;
+
+  // Number of latencies and their sum in microseconds.
+  int64 count() const { return count_; }
+  int64 sum() const { return sum_; }
+
+ private:
+  // Return bucket for latency.
+  static int Bucket(int64 us);
+
+  // Return exclusive upper bound for bucket.
+  static int64 UpperBound(int bucket);
+
+  std::atomic<int64> buckets_[kBuckets];
+  std::atomic<int64> count_{0};
+  std::atomic<int64> sum_{0};
+};
+
+// Request statistics for an HTTP context.
+class HTTPStats {
+ public:
+  explicit HTTPStats(const string &uri);
+
+  // Record timing and size for request. The queue time is the time from
+  // receiving the request until the handler is called, and the handler time
+  // is the time spent generating the response.
+  void Record(int status, int64 queue_us, int64 handler_us,
+              int64 bytes_in, int64 bytes_out);
+
+  // Add statistics to JSON object.
+  void AddJSON(JSON::Object *json) const;
+
+  // Output statistics in Prometheus text exposition format.
+  void WritePrometheus(string *out) const;
+
+  // Output Prometheus metric descriptions.
+  static void WritePrometheusHeader(string *out);
+
+  // Increment number of slow requests and return the new count.
+  int64 AddSlow() { return ++slow_; }
+
+  // URI for context.
+  const string &uri() const { return uri_; }
+
+ private:
+  // URI for context.
+  string uri_;
+
+  // Latency histograms for total, queue, and handler time.
+  LatencyHistogram total_;
+  LatencyHistogram queue_;
+  LatencyHistogram handler_;
+
+  // Number of responses by status class (1xx to 5xx).
+  std::atomic<int64> status_[5];
+
+  // Bytes received and sent.
+  std::atomic<int64> bytes_in_{0};
+  std::atomic<int64> bytes_out_{0};
+
+  // Number of slow requests.
+  std::atomic<int64> slow_{0};
+};
+
+}  // namespace sling
+
+#endif  // SLING_NET_HTTP_STATS_H_
@@ -20,6 +20,7 @@
 #include "sling/string/ctype.h"
 #include "sling/string/numbers.h"
 #include "sling/string/text.h"
+#include "third_party/zlib/zlib.h"
 
 namespace sling {
 
@@ -232,5 +233,66 @@ const char *GetExtension(const char *filename) {
   return ext;
 }
 
+bool CompressibleContentType(const char *type) {
+  if (type == nullptr) return false;
+  if (strncasecmp(type, "text/", 5) == 0) return true;
+  Text mime(type);
+  int semicolon = mime.find(';');
+  if (semicolon != -1) mime = mime.substr(0, semicolon);
+  return mime.find("json") != -1 ||
+         mime.find("javascript") != -1 ||
+         mime.find("xml") != -1 ||
+         mime == "application/sling";
+}
+
+bool AcceptsEncoding(const char *accept, const char *encoding) {
+  if (accept == nullptr) return false;
+  int enclen = strlen(encoding);
+  bool wildcard = false;
+  const char *p = accept;
+  while (*p) {
+    // Parse next coding in comma-separated list.
+    while (*p == ' ' || *p == '\t' || *p == ',') p++;
+    const char *name = p;
+    while (*p && *p != ',' && *p != ';' && *p != ' ') p++;
+    int namelen = p - name;
+
+    // Parse optional quality value; q=0 means not acceptable.
+    bool acceptable = true;
+    while (*p && *p != ',') {
+      if (*p == 'q' && p[1] == '=') {
+        acceptable = strtod(p + 2, nullptr) > 0.0;
+      }
+      p++;
+    }
+
+    if (namelen == enclen && strncasecmp(name, encoding, enclen) == 0) {
+      return acceptable;
+    }
+    if (namelen == 1 && *name == '*') wildcard = acceptable;
+  }
+  return wildcard;
+}
+
+bool GZipCompress(const char *data, size_t size, int level, string *output) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(z_stream));
+
+  // Use window bits 15+16 for gzip header and trailer.
+  if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  output->resize(deflateBound(&stream, size));
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  stream.avail_in = size;
+  stream.next_out = reinterpret_cast<Bytef *>(&(*output)[0]);
+  stream.avail_out = output->size();
+  int rc = deflate(&stream, Z_FINISH);
+  output->resize(stream.total_out);
+  deflateEnd(&stream);
+  return rc == Z_STREAM_END;
+}
+
 }  // namespace sling
 
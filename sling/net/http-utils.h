@@ -106,6 +106,15 @@ const char *GetMimeType(const char *ext);
 // Get extension for file name.
 const char *GetExtension(const char *filename);
 
+// Check if content with MIME type is worth compressing.
+bool CompressibleContentType(const char *type);
+
+// Check if Accept-Encoding header value allows content encoding.
+bool AcceptsEncoding(const char *accept, const char *encoding);
+
+// Compress data in gzip format. Returns false if compression fails.
+bool GZipCompress(const char *data, size_t size, int level, string *output);
+
 }  // namespace sling
 
 #endif  // SLING_NET_HTTP_UTILS_H_
@@ -21,7 +21,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string>
 
@@ -49,16 +51,22 @@ SocketServer::Endpoint::Endpoint(const char *addr,
 }
 
 SocketServer::~SocketServer() {
-  // Close poll descriptor.
+  // Close poll descriptors and listen sockets.
   VLOG(1) << "Stop event polling";
-  if (pollfd_ != -1) close(pollfd_);
+  for (EventLoop *loop : loops_) {
+    if (loop->pollfd != -1) close(loop->pollfd);
+    for (Listener *listener : loop->listeners) {
+      close(listener->sock);
+      delete listener;
+    }
+    delete loop;
+  }
 
-  // Delete listeners.
+  // Delete endpoints.
   VLOG(1) << "Stop listeners";
   Endpoint *endpoint = endpoints_;
   while (endpoint != nullptr) {
     Endpoint *next = endpoint->next;
-    if (endpoint->sock != -1) close(endpoint->sock);
     delete endpoint;
     endpoint = next;
   }
@@ -82,46 +90,82 @@ void SocketServer::Listen(const char *addr, int port,
 }
 
 Status SocketServer::Start() {
+  // Create event loops.
+  int num_loops = options_.sharded ? options_.num_workers : 1;
+  time_t now = time(0);
+  for (int i = 0; i < num_loops; ++i) {
+    EventLoop *loop = new EventLoop();
+    loops_.push_back(loop);
+    for (int j = 0; j < kTimerSlots; ++j) loop->wheel[j] = nullptr;
+    loop->swept = now;
+
+    // Create poll file descriptor.
+    loop->pollfd = epoll_create(1);
+    if (loop->pollfd < 0) return Error("epoll_create");
+
+    // Create listen sockets.
+    for (Endpoint *ep = endpoints_; ep != nullptr; ep = ep->next) {
+      Status st = AddListener(loop, ep);
+      if (!st.ok()) return st;
+    }
+  }
+
+  // Start workers.
+  if (options_.sharded) {
+    workers_.Start(options_.num_workers, [this](int index) {
+      this->Worker(loops_[index]);
+    });
+  } else {
+    workers_.Start(options_.num_workers, [this](int index) {
+      this->Worker(loops_[0]);
+    });
+  }
+
+  return Status::OK;
+}
+
+Status SocketServer::AddListener(EventLoop *loop, Endpoint *ep) {
   int rc;
 
-  // Create poll file descriptor.
-  pollfd_ = epoll_create(1);
-  if (pollfd_ < 0) return Error("epoll_create");
-
-  // Create listen sockets.
-  for (Endpoint *ep = endpoints_; ep != nullptr; ep = ep->next) {
-    ep->sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (ep->sock < 0) return Error("socket");
-    rc = fcntl(ep->sock, F_SETFL, O_NONBLOCK);
-    if (rc < 0) return Error("fcntl");
-    int on = 1;
-    rc = setsockopt(ep->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-    if (rc < 0) return Error("setsockopt");
-
-    // Bind listen socket.
-    rc = bind(ep->sock, reinterpret_cast<struct sockaddr *>(&ep->sin),
-              sizeof(ep->sin));
-    if (rc < 0) return Error("bind");
-
-    // Start listening on socket.
-    rc = listen(ep->sock, SOMAXCONN);
-    if (rc < 0) return Error("listen");
-
-    // Add listening socket to poll descriptor.
-    struct epoll_event ev;
-    ev.events = EPOLLIN;
-    ev.data.ptr = ep;
-    rc = epoll_ctl(pollfd_, EPOLL_CTL_ADD, ep->sock, &ev);
-    if (rc < 0) return Error("epoll_ctl");
+  // Create listen socket.
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) return Error("socket");
+  Listener *listener = new Listener(ep, sock);
+  loop->listeners.push_back(listener);
+  if (ep->sock == -1) ep->sock = sock;
+
+  rc = fcntl(sock, F_SETFL, O_NONBLOCK);
+  if (rc < 0) return Error("fcntl");
+  int on = 1;
+  rc = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (rc < 0) return Error("setsockopt");
+
+  // Let the kernel distribute new connections between the event loops.
+  if (options_.sharded) {
+    rc = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (rc < 0) return Error("setsockopt(SO_REUSEPORT)");
   }
 
-  // Start workers.
-  workers_.Start(options_.num_workers, [this](int index) { this->Worker(); });
+  // Bind listen socket.
+  rc = bind(sock, reinterpret_cast<struct sockaddr *>(&ep->sin),
+            sizeof(ep->sin));
+  if (rc < 0) return Error("bind");
+
+  // Start listening on socket.
+  rc = listen(sock, SOMAXCONN);
+  if (rc < 0) return Error("listen");
+
+  // Add listening socket to poll descriptor.
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = listener;
+  rc = epoll_ctl(loop->pollfd, EPOLL_CTL_ADD, sock, &ev);
+  if (rc < 0) return Error("epoll_ctl");
 
   return Status::OK;
 }
 
-void SocketServer::Worker() {
+void SocketServer::Worker(EventLoop *loop) {
   // Allocate event structure.
   int max_events = options_.max_events;
   struct epoll_event *events = new epoll_event[max_events];
@@ -130,7 +174,7 @@ void SocketServer::Worker() {
   while (!stop_) {
     // Get new events.
     idle_++;
-    int rc = epoll_wait(pollfd_, events, max_events, options_.timeout);
+    int rc = epoll_wait(loop->pollfd, events, max_events, options_.timeout);
     idle_--;
     if (stop_) break;
     if (rc < 0) {
@@ -139,16 +183,19 @@ void SocketServer::Worker() {
       break;
     }
     if (rc == 0) {
-      ShutdownIdleConnections();
+      ShutdownIdleConnections(loop);
       continue;
     }
 
-    // Start new worker if all workers are busy.
-    if (++active_ == workers_.size() && options_.max_workers > 0) {
+    // Start new worker if all workers are busy. The number of workers is
+    // fixed in sharded mode.
+    int active = ++active_;
+    if (active == workers_.size() && options_.max_workers > 0 &&
+        !options_.sharded) {
       MutexLock lock(&mu_);
       if (workers_.size() < options_.max_workers) {
         VLOG(3) << "Starting new worker thread " << workers_.size();
-        workers_.Start(1, [this](int index) { this->Worker(); });
+        workers_.Start(1, [this, loop](int index) { this->Worker(loop); });
       } else {
         LOG(WARNING) << "All socket worker threads are busy";
       }
@@ -159,14 +206,16 @@ void SocketServer::Worker() {
       struct epoll_event *ev = &events[i];
 
       // Check for new connection.
-      Endpoint *ep = endpoints_;
-      while (ep != nullptr) {
-        if (ep == ev->data.ptr) break;
-        ep = ep->next;
+      Listener *listener = nullptr;
+      for (Listener *l : loop->listeners) {
+        if (l == ev->data.ptr) {
+          listener = l;
+          break;
+        }
       }
-      if (ep != nullptr) {
+      if (listener != nullptr) {
         // New connection.
-        AcceptConnection(ep);
+        AcceptConnection(loop, listener);
       } else {
         // Check if connection has been closed.
         auto *conn = reinterpret_cast<SocketConnection *>(ev->data.ptr);
@@ -175,7 +224,7 @@ void SocketServer::Worker() {
           if (ev->events & EPOLLERR) {
             VLOG(5) << "Error polling socket " << conn->sock_;
           }
-          rc = epoll_ctl(pollfd_, EPOLL_CTL_DEL, conn->sock_, ev);
+          rc = epoll_ctl(loop->pollfd, EPOLL_CTL_DEL, conn->sock_, ev);
           if (rc < 0) {
             VLOG(2) << Error("epoll_ctl");
           } else {
@@ -196,6 +245,19 @@ void SocketServer::Worker() {
               conn->state_ = SOCKET_STATE_TERMINATE;
             }
           } while (conn->state_ == SOCKET_STATE_PROCESS);
+
+          // Send data that was queued by other threads while the connection
+          // was locked by this worker.
+          Status s = conn->FlushQueue(true);
+          if (!s.ok()) {
+            LOG(ERROR) << "Socket error: " << s;
+            conn->state_ = SOCKET_STATE_TERMINATE;
+          }
+
+          // Let session queue more data when the output queue is empty.
+          if (conn->queued_ == 0 && conn->state_ != SOCKET_STATE_TERMINATE) {
+            conn->session_->Drained(conn);
+          }
           VLOG(5) << "End " << conn->sock_ << " in state " << conn->State();
 
           if (conn->state_ == SOCKET_STATE_TERMINATE) {
@@ -208,6 +270,11 @@ void SocketServer::Worker() {
       }
     }
     active_--;
+
+    // Sweep timer wheel if it has not been swept in this second. This ensures
+    // that idle connections are shut down even on busy servers where polling
+    // never times out.
+    if (loop->swept != time(0)) ShutdownIdleConnections(loop);
   }
 
   // Free event structure.
@@ -224,13 +291,15 @@ void SocketServer::Shutdown() {
   stop_ = true;
 }
 
-void SocketServer::AcceptConnection(Endpoint *ep) {
+void SocketServer::AcceptConnection(EventLoop *loop, Listener *listener) {
   int rc;
 
   // Accept new connection from listen socket.
+  Endpoint *ep = listener->endpoint;
   struct sockaddr_in addr;
   socklen_t len = sizeof(addr);
-  int sock = accept(ep->sock, reinterpret_cast<struct sockaddr *>(&addr), &len);
+  struct sockaddr *saddr = reinterpret_cast<struct sockaddr *>(&addr);
+  int sock = accept(listener->sock, saddr, &len);
   if (sock < 0) {
     if (errno != EAGAIN) LOG(WARNING) << Error("accept");
     return;
@@ -249,26 +318,37 @@ void SocketServer::AcceptConnection(Endpoint *ep) {
   // Create new connection.
   VLOG(3) << "New socket connection " << sock;
   SocketConnection *conn = new SocketConnection(this, sock, ep->protocol);
+  conn->loop_ = loop;
   AddConnection(conn);
 
   // Add new connection to poll descriptor.
   struct epoll_event ev;
   ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
   ev.data.ptr = conn;
-  rc = epoll_ctl(pollfd_, EPOLL_CTL_ADD, sock, &ev);
+  rc = epoll_ctl(loop->pollfd, EPOLL_CTL_ADD, sock, &ev);
   if (rc < 0) LOG(WARNING) << Error("epoll_ctl");
   ep->num_connects++;
 }
 
 void SocketServer::AddConnection(SocketConnection *conn) {
-  MutexLock lock(&mu_);
-  conn->next_ = connections_;
-  conn->prev_ = nullptr;
-  if (connections_ != nullptr) connections_->prev_ = conn;
-  connections_ = conn;
+  {
+    MutexLock lock(&mu_);
+    conn->next_ = connections_;
+    conn->prev_ = nullptr;
+    if (connections_ != nullptr) connections_->prev_ = conn;
+    connections_ = conn;
+  }
+
+  MutexLock lock(&conn->loop_->mu);
+  Schedule(conn->loop_, conn, conn->last_ + conn->idle_timeout_);
 }
 
 void SocketServer::RemoveConnection(SocketConnection *conn) {
+  {
+    MutexLock lock(&conn->loop_->mu);
+    Unschedule(conn->loop_, conn);
+  }
+
   MutexLock lock(&mu_);
   if (conn->prev_ != nullptr) conn->prev_->next_ = conn->next_;
   if (conn->next_ != nullptr) conn->next_->prev_ = conn->prev_;
@@ -276,17 +356,68 @@ void SocketServer::RemoveConnection(SocketConnection *conn) {
   conn->next_ = conn->prev_ = nullptr;
 }
 
-void SocketServer::ShutdownIdleConnections() {
-  MutexLock lock(&mu_);
+void SocketServer::Schedule(EventLoop *loop, SocketConnection *conn,
+                            time_t expiry) {
+  int slot = expiry % kTimerSlots;
+  conn->timer_slot_ = slot;
+  conn->timer_prev_ = nullptr;
+  conn->timer_next_ = loop->wheel[slot];
+  if (conn->timer_next_ != nullptr) conn->timer_next_->timer_prev_ = conn;
+  loop->wheel[slot] = conn;
+}
+
+void SocketServer::Unschedule(EventLoop *loop, SocketConnection *conn) {
+  if (conn->timer_slot_ == -1) return;
+  if (conn->timer_prev_ != nullptr) {
+    conn->timer_prev_->timer_next_ = conn->timer_next_;
+  } else {
+    loop->wheel[conn->timer_slot_] = conn->timer_next_;
+  }
+  if (conn->timer_next_ != nullptr) {
+    conn->timer_next_->timer_prev_ = conn->timer_prev_;
+  }
+  conn->timer_slot_ = -1;
+  conn->timer_next_ = conn->timer_prev_ = nullptr;
+}
+
+void SocketServer::ShutdownIdleConnections(EventLoop *loop) {
+  MutexLock lock(&loop->mu);
   time_t now = time(0);
-  SocketConnection *conn = connections_;
-  while (conn != nullptr) {
-    if (now - conn->last_ > conn->idle_timeout_) {
-      conn->Shutdown();
-      VLOG(5) << "Shut down idle connection";
+  time_t swept = loop->swept;
+  if (now <= swept) return;
+
+  // Check the slots that have expired since the last sweep. At most one full
+  // rotation of the wheel needs to be checked.
+  time_t start = swept + 1;
+  if (now - start >= kTimerSlots) start = now - kTimerSlots + 1;
+  for (time_t t = start; t <= now; ++t) {
+    // Detach connections in slot.
+    int slot = t % kTimerSlots;
+    SocketConnection *conn = loop->wheel[slot];
+    loop->wheel[slot] = nullptr;
+
+    while (conn != nullptr) {
+      SocketConnection *next = conn->timer_next_;
+      conn->timer_slot_ = -1;
+      time_t expiry = conn->last_ + conn->idle_timeout_;
+      if (expiry < now) {
+        // Shut down idle connection. The connection is checked again in the
+        // next second in case it has not been closed by then.
+        conn->Shutdown();
+        VLOG(5) << "Shut down idle connection";
+        expiry = now + 1;
+      } else if (expiry == now) {
+        // The connection has been idle for exactly the timeout, so it expires
+        // in the next second.
+        expiry = now + 1;
+      }
+
+      // Move connection to the slot for its current expiry time.
+      Schedule(loop, conn, expiry);
+      conn = next;
     }
-    conn = conn->next_;
   }
+  loop->swept = now;
 }
 
 void SocketServer::OutputSocketZ(IOBuffer *out) const {
@@ -389,6 +520,13 @@ SocketConnection::~SocketConnection() {
 
 Status SocketConnection::Process() {
   SocketSession *session = session_;
+
+  // Send queued data if there is no pending response.
+  if (state_ == SOCKET_STATE_IDLE || state_ == SOCKET_STATE_RECEIVE) {
+    Status st = SendQueue();
+    if (!st.ok()) return st;
+  }
+
   switch (state_) {
     case SOCKET_STATE_IDLE:
       // Allocate request buffer.
@@ -402,21 +540,13 @@ Status SocketConnection::Process() {
 
     case SOCKET_STATE_RECEIVE: {
       // Keep reading until input is exhausted.
-      bool done = false;
-      size_t before = request_.available();
-      while (!done) {
-        // Expand request buffer to ensure we have room to read data.
-        request_.Ensure(1);
-
-        // Receive more data.
-        Status st = Recv(&request_, &done);
-        if (!st.ok()) return st;
-        if (state_ == SOCKET_STATE_TERMINATE) return Status::OK;
-      }
+      bool received;
+      Status st = Receive(&received);
+      if (!st.ok()) return st;
+      if (state_ == SOCKET_STATE_TERMINATE) return Status::OK;
 
       // Check if any input was received.
-      size_t after = request_.available();
-      if (after == before) return Status::OK;
+      if (!received) return Status::OK;
 
       state_ = SOCKET_STATE_PROCESS;
       FALLTHROUGH_INTENDED;
@@ -453,24 +583,30 @@ Status SocketConnection::Process() {
     }
 
     case SOCKET_STATE_SEND: {
-      // Send response header.
-      while (response_header_.available() > 0) {
-        bool done;
-        Status st = Send(&response_header_, &done);
-        if (!st.ok()) return st;
-        if (done) return Status::OK;
-      }
-
-      // Send response body.
-      while (response_body_.available() > 0) {
+      // Send response header and body.
+      while (response_header_.available() > 0 ||
+             response_body_.available() > 0) {
         bool done;
-        Status st = Send(&response_body_, &done);
+        Status st = SendResponse(file_ != nullptr, &done);
         if (!st.ok()) return st;
         if (done) return Status::OK;
       }
 
       // Send file data.
       while (file_ != nullptr) {
+        // Send file directly from file descriptor if possible.
+        int fd = -1;
+        if (sendfile_ && server_->options().zero_copy) {
+          fd = file_->Descriptor();
+        }
+        if (fd != -1) {
+          bool done;
+          Status st = SendFileData(fd, &done);
+          if (!st.ok()) return st;
+          if (done) return Status::OK;
+          continue;
+        }
+
         if (response_body_.empty()) {
           // Read next chunk from file.
           uint64 read;
@@ -504,12 +640,33 @@ Status SocketConnection::Process() {
         }
       }
 
+      // Send queued data after the response. If the queue could not be sent
+      // without blocking, the rest is sent when the socket becomes writable.
+      Status st = SendQueue();
+      if (!st.ok()) return st;
+      if (queue_blocked_ || state_ == SOCKET_STATE_TERMINATE) {
+        return Status::OK;
+      }
+
       // Reset buffer.
       if (!close_) {
         // Clear buffers.
         request_.Flush();
         response_header_.Clear();
         response_body_.Clear();
+        sendfile_ = true;
+
+        // Pipelined requests that have already been received are processed
+        // right away. Otherwise, try to read the next request before going
+        // back to polling, since it might already have arrived while the
+        // response was being generated. This is only done in the worker
+        // thread, since pushed data is sent outside the request loop.
+        if (request_.available() == 0 && !pushing_) {
+          bool received;
+          Status st = Receive(&received);
+          if (!st.ok()) return st;
+          if (state_ == SOCKET_STATE_TERMINATE) return Status::OK;
+        }
 
         // Mark connection as idle if all received data has been processed.
         if (request_.available() > 0) {
@@ -532,6 +689,23 @@ Status SocketConnection::Process() {
   }
 }
 
+Status SocketConnection::Receive(bool *received) {
+  bool done = false;
+  size_t before = request_.available();
+  while (!done) {
+    // Expand request buffer to ensure we have room to read data.
+    request_.Ensure(1);
+
+    // Receive more data.
+    Status st = Recv(&request_, &done);
+    if (!st.ok()) return st;
+    if (state_ == SOCKET_STATE_TERMINATE) break;
+  }
+  *received = request_.available() > before;
+  if (*received && before == 0) request_start_ = Clock::now();
+  return Status::OK;
+}
+
 Status SocketConnection::Recv(IOBuffer *buffer, bool *done) {
   *done = false;
   int rc = recv(sock_, buffer->end(), buffer->remaining(), 0);
@@ -583,12 +757,188 @@ Status SocketConnection::Send(IOBuffer *buffer, bool *done) {
   return Status::OK;
 }
 
+Status SocketConnection::SendResponse(bool more, bool *done) {
+  *done = false;
+
+  // Gather response header and body.
+  struct iovec iov[2];
+  int n = 0;
+  size_t hdrlen = response_header_.available();
+  if (hdrlen > 0) {
+    iov[n].iov_base = response_header_.begin();
+    iov[n].iov_len = hdrlen;
+    n++;
+  }
+  if (response_body_.available() > 0) {
+    iov[n].iov_base = response_body_.begin();
+    iov[n].iov_len = response_body_.available();
+    n++;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  int flags = MSG_NOSIGNAL;
+  if (more) flags |= MSG_MORE;
+  ssize_t rc = sendmsg(sock_, &msg, flags);
+  if (rc <= 0) {
+    *done = true;
+    if (rc == 0) {
+      // Connection closed.
+      VLOG(6) << "Send " << sock_ << " closed";
+      state_ = SOCKET_STATE_TERMINATE;
+      return Status::OK;
+    } else if (errno == EAGAIN) {
+      // Output queue full.
+      VLOG(6) << "Send " << sock_ << " again";
+      return Status::OK;
+    } else {
+      // Send error.
+      VLOG(6) << "Send " << sock_ << " done";
+      return Error("sendmsg");
+    }
+  }
+  VLOG(6) << "Send " << sock_ << ", " << rc << " bytes";
+
+  // Consume sent data from header and body.
+  size_t sent = rc;
+  size_t hdrsent = sent < hdrlen ? sent : hdrlen;
+  response_header_.Consume(hdrsent);
+  response_body_.Consume(sent - hdrsent);
+  tx_bytes_ += rc;
+  return Status::OK;
+}
+
+Status SocketConnection::SendFileData(int fd, bool *done) {
+  *done = false;
+  ssize_t rc = sendfile(sock_, fd, nullptr, 1 << 30);
+  if (rc < 0) {
+    if (errno == EAGAIN) {
+      // Output queue full.
+      VLOG(6) << "Sendfile " << sock_ << " again";
+      *done = true;
+      return Status::OK;
+    } else if (errno == EINVAL || errno == ENOSYS) {
+      // Fall back to reading file into buffer. The file position has been
+      // advanced past the data that has already been sent.
+      VLOG(6) << "Sendfile " << sock_ << " not supported";
+      sendfile_ = false;
+      return Status::OK;
+    } else {
+      // Send error.
+      file_->Close();
+      file_ = nullptr;
+      return Error("sendfile");
+    }
+  }
+
+  if (rc == 0) {
+    // End of file.
+    file_->Close();
+    file_ = nullptr;
+  } else {
+    VLOG(6) << "Sendfile " << sock_ << ", " << rc << " bytes";
+    tx_bytes_ += rc;
+  }
+  return Status::OK;
+}
+
+Status SocketConnection::SendQueue() {
+  MutexLock lock(&queue_mu_);
+  queue_blocked_ = false;
+  while (!queue_.empty()) {
+    // Gather queued buffers.
+    static const int kMaxBuffers = 64;
+    struct iovec iov[kMaxBuffers];
+    int n = 0;
+    for (auto &buffer : queue_) {
+      if (n == kMaxBuffers) break;
+      size_t skip = n == 0 ? queue_offset_ : 0;
+      iov[n].iov_base = const_cast<char *>(buffer->data()) + skip;
+      iov[n].iov_len = buffer->size() - skip;
+      n++;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    ssize_t rc = sendmsg(sock_, &msg, MSG_NOSIGNAL);
+    if (rc <= 0) {
+      if (rc == 0) {
+        // Connection closed.
+        VLOG(6) << "Send " << sock_ << " closed";
+        state_ = SOCKET_STATE_TERMINATE;
+        return Status::OK;
+      } else if (errno == EAGAIN) {
+        // Output queue full.
+        VLOG(6) << "Send " << sock_ << " again";
+        queue_blocked_ = true;
+        return Status::OK;
+      } else {
+        // Send error.
+        VLOG(6) << "Send " << sock_ << " done";
+        return Error("sendmsg");
+      }
+    }
+    VLOG(6) << "Send " << sock_ << ", " << rc << " queued bytes";
+
+    // Remove sent data from queue.
+    size_t sent = rc;
+    while (sent > 0) {
+      size_t left = queue_.front()->size() - queue_offset_;
+      if (sent < left) {
+        queue_offset_ += sent;
+        break;
+      }
+      sent -= left;
+      queue_.pop_front();
+      queue_offset_ = 0;
+    }
+    queued_ -= rc;
+    tx_bytes_ += rc;
+  }
+  return Status::OK;
+}
+
+bool SocketConnection::QueuePending() {
+  MutexLock lock(&queue_mu_);
+  return !queue_.empty() && !queue_blocked_;
+}
+
+Status SocketConnection::FlushQueue(bool wait) {
+  // Another thread can queue data after the queue has been sent but before the
+  // connection is unlocked. Its attempt to lock the connection fails, so the
+  // queue is checked again after the connection has been unlocked.
+  while (QueuePending()) {
+    if (wait) {
+      mu_.Lock();
+    } else if (!mu_.TryLock()) {
+      break;
+    }
+    Status st;
+    bool idle = state_ == SOCKET_STATE_IDLE || state_ == SOCKET_STATE_RECEIVE;
+    if (idle) st = SendQueue();
+    mu_.Unlock();
+    if (!idle || !st.ok()) return st;
+  }
+  return Status::OK;
+}
+
 void SocketConnection::Upgrade(SocketSession *session) {
   CHECK_EQ(state_, SOCKET_STATE_PROCESS)
       << "Socket protocol upgrade only allowed in PROCESS state";
   session_ = session;
   if (session_->IdleTimeout() != -1) {
     idle_timeout_ = session_->IdleTimeout();
+
+    // Move connection in timer wheel if the idle timeout has changed.
+    if (loop_ != nullptr) {
+      MutexLock lock(&loop_->mu);
+      server_->Unschedule(loop_, this);
+      server_->Schedule(loop_, this, last_ + idle_timeout_);
+    }
   }
 }
 
@@ -607,9 +957,42 @@ void SocketConnection::Push(const void *hdr, size_t hdrlen,
 
   if (!self) {
     state_ = SOCKET_STATE_SEND;
+    pushing_ = true;
     Process();
+    pushing_ = false;
     Unlock();
+
+    // Send data queued by other threads while the connection was locked.
+    Status st = FlushQueue(false);
+    if (!st.ok()) {
+      LOG(ERROR) << "Socket error: " << st;
+      Shutdown();
+    }
+  }
+}
+
+bool SocketConnection::Enqueue(const std::shared_ptr<const string> &data,
+                               size_t limit) {
+  // Add data to output queue unless the client is too far behind.
+  {
+    MutexLock lock(&queue_mu_);
+    if (limit > 0 && queued_ + data->size() > limit) return false;
+    queue_.push_back(data);
+    queued_ += data->size();
+  }
+
+  // Try to send the data right away if the connection is idle. If the
+  // connection is locked by another thread, that thread sends the data after
+  // unlocking the connection. If the connection is busy, the data is sent by
+  // the worker when it is done.
+  if (pthread_self() != worker_) {
+    Status st = FlushQueue(false);
+    if (!st.ok()) {
+      LOG(ERROR) << "Socket error: " << st;
+      Shutdown();
+    }
   }
+  return true;
 }
 
 const char *SocketConnection::State() const {
@@ -17,9 +17,13 @@
 
 #include <time.h>
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
 #include <vector>
 #include <netinet/in.h>
 
+#include "sling/base/clock.h"
 #include "sling/base/status.h"
 #include "sling/base/types.h"
 #include "sling/file/file.h"
@@ -65,6 +69,15 @@ struct SocketServerOptions {
 
   // File data buffer size.
   int file_bufsiz = 1 << 16;
+
+  // Use sendfile() for streaming files that are backed by a file descriptor.
+  bool zero_copy = true;
+
+  // Run one event loop per worker thread. Each worker has its own listen
+  // sockets (using SO_REUSEPORT) and poll descriptor, and connections stay in
+  // the event loop that accepted them. The number of workers is fixed in
+  // sharded mode.
+  bool sharded = false;
 };
 
 // Socket server.
@@ -93,9 +106,12 @@ class SocketServer {
   void OutputSocketZ(IOBuffer *out) const;
 
   // Check if server has been started.
-  bool started() const { return pollfd_ != -1; }
+  bool started() const { return !loops_.empty(); }
 
  private:
+  // Number of slots in idle timer wheel. Each slot covers one second.
+  static const int kTimerSlots = 64;
+
   // Endpoint for listening for new connections for protocol.
   struct Endpoint {
     Endpoint(const char *addr, int port, SocketProtocol *protocol);
@@ -107,11 +123,35 @@ class SocketServer {
     Endpoint *next;            // next endpoint
   };
 
+  // Listen socket for endpoint in event loop.
+  struct Listener {
+    Listener(Endpoint *ep, int sock) : endpoint(ep), sock(sock) {}
+
+    Endpoint *endpoint;        // endpoint for listener
+    int sock;                  // listen socket
+  };
+
+  // Event loop with poll descriptor and listen sockets. Idle connections in
+  // the event loop are tracked in a timer wheel, where each connection is in
+  // the slot for the time it is expected to expire. Since the connection
+  // activity time is updated without moving the connection in the wheel,
+  // connections are re-inserted in new slots when their slot expires.
+  struct EventLoop {
+    int pollfd = -1;                        // poll descriptor
+    std::vector<Listener *> listeners;      // listen sockets for event loop
+    SocketConnection *wheel[kTimerSlots];   // timer wheel for idle timeouts
+    std::atomic<time_t> swept{0};           // last time wheel was swept
+    Mutex mu;                               // mutex for timer wheel
+  };
+
+  // Create listen socket for endpoint in event loop.
+  Status AddListener(EventLoop *loop, Endpoint *ep);
+
   // Worker handler.
-  void Worker();
+  void Worker(EventLoop *loop);
 
   // Accept new connection.
-  void AcceptConnection(Endpoint *ep);
+  void AcceptConnection(EventLoop *loop, Listener *listener);
 
   // Process I/O events for connection.
   void Process(SocketConnection *conn, int events);
@@ -122,14 +162,22 @@ class SocketServer {
   // Remove connection from server.
   void RemoveConnection(SocketConnection *conn);
 
-  // Shut down idle connections.
-  void ShutdownIdleConnections();
+  // Shut down idle connections in expired timer wheel slots.
+  void ShutdownIdleConnections(EventLoop *loop);
+
+  // Add connection to timer wheel slot for expiry time. The event loop must
+  // be locked.
+  void Schedule(EventLoop *loop, SocketConnection *conn, time_t expiry);
+
+  // Remove connection from timer wheel. The event loop must be locked.
+  void Unschedule(EventLoop *loop, SocketConnection *conn);
 
   // Server configuration.
   SocketServerOptions options_;
 
-  // File descriptor for epoll.
-  int pollfd_ = -1;
+  // Event loops. There is one event loop per worker in sharded mode and
+  // otherwise one event loop shared by all workers.
+  std::vector<EventLoop *> loops_;
 
   // Mutex for serializing access to server state.
   mutable Mutex mu_;
@@ -151,6 +199,8 @@ class SocketServer {
 
   // Flag to determine if server is shutting down.
   bool stop_ = false;
+
+  friend class SocketConnection;
 };
 
 // Socket connection.
@@ -174,6 +224,18 @@ class SocketConnection {
   // Send data back to client.
   void Push(const void *hdr, size_t hdrlen, const void *data, size_t datalen);
 
+  // Queue shared data buffer for sending to client. This never blocks on the
+  // connection, so it can be used for sending the same data to many clients.
+  // Queued data is sent after any pending response. Returns false if the data
+  // would make the output queue exceed limit bytes (zero means no limit).
+  bool Enqueue(const std::shared_ptr<const string> &data, size_t limit = 0);
+
+  // Number of bytes in output queue.
+  size_t queued() const { return queued_; }
+
+  // Shut down connection.
+  void Shutdown();
+
   // Server for connection.
   SocketServer *server() const { return server_; }
 
@@ -196,17 +258,43 @@ class SocketConnection {
   // Last time event was received on connection.
   time_t last() const { return last_; }
 
+  // Cycle counter timestamp for when the data for the current request started
+  // to arrive.
+  Clock::Timestamp request_start() const { return request_start_; }
+
  private:
   // Receive data into buffer until it is full or all data that can be received
   // without blocking has been received.
   Status Recv(IOBuffer *buffer, bool *done);
 
+  // Receive all data that can be received without blocking into the request
+  // buffer. Sets received to true if any data was received.
+  Status Receive(bool *received);
+
   // Send data from buffer until all data has been sent or all the data that can
   // be sent without blocking has been sent.
   Status Send(IOBuffer *buffer, bool *done);
 
-  // Shut down connection.
-  void Shutdown();
+  // Send response header and body in one system call. If more is true, the
+  // kernel is told that more data follows, so the header can be coalesced
+  // with the file data.
+  Status SendResponse(bool more, bool *done);
+
+  // Send file data from file descriptor without copying it to user space.
+  Status SendFileData(int fd, bool *done);
+
+  // Send data from output queue until the queue is empty or no more data can
+  // be sent without blocking. The connection must be locked.
+  Status SendQueue();
+
+  // Check if the output queue has data that can be sent without blocking.
+  bool QueuePending();
+
+  // Send data from output queue if the connection is idle. The connection is
+  // locked while sending and checked again for newly queued data after it has
+  // been unlocked. If wait is false, the queue is left to the thread holding
+  // the lock if the connection is already locked.
+  Status FlushQueue(bool wait);
 
   // Server for connection.
   SocketServer *server_;
@@ -230,6 +318,14 @@ class SocketConnection {
   SocketConnection *next_;
   SocketConnection *prev_;
 
+  // Event loop for connection.
+  SocketServer::EventLoop *loop_ = nullptr;
+
+  // Timer wheel slot and list for idle timeouts.
+  int timer_slot_ = -1;
+  SocketConnection *timer_next_ = nullptr;
+  SocketConnection *timer_prev_ = nullptr;
+
   // Buffers for request and response header/body.
   IOBuffer request_;
   IOBuffer response_header_;
@@ -238,12 +334,34 @@ class SocketConnection {
   // File for streaming response.
   File *file_ = nullptr;
 
+  // Use sendfile() for streaming response file. This is disabled if the
+  // kernel does not support sendfile() for the file.
+  bool sendfile_ = true;
+
   // Close connection after response has been sent.
   bool close_ = false;
 
+  // Data is being pushed to the client from outside the worker thread.
+  bool pushing_ = false;
+
+  // Output queue with shared data buffers. The offset is the number of bytes
+  // already sent from the first buffer in the queue.
+  Mutex queue_mu_;
+  std::deque<std::shared_ptr<const string>> queue_;
+  size_t queue_offset_ = 0;
+  std::atomic<size_t> queued_{0};
+
+  // The last send from the output queue would have blocked. The rest of the
+  // queue is sent by the worker when the socket becomes writable. This is only
+  // updated while holding both the connection lock and the queue lock.
+  bool queue_blocked_ = false;
+
   // Thread handle for worker processing a request on the connection.
   pthread_t worker_ = 0;
 
+  // Timestamp for start of current request.
+  Clock::Timestamp request_start_ = 0;
+
   // Statistics.
   uint64 rx_bytes_ = 0;
   uint64 tx_bytes_ = 0;
@@ -293,6 +411,11 @@ class SocketSession {
   // Process the request in the request buffer and return the response header
   // and body. Return false to terminate the session.
   virtual Continuation Process(SocketConnection *conn) = 0;
+
+  // Called by the worker thread after processing events for the connection
+  // when there is no data left in the output queue. Sessions that push data
+  // to the client can use this for queuing more data.
+  virtual void Drained(SocketConnection *conn) {}
 };
 
 }  // namespace sling
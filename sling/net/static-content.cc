@@ -27,6 +27,11 @@
 DEFINE_string(webdir, "/intern", "Base directory for serving web contents");
 DEFINE_bool(webcache, true, "Enable caching of web content");
 DEFINE_string(static_expires, "", "Expiry time for static content");
+DEFINE_int32(webgzip_max_size, 16 << 20,
+             "Maximum size of gzip-compressed static files (0=disabled)");
+DEFINE_int32(webgzip_level, 9, "Compression level for static content");
+DEFINE_int32(webgzip_cache_size, 64 << 20,
+             "Maximum total size of cached gzip-compressed static files");
 
 namespace sling {
 
@@ -155,6 +160,15 @@ void StaticContent::HandleFile(HTTPRequest *request, HTTPResponse *response) {
     }
   }
 
+  // Compressible files can be returned gzip-compressed, so the response
+  // depends on the Accept-Encoding header of the request.
+  const char *mimetype = GetMimeType(GetExtension(filename.c_str()));
+  uint64 max_gzip_size = FLAGS_webgzip_max_size;
+  bool compressible = FLAGS_webgzip_max_size > 0 &&
+                      stat.size <= max_gzip_size &&
+                      CompressibleContentType(mimetype);
+  if (compressible) response->Set("Vary", "Accept-Encoding");
+
   // Check if file has changed.
   const char *cached = request->Get("If-modified-since");
   const char *control = request->Get("Cache-Control");
@@ -168,7 +182,6 @@ void StaticContent::HandleFile(HTTPRequest *request, HTTPResponse *response) {
   }
 
   // Set content type from file extension.
-  const char *mimetype = GetMimeType(GetExtension(filename.c_str()));
   if (mimetype != nullptr) {
     response->set_content_type(mimetype);
   }
@@ -187,8 +200,20 @@ void StaticContent::HandleFile(HTTPRequest *request, HTTPResponse *response) {
     }
   }
 
+  // Return compressed file content if client accepts gzip encoding. The
+  // headers for a HEAD request are the same as for a GET request.
+  bool head = method == HTTP_HEAD;
+  if (compressible &&
+      AcceptsEncoding(request->Get("Accept-Encoding"), "gzip") &&
+      SendCompressed(filename, stat, !head, response)) {
+    return;
+  }
+
   // Do not return file content if only headers were requested.
-  if (method == HTTP_HEAD) return;
+  if (head) {
+    response->set_content_length(stat.size);
+    return;
+  }
 
   // Open requested file.
   File *file;
@@ -212,5 +237,69 @@ void StaticContent::HandleFile(HTTPRequest *request, HTTPResponse *response) {
   response->SendFile(file);
 }
 
+bool StaticContent::SendCompressed(const string &filename,
+                                   const FileStat &stat,
+                                   bool body,
+                                   HTTPResponse *response) {
+  // Look up file in compressed file cache.
+  {
+    MutexLock lock(&mu_);
+    auto f = compressed_.find(filename);
+    if (f != compressed_.end()) {
+      const CompressedFile &entry = f->second;
+      if (entry.mtime == stat.mtime && entry.size == stat.size) {
+        if (!entry.useful) return false;
+        response->Set("Content-Encoding", "gzip");
+        response->set_content_length(entry.data.size());
+        if (body) response->Append(entry.data);
+        return true;
+      }
+    }
+  }
+
+  // Read and compress file outside the lock.
+  string content;
+  if (!File::ReadContents(filename, &content).ok()) return false;
+  CompressedFile entry;
+  entry.mtime = stat.mtime;
+  entry.size = content.size();
+  if (GZipCompress(content.data(), content.size(), FLAGS_webgzip_level,
+                   &entry.data)) {
+    entry.useful = entry.data.size() < content.size();
+  }
+  if (!entry.useful) entry.data.clear();
+  VLOG(5) << "Compressed " << filename << " from " << content.size()
+          << " to " << entry.data.size() << " bytes";
+
+  // Return compressed content.
+  bool useful = entry.useful;
+  if (useful) {
+    response->Set("Content-Encoding", "gzip");
+    response->set_content_length(entry.data.size());
+    if (body) response->Append(entry.data);
+  }
+
+  // Add compressed file to cache. The file might have changed since it was
+  // stat'ed, in which case the next request will compress it again. Entries
+  // are evicted when the cache is full.
+  MutexLock lock(&mu_);
+  auto f = compressed_.find(filename);
+  if (f != compressed_.end()) {
+    compressed_bytes_ -= CacheSize(f->first, f->second);
+    compressed_.erase(f);
+  }
+  uint64 size = CacheSize(filename, entry);
+  uint64 capacity = FLAGS_webgzip_cache_size;
+  if (size > capacity) return useful;
+  while (compressed_bytes_ + size > capacity && !compressed_.empty()) {
+    auto victim = compressed_.begin();
+    compressed_bytes_ -= CacheSize(victim->first, victim->second);
+    compressed_.erase(victim);
+  }
+  compressed_bytes_ += size;
+  compressed_[filename] = std::move(entry);
+  return useful;
+}
+
 }  // namespace sling
 
@@ -16,9 +16,12 @@
 #define SLING_NET_STATIC_CONTENT_H_
 
 #include <string>
+#include <unordered_map>
 
 #include "sling/base/types.h"
+#include "sling/file/file.h"
 #include "sling/net/http-server.h"
+#include "sling/util/mutex.h"
 
 namespace sling {
 
@@ -39,6 +42,25 @@ class StaticContent {
   void set_index_fallback(bool b) { index_fallback_ = b; }
 
  private:
+  // Compressed file content.
+  struct CompressedFile {
+    time_t mtime = 0;      // modification time of source file
+    uint64 size = 0;       // size of source file
+    bool useful = false;   // compressed content is smaller than source file
+    string data;           // gzip-compressed file content
+  };
+
+  // Return gzip-compressed file content in response. Only the headers are
+  // set if body is false. Returns false if the file cannot be compressed or
+  // compression does not reduce its size.
+  bool SendCompressed(const string &filename, const FileStat &stat,
+                      bool body, HTTPResponse *response);
+
+  // Memory used by compressed file cache entry.
+  static uint64 CacheSize(const string &filename, const CompressedFile &file) {
+    return sizeof(CompressedFile) + filename.size() + file.data.size();
+  }
+
   // URL path for static content.
   string url_;
 
@@ -47,6 +69,12 @@ class StaticContent {
 
   // Return index page if file not found.
   bool index_fallback_ = false;
+
+  // Cache of compressed files keyed by file name. The total size of the
+  // cache is bounded by --webgzip_cache_size.
+  std::unordered_map<string, CompressedFile> compressed_;
+  uint64 compressed_bytes_ = 0;
+  Mutex mu_;
 };
 
 }  // namespace sling
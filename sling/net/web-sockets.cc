@@ -167,6 +167,12 @@ void WebSocket::Close() {
 }
 
 void WebSocket::Send(int type, const void *data, size_t size) {
+  SendFrame(Frame(type, data, size));
+}
+
+std::shared_ptr<const string> WebSocket::Frame(int type,
+                                               const void *data,
+                                               size_t size) {
   uint8 hdr[16];
 
   // Setup fragment header.
@@ -192,8 +198,12 @@ void WebSocket::Send(int type, const void *data, size_t size) {
     hdrlen = 10;
   }
 
-  // Write header and payload to output.
-  conn_->Push(&hdr, hdrlen, data, size);
+  // Write header and payload to frame.
+  auto *frame = new string();
+  frame->reserve(hdrlen + size);
+  frame->append(reinterpret_cast<char *>(hdr), hdrlen);
+  if (size > 0) frame->append(static_cast<const char *>(data), size);
+  return std::shared_ptr<const string>(frame);
 }
 
 }  // namespace sling
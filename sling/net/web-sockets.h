@@ -15,6 +15,9 @@
 #ifndef SLING_NET_WEB_SOCKETS_H_
 #define SLING_NET_WEB_SOCKETS_H_
 
+#include <memory>
+#include <string>
+
 #include "sling/net/socket-server.h"
 #include "sling/net/http-server.h"
 
@@ -63,6 +66,23 @@ class WebSocket : public SocketSession {
     Send(WS_OP_TEXT, data, size);
   }
 
+  // Build frame for sending the same packet to multiple clients.
+  static std::shared_ptr<const string> Frame(int type,
+                                             const void *data,
+                                             size_t size);
+  static std::shared_ptr<const string> Frame(const Slice &packet) {
+    return Frame(WS_OP_BIN, packet.data(), packet.size());
+  }
+
+  // Queue frame for sending to client without blocking. Returns false if the
+  // client has more than limit bytes waiting to be sent (zero means no limit).
+  bool SendFrame(const std::shared_ptr<const string> &frame, size_t limit = 0) {
+    return conn_->Enqueue(frame, limit);
+  }
+
+  // Shut down the connection to the client.
+  void Disconnect() { conn_->Shutdown(); }
+
   // Last time event was received on connection.
   time_t last() const { return conn_->last(); }
 
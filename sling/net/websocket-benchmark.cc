@@ -0,0 +1,329 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/net/http-server.h"
+#include "sling/net/http-stats.h"
+#include "sling/net/web-sockets.h"
+#include "sling/util/mutex.h"
+#include "sling/util/thread.h"
+
+DEFINE_int32(port, 8092, "Port for benchmark HTTP server");
+DEFINE_int32(workers, 8, "Number of server worker threads");
+DEFINE_int32(clients, 300, "Number of simulated WebSocket clients");
+DEFINE_int32(readers, 4, "Number of client threads for reading frames");
+DEFINE_int32(senders, 10, "Number of clients sending updates");
+DEFINE_int32(messages, 200, "Number of updates sent by each sender");
+DEFINE_int32(interval, 50000, "Time between updates from a sender in us");
+DEFINE_int32(size, 256, "Update size in bytes");
+DEFINE_int32(backlog, 16, "Maximum output backlog in MB for slow clients");
+
+using namespace sling;
+
+// Broadcast hub on the server. Updates received from a client are broadcast
+// to all the other clients in the same way as collaboration updates.
+class Hub {
+ public:
+  class Client : public WebSocket {
+   public:
+    Client(Hub *hub, SocketConnection *conn) : WebSocket(conn), hub_(hub) {
+      hub_->Add(this);
+    }
+    ~Client() { hub_->Remove(this); }
+
+    void Receive(const uint8 *data, uint64 size, bool binary) override {
+      hub_->Broadcast(this, data, size);
+    }
+
+   private:
+    Hub *hub_;
+  };
+
+  // Upgrade HTTP connection to WebSocket client.
+  void Connect(HTTPRequest *request, HTTPResponse *response) {
+    Client *client = new Client(this, request->conn());
+    if (!WebSocket::Upgrade(client, request, response)) {
+      delete client;
+      response->SendError(404);
+    }
+  }
+
+  // Number of clients disconnected for falling behind.
+  int disconnects() const { return disconnects_; }
+
+ private:
+  void Add(Client *client) {
+    MutexLock lock(&mu_);
+    clients_.insert(client);
+  }
+
+  void Remove(Client *client) {
+    MutexLock lock(&mu_);
+    clients_.erase(client);
+  }
+
+  // Frame update once and queue it to all the other clients.
+  void Broadcast(Client *source, const void *data, size_t size) {
+    auto frame = WebSocket::Frame(WebSocket::WS_OP_BIN, data, size);
+    size_t limit = static_cast<size_t>(FLAGS_backlog) << 20;
+    MutexLock lock(&mu_);
+    for (Client *client : clients_) {
+      if (client == source) continue;
+      if (!client->SendFrame(frame, limit)) {
+        disconnects_++;
+        client->Disconnect();
+      }
+    }
+  }
+
+  Mutex mu_;
+  std::unordered_set<Client *> clients_;
+  std::atomic<int> disconnects_{0};
+};
+
+// Simulated WebSocket client connection.
+class Connection {
+ public:
+  // Connect to server and upgrade connection to WebSocket.
+  explicit Connection(int port) {
+    sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(sock_ != -1);
+    int on = 1;
+    setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+    CHECK(connect(sock_, reinterpret_cast<sockaddr *>(&sin), sizeof(sin)) == 0)
+        << "Unable to connect to port " << port;
+
+    Write("GET /ws HTTP/1.1\r\n"
+          "Host: localhost\r\n"
+          "Connection: Upgrade\r\n"
+          "Upgrade: websocket\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+          "Sec-WebSocket-Version: 13\r\n"
+          "\r\n");
+    size_t eoh;
+    while ((eoh = buffer_.find("\r\n\r\n")) == string::npos) {
+      CHECK(Read()) << "Connection closed";
+    }
+    CHECK_EQ(buffer_.compare(0, 12, "HTTP/1.1 101"), 0)
+        << buffer_.substr(0, buffer_.find("\r\n"));
+    buffer_.erase(0, eoh + 4);
+  }
+
+  ~Connection() { close(sock_); }
+
+  // Send update with the current time stamp. Client frames are masked with an
+  // all-zero key, so the payload is sent as is.
+  void SendUpdate() {
+    string frame;
+    frame.push_back(0x80 | WebSocket::WS_OP_BIN);
+    if (FLAGS_size < 0x7E) {
+      frame.push_back(0x80 | FLAGS_size);
+    } else {
+      frame.push_back(0xFE);
+      frame.push_back(FLAGS_size >> 8);
+      frame.push_back(FLAGS_size & 0xFF);
+    }
+    frame.append(4, '\0');
+    Clock::Timestamp now = Clock::now();
+    frame.append(reinterpret_cast<const char *>(&now), sizeof(now));
+    frame.append(FLAGS_size - sizeof(now), 'x');
+    Write(frame);
+  }
+
+  // Read available data and add the delivery latency for all complete frames
+  // to the histogram. Returns false if the connection has been closed.
+  bool Receive(LatencyHistogram *latency) {
+    if (!Read()) return false;
+    for (;;) {
+      if (buffer_.size() < 2) break;
+      const uint8 *hdr = reinterpret_cast<const uint8 *>(buffer_.data());
+      size_t hdrlen = 2;
+      uint64 size = hdr[1] & 0x7F;
+      if (size == 0x7E) {
+        hdrlen = 4;
+        if (buffer_.size() < hdrlen) break;
+        size = (hdr[2] << 8) | hdr[3];
+      } else if (size == 0x7F) {
+        hdrlen = 10;
+        if (buffer_.size() < hdrlen) break;
+        size = 0;
+        for (int i = 2; i < 10; ++i) size = (size << 8) | hdr[i];
+      }
+      if (buffer_.size() < hdrlen + size) break;
+      Clock::Timestamp sent;
+      CHECK_GE(size, sizeof(sent));
+      memcpy(&sent, hdr + hdrlen, sizeof(sent));
+      latency->Add((Clock::now() - sent) / Clock::mhz());
+      buffer_.erase(0, hdrlen + size);
+    }
+    return true;
+  }
+
+  int sock() const { return sock_; }
+
+ private:
+  // Write data to socket.
+  void Write(const string &data) {
+    const char *ptr = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      int rc = write(sock_, ptr, left);
+      CHECK_GT(rc, 0);
+      ptr += rc;
+      left -= rc;
+    }
+  }
+
+  // Read data from socket into buffer. Returns false if the connection has
+  // been closed.
+  bool Read() {
+    char data[1 << 16];
+    int rc = read(sock_, data, sizeof(data));
+    if (rc <= 0) return false;
+    buffer_.append(data, rc);
+    return true;
+  }
+
+  int sock_;
+  string buffer_;
+};
+
+// Simulate WebSocket clients where a few clients send updates that are
+// broadcast to all other clients. Reports the delivery rate, the number of
+// frames delivered to clients, and the delivery latency from an update being
+// sent until it is received by each client.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+  CHECK_LE(FLAGS_senders, FLAGS_clients);
+  CHECK_GE(FLAGS_size, sizeof(Clock::Timestamp));
+  CHECK_LT(FLAGS_size, 0x10000);
+
+  // Start server.
+  SocketServerOptions options;
+  options.num_workers = FLAGS_workers;
+  HTTPServer http(options, "127.0.0.1", FLAGS_port);
+  Hub hub;
+  http.Register("/ws", &hub, &Hub::Connect);
+  CHECK(http.Start());
+
+  // Connect clients.
+  std::vector<Connection *> conns;
+  for (int i = 0; i < FLAGS_clients; ++i) {
+    conns.push_back(new Connection(FLAGS_port));
+  }
+
+  // Start reader threads. Each reader polls its share of the connections.
+  LatencyHistogram latency;
+  std::atomic<bool> done{false};
+  std::atomic<int> closed{0};
+  std::vector<ClosureThread *> threads;
+  for (int r = 0; r < FLAGS_readers; ++r) {
+    threads.push_back(new ClosureThread([&, r]() {
+      std::vector<Connection *> mine;
+      std::vector<struct pollfd> fds;
+      for (int i = r; i < conns.size(); i += FLAGS_readers) {
+        mine.push_back(conns[i]);
+        struct pollfd pfd;
+        pfd.fd = conns[i]->sock();
+        pfd.events = POLLIN;
+        fds.push_back(pfd);
+      }
+      while (!done) {
+        if (poll(fds.data(), fds.size(), 100) <= 0) continue;
+        for (int i = 0; i < fds.size(); ++i) {
+          if (fds[i].revents == 0) continue;
+          if (!mine[i]->Receive(&latency)) {
+            closed++;
+            fds[i].fd = -1;
+          }
+        }
+      }
+    }));
+  }
+
+  // Start sender threads.
+  Clock clock;
+  clock.start();
+  for (int s = 0; s < FLAGS_senders; ++s) {
+    threads.push_back(new ClosureThread([&, s]() {
+      for (int i = 0; i < FLAGS_messages; ++i) {
+        conns[s]->SendUpdate();
+        usleep(FLAGS_interval);
+      }
+    }));
+  }
+  for (ClosureThread *t : threads) {
+    t->SetJoinable(true);
+    t->Start();
+  }
+
+  // Wait until all updates have been delivered or the clients that have not
+  // received all updates have been idle for a while.
+  int64 expected = static_cast<int64>(FLAGS_senders) * FLAGS_messages *
+                   (FLAGS_clients - 1);
+  int64 received = 0;
+  int idle = 0;
+  while (latency.count() < expected && idle < 50) {
+    usleep(100000);
+    if (latency.count() == received) {
+      idle++;
+    } else {
+      received = latency.count();
+      idle = 0;
+    }
+  }
+  clock.stop();
+  done = true;
+  for (ClosureThread *t : threads) {
+    t->Join();
+    delete t;
+  }
+
+  int64 n = latency.count();
+  std::cout << FLAGS_clients << " clients, " << FLAGS_senders << " senders, "
+            << FLAGS_senders * FLAGS_messages << " updates of "
+            << FLAGS_size << " bytes\n"
+            << n << "/" << expected << " frames delivered, "
+            << static_cast<int64>(n / clock.secs()) << " frames/sec, "
+            << hub.disconnects() << " slow clients disconnected, "
+            << closed << " connections closed\n"
+            << "delivery latency: p50 " << latency.Percentile(0.5) << " us"
+            << ", p99 " << latency.Percentile(0.99) << " us"
+            << ", p999 " << latency.Percentile(0.999) << " us\n";
+
+  for (Connection *conn : conns) delete conn;
+  http.Shutdown();
+  http.Wait();
+  return n == expected ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/nlp/document/text-tokenizer.h"
+
+DEFINE_string(input, "", "Text file with one text per line");
+DEFINE_string(tokenization, "standard", "Tokenization (standard, ptb, ldc)");
+DEFINE_int32(repeat, 10, "Number of passes over the input");
+
+using namespace sling;
+using namespace sling::nlp;
+
+// Sample text used if no input file is given.
+static const char *sample =
+  "Douglas Noël Adams (11 March 1952 – 11 May 2001) was an English author, "
+  "screenwriter, essayist, humorist, satirist and dramatist. Adams was the "
+  "author of The Hitchhiker's Guide to the Galaxy, which originated in 1978 "
+  "as a BBC radio comedy before developing into a \"trilogy\" of five books "
+  "that sold more than 15 million copies in his lifetime. He also wrote "
+  "Dirk Gently's Holistic Detective Agency (1987) and The Long Dark Tea-Time "
+  "of the Soul (1988), and co-wrote The Meaning of Liff (1983), The Deeper "
+  "Meaning of Liff (1990), Last Chance to See (1989), and three stories for "
+  "the television series Doctor Who; he also served as script editor for "
+  "its 17th season in 1979. A posthumous collection of his works, including "
+  "an unfinished novel, was published as The Salmon of Doubt in 2002.";
+
+// Time tokenization of all texts and return the number of tokens per second.
+double Run(const Tokenizer &tokenizer, const std::vector<string> &texts) {
+  int64 tokens = 0;
+  Clock clock;
+  clock.start();
+  for (int r = 0; r < FLAGS_repeat; ++r) {
+    for (const string &text : texts) {
+      tokenizer.Tokenize(text, [&](const Tokenizer::Token &token) {
+        tokens++;
+      });
+    }
+  }
+  clock.stop();
+  return tokens / clock.secs();
+}
+
+// Compare tokenization speed with compiled automata and with direct trie
+// matching.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Read input texts.
+  std::vector<string> texts;
+  if (FLAGS_input.empty()) {
+    for (int i = 0; i < 1000; ++i) texts.push_back(sample);
+  } else {
+    string data;
+    CHECK(File::ReadContents(FLAGS_input, &data));
+    size_t start = 0;
+    while (start < data.size()) {
+      size_t end = data.find('\n', start);
+      if (end == string::npos) end = data.size();
+      if (end > start) texts.push_back(data.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+
+  // Set up tokenizer.
+  StandardTokenization *processor;
+  if (FLAGS_tokenization == "ptb") {
+    processor = new PTBTokenization();
+  } else if (FLAGS_tokenization == "ldc") {
+    processor = new LDCTokenization();
+  } else {
+    processor = new StandardTokenization();
+  }
+  Tokenizer tokenizer;
+  tokenizer.Add(processor);
+
+  double compiled = Run(tokenizer, texts);
+  processor->ClearAutomata();
+  double trie = Run(tokenizer, texts);
+  std::cout << "trie: " << static_cast<int64>(trie) << " tokens/sec"
+            << ", compiled: " << static_cast<int64>(compiled) << " tokens/sec"
+            << ", speedup: " << compiled / trie << "\n";
+
+  return 0;
+}
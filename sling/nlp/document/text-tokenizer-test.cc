@@ -0,0 +1,132 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/nlp/document/text-tokenizer.h"
+
+DEFINE_string(input, "", "Text file with one text per line");
+
+using namespace sling;
+using namespace sling::nlp;
+
+// Texts exercising special tokens, suffixes, entities, and non-ASCII
+// punctuation.
+static const char *sample[] = {
+  "Mr. Smith doesn't live in the U.S. anymore; he's moved to St. Louis.",
+  "He said: \"I can't believe it's 9:30 a.m. already!\" -- and left...",
+  "Prices rose 3.5% to $1,234.56 on Jan. 3rd, 2019 (see http://x.com/a?b=c).",
+  "Ellipsis… em—dash – en dash ‒ figure dash − minus sign.",
+  "Full-width punctuation：ａｂｃ，ｄｅｆ．！？；＆＂",
+  "HTML entities &amp; &lt;b&gt; &#39;quoted&#39; &nbsp;non-breaking",
+  "<section>Chapter one<chapter>Chapter two\n\nNew paragraph\r\nline",
+  "WON'T CAN'T Y'ALL I'M YOU'RE THEY'VE WE'D SHE'LL gonna gotta wanna",
+  "anti-inflammatory co-operation e-mail self-esteem pre-war 1990s-era",
+  "Tab\tseparated | pipe · middle dot . . . spaced dots",
+  "Ünïcödé wörds: Müller's café, naïve résumé, Дуглас Адамс, 東京都",
+  "@user #hashtag email@example.com 12th 21st 2nd 3rd 100th",
+};
+
+// Tokenize text into a list of tokens with break types, styles and spans.
+string Tokenize(const Tokenizer &tokenizer, const string &text) {
+  string result;
+  tokenizer.Tokenize(text, [&](const Tokenizer::Token &token) {
+    result.append(token.text);
+    result.append("|" + std::to_string(token.brk));
+    result.append("|" + std::to_string(token.style));
+    result.append("|" + std::to_string(token.begin));
+    result.append("|" + std::to_string(token.end));
+    result.push_back('\n');
+  });
+  return result;
+}
+
+// Create tokenization processor.
+StandardTokenization *CreateProcessor(const string &type) {
+  if (type == "ptb") return new PTBTokenization();
+  if (type == "ldc") return new LDCTokenization();
+  return new StandardTokenization();
+}
+
+// Check that tokenization with the compiled automata gives the same result as
+// matching the tries directly.
+int Compare(const string &type, const std::vector<string> &texts,
+            bool extend) {
+  Tokenizer compiled;
+  StandardTokenization *processor = CreateProcessor(type);
+  compiled.Add(processor);
+
+  Tokenizer reference;
+  StandardTokenization *trie = CreateProcessor(type);
+  reference.Add(trie);
+  trie->ClearAutomata();
+
+  // Add token types after the tokenizers have been initialized.
+  if (extend) {
+    processor->AddTokenType(":-)", 0);
+    processor->AddSuffixType("'em", nullptr);
+    trie->AddTokenType(":-)", 0);
+    trie->AddSuffixType("'em", nullptr);
+    processor->Compile();
+  }
+
+  int errors = 0;
+  for (const string &text : texts) {
+    string expected = Tokenize(reference, text);
+    string actual = Tokenize(compiled, text);
+    if (actual != expected) {
+      LOG(ERROR) << type << " tokenization mismatch for: " << text
+                 << "\nexpected:\n" << expected << "actual:\n" << actual;
+      errors++;
+    }
+  }
+  return errors;
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Read input texts.
+  std::vector<string> texts;
+  for (const char *text : sample) texts.push_back(text);
+  texts.push_back("Smile :-) and get'em to smile back");
+  if (!FLAGS_input.empty()) {
+    string data;
+    CHECK(File::ReadContents(FLAGS_input, &data));
+    size_t start = 0;
+    while (start < data.size()) {
+      size_t end = data.find('\n', start);
+      if (end == string::npos) end = data.size();
+      if (end > start) texts.push_back(data.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+
+  // Compare compiled and trie-based tokenization.
+  int errors = 0;
+  for (const char *type : {"standard", "ptb", "ldc"}) {
+    errors += Compare(type, texts, false);
+    errors += Compare(type, texts, true);
+  }
+  CHECK_EQ(errors, 0);
+  std::cout << "PASS: " << texts.size() << " texts\n";
+
+  return 0;
+}
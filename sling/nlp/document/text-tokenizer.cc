@@ -42,7 +42,7 @@ class TrieNode {
   // added and returned.
   TrieNode *AddChild(char32 ch);
 
-  // Finds the longest matching token.
+  // Finds the longest matching token by walking the trie.
   const TrieNode *FindMatch(const TokenizerText &text, int start,
                             int *length) const;
 
@@ -75,6 +75,13 @@ class TrieNode {
   bool terminal() const { return terminal_; }
   void set_terminal(bool terminal) { terminal_ = terminal; }
 
+  // Returns all children of the node.
+  void GetChildren(std::vector<std::pair<char32, TrieNode *>> *children) const;
+
+  // Returns/sets the automaton state for the node.
+  int state() const { return state_; }
+  void set_state(int state) { state_ = state; }
+
  private:
   typedef std::unordered_map<char32, TrieNode *> TrieMap;
 
@@ -96,6 +103,89 @@ class TrieNode {
   // has any children.
   std::vector<TrieNode *> *low_children_;
   TrieMap *high_children_;
+
+  // State number for node in compiled automaton.
+  int state_ = -1;
+};
+
+// Table-driven automaton compiled from a token trie. The transitions for ASCII
+// characters are looked up in a dense transition table indexed by state and
+// character class, where the character classes already take lowercasing into
+// account. Only transitions on other characters fall back to the trie nodes.
+class TrieAutomaton {
+ public:
+  // Compiles automaton from trie.
+  explicit TrieAutomaton(TrieNode *root);
+
+  // Finds the longest matching token.
+  const TrieNode *FindMatch(const TokenizerText &text, int start,
+                            int *length) const {
+    const TrieNode *matched_node = nullptr;
+    int matched_length = 0;
+
+    int state = 0;
+    int current = start;
+    while (current < text.length()) {
+      state = Next(state, text.at(current));
+      if (state < 0) break;
+      current++;
+      if (terminal_[state]) {
+        matched_node = nodes_[state];
+        matched_length = current - start;
+      }
+    }
+
+    *length = matched_length;
+    return matched_node;
+  }
+
+  // Finds the longest matching token by traversing the text in reverse order.
+  const TrieNode *FindReverseMatch(const TokenizerText &text, int start,
+                                   int limit, int *length) const {
+    const TrieNode *matched_node = nullptr;
+    int matched_length = 0;
+
+    int state = 0;
+    int current = start;
+    while (current >= limit) {
+      state = Next(state, text.at(current));
+      if (state < 0) break;
+      current--;
+      if (terminal_[state]) {
+        matched_node = nodes_[state];
+        matched_length = start - current;
+      }
+    }
+
+    *length = matched_length;
+    return matched_node;
+  }
+
+ private:
+  // Returns the next state for a transition on a character, or -1 if there
+  // is no transition.
+  int Next(int state, char32 ch) const {
+    if (ch >= kMaxAscii) {
+      ch = Unicode::ToLower(ch);
+      if (ch >= kMaxAscii) {
+        const TrieNode *child = nodes_[state]->FindChild(ch);
+        return child == nullptr ? -1 : child->state();
+      }
+    }
+    return transitions_[state * num_classes_ + classes_[ch]];
+  }
+
+  // Character class for each ASCII character. Class 0 is used for characters
+  // that do not have any transitions.
+  uint8 classes_[kMaxAscii];
+  int num_classes_ = 1;
+
+  // Transition table indexed by state and character class.
+  std::vector<int> transitions_;
+
+  // Trie node and terminal status for each state.
+  std::vector<const TrieNode *> nodes_;
+  std::vector<uint8> terminal_;
 };
 
 CharacterFlags::CharacterFlags(): low_flags_(kMaxAscii) {
@@ -149,8 +239,11 @@ TokenizerText::TokenizerText(Text text, const CharacterFlags &char_flags) {
     e.node = nullptr;
     e.escapes = escapes;
 
-    char32 c = UTF8::Decode(cur, end - cur);
-    if (c == '&') {
+    char32 c = *reinterpret_cast<const uint8 *>(cur);
+    if (c < 0x80 && c != '&') {
+      // Fast path for plain ASCII characters.
+      cur++;
+    } else if ((c = UTF8::Decode(cur, end - cur)) == '&') {
       // Handle decoding of HTML entities like &amp; and &#39;.
       int consumed;
       char32 entity = ParseEntityRef(cur, end - cur, &consumed);
@@ -340,6 +433,65 @@ const TrieNode *TrieNode::FindReverseMatch(const TokenizerText &text,
   return matched_node;
 }
 
+void TrieNode::GetChildren(
+    std::vector<std::pair<char32, TrieNode *>> *children) const {
+  children->clear();
+  if (low_children_ != nullptr) {
+    for (int ch = 0; ch < kMaxAscii; ++ch) {
+      TrieNode *child = (*low_children_)[ch];
+      if (child != nullptr) children->emplace_back(ch, child);
+    }
+  }
+  if (high_children_ != nullptr) {
+    for (const auto &it : *high_children_) {
+      children->emplace_back(it.first, it.second);
+    }
+  }
+}
+
+TrieAutomaton::TrieAutomaton(TrieNode *root) {
+  // Number all the trie nodes in breadth-first order.
+  std::vector<std::pair<char32, TrieNode *>> children;
+  std::vector<bool> used(kMaxAscii);
+  root->set_state(0);
+  nodes_.push_back(root);
+  for (int i = 0; i < nodes_.size(); ++i) {
+    nodes_[i]->GetChildren(&children);
+    for (auto &child : children) {
+      child.second->set_state(nodes_.size());
+      nodes_.push_back(child.second);
+      if (child.first < kMaxAscii) used[child.first] = true;
+    }
+  }
+
+  // Assign character classes to the ASCII characters used in the trie. The
+  // trie is matched against lowercased characters, so each ASCII character
+  // is mapped to the class for its lowercase version.
+  uint8 lower_class[kMaxAscii];
+  for (int ch = 0; ch < kMaxAscii; ++ch) {
+    lower_class[ch] = used[ch] ? num_classes_++ : 0;
+  }
+  CHECK_LT(num_classes_, 256);
+  for (int ch = 0; ch < kMaxAscii; ++ch) {
+    char32 lower = Unicode::ToLower(ch);
+    classes_[ch] = lower < kMaxAscii ? lower_class[lower] : 0;
+  }
+
+  // Build transition table.
+  int num_states = nodes_.size();
+  transitions_.resize(num_states * num_classes_, -1);
+  terminal_.resize(num_states);
+  for (int state = 0; state < num_states; ++state) {
+    terminal_[state] = nodes_[state]->terminal();
+    nodes_[state]->GetChildren(&children);
+    for (auto &child : children) {
+      if (child.first < kMaxAscii) {
+        int cls = lower_class[child.first];
+        transitions_[state * num_classes_ + cls] = child.second->state();
+      }
+    }
+  }
+}
 
 Tokenizer::Tokenizer() {
 }
@@ -367,6 +519,7 @@ void Tokenizer::InitLDC() {
 
 void Tokenizer::Add(TokenProcessor *processor) {
   processor->Init(&char_flags_);
+  processor->Compile();
   processors_.push_back(processor);
 }
 
@@ -708,11 +861,27 @@ StandardTokenization::StandardTokenization() {
 StandardTokenization::~StandardTokenization() {
   delete token_types_;
   delete suffix_types_;
+  delete token_matcher_;
+  delete suffix_matcher_;
+}
+
+void StandardTokenization::Compile() {
+  ClearAutomata();
+  token_matcher_ = new TrieAutomaton(token_types_);
+  suffix_matcher_ = new TrieAutomaton(suffix_types_);
+}
+
+void StandardTokenization::ClearAutomata() {
+  delete token_matcher_;
+  delete suffix_matcher_;
+  token_matcher_ = nullptr;
+  suffix_matcher_ = nullptr;
 }
 
 TrieNode *StandardTokenization::AddTokenType(const char *token,
                                              TokenFlags flags,
                                              const char *value) {
+  ClearAutomata();
   TrieNode *node = token_types_;
   const char *p = token;
   const char *end = token + strlen(token);
@@ -731,6 +900,7 @@ TrieNode *StandardTokenization::AddTokenType(const char *token,
 
 TrieNode *StandardTokenization::AddSuffixType(const char *token,
                                               const char *value) {
+  ClearAutomata();
   std::vector<char32> ustr;
   const char *p = token;
   const char *end = token + strlen(token);
@@ -1009,7 +1179,12 @@ void StandardTokenization::Process(TokenizerText *t) {
     // the longest match is found.
     TokenFlags tag_flags = 0;
     int length;
-    const TrieNode *node = token_types_->FindMatch(*t, i, &length);
+    const TrieNode *node;
+    if (token_matcher_ != nullptr) {
+      node = token_matcher_->FindMatch(*t, i, &length);
+    } else {
+      node = token_types_->FindMatch(*t, i, &length);
+    }
     if (length > 0) {
       int j = i + length;
       bool match = true;
@@ -1081,7 +1256,7 @@ void StandardTokenization::Process(TokenizerText *t) {
       int j = i + 1;
       bool prev_was_punct = false;
       while (j < t->length()) {
-        if (t->is(j, CHAR_LETTER) || t->is(j, CHAR_DIGIT)) {
+        if (t->is(j, CHAR_LETTER | CHAR_DIGIT)) {
           prev_was_punct = false;
           j++;
         } else if (t->is(j, WORD_PUNCT)) {
@@ -1111,7 +1286,13 @@ void StandardTokenization::Process(TokenizerText *t) {
       // Check for special suffix.
       int suffix_length;
       const TrieNode *suffix;
-      suffix = suffix_types_->FindReverseMatch(*t, j - 1, i, &suffix_length);
+      if (suffix_matcher_ != nullptr) {
+        suffix = suffix_matcher_->FindReverseMatch(*t, j - 1, i,
+                                                   &suffix_length);
+      } else {
+        suffix = suffix_types_->FindReverseMatch(*t, j - 1, i,
+                                                 &suffix_length);
+      }
       if (suffix_length != 0) {
         // Mark suffix as separate token.
         int suffix_start = j - suffix_length;
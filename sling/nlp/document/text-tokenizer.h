@@ -30,6 +30,7 @@ namespace sling {
 namespace nlp {
 
 class TrieNode;
+class TrieAutomaton;
 
 // Flags for tokens.
 enum TokenFlagValues : uint64 {
@@ -190,6 +191,9 @@ class TokenProcessor {
   virtual ~TokenProcessor() = default;
   virtual void Init(CharacterFlags *char_flags) = 0;
   virtual void Process(TokenizerText *t) = 0;
+
+  // Called when the processor has been fully initialized, i.e. after Init().
+  virtual void Compile() {}
 };
 
 // Tokenizer for breaking text into tokens and sentences.
@@ -247,7 +251,8 @@ class StandardTokenization : public TokenProcessor {
   void Init(CharacterFlags *char_flags) override;
 
   // Adds new token type. The (optional) value is a replacement value for the
-  // token.
+  // token. Adding token or suffix types discards the compiled automata, and
+  // the tries are then matched directly until Compile() is called again.
   TrieNode *AddTokenType(const char *token, TokenFlags flags,
                          const char *value);
   TrieNode *AddTokenType(const char *token, TokenFlags flags) {
@@ -260,6 +265,13 @@ class StandardTokenization : public TokenProcessor {
   // Break text into tokens.
   void Process(TokenizerText *t) override;
 
+  // Compile token and suffix tries into automata for matching.
+  void Compile() override;
+
+  // Discard compiled automata. The token and suffix tries are then matched
+  // directly, which is slower, but gives the same result.
+  void ClearAutomata();
+
  protected:
   // Trie with special token types.
   TrieNode *token_types_;
@@ -268,6 +280,11 @@ class StandardTokenization : public TokenProcessor {
   // suffixes are encoded in reverse order.
   TrieNode *suffix_types_;
 
+  // Automata compiled from the token and suffix tries, or null if the tries
+  // have not been compiled.
+  TrieAutomaton *token_matcher_ = nullptr;
+  TrieAutomaton *suffix_matcher_ = nullptr;
+
   // Maximum length of a tag token, e.g. token of the form <...>.
   int max_tag_token_length_ = 32;
 
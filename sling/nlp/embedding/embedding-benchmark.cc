@@ -0,0 +1,88 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/nlp/embedding/sparse-embeddings.h"
+#include "sling/util/random.h"
+#include "sling/util/thread.h"
+
+DEFINE_int32(vocabulary, 100000, "Number of words in synthetic vocabulary");
+DEFINE_int32(dims, 128, "Embedding dimensions");
+DEFINE_int32(window, 5, "Window size for skip-grams");
+DEFINE_int32(negative, 5, "Negative examples per positive example");
+DEFINE_int32(examples, 1000000, "Number of training examples per run");
+DEFINE_int32(max_threads, 64, "Maximum number of threads");
+DEFINE_double(alpha, 0.025, "Learning rate");
+
+using namespace sling;
+using namespace sling::nlp;
+
+// Train sparse embedding model on synthetic examples with words drawn from a
+// Zipf distribution and return the number of examples per second.
+double Run(int threads, const NegativeSampler &words) {
+  EmbeddingMatrix W0;
+  EmbeddingMatrix W1;
+  W0.Init(FLAGS_vocabulary, FLAGS_dims, threads, 1.0 / FLAGS_dims);
+  W1.Init(FLAGS_vocabulary, FLAGS_dims, threads, 0.0);
+
+  Clock clock;
+  clock.start();
+  WorkerPool pool;
+  pool.Start(threads, [&](int index) {
+    SparseEmbeddingLearner learner(&W0, &W1, &words, index);
+    Random rnd;
+    rnd.seed(index + 1000);
+    std::vector<int> context(FLAGS_window * 2);
+    int examples = FLAGS_examples / threads;
+    for (int i = 0; i < examples; ++i) {
+      for (int &w : context) w = words.Sample(&rnd);
+      int target = words.Sample(&rnd);
+      learner.Train(context.data(), context.size(), &target, 1,
+                    FLAGS_negative, FLAGS_alpha);
+    }
+  });
+  pool.Join();
+  clock.stop();
+
+  return (FLAGS_examples / threads) * threads / clock.secs();
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Use Zipf distribution for word frequencies.
+  std::vector<float> counts(FLAGS_vocabulary);
+  for (int i = 0; i < FLAGS_vocabulary; ++i) counts[i] = 1.0 / (i + 1);
+  NegativeSampler words;
+  words.Init(counts);
+
+  // Run training with increasing number of threads.
+  double base = 0.0;
+  for (int threads = 1; threads <= FLAGS_max_threads; threads *= 2) {
+    double rate = Run(threads, words);
+    if (threads == 1) base = rate;
+    std::cout << "threads: " << threads
+              << ", examples/sec: " << static_cast<int64>(rate)
+              << ", speedup: " << rate / base << "\n";
+    std::cout.flush();
+  }
+
+  return 0;
+}
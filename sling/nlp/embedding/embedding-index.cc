@@ -0,0 +1,321 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/nlp/embedding/embedding-index.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "sling/base/logging.h"
+#include "sling/file/buffered.h"
+#include "sling/util/embeddings.h"
+#include "sling/util/random.h"
+#include "sling/util/thread.h"
+#include "sling/util/top.h"
+
+namespace sling {
+namespace nlp {
+
+// Compute dot product between two vectors. The sum is split into several
+// partial sums to allow the compiler to vectorize the loop.
+static float DotProduct(const float *a, const float *b, int n) {
+  float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += a[i] * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  for (; i < n; ++i) s0 += a[i] * b[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+// Find the clusters with centroids most similar to query.
+static void ClosestClusters(const float *query, const float *centroids,
+                            int clusters, int dim, int probes,
+                            std::vector<int> *closest) {
+  Top<std::pair<float, int>> top(probes);
+  for (int c = 0; c < clusters; ++c) {
+    float score = DotProduct(query, centroids + c * dim, dim);
+    top.push(std::make_pair(score, c));
+  }
+  closest->clear();
+  for (auto &t : top) closest->push_back(t.second);
+}
+
+void EmbeddingIndex::Load(const string &filename) {
+  // Load index repository from file.
+  repository_.Read(filename);
+
+  // Get index blocks.
+  repository_.FetchBlock("EmbeddingIndex", &header_);
+  CHECK(header_ != nullptr) << "No embedding index in " << filename;
+  repository_.FetchBlock("Centroids", &centroids_);
+  repository_.FetchBlock("Clusters", &clusters_);
+  repository_.FetchBlock("Vectors", &vectors_);
+  repository_.FetchBlock("WordIndex", &word_index_);
+  repository_.FetchBlock("Words", &words_);
+  CHECK(centroids_ != nullptr);
+  CHECK(clusters_ != nullptr);
+  CHECK(vectors_ != nullptr);
+  CHECK(word_index_ != nullptr);
+  CHECK(words_ != nullptr);
+
+  // Build word map.
+  word_map_.clear();
+  word_map_.reserve(size());
+  for (int i = 0; i < size(); ++i) {
+    word_map_[word(i)] = i;
+  }
+}
+
+int EmbeddingIndex::Lookup(Text word) const {
+  auto f = word_map_.find(word);
+  return f != word_map_.end() ? f->second : -1;
+}
+
+void EmbeddingIndex::Search(const float *query, int k, int probes,
+                            Hits *hits) const {
+  SearchBatch(query, 1, k, probes, hits);
+}
+
+void EmbeddingIndex::Search(const float *queries, int num_queries,
+                            int k, int probes,
+                            std::vector<Hits> *results,
+                            int threads) const {
+  results->clear();
+  results->resize(num_queries);
+  if (threads <= 1 || num_queries < 2 * threads) {
+    SearchBatch(queries, num_queries, k, probes, results->data());
+    return;
+  }
+
+  // Split batch between worker threads.
+  int chunk = (num_queries + threads - 1) / threads;
+  WorkerPool pool;
+  pool.Start(threads, [&](int index) {
+    int begin = index * chunk;
+    int end = std::min(begin + chunk, num_queries);
+    if (begin >= end) return;
+    SearchBatch(queries + begin * dim(), end - begin, k, probes,
+                results->data() + begin);
+  });
+  pool.Join();
+}
+
+void EmbeddingIndex::SearchBatch(const float *queries, int num_queries,
+                                 int k, int probes,
+                                 Hits *results) const {
+  int d = dim();
+  if (probes > num_clusters()) probes = num_clusters();
+
+  // Find the queries probing each cluster.
+  std::vector<std::vector<int>> probing(num_clusters());
+  std::vector<int> closest;
+  for (int q = 0; q < num_queries; ++q) {
+    ClosestClusters(queries + q * d, centroids_, num_clusters(), d, probes,
+                    &closest);
+    for (int c : closest) probing[c].push_back(q);
+  }
+
+  // Scan each cluster once for all queries probing it.
+  std::vector<Top<Hit>> top(num_queries, Top<Hit>(k));
+  for (int c = 0; c < num_clusters(); ++c) {
+    const std::vector<int> &qs = probing[c];
+    if (qs.empty()) continue;
+    int end = clusters_[c + 1];
+    for (int id = clusters_[c]; id < end; ++id) {
+      const float *v = vector(id);
+      for (int q : qs) {
+        top[q].push(Hit(id, DotProduct(queries + q * d, v, d)));
+      }
+    }
+  }
+
+  // Return hits sorted by decreasing similarity.
+  for (int q = 0; q < num_queries; ++q) {
+    top[q].sort();
+    results[q].assign(top[q].begin(), top[q].end());
+  }
+}
+
+void EmbeddingIndex::BruteForce(const float *query, int k, Hits *hits) const {
+  Top<Hit> top(k);
+  for (int id = 0; id < size(); ++id) {
+    top.push(Hit(id, DotProduct(query, vector(id), dim())));
+  }
+  top.sort();
+  hits->assign(top.begin(), top.end());
+}
+
+void EmbeddingIndexBuilder::Add(Text word, const float *vector) {
+  words_.emplace_back(word.data(), word.size());
+  vectors_.insert(vectors_.end(), vector, vector + dim_);
+}
+
+void EmbeddingIndexBuilder::AddEmbeddings(const string &filename,
+                                          bool normalize) {
+  EmbeddingReader reader(filename);
+  reader.set_normalize(normalize);
+  CHECK_EQ(reader.dim(), dim_) << filename;
+  words_.reserve(words_.size() + reader.num_words());
+  vectors_.reserve(vectors_.size() + reader.num_words() * dim_);
+  while (reader.Next()) {
+    Add(reader.word(), reader.embedding().data());
+  }
+}
+
+void EmbeddingIndexBuilder::Assign(const std::vector<int> &ids,
+                                   std::vector<int> *assignment,
+                                   int threads) const {
+  assignment->resize(ids.size());
+  if (threads < 1) threads = 1;
+  int chunk = (ids.size() + threads - 1) / threads;
+  WorkerPool pool;
+  pool.Start(threads, [&](int index) {
+    std::vector<int> closest;
+    int begin = index * chunk;
+    int end = std::min<int>(begin + chunk, ids.size());
+    for (int i = begin; i < end; ++i) {
+      ClosestClusters(vector(ids[i]), centroids_.data(), num_clusters_, dim_,
+                      1, &closest);
+      (*assignment)[i] = closest[0];
+    }
+  });
+  pool.Join();
+}
+
+void EmbeddingIndexBuilder::Build(const Options &options) {
+  int n = size();
+  CHECK_GT(n, 0);
+  num_clusters_ = options.clusters;
+  if (num_clusters_ <= 0) {
+    num_clusters_ = std::max(1, static_cast<int>(sqrt(n)));
+  }
+  if (num_clusters_ > n) num_clusters_ = n;
+
+  // Select random sample of vectors for training.
+  Random rnd;
+  rnd.seed(options.seed);
+  std::vector<int> sample(n);
+  for (int i = 0; i < n; ++i) sample[i] = i;
+  for (int i = n - 1; i > 0; --i) {
+    std::swap(sample[i], sample[rnd.UniformInt(i + 1)]);
+  }
+  int64 sample_size = static_cast<int64>(num_clusters_) * options.sample;
+  if (sample_size < n) sample.resize(sample_size);
+
+  // Initialize centroids with the first sample vectors.
+  centroids_.resize(num_clusters_ * dim_);
+  for (int c = 0; c < num_clusters_; ++c) {
+    memcpy(centroids_.data() + c * dim_, vector(sample[c]),
+           dim_ * sizeof(float));
+  }
+
+  // Run k-means on sample. The centroids are normalized to unit length, so
+  // the clusters are formed using cosine similarity.
+  std::vector<int> assignment;
+  std::vector<int> counts(num_clusters_);
+  for (int iter = 0; iter < options.iterations; ++iter) {
+    Assign(sample, &assignment, options.threads);
+
+    // Compute new centroids.
+    std::fill(centroids_.begin(), centroids_.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (int i = 0; i < assignment.size(); ++i) {
+      int c = assignment[i];
+      float *centroid = centroids_.data() + c * dim_;
+      const float *v = vector(sample[i]);
+      for (int j = 0; j < dim_; ++j) centroid[j] += v[j];
+      counts[c]++;
+    }
+
+    int empty = 0;
+    for (int c = 0; c < num_clusters_; ++c) {
+      float *centroid = centroids_.data() + c * dim_;
+      if (counts[c] == 0) {
+        // Re-seed empty cluster with a random sample vector.
+        int id = sample[rnd.UniformInt(sample.size())];
+        memcpy(centroid, vector(id), dim_ * sizeof(float));
+        empty++;
+      }
+      float norm = sqrtf(DotProduct(centroid, centroid, dim_));
+      if (norm > 0.0) {
+        for (int j = 0; j < dim_; ++j) centroid[j] /= norm;
+      }
+    }
+    VLOG(1) << "k-means iteration " << iter << ", " << empty
+            << " empty clusters";
+  }
+
+  // Assign all vectors to clusters.
+  std::vector<int> all(n);
+  for (int i = 0; i < n; ++i) all[i] = i;
+  Assign(all, &assignment_, options.threads);
+}
+
+void EmbeddingIndexBuilder::Write(const string &filename) {
+  int n = size();
+  CHECK_EQ(assignment_.size(), n) << "Embedding index has not been built";
+
+  // Sort vectors by cluster.
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return assignment_[a] < assignment_[b];
+  });
+
+  Repository repository;
+
+  // Write header and centroids.
+  EmbeddingIndex::Header header;
+  header.dim = dim_;
+  header.size = n;
+  header.clusters = num_clusters_;
+  repository.AddBlock("EmbeddingIndex", &header, sizeof(header));
+  repository.AddBlock("Centroids", centroids_.data(),
+                      centroids_.size() * sizeof(float));
+
+  // Write cluster table.
+  std::vector<uint32> clusters(num_clusters_ + 1);
+  for (int i = 0; i < n; ++i) clusters[assignment_[i] + 1]++;
+  for (int c = 0; c < num_clusters_; ++c) clusters[c + 1] += clusters[c];
+  repository.AddBlock("Clusters", clusters.data(),
+                      clusters.size() * sizeof(uint32));
+
+  // Write vectors and words in cluster order.
+  OutputBuffer vector_block(repository.AddBlock("Vectors"));
+  OutputBuffer index_block(repository.AddBlock("WordIndex"));
+  OutputBuffer word_block(repository.AddBlock("Words"));
+  uint32 offset = 0;
+  for (int id : order) {
+    vector_block.Write(vector(id), dim_ * sizeof(float));
+    index_block.Write(&offset, sizeof(uint32));
+    const string &word = words_[id];
+    word_block.Write(word.data(), word.size());
+    offset += word.size();
+  }
+  index_block.Write(&offset, sizeof(uint32));
+  vector_block.Flush();
+  index_block.Flush();
+  word_block.Flush();
+
+  // Write repository to file.
+  repository.Write(filename);
+}
+
+}  // namespace nlp
+}  // namespace sling
@@ -0,0 +1,195 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_NLP_EMBEDDING_EMBEDDING_INDEX_H_
+#define SLING_NLP_EMBEDDING_EMBEDDING_INDEX_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sling/base/types.h"
+#include "sling/file/repository.h"
+#include "sling/string/text.h"
+
+namespace sling {
+namespace nlp {
+
+// Approximate nearest-neighbor index for embedding vectors. The vectors are
+// partitioned into clusters using k-means, and each query only scans the
+// vectors in the clusters whose centroids are most similar to the query
+// (inverted file index). Similarity is the dot product, so the vectors should
+// be normalized to unit length for cosine similarity. The index is stored in a
+// repository with the following blocks:
+//   EmbeddingIndex: header with dimension, number of vectors, and clusters
+//   Centroids:      cluster centroid vectors
+//   Clusters:       start of each cluster in the vector table, plus end marker
+//   Vectors:        embedding vectors sorted by cluster
+//   WordIndex:      offset of each word in word block, plus end marker
+//   Words:          words for embedding vectors
+class EmbeddingIndex {
+ public:
+  // Index header.
+  struct Header {
+    uint32 dim;       // embedding dimension
+    uint32 size;      // number of embedding vectors
+    uint32 clusters;  // number of clusters
+  };
+
+  // Search hit with vector id and similarity score.
+  struct Hit {
+    Hit() {}
+    Hit(int id, float score) : id(id), score(score) {}
+    bool operator >(const Hit &other) const { return score > other.score; }
+
+    int id;
+    float score;
+  };
+  typedef std::vector<Hit> Hits;
+
+  // Load index from repository file.
+  void Load(const string &filename);
+
+  // Return embedding dimension.
+  int dim() const { return header_->dim; }
+
+  // Return number of embedding vectors in index.
+  int size() const { return header_->size; }
+
+  // Return number of clusters.
+  int num_clusters() const { return header_->clusters; }
+
+  // Return word for vector.
+  Text word(int id) const {
+    return Text(words_ + word_index_[id],
+                word_index_[id + 1] - word_index_[id]);
+  }
+
+  // Return embedding vector.
+  const float *vector(int id) const { return vectors_ + id * dim(); }
+
+  // Look up vector id for word. Returns -1 if the word is not in the index.
+  int Lookup(Text word) const;
+
+  // Find the top-k most similar vectors to the query by searching the vectors
+  // in the probes clusters closest to the query. The hits are sorted by
+  // decreasing similarity.
+  void Search(const float *query, int k, int probes, Hits *hits) const;
+
+  // Search for a batch of queries. The query vectors are stored consecutively.
+  // Each cluster is only scanned once for all the queries that probe it, and
+  // the batch is split between the worker threads.
+  void Search(const float *queries, int num_queries, int k, int probes,
+              std::vector<Hits> *results, int threads = 1) const;
+
+  // Find the exact top-k most similar vectors by scanning all the vectors.
+  void BruteForce(const float *query, int k, Hits *hits) const;
+
+ private:
+  // Search batch of queries sequentially.
+  void SearchBatch(const float *queries, int num_queries, int k, int probes,
+                   Hits *results) const;
+
+  // Repository with index.
+  Repository repository_;
+
+  // Index header.
+  const Header *header_ = nullptr;
+
+  // Centroid vectors for clusters.
+  const float *centroids_ = nullptr;
+
+  // Start of each cluster in vector table.
+  const uint32 *clusters_ = nullptr;
+
+  // Embedding vectors.
+  const float *vectors_ = nullptr;
+
+  // Word offsets and word data.
+  const uint32 *word_index_ = nullptr;
+  const char *words_ = nullptr;
+
+  // Mapping from word to vector id.
+  std::unordered_map<Text, int> word_map_;
+};
+
+// Build embedding index with k-means clustering.
+class EmbeddingIndexBuilder {
+ public:
+  // Index build options.
+  struct Options {
+    // Number of clusters. If this is zero, the square root of the number of
+    // vectors is used.
+    int clusters = 0;
+
+    // Number of k-means iterations.
+    int iterations = 10;
+
+    // Maximum number of training vectors per cluster for k-means.
+    int sample = 256;
+
+    // Number of threads for assigning vectors to clusters.
+    int threads = 8;
+
+    // Seed for random initialization of centroids.
+    int seed = 0;
+  };
+
+  // Initialize builder for embedding vectors with dimension dim.
+  explicit EmbeddingIndexBuilder(int dim) : dim_(dim) {}
+
+  // Add embedding vector for word.
+  void Add(Text word, const float *vector);
+
+  // Add all embeddings from embedding file in Mikolov format.
+  void AddEmbeddings(const string &filename, bool normalize);
+
+  // Cluster vectors.
+  void Build(const Options &options);
+
+  // Write index to repository file.
+  void Write(const string &filename);
+
+  // Number of vectors added.
+  int size() const { return words_.size(); }
+
+ private:
+  // Assign vectors to closest centroids using worker threads.
+  void Assign(const std::vector<int> &ids, std::vector<int> *assignment,
+              int threads) const;
+
+  // Return embedding vector.
+  const float *vector(int id) const { return vectors_.data() + id * dim_; }
+
+  // Embedding dimension.
+  int dim_;
+
+  // Words and embedding vectors.
+  std::vector<string> words_;
+  std::vector<float> vectors_;
+
+  // Number of clusters.
+  int num_clusters_ = 0;
+
+  // Cluster centroids.
+  std::vector<float> centroids_;
+
+  // Cluster for each vector.
+  std::vector<int> assignment_;
+};
+
+}  // namespace nlp
+}  // namespace sling
+
+#endif  // SLING_NLP_EMBEDDING_EMBEDDING_INDEX_H_
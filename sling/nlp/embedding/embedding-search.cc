@@ -0,0 +1,152 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/nlp/embedding/embedding-index.h"
+#include "sling/util/embeddings.h"
+#include "sling/util/random.h"
+
+DEFINE_string(embeddings, "", "Embeddings for building index");
+DEFINE_string(index, "", "Embedding index repository");
+DEFINE_bool(normalize, true, "Normalize embeddings to unit length");
+DEFINE_int32(clusters, 0, "Number of clusters (default: sqrt of size)");
+DEFINE_int32(iterations, 10, "Number of k-means iterations");
+DEFINE_int32(threads, 8, "Number of threads");
+DEFINE_int32(topk, 15, "Number of similar words to list");
+DEFINE_int32(probes, 16, "Number of clusters to search");
+DEFINE_int32(benchmark, 0, "Number of queries for recall/latency benchmark");
+DEFINE_int32(batch, 64, "Batch size for benchmark");
+
+using namespace sling;
+using namespace sling::nlp;
+
+// Compare index search with brute-force search for random queries from the
+// index and report recall and latency.
+void Benchmark(const EmbeddingIndex &index) {
+  int n = FLAGS_benchmark;
+  int k = FLAGS_topk;
+  int dim = index.dim();
+
+  // Select random queries.
+  Random rnd;
+  std::vector<float> queries(n * dim);
+  for (int i = 0; i < n; ++i) {
+    const float *v = index.vector(rnd.UniformInt(index.size()));
+    std::copy(v, v + dim, queries.begin() + i * dim);
+  }
+
+  // Brute-force search.
+  std::vector<EmbeddingIndex::Hits> exact(n);
+  Clock clock;
+  clock.start();
+  for (int i = 0; i < n; ++i) {
+    index.BruteForce(queries.data() + i * dim, k, &exact[i]);
+  }
+  clock.stop();
+  double brute_us = clock.us() / n;
+
+  // Single-query index search.
+  std::vector<EmbeddingIndex::Hits> approx(n);
+  clock.start();
+  for (int i = 0; i < n; ++i) {
+    index.Search(queries.data() + i * dim, k, FLAGS_probes, &approx[i]);
+  }
+  clock.stop();
+  double single_us = clock.us() / n;
+
+  // Batched index search.
+  std::vector<EmbeddingIndex::Hits> batch;
+  clock.start();
+  for (int i = 0; i < n; i += FLAGS_batch) {
+    int size = std::min(FLAGS_batch, n - i);
+    index.Search(queries.data() + i * dim, size, k, FLAGS_probes, &batch,
+                 FLAGS_threads);
+  }
+  clock.stop();
+  double batch_us = clock.us() / n;
+
+  // Compute recall@k.
+  int64 found = 0;
+  int64 total = 0;
+  for (int i = 0; i < n; ++i) {
+    for (auto &e : exact[i]) {
+      for (auto &a : approx[i]) {
+        if (a.id == e.id) {
+          found++;
+          break;
+        }
+      }
+    }
+    total += exact[i].size();
+  }
+
+  std::cout << "queries: " << n << ", clusters: " << index.num_clusters()
+            << ", probes: " << FLAGS_probes << "\n";
+  std::cout << "recall@" << k << ": " << (found * 1.0 / total) << "\n";
+  std::cout << "brute force: " << brute_us << " us/query\n";
+  std::cout << "index: " << single_us << " us/query\n";
+  std::cout << "index batch " << FLAGS_batch << " with " << FLAGS_threads
+            << " threads: " << batch_us << " us/query\n";
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+  CHECK(!FLAGS_index.empty()) << "--index required";
+
+  // Build index from embeddings.
+  if (!FLAGS_embeddings.empty()) {
+    EmbeddingReader reader(FLAGS_embeddings);
+    EmbeddingIndexBuilder builder(reader.dim());
+    LOG(INFO) << "Loading embeddings from " << FLAGS_embeddings;
+    builder.AddEmbeddings(FLAGS_embeddings, FLAGS_normalize);
+
+    LOG(INFO) << "Clustering " << builder.size() << " embeddings";
+    EmbeddingIndexBuilder::Options options;
+    options.clusters = FLAGS_clusters;
+    options.iterations = FLAGS_iterations;
+    options.threads = FLAGS_threads;
+    builder.Build(options);
+
+    LOG(INFO) << "Writing index to " << FLAGS_index;
+    builder.Write(FLAGS_index);
+  }
+
+  // Load index.
+  EmbeddingIndex index;
+  index.Load(FLAGS_index);
+  if (FLAGS_topk > index.size()) FLAGS_topk = index.size();
+
+  if (FLAGS_benchmark > 0) {
+    Benchmark(index);
+    return 0;
+  }
+
+  for (;;) {
+    // Get word.
+    string word;
+    std::cout << "word: ";
+    std::getline(std::cin, word);
+    if (word == "q" || std::cin.eof()) break;
+
+    // Look up word.
+    int id = index.Lookup(word);
+    if (id == -1) {
+      std::cout << "Unknown word\n";
+      continue;
+    }
+
+    // Output top-k most similar words.
+    EmbeddingIndex::Hits hits;
+    index.Search(index.vector(id), FLAGS_topk, FLAGS_probes, &hits);
+    for (int i = 0; i < hits.size(); ++i) {
+      std::cout << i << ": " << hits[i].score << " "
+                << index.word(hits[i].id) << "\n";
+    }
+  }
+
+  return 0;
+}
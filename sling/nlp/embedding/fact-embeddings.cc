@@ -14,6 +14,7 @@
 
 #include <math.h>
 #include <atomic>
+#include <memory>
 #include <utility>
 
 #include "sling/file/textmap.h"
@@ -24,6 +25,7 @@
 #include "sling/myelin/compiler.h"
 #include "sling/myelin/learning.h"
 #include "sling/nlp/embedding/embedding-model.h"
+#include "sling/nlp/embedding/sparse-embeddings.h"
 #include "sling/task/frames.h"
 #include "sling/task/learner.h"
 #include "sling/util/embeddings.h"
@@ -34,7 +36,11 @@ namespace nlp {
 
 using namespace task;
 
-// Trainer for fact embeddings model.
+// Trainer for fact embeddings model. In sparse mode, the dual encoder is
+// replaced by a model where the average of the fact embeddings for an item is
+// trained to predict each of its categories with negative sampling. The
+// embedding rows are updated lock-free by the workers, and the loss is
+// accumulated in per-worker statistics.
 class FactEmbeddingsTrainer : public LearnerTask {
  public:
   // Run training of embedding net.
@@ -46,6 +52,8 @@ class FactEmbeddingsTrainer : public LearnerTask {
     task->Fetch("max_features", &max_features_);
     task->Fetch("learning_rate", &learning_rate_);
     task->Fetch("min_learning_rate", &min_learning_rate_);
+    task->Fetch("sparse", &sparse_);
+    task->Fetch("negative", &negative_);
 
     // Set up counters.
     Counter *num_instances = task->GetCounter("instances");
@@ -71,29 +79,43 @@ class FactEmbeddingsTrainer : public LearnerTask {
     int category_dims = category_lexicon.size();
     task->GetCounter("categories")->Increment(category_dims);
 
-    // Build dual encoder model with facts on the left side and categories on
-    // the right side.
-    myelin::Compiler compiler;
-    flow_.dims = embedding_dims_;
-    flow_.batch_size = batch_size_;
-    flow_.normalize = task->Get("normalize", false);
-    flow_.left.dims = fact_dims;
-    flow_.left.max_features = max_features_;
-    flow_.right.dims = category_dims;
-    flow_.right.max_features = max_features_;
-    flow_.Build();
-    loss_.Build(&flow_, flow_.sim_cosine, flow_.gsim_d_cosine);
-    optimizer_ = GetOptimizer(task);
-    optimizer_->Build(&flow_);
-
-    // Compile embedding model.
     myelin::Network model;
-    compiler.Compile(&flow_, &model);
-    optimizer_->Initialize(model);
-    loss_.Initialize(model);
-
-    // Initialize weights.
-    model.InitModelParameters(task->Get("seed", 0));
+    std::vector<float> category_counts(category_dims);
+    if (sparse_) {
+      // Initialize sparse embedding matrices sharded over the workers, with
+      // facts as inputs and categories as outputs.
+      int workers = task->Get("workers", jit::CPU::Cores());
+      W0_.Init(fact_dims, embedding_dims_, workers,
+               1.0 / embedding_dims_, task->Get("seed", 0));
+      W1_.Init(category_dims, embedding_dims_, workers, 0.0);
+      stats_.reset(new WorkerStats[workers]);
+      num_workers_ = workers;
+      learning_rate_decay_ = task->Get("learning_rate_decay", 1.0);
+      alpha_ = learning_rate_;
+    } else {
+      // Build dual encoder model with facts on the left side and categories on
+      // the right side.
+      myelin::Compiler compiler;
+      flow_.dims = embedding_dims_;
+      flow_.batch_size = batch_size_;
+      flow_.normalize = task->Get("normalize", false);
+      flow_.left.dims = fact_dims;
+      flow_.left.max_features = max_features_;
+      flow_.right.dims = category_dims;
+      flow_.right.max_features = max_features_;
+      flow_.Build();
+      loss_.Build(&flow_, flow_.sim_cosine, flow_.gsim_d_cosine);
+      optimizer_ = GetOptimizer(task);
+      optimizer_->Build(&flow_);
+
+      // Compile embedding model.
+      compiler.Compile(&flow_, &model);
+      optimizer_->Initialize(model);
+      loss_.Initialize(model);
+
+      // Initialize weights.
+      model.InitModelParameters(task->Get("seed", 0));
+    }
 
     // Read training instances from input.
     LOG(INFO) << "Reading training data";
@@ -107,6 +129,9 @@ class FactEmbeddingsTrainer : public LearnerTask {
       if (facts.length() > 0 && categories.length() > 0) {
         instances_.push_back(instance.handle());
         num_instances->Increment();
+        for (int i = 0; i < categories.length(); ++i) {
+          category_counts[categories.get(i).AsInt()]++;
+        }
       } else {
         num_instances_skipped->Increment();
       }
@@ -115,31 +140,33 @@ class FactEmbeddingsTrainer : public LearnerTask {
     }
     store_.Freeze();
 
+    // Initialize sampling table for negative categories.
+    if (sparse_) {
+      for (float &count : category_counts) {
+        if (count == 0.0) count = 1.0;
+      }
+      sampler_.Init(category_counts, task->Get("sampling_power", 0.75));
+    }
+
     // Run training.
     Train(task, &model);
 
     // Write fact embeddings to output file.
     LOG(INFO) << "Writing embeddings";
-    myelin::TensorData W0 = model[flow_.left.embeddings];
     std::vector<float> embedding(embedding_dims_);
     EmbeddingWriter fact_writer(task->GetOutputFile("factvecs"),
                                 fact_lexicon.size(), embedding_dims_);
     for (int i = 0; i < fact_lexicon.size(); ++i) {
-      for (int j = 0; j < embedding_dims_; ++j) {
-        embedding[j] = W0.at<float>(i, j);
-      }
+      GetEmbedding(&model, true, i, &embedding);
       fact_writer.Write(fact_lexicon[i], embedding);
     }
     CHECK(fact_writer.Close());
 
     // Write category embeddings to output file.
-    myelin::TensorData W1 =  model[flow_.right.embeddings];
     EmbeddingWriter category_writer(task->GetOutputFile("catvecs"),
                                     category_lexicon.size(), embedding_dims_);
     for (int i = 0; i < category_lexicon.size(); ++i) {
-      for (int j = 0; j < embedding_dims_; ++j) {
-        embedding[j] = W1.at<float>(i, j);
-      }
+      GetEmbedding(&model, false, i, &embedding);
       category_writer.Write(category_lexicon[i], embedding);
     }
     CHECK(category_writer.Close());
@@ -147,8 +174,28 @@ class FactEmbeddingsTrainer : public LearnerTask {
     delete optimizer_;
   }
 
+  // Get fact (left) or category (right) embedding from model.
+  void GetEmbedding(myelin::Network *model, bool left, int index,
+                    std::vector<float> *embedding) {
+    if (sparse_) {
+      const float *v = left ? W0_.row(index) : W1_.row(index);
+      embedding->assign(v, v + embedding_dims_);
+    } else {
+      auto *embeddings = left ? flow_.left.embeddings : flow_.right.embeddings;
+      myelin::TensorData W = (*model)[embeddings];
+      for (int j = 0; j < embedding_dims_; ++j) {
+        (*embedding)[j] = W.at<float>(index, j);
+      }
+    }
+  }
+
   // Worker thread for training embedding model.
   void Worker(int index, myelin::Network *model) override {
+    if (sparse_) {
+      SparseWorker(index);
+      return;
+    }
+
     // Initialize batch.
     Random rnd;
     rnd.seed(index);
@@ -208,8 +255,74 @@ class FactEmbeddingsTrainer : public LearnerTask {
     }
   }
 
+  // Worker thread for training sparse embedding model.
+  void SparseWorker(int index) {
+    SparseEmbeddingLearner learner(&W0_, &W1_, &sampler_, index);
+    learner.set_compute_loss(true);
+    Random rnd;
+    rnd.seed(index);
+    std::vector<int> facts;
+    std::vector<int> categories;
+    WorkerStats &stats = stats_[index];
+
+    for (;;) {
+      float alpha = alpha_;
+      int64 overflows = 0;
+      for (int i = 0; i < batch_size_ * batches_per_update_; ++i) {
+        // Get facts and categories for random instance.
+        int sample = rnd.UniformInt(instances_.size());
+        Frame instance(&store_, instances_[sample]);
+        Array f = instance.Get(p_facts_).AsArray();
+        Array c = instance.Get(p_categories_).AsArray();
+        facts.clear();
+        for (int j = 0; j < f.length(); ++j) {
+          if (facts.size() == max_features_) {
+            overflows++;
+            break;
+          }
+          facts.push_back(f.get(j).AsInt());
+        }
+        categories.clear();
+        for (int j = 0; j < c.length(); ++j) {
+          if (categories.size() == max_features_) {
+            overflows++;
+            break;
+          }
+          categories.push_back(c.get(j).AsInt());
+        }
+
+        // Update embeddings for the rows touched by the instance.
+        learner.Train(facts.data(), facts.size(),
+                      categories.data(), categories.size(),
+                      negative_, alpha);
+      }
+
+      // Add local statistics to worker statistics.
+      stats.mu.Lock();
+      stats.loss += learner.loss();
+      stats.count += learner.examples();
+      stats.mu.Unlock();
+      learner.ResetStats();
+      if (overflows > 0) num_feature_overflows_->Increment(overflows);
+
+      // Check if we are done.
+      if (EpochCompleted()) break;
+    }
+  }
+
   // Evaluate model.
   bool Evaluate(int64 epoch, myelin::Network *model) override {
+    // Collect loss from workers for sparse model.
+    for (int i = 0; i < num_workers_; ++i) {
+      WorkerStats &stats = stats_[i];
+      stats.mu.Lock();
+      loss_sum_ += stats.loss;
+      loss_count_ += stats.count;
+      stats.loss = 0.0;
+      stats.count = 0;
+      stats.mu.Unlock();
+    }
+
     // Skip evaluation if there are no data.
     if (loss_count_ == 0) return true;
 
@@ -223,7 +336,12 @@ class FactEmbeddingsTrainer : public LearnerTask {
     if (prev_loss_ != 0.0 &&
         prev_loss_ < loss &&
         learning_rate_ > min_learning_rate_) {
-      learning_rate_ = optimizer_->DecayLearningRate();
+      if (sparse_) {
+        learning_rate_ *= learning_rate_decay_;
+        alpha_ = learning_rate_;
+      } else {
+        learning_rate_ = optimizer_->DecayLearningRate();
+      }
     }
     prev_loss_ = loss;
 
@@ -252,6 +370,8 @@ class FactEmbeddingsTrainer : public LearnerTask {
   int max_features_ = 512;             // maximum features per item
   int batch_size_ = 1024;              // number of examples per batch
   int batches_per_update_ = 1;         // number of batches per epoch
+  bool sparse_ = false;                // use lock-free sparse updates
+  int negative_ = 5;                   // negative categories per category
 
   // Mutex for serializing access to optimizer.
   Mutex optimizer_mu_;
@@ -261,7 +381,27 @@ class FactEmbeddingsTrainer : public LearnerTask {
   float min_learning_rate_ = 0.01;
   float prev_loss_ = 0.0;
   float loss_sum_ = 0.0;
-  int loss_count_ = 0.0;
+  int64 loss_count_ = 0;
+
+  // Embedding matrices and negative sampling table for sparse model.
+  EmbeddingMatrix W0_;
+  EmbeddingMatrix W1_;
+  NegativeSampler sampler_;
+
+  // Current learning rate for sparse model.
+  std::atomic<float> alpha_{0.0};
+  float learning_rate_decay_ = 1.0;
+
+  // Loss statistics for each worker for sparse model. The statistics are
+  // padded so the workers do not update the same cache lines.
+  struct WorkerStats {
+    Mutex mu;
+    double loss = 0.0;
+    int64 count = 0;
+    char padding[64];
+  };
+  std::unique_ptr<WorkerStats[]> stats_;
+  int num_workers_ = 0;
 
   // Symbols.
   Names names_;
@@ -0,0 +1,194 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/nlp/embedding/sparse-embeddings.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "sling/base/logging.h"
+#include "sling/util/thread.h"
+
+namespace sling {
+namespace nlp {
+
+// Cache line size in bytes.
+static const int kCacheLine = 64;
+
+// Number of negative examples sampled at a time.
+static const int kNegativeBlock = 4096;
+
+// Sampling table entries per item.
+static const int kTableEntriesPerItem = 8;
+static const int kMinTableSize = 1 << 20;
+
+// Clip the sigmoid input to avoid overflow in exp().
+static const float kMaxLogit = 20.0;
+
+EmbeddingMatrix::~EmbeddingMatrix() {
+  free(data_);
+}
+
+void EmbeddingMatrix::Init(int rows, int dims, int shards, float scale,
+                           int seed) {
+  CHECK(data_ == nullptr);
+  rows_ = rows;
+  dims_ = dims;
+  int floats_per_line = kCacheLine / sizeof(float);
+  stride_ = (dims + floats_per_line - 1) / floats_per_line * floats_per_line;
+
+  // Allocate matrix without touching the memory.
+  size_t size = static_cast<size_t>(rows) * stride_ * sizeof(float);
+  void *data;
+  CHECK_EQ(posix_memalign(&data, kCacheLine, std::max<size_t>(size, 1)), 0);
+  data_ = static_cast<float *>(data);
+
+  // Initialize each shard in a separate thread.
+  if (shards < 1) shards = 1;
+  if (shards > rows) shards = std::max(rows, 1);
+  int rows_per_shard = (rows + shards - 1) / shards;
+  WorkerPool pool;
+  pool.Start(shards, [&](int index) {
+    Random rnd;
+    rnd.seed(seed + index);
+    int begin = index * rows_per_shard;
+    int end = std::min(begin + rows_per_shard, rows);
+    for (int r = begin; r < end; ++r) {
+      float *v = row(r);
+      if (scale == 0.0) {
+        memset(v, 0, stride_ * sizeof(float));
+      } else {
+        for (int i = 0; i < dims; ++i) {
+          v[i] = rnd.UniformFloat(scale, -scale / 2);
+        }
+        for (int i = dims; i < stride_; ++i) v[i] = 0.0;
+      }
+    }
+  });
+  pool.Join();
+}
+
+void NegativeSampler::Init(const std::vector<float> &counts, float power) {
+  int n = counts.size();
+  CHECK_GT(n, 0);
+  double sum = 0.0;
+  for (float c : counts) sum += pow(c, power);
+  CHECK_GT(sum, 0.0);
+
+  // Fill table with each item occupying a fraction of the entries
+  // proportional to its probability.
+  size_ = std::max(kMinTableSize, n * kTableEntriesPerItem);
+  table_.resize(size_);
+  int item = 0;
+  double acc = pow(counts[0], power) / sum;
+  for (int i = 0; i < size_; ++i) {
+    table_[i] = item;
+    if ((i + 1.0) / size_ > acc && item < n - 1) {
+      item++;
+      acc += pow(counts[item], power) / sum;
+    }
+  }
+}
+
+SparseEmbeddingLearner::SparseEmbeddingLearner(EmbeddingMatrix *input,
+                                               EmbeddingMatrix *output,
+                                               const NegativeSampler *sampler,
+                                               int seed)
+    : input_(input), output_(output), sampler_(sampler) {
+  CHECK_EQ(input->dims(), output->dims());
+  rnd_.seed(seed);
+  negatives_.resize(kNegativeBlock);
+  next_ = negatives_.size();
+  hidden_.resize(input->dims());
+  error_.resize(input->dims());
+}
+
+void SparseEmbeddingLearner::RefillNegatives() {
+  for (int &n : negatives_) n = sampler_->Sample(&rnd_);
+  next_ = 0;
+}
+
+void SparseEmbeddingLearner::Train(const int *features, int num_features,
+                                   const int *targets, int num_targets,
+                                   int negative, float alpha) {
+  if (num_features == 0 || num_targets == 0) return;
+  int dims = hidden_.size();
+  float *h = hidden_.data();
+  float *e = error_.data();
+
+  // Compute hidden activation as the average of the input embeddings.
+  for (int i = 0; i < dims; ++i) h[i] = 0.0;
+  for (int f = 0; f < num_features; ++f) {
+    const float *v = input_->row(features[f]);
+    for (int i = 0; i < dims; ++i) h[i] += v[i];
+  }
+  float scale = 1.0 / num_features;
+  for (int i = 0; i < dims; ++i) h[i] *= scale;
+
+  // Update output embeddings for positive and negative examples.
+  for (int i = 0; i < dims; ++i) e[i] = 0.0;
+  for (int t = 0; t < num_targets; ++t) {
+    int target = targets[t];
+    Update(target, 1.0, alpha);
+    for (int d = 0; d < negative; ++d) {
+      int sample = NextNegative();
+      if (sample == target) continue;
+      Update(sample, 0.0, alpha);
+    }
+  }
+
+  // Propagate error back to the input embeddings.
+  for (int f = 0; f < num_features; ++f) {
+    float *v = input_->row(features[f]);
+    for (int i = 0; i < dims; ++i) v[i] += e[i];
+  }
+  examples_++;
+}
+
+void SparseEmbeddingLearner::Update(int target, float label, float alpha) {
+  int dims = hidden_.size();
+  const float *h = hidden_.data();
+  float *e = error_.data();
+  float *w = output_->row(target);
+
+  // Compute logit for target.
+  float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  int i = 0;
+  for (; i + 4 <= dims; i += 4) {
+    s0 += h[i] * w[i];
+    s1 += h[i + 1] * w[i + 1];
+    s2 += h[i + 2] * w[i + 2];
+    s3 += h[i + 3] * w[i + 3];
+  }
+  for (; i < dims; ++i) s0 += h[i] * w[i];
+  float logit = (s0 + s1) + (s2 + s3);
+  if (logit > kMaxLogit) logit = kMaxLogit;
+  if (logit < -kMaxLogit) logit = -kMaxLogit;
+
+  // Compute gradient of the log-likelihood.
+  float p = 1.0 / (1.0 + exp(-logit));
+  float eta = (label - p) * alpha;
+  if (compute_loss_) loss_ -= log(label > 0.0 ? p : 1.0 - p);
+
+  // Accumulate error for input and update output embedding.
+  for (int i = 0; i < dims; ++i) {
+    e[i] += w[i] * eta;
+    w[i] += h[i] * eta;
+  }
+}
+
+}  // namespace nlp
+}  // namespace sling
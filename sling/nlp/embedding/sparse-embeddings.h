@@ -0,0 +1,151 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_NLP_EMBEDDING_SPARSE_EMBEDDINGS_H_
+#define SLING_NLP_EMBEDDING_SPARSE_EMBEDDINGS_H_
+
+#include <vector>
+
+#include "sling/base/macros.h"
+#include "sling/base/types.h"
+#include "sling/util/random.h"
+
+namespace sling {
+namespace nlp {
+
+// Embedding matrix for lock-free sparse training. Each row is padded and
+// aligned to a multiple of the cache line size, so updates to different rows
+// from different threads never touch the same cache line. The rows are split
+// into shards of consecutive rows that are initialized in parallel by one
+// thread each. With the first-touch page placement policy of the kernel, this
+// spreads the pages of the matrix over the NUMA nodes of the training threads
+// instead of placing the whole matrix on the node of the main thread.
+class EmbeddingMatrix {
+ public:
+  EmbeddingMatrix() {}
+  ~EmbeddingMatrix();
+
+  // Allocate matrix and initialize it with uniformly distributed random values
+  // in [-scale/2;scale/2]. The matrix is zero-initialized if scale is zero.
+  void Init(int rows, int dims, int shards, float scale, int seed = 0);
+
+  // Return row in matrix.
+  float *row(int r) { return data_ + static_cast<int64>(r) * stride_; }
+  const float *row(int r) const {
+    return data_ + static_cast<int64>(r) * stride_;
+  }
+
+  // Return matrix dimensions.
+  int rows() const { return rows_; }
+  int dims() const { return dims_; }
+
+ private:
+  // Matrix data.
+  float *data_ = nullptr;
+
+  // Matrix dimensions.
+  int rows_ = 0;
+  int dims_ = 0;
+
+  // Distance between rows in floats.
+  int stride_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(EmbeddingMatrix);
+};
+
+// Table for sampling negative examples. The table is shared read-only by all
+// training threads.
+class NegativeSampler {
+ public:
+  // Initialize sampling table where items are sampled with a probability
+  // proportional to their count raised to the power.
+  void Init(const std::vector<float> &counts, float power = 1.0);
+
+  // Sample item from table.
+  int Sample(Random *rnd) const { return table_[rnd->UniformInt(size_)]; }
+
+ private:
+  // Sampling table with items repeated according to their probability.
+  std::vector<int> table_;
+  int size_ = 0;
+};
+
+// Per-thread learner for lock-free (HOGWILD!) training of an embedding model
+// with negative sampling. This implements the same model as MikolovFlow, but
+// the updates are applied directly to the rows touched by each example instead
+// of going through myelin cells. Negative examples are drawn from a private
+// buffer that is refilled in blocks, and statistics are accumulated locally so
+// the worker threads do not share any mutable state except for the embedding
+// rows themselves.
+class SparseEmbeddingLearner {
+ public:
+  SparseEmbeddingLearner(EmbeddingMatrix *input, EmbeddingMatrix *output,
+                         const NegativeSampler *sampler, int seed);
+
+  // Train model on example. The embeddings for the input features are averaged
+  // and trained to predict each of the targets with the given number of
+  // sampled negative examples per target.
+  void Train(const int *features, int num_features,
+             const int *targets, int num_targets,
+             int negative, float alpha);
+
+  // Enable loss computation.
+  void set_compute_loss(bool b) { compute_loss_ = b; }
+
+  // Return and reset accumulated loss and number of examples.
+  double loss() const { return loss_; }
+  int64 examples() const { return examples_; }
+  void ResetStats() { loss_ = 0.0; examples_ = 0; }
+
+ private:
+  // Update output embedding for target and accumulate error for input.
+  void Update(int target, float label, float alpha);
+
+  // Get next negative example from sample buffer.
+  int NextNegative() {
+    if (next_ == negatives_.size()) RefillNegatives();
+    return negatives_[next_++];
+  }
+
+  // Refill sample buffer with negative examples.
+  void RefillNegatives();
+
+  // Input and output embedding matrices.
+  EmbeddingMatrix *input_;
+  EmbeddingMatrix *output_;
+
+  // Sampling table for negative examples.
+  const NegativeSampler *sampler_;
+
+  // Random number generator for this thread.
+  Random rnd_;
+
+  // Buffer with pre-sampled negative examples.
+  std::vector<int> negatives_;
+  size_t next_ = 0;
+
+  // Hidden activation and accumulated error for current example.
+  std::vector<float> hidden_;
+  std::vector<float> error_;
+
+  // Local statistics.
+  bool compute_loss_ = false;
+  double loss_ = 0.0;
+  int64 examples_ = 0;
+};
+
+}  // namespace nlp
+}  // namespace sling
+
+#endif  // SLING_NLP_EMBEDDING_SPARSE_EMBEDDINGS_H_
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -25,6 +26,7 @@
 #include "sling/myelin/profile.h"
 #include "sling/nlp/document/document.h"
 #include "sling/nlp/embedding/embedding-model.h"
+#include "sling/nlp/embedding/sparse-embeddings.h"
 #include "sling/task/process.h"
 #include "sling/util/embeddings.h"
 #include "sling/util/random.h"
@@ -104,6 +106,12 @@ class WordVocabularySampler {
     return (sqrt(count / threshold_) + 1.0) * threshold_ / count;
   }
 
+  // Get word counts in vocabulary order.
+  void GetCounts(std::vector<float> *counts) const {
+    counts->clear();
+    for (const Entry &e : entry_) counts->push_back(e.count);
+  }
+
   // Clear data.
   void Clear() {
     dictionary_.clear();
@@ -153,6 +161,11 @@ class WordVocabularySampler {
 // the weight matrices in the network. However, the updates are usually small,
 // so in practice these unsafe updates are usually not harmful and adding
 // mutexes to serialize access to the model slows down training considerably.
+//
+// In sparse mode, the myelin model is replaced by lock-free updates of the
+// embedding rows touched by each example (see SparseEmbeddingLearner). This
+// avoids false sharing between threads and scales better with the number of
+// worker threads.
 class WordEmbeddingsTrainer : public Process {
  public:
   // Run training of embedding net.
@@ -166,31 +179,50 @@ class WordEmbeddingsTrainer : public Process {
     task->Fetch("min_learning_rate", &min_learning_rate_);
     task->Fetch("embedding_dims", &embedding_dims_);
     task->Fetch("subsampling", &subsampling_);
+    task->Fetch("sparse", &sparse_);
 
     // Load vocabulary.
     normalization_ = ParseNormalization(task->Get("normalization", ""));
     vocabulary_.Load(task->GetInputFile("vocabulary"), subsampling_);
     int vocabulary_size = vocabulary_.size();
 
-    // Build embedding model.
-    flow_.inputs = flow_.outputs = vocabulary_size;
-    flow_.dims = embedding_dims_;
-    flow_.in_features = window_ * 2;
-    flow_.Build();
+    // Get the number of worker threads. Use one worker thread per input file
+    // by default.
+    std::vector<string> filenames = task->GetInputFiles("documents");
+    int threads = filenames.size();
+    task->Fetch("threads", &threads);
 
-    // Compile embedding model.
-    myelin::Compiler compiler;
     myelin::Network model;
-    compiler.Compile(&flow_, &model);
-
-    // Initialize weights.
-    Random rnd;
-    myelin::TensorData W0 = model[flow_.W0];
-    myelin::TensorData W1 = model[flow_.W1];
-    for (int i = 0; i < vocabulary_size; ++i) {
-      for (int j = 0; j < embedding_dims_; ++j) {
-        W0.at<float>(i, j) = rnd.UniformFloat(1.0, -0.5) / embedding_dims_;
-        W1.at<float>(i, j) = 0.0;
+    if (sparse_) {
+      // Initialize sparse embedding matrices sharded over the worker threads.
+      W0_.Init(vocabulary_size, embedding_dims_, threads,
+               1.0 / embedding_dims_, task->Get("seed", 0));
+      W1_.Init(vocabulary_size, embedding_dims_, threads, 0.0);
+
+      // Initialize sampling table for negative examples.
+      std::vector<float> counts;
+      vocabulary_.GetCounts(&counts);
+      sampler_.Init(counts);
+    } else {
+      // Build embedding model.
+      flow_.inputs = flow_.outputs = vocabulary_size;
+      flow_.dims = embedding_dims_;
+      flow_.in_features = window_ * 2;
+      flow_.Build();
+
+      // Compile embedding model.
+      myelin::Compiler compiler;
+      compiler.Compile(&flow_, &model);
+
+      // Initialize weights.
+      Random rnd;
+      myelin::TensorData W0 = model[flow_.W0];
+      myelin::TensorData W1 = model[flow_.W1];
+      for (int i = 0; i < vocabulary_size; ++i) {
+        for (int j = 0; j < embedding_dims_; ++j) {
+          W0.at<float>(i, j) = rnd.UniformFloat(1.0, -0.5) / embedding_dims_;
+          W1.at<float>(i, j) = 0.0;
+        }
       }
     }
 
@@ -206,10 +238,7 @@ class WordEmbeddingsTrainer : public Process {
     num_instances_ = task->GetCounter("instances");
     epochs_completed_ = task->GetCounter("epochs_completed");
 
-    // Start training threads. Use one worker thread per input file.
-    std::vector<string> filenames = task->GetInputFiles("documents");
-    int threads = filenames.size();
-    task->Fetch("threads", &threads);
+    // Start training threads.
     WorkerPool pool;
     pool.Start(threads, [this, &filenames, &model](int index) {
       Worker(index, filenames[index % filenames.size()], &model);
@@ -219,7 +248,7 @@ class WordEmbeddingsTrainer : public Process {
     pool.Join();
 
     // Output profile.
-    myelin::LogProfile(model);
+    if (!sparse_) myelin::LogProfile(model);
 
     // Write embeddings to output file.
     const string &output_filename = task->GetOutputFile("output");
@@ -227,8 +256,14 @@ class WordEmbeddingsTrainer : public Process {
     std::vector<float> embedding(embedding_dims_);
     for (int i = 0; i < vocabulary_size; ++i) {
       const string &word = vocabulary_.word(i);
-      for (int j = 0; j < embedding_dims_; ++j) {
-        embedding[j] = W1.at<float>(i, j);
+      if (sparse_) {
+        const float *v = W1_.row(i);
+        embedding.assign(v, v + embedding_dims_);
+      } else {
+        myelin::TensorData W1 = model[flow_.W1];
+        for (int j = 0; j < embedding_dims_; ++j) {
+          embedding[j] = W1.at<float>(i, j);
+        }
       }
       writer.Write(word, embedding);
     }
@@ -248,22 +283,34 @@ class WordEmbeddingsTrainer : public Process {
     rnd.seed(index);
     int epoch = 0;
     std::vector<int> words;
-
-    // Set up model compute instances.
-    myelin::Instance l0(flow_.layer0);
-    myelin::Instance l1(flow_.layer1);
-    myelin::Instance l0b(flow_.layer0b);
-
-    int *features = l0.Get<int>(flow_.fv);
-    int *fend = features + flow_.in_features;
-    int *target = l1.Get<int>(flow_.target);
-    float *label = l1.Get<float>(flow_.label);
-    float *alpha = l1.Get<float>(flow_.alpha);
-    *alpha = learning_rate_;
-
-    l1.Set(flow_.l1_l0, &l0);
-    l0b.Set(flow_.l0b_l0, &l0);
-    l0b.Set(flow_.l0b_l1, &l1);
+    std::vector<int> context(window_ * 2);
+    float learning_rate = learning_rate_;
+
+    // Set up lock-free learner for sparse model or compute instances for
+    // myelin model.
+    std::unique_ptr<SparseEmbeddingLearner> learner;
+    std::unique_ptr<myelin::Instance> l0, l1, l0b;
+    int *features = nullptr;
+    int *target = nullptr;
+    float *label = nullptr;
+    float *alpha = nullptr;
+    if (sparse_) {
+      learner.reset(new SparseEmbeddingLearner(&W0_, &W1_, &sampler_, index));
+    } else {
+      l0.reset(new myelin::Instance(flow_.layer0));
+      l1.reset(new myelin::Instance(flow_.layer1));
+      l0b.reset(new myelin::Instance(flow_.layer0b));
+
+      features = l0->Get<int>(flow_.fv);
+      target = l1->Get<int>(flow_.target);
+      label = l1->Get<float>(flow_.label);
+      alpha = l1->Get<float>(flow_.alpha);
+      *alpha = learning_rate;
+
+      l1->Set(flow_.l1_l0, l0.get());
+      l0b->Set(flow_.l0b_l0, l0.get());
+      l0b->Set(flow_.l0b_l1, l1.get());
+    }
 
     RecordFileOptions options;
     RecordReader input(filename, options);
@@ -278,8 +325,11 @@ class WordEmbeddingsTrainer : public Process {
 
           // Update learning rate.
           float progress = static_cast<float>(epoch) / iterations_;
-          *alpha = learning_rate_ * (1.0 - progress);
-          if (*alpha < min_learning_rate_) *alpha = min_learning_rate_;
+          learning_rate = learning_rate_ * (1.0 - progress);
+          if (learning_rate < min_learning_rate_) {
+            learning_rate = min_learning_rate_;
+          }
+          if (alpha != nullptr) *alpha = learning_rate;
           continue;
         } else {
           break;
@@ -297,7 +347,9 @@ class WordEmbeddingsTrainer : public Process {
       Document document(decoder.Decode().AsFrame(), docnames_);
       num_tokens_->Increment(document.num_tokens());
 
-      // Go over each sentence in the document.
+      // Go over each sentence in the document. The number of instances is
+      // counted locally and added to the shared counter for each document.
+      int64 instances = 0;
       for (SentenceIterator s(&document); s.more(); s.next()) {
         // Get all the words in the sentence with sub-sampling.
         words.clear();
@@ -313,38 +365,47 @@ class WordEmbeddingsTrainer : public Process {
         // Use each word in the sentence as a training example.
         for (int pos = 0; pos < words.size(); ++pos) {
           // Get features from window around word.
-          int *f = features;
+          int num_features = 0;
           for (int i = pos - window_; i <= pos + window_; ++i) {
             if (i == pos) continue;
             if (i < 0) continue;
             if (i >= words.size()) continue;
-            *f++ = words[i];
+            context[num_features++] = words[i];
+          }
+          if (num_features == 0) continue;
+          instances++;
+
+          if (sparse_) {
+            // Update embeddings for the rows touched by the example.
+            learner->Train(context.data(), num_features, &words[pos], 1,
+                           negative_, learning_rate);
+            continue;
           }
-          if (f == features) continue;
-          if (f < fend) *f = -1;
-          num_instances_->Increment();
 
           // Propagate input to hidden layer.
-          l0.Compute();
+          std::copy(context.begin(), context.begin() + num_features, features);
+          if (num_features < flow_.in_features) features[num_features] = -1;
+          l0->Compute();
 
           // Propagate hidden to output and back. This also accumulates the
           // errors that should be propagated back to the input layer.
-          l1.Clear(flow_.error);
+          l1->Clear(flow_.error);
           *label = 1.0;
           *target = words[pos];
-          l1.Compute();
+          l1->Compute();
 
           // Randomly sample negative examples.
           *label = 0.0;
           for (int d = 0; d < negative_; ++d) {
             *target = vocabulary_.Sample(rnd.UniformProb());
-            l1.Compute();
+            l1->Compute();
           }
 
           // Propagate hidden to input.
-          l0b.Compute();
+          l0b->Compute();
         }
       }
+      num_instances_->Increment(instances);
 
       // Check for early stopping.
       if (max_epochs_ != -1) {
@@ -363,10 +424,16 @@ class WordEmbeddingsTrainer : public Process {
   double min_learning_rate_ = 0.0001;  // minimum learning rate
   int embedding_dims_ = 256;           // size of embedding vectors
   double subsampling_ = 1e-3;          // sub-sampling rate
+  bool sparse_ = false;                // use lock-free sparse updates
 
   // Flow model for word embedding trainer.
   MikolovFlow flow_;
 
+  // Embedding matrices and negative sampling table for sparse training.
+  EmbeddingMatrix W0_;
+  EmbeddingMatrix W1_;
+  NegativeSampler sampler_;
+
   // Token normalization flags.
   Normalization normalization_;
 
@@ -0,0 +1,115 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/frame/object.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+#include "sling/nlp/kb/facts.h"
+
+DEFINE_string(kb, "data/e/kb/kb.sling", "Knowledge base");
+DEFINE_int32(items, 0, "Maximum number of items to extract facts for");
+DEFINE_int32(slot_index_threshold, 64,
+             "Minimum number of slots for indexed frames (0=no slot index)");
+
+using namespace sling;
+using namespace sling::nlp;
+
+// Time slot lookups for all slot names in the items with and without the slot
+// index and return the number of nanoseconds per lookup.
+double TimeLookups(const Store &commons, const std::vector<Handle> &items,
+                   const SlotIndex *index, int64 *checksum) {
+  int64 lookups = 0;
+  Clock clock;
+  clock.start();
+  for (Handle item : items) {
+    const FrameDatum *frame = commons.GetFrame(item);
+    for (const Slot *s = frame->begin(); s < frame->end(); ++s) {
+      *checksum += frame->get(s->name, index).raw();
+      lookups++;
+    }
+  }
+  clock.stop();
+  return clock.ns() / lookups;
+}
+
+// Time slot lookups and fact extraction for all items in the knowledge base.
+// Run with --slot_index_threshold=0 to time fact extraction without the slot
+// index.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Load knowledge base.
+  LOG(INFO) << "Loading knowledge base from " << FLAGS_kb;
+  Store::Options options;
+  options.slot_index_threshold = FLAGS_slot_index_threshold;
+  Store commons(&options);
+  LoadStore(FLAGS_kb, &commons);
+  FactCatalog catalog;
+  catalog.Init(&commons);
+  Names names;
+  Name n_item(names, "/w/item");
+  names.Bind(&commons);
+  commons.Freeze();
+  const SlotIndex *index = commons.slot_index();
+  if (index != nullptr) {
+    std::cout << "slot index: " << index->num_frames() << " frames, "
+              << index->memory() << " bytes\n";
+  }
+
+  // Collect items.
+  std::vector<Handle> items;
+  commons.ForAll([&](Handle handle) {
+    if (FLAGS_items > 0 && items.size() >= FLAGS_items) return;
+    Frame item(&commons, handle);
+    if (item.IsA(n_item)) items.push_back(handle);
+  });
+
+  // Time slot lookups in items with and without slot index.
+  if (index != nullptr) {
+    int64 linear_checksum = 0;
+    int64 indexed_checksum = 0;
+    double linear = TimeLookups(commons, items, nullptr, &linear_checksum);
+    double indexed = TimeLookups(commons, items, index, &indexed_checksum);
+    CHECK_EQ(linear_checksum, indexed_checksum);
+    std::cout << "slot lookups: " << linear << " ns linear, "
+              << indexed << " ns indexed\n";
+  }
+
+  // Extract facts for all items.
+  Clock clock;
+  clock.start();
+  int64 num_facts = 0;
+  for (Handle item : items) {
+    Store store(&commons);
+    Facts facts(&catalog);
+    facts.Extract(item);
+    Handles fact_list(&store);
+    facts.AsArrays(&store, &fact_list);
+    num_facts += fact_list.size();
+  }
+  clock.stop();
+
+  std::cout << items.size() << " items, " << num_facts << " facts, "
+            << clock.secs() << " secs, "
+            << static_cast<int64>(items.size() / clock.secs())
+            << " items/sec\n";
+  return 0;
+}
@@ -26,19 +26,28 @@
 #include "sling/frame/serialization.h"
 #include "sling/frame/store.h"
 #include "sling/net/http-server.h"
+#include "sling/net/http-utils.h"
 #include "sling/net/web-service.h"
 #include "sling/nlp/kb/calendar.h"
 #include "sling/nlp/kb/properties.h"
 #include "sling/string/text.h"
 #include "sling/string/strcat.h"
+#include "sling/util/fingerprint.h"
 #include "sling/util/md5.h"
 #include "sling/util/sortmap.h"
 
 DEFINE_string(thumbnails, "", "Thumbnail web service");
+DEFINE_int32(kb_cache_size, 256, "KB response cache size in MB (0=disabled)");
+DEFINE_int32(kb_cache_shards, 16, "Number of shards in KB response cache");
 
 namespace sling {
 namespace nlp {
 
+// Set when the request handled by the current thread has looked up items in
+// the item database. The item database can change at any time, so these
+// responses are not cached.
+static thread_local bool itemdb_used = false;
+
 // HTML header and footer for landing page.
 static const char *html_landing_header =
 R"""(<!DOCTYPE html>
@@ -259,80 +268,264 @@ void KnowledgeService::Load(Store *kb, const string &name_table) {
     LOG(INFO) << "Loading name table from " << name_table;
     aliases_.Load(name_table);
   }
+
+  Invalidate();
 }
 
 void KnowledgeService::LoadXref(const string &xref_table) {
   xref_.Load(xref_table);
+  Invalidate();
 }
 
 void KnowledgeService::LoadSearchIndex(const string &search_index) {
   search_.Load(search_index);
+  Invalidate();
 }
 
 void KnowledgeService::OpenItems(const string &filename) {
   delete items_;
   RecordFileOptions options;
+  options.memory_mapped = true;
   items_ = new RecordDatabase(filename, options);
+  Invalidate();
 }
 
 void KnowledgeService::OpenItemDatabase(const string &db) {
   delete itemdb_;
   itemdb_ = new DBClient();
   CHECK(itemdb_->Connect(db, "kb"));
+  Invalidate();
 }
 
 void KnowledgeService::Register(HTTPServer *http) {
+  if (FLAGS_kb_cache_size > 0 && cache_ == nullptr) {
+    size_t capacity = static_cast<size_t>(FLAGS_kb_cache_size) << 20;
+    cache_ = new ResponseCache(capacity, FLAGS_kb_cache_shards);
+  }
+
   http->Register("/kb", this, &KnowledgeService::HandleLandingPage);
-  http->Register("/kb/query", this, &KnowledgeService::HandleQuery);
+  RegisterCached(http, "/kb/query", &KnowledgeService::HandleQuery);
   http->Register("/kb/search", this, &KnowledgeService::HandleSearch);
-  http->Register("/kb/item", this, &KnowledgeService::HandleGetItem);
+  RegisterCached(http, "/kb/item", &KnowledgeService::HandleGetItem);
   http->Register("/kb/frame", this, &KnowledgeService::HandleGetFrame);
   http->Register("/kb/topic", this, &KnowledgeService::HandleGetTopic);
-  http->Register("/kb/stubs", this, &KnowledgeService::HandleGetStubs);
+  RegisterCached(http, "/kb/stubs", &KnowledgeService::HandleGetStubs);
+  http->Register("/kb/cachez", this, &KnowledgeService::HandleCacheStatus);
   common_.Register(http);
   app_.Register(http);
 }
 
-Handle KnowledgeService::RetrieveItem(Store *store, Text id,
-                                      bool offline) const {
+void KnowledgeService::RegisterCached(HTTPServer *http,
+                                      const char *endpoint,
+                                      Handler handler) {
+  http->Register(endpoint,
+    [this, endpoint, handler](HTTPRequest *request, HTTPResponse *response) {
+      ServeCached(request, response, endpoint, handler);
+    }
+  );
+}
+
+void KnowledgeService::ServeCached(HTTPRequest *request,
+                                   HTTPResponse *response,
+                                   const char *endpoint,
+                                   Handler handler) {
+  // Only GET and POST requests are cached.
+  HTTPMethod method = request->Method();
+  if (cache_ == nullptr || (method != HTTP_GET && method != HTTP_POST)) {
+    (this->*handler)(request, response);
+    return;
+  }
+
+  // The cache key consists of the endpoint, the query parameters, the request
+  // content type, which selects the output format, the request body, and
+  // whether the client accepts gzip-compressed responses.
+  string key = StrCat(request->method(), " ", endpoint, request->path());
+  if (request->query() != nullptr) StrAppend(&key, "?", request->query());
+  if (request->content_type() != nullptr) {
+    StrAppend(&key, " ", request->content_type());
+  }
+  if (request->content_size() > 0) {
+    uint64 fp = Fingerprint(request->content(), request->content_size());
+    StrAppend(&key, " ", fp);
+  }
+  if (AcceptsEncoding(request->Get("Accept-Encoding"), "gzip")) {
+    StrAppend(&key, " gzip");
+  }
+
+  // Look up response in cache.
+  uint64 generation = generation_;
+  ResponseCache::Entry entry = cache_->Lookup(key, generation);
+  const char *etag = request->Get("If-None-Match");
+  if (entry != nullptr) {
+    response->Set("ETag", entry->etag.c_str());
+    if (CompressibleContentType(entry->content_type.c_str())) {
+      response->Set("Vary", "Accept-Encoding");
+    }
+    if (etag != nullptr && entry->etag == etag) {
+      response->set_status(304);
+      return;
+    }
+    response->set_content_type(entry->content_type.c_str());
+    if (!entry->encoding.empty()) {
+      response->Set("Content-Encoding", entry->encoding.c_str());
+    }
+    response->Append(entry->body);
+    return;
+  }
+
+  // Generate response.
+  itemdb_used = false;
+  (this->*handler)(request, response);
+
+  // Only cache successful responses that were generated into the buffer.
+  IOBuffer *buffer = response->buffer();
+  if (response->status() != 200 || buffer->empty()) return;
+  if (response->content_length() != 0 &&
+      response->content_length() != buffer->available()) {
+    return;
+  }
+  if (response->Get("Content-Encoding") != nullptr) return;
+
+  // Compress the response before computing the entity tag, so the tag and the
+  // cached response are for the bytes sent to the client.
+  const char *content_type = response->content_type();
+  response->Compress();
+  if (CompressibleContentType(content_type)) {
+    response->Set("Vary", "Accept-Encoding");
+  }
+  uint64 fp = Fingerprint(buffer->begin(), buffer->available());
+  string tag = StrCat("\"", fp, "\"");
+  response->Set("ETag", tag.c_str());
+
+  // Responses with items from the item database are not cached.
+  if (!itemdb_used) {
+    auto *cached = new ResponseCache::Response();
+    cached->key = std::move(key);
+    cached->generation = generation;
+    if (content_type != nullptr) cached->content_type = content_type;
+    const char *encoding = response->Get("Content-Encoding");
+    if (encoding != nullptr) cached->encoding = encoding;
+    cached->etag = tag;
+    cached->body.assign(buffer->begin(), buffer->available());
+    cache_->Insert(ResponseCache::Entry(cached));
+  }
+
+  // Return empty response if client already has the content.
+  if (etag != nullptr && tag == etag) {
+    buffer->Clear();
+    response->set_status(304);
+    response->set_content_length(0);
+  }
+}
+
+void KnowledgeService::HandleCacheStatus(HTTPRequest *request,
+                                         HTTPResponse *response) {
+  response->set_content_type("text/json");
+  if (cache_ == nullptr) {
+    response->Append("{\"enabled\": false}\n");
+  } else {
+    cache_->OutputStats(response->buffer());
+  }
+}
+
+Handle KnowledgeService::LookupItem(Store *store, Text id,
+                                    string *key) const {
   // Look up item in knowledge base.
   Handle handle = store->LookupExisting(id);
   if (!handle.IsNil() && store->IsProxy(handle)) handle = Handle::nil();
 
-  string key = id.str();
+  key->assign(id.data(), id.size());
   if (handle.IsNil() and xref_.loaded()) {
     // Try looking up in cross-reference.
-    if (xref_.Map(&key)) {
-      handle = store->LookupExisting(key);
+    if (xref_.Map(key)) {
+      handle = store->LookupExisting(*key);
     }
   }
 
+  return handle;
+}
+
+Handle KnowledgeService::ParseItem(Store *store, const Slice &value) {
+  ArrayInputStream stream(value);
+  InputParser parser(store, &stream);
+  return parser.Read().handle();
+}
+
+Handle KnowledgeService::RetrieveItem(Store *store, Text id,
+                                      bool offline) const {
+  string key;
+  Handle handle = LookupItem(store, id, &key);
+
   if (handle.IsNil() && offline && items_ != nullptr) {
     // Try looking up item in the offline item records.
-    MutexLock lock(&mu_);
     Record rec;
-    if (items_->Lookup(key, &rec)) {
-      ArrayInputStream stream(rec.value);
-      InputParser parser(store, &stream);
-      handle = parser.Read().handle();
+    IOBuffer buffer;
+    if (items_->Lookup(key, &rec, &buffer)) {
+      handle = ParseItem(store, rec.value);
     }
   }
 
   if (handle.IsNil() && offline && itemdb_ != nullptr) {
     // Try looking up item in the offline item database.
+    itemdb_used = true;
     MutexLock lock(&mu_);
     DBRecord rec;
     Status st = itemdb_->Get(key, &rec);
     if (st.ok() && !rec.value.empty()) {
-      ArrayInputStream stream(rec.value);
-      InputParser parser(store, &stream);
-      handle = parser.Read().handle();
+      handle = ParseItem(store, rec.value);
     }
   }
 
   return handle;
 }
 
+void KnowledgeService::RetrieveItems(Store *store,
+                                     const std::vector<Text> &ids,
+                                     Handles *items) const {
+  // Look up items in knowledge base and collect keys for missing items.
+  items->resize(ids.size());
+  std::vector<string> keys(ids.size());
+  std::vector<int> missing;
+  for (int i = 0; i < ids.size(); ++i) {
+    (*items)[i] = LookupItem(store, ids[i], &keys[i]);
+    if ((*items)[i].IsNil()) missing.push_back(i);
+  }
+  if (missing.empty()) return;
+
+  if (items_ != nullptr) {
+    // Look up missing items in the offline item records.
+    Record rec;
+    IOBuffer buffer;
+    int unresolved = 0;
+    for (int i : missing) {
+      if (items_->Lookup(keys[i], &rec, &buffer)) {
+        (*items)[i] = ParseItem(store, rec.value);
+      }
+      if ((*items)[i].IsNil()) missing[unresolved++] = i;
+    }
+    missing.resize(unresolved);
+    if (missing.empty()) return;
+  }
+
+  if (itemdb_ != nullptr) {
+    // Fetch missing items from the offline item database in one batch.
+    std::vector<Slice> dbkeys;
+    for (int i : missing) dbkeys.emplace_back(keys[i]);
+    itemdb_used = true;
+    MutexLock lock(&mu_);
+    std::vector<DBRecord> recs;
+    Status st = itemdb_->Get(dbkeys, &recs);
+    if (st.ok()) {
+      for (int j = 0; j < missing.size(); ++j) {
+        if (recs[j].value.empty()) continue;
+        (*items)[missing[j]] = ParseItem(store, recs[j].value);
+      }
+    } else {
+      LOG(WARNING) << "Error fetching items: " << st;
+    }
+  }
+}
+
 void KnowledgeService::Preload(const Frame &item, Store *store) {
   // Skip preloading if there is no item database.
   if (itemdb_ == nullptr) return;
@@ -352,6 +545,7 @@ void KnowledgeService::Preload(const Frame &item, Store *store) {
       keys.push_back(store->FrameId(h).slice());
     }
 
+    itemdb_used = true;
     MutexLock lock(&mu_);
     std::vector<DBRecord> recs;
     Status st = itemdb_->Get(keys, &recs);
@@ -462,16 +656,27 @@ void KnowledgeService::HandleQuery(HTTPRequest *request,
     }
   }
 
-  // Generate response.
+  // Retrieve matching items in batches until the result limit is reached or
+  // all matches have been tried.
   Builder b(ws.store());
-  for (const auto &m : matches) {
-    if (results.size() >= limit) break;
-    Text id = m.second->id();
-    Frame item(ws.store(), RetrieveItem(ws.store(), id));
-    if (item.invalid()) continue;
-    Builder match(ws.store());
-    GetStandardProperties(item, &match, true);
-    results.push_back(match.Create().handle());
+  std::vector<Text> ids;
+  Handles items(ws.store());
+  int next = 0;
+  while (results.size() < limit && next < matches.size()) {
+    ids.clear();
+    int batch = limit - results.size();
+    while (ids.size() < batch && next < matches.size()) {
+      ids.push_back(matches[next++].second->id());
+    }
+    RetrieveItems(ws.store(), ids, &items);
+    for (Handle h : items) {
+      if (results.size() >= limit) break;
+      Frame item(ws.store(), h);
+      if (item.invalid()) continue;
+      Builder match(ws.store());
+      GetStandardProperties(item, &match, true);
+      results.push_back(match.Create().handle());
+    }
   }
   b.Add(n_matches_,  Array(ws.store(), results));
 
@@ -497,8 +702,14 @@ void KnowledgeService::HandleSearch(HTTPRequest *request,
   std::vector<std::pair<int, Handle>> ranking;
   Builder b(ws.store());
   b.Add(n_hits_, hits);
-  for (auto *result : results.hits()) {
-    Frame item(ws.store(), RetrieveItem(ws.store(), result->id()));
+  auto found = results.hits();
+  std::vector<Text> ids;
+  for (auto *result : found) ids.push_back(result->id());
+  Handles items(ws.store());
+  RetrieveItems(ws.store(), ids, &items);
+  for (int i = 0; i < items.size(); ++i) {
+    auto *result = found[i];
+    Frame item(ws.store(), items[i]);
     if (item.invalid()) continue;
     Builder match(ws.store());
     GetStandardProperties(item, &match, true);
@@ -15,7 +15,9 @@
 #ifndef NLP_KB_KNOWLEDGE_SERVICE_H_
 #define NLP_KB_KNOWLEDGE_SERVICE_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "sling/base/types.h"
 #include "sling/db/dbclient.h"
@@ -29,6 +31,7 @@
 #include "sling/nlp/document/lex.h"
 #include "sling/nlp/kb/calendar.h"
 #include "sling/nlp/kb/name-table.h"
+#include "sling/nlp/kb/response-cache.h"
 #include "sling/nlp/kb/xref.h"
 #include "sling/nlp/search/search-engine.h"
 #include "sling/util/mutex.h"
@@ -55,6 +58,7 @@ class KnowledgeService {
   };
 
   ~KnowledgeService() {
+    delete cache_;
     delete itemdb_;
     delete items_;
     if (docnames_) docnames_->Release();
@@ -99,10 +103,22 @@ class KnowledgeService {
   // Handle KB stubs requests.
   void HandleGetStubs(HTTPRequest *request, HTTPResponse *response);
 
+  // Handle KB response cache status requests.
+  void HandleCacheStatus(HTTPRequest *request, HTTPResponse *response);
+
+  // Invalidate cached responses. This must be called when the knowledge base
+  // is reloaded.
+  void Invalidate() { generation_++; }
+
   // Get item from id. This also resolves cross-reference and loads offline
   // items from the item database.
   Handle RetrieveItem(Store *store, Text id, bool offline = true) const;
 
+  // Get items for a list of ids. Offline items are fetched from the item
+  // database in a single batch. Items that are not found are set to nil.
+  void RetrieveItems(Store *store, const std::vector<Text> &ids,
+                     Handles *items) const;
+
   // Return representative image URL for item.
   string GetImage(const Frame &item);
 
@@ -110,6 +126,26 @@ class KnowledgeService {
   const NameTable &aliases() const { return aliases_; }
 
  private:
+  // Look up item in knowledge base, mapping the id through the
+  // cross-reference if needed. Returns nil if the item is not in the
+  // knowledge base, and the key for looking up the item offline.
+  Handle LookupItem(Store *store, Text id, string *key) const;
+
+  // Parse offline item record into store.
+  static Handle ParseItem(Store *store, const Slice &value);
+
+  // KB request handler.
+  typedef void (KnowledgeService::*Handler)(HTTPRequest *request,
+                                            HTTPResponse *response);
+
+  // Serve response from the response cache, or call the handler and add the
+  // response to the cache.
+  void ServeCached(HTTPRequest *request, HTTPResponse *response,
+                   const char *endpoint, Handler handler);
+
+  // Register cached handler for endpoint.
+  void RegisterCached(HTTPServer *http, const char *endpoint, Handler handler);
+
   // Fetch properties.
   void FetchProperties(const Frame &item, Item *info);
 
@@ -193,6 +229,13 @@ class KnowledgeService {
   DBClient *itemdb_ = nullptr;
   mutable Mutex mu_;
 
+  // Response cache for read-only KB requests.
+  ResponseCache *cache_ = nullptr;
+
+  // Knowledge base generation. This is incremented every time the knowledge
+  // base is changed and invalidates all cached responses.
+  std::atomic<uint64> generation_{0};
+
   // Knowledge base browser app.
   StaticContent common_{"/common", "app"};
   StaticContent app_{"/kb/app", "sling/nlp/kb/app"};
@@ -27,6 +27,7 @@
 #include "sling/task/frames.h"
 #include "sling/task/task.h"
 #include "sling/util/arena.h"
+#include "sling/util/bloom.h"
 #include "sling/util/mutex.h"
 
 namespace sling {
@@ -133,6 +134,18 @@ class PhraseTableBuilder : public task::FrameProcessor {
     int num_buckets = (num_phrases + 32) / 32;
     repository.WriteMap("Phrase", &phrase_table_, num_buckets);
 
+    // Write Bloom filter for phrase fingerprints.
+    int filter_bits = task->Get("phrase_filter_bits", 10);
+    if (filter_bits > 0) {
+      LOG(INFO) << "Build phrase filter";
+      size_t size = BlockedBloomFilter::FilterSize(num_phrases, filter_bits);
+      std::vector<uint64> bits(size / sizeof(uint64));
+      BlockedBloomFilter filter;
+      filter.Init(bits.data(), size);
+      for (auto *p : phrase_table_) filter.insert(p->Hash());
+      repository.AddBlock("PhraseFilter", bits.data(), size);
+    }
+
     // Write repository to file.
     const string &filename = task->GetOutput("repository")->resource()->name();
     CHECK(!filename.empty());
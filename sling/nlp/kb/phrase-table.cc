@@ -14,10 +14,13 @@
 
 #include "sling/nlp/kb/phrase-table.h"
 
+#include "sling/util/thread.h"
+
 namespace sling {
 namespace nlp {
 
-void PhraseTable::Load(Store *store, const string &filename) {
+void PhraseTable::Load(Store *store, const string &filename,
+                       int resolve_threads) {
   // Load name repository from file.
   repository_.Read(filename);
 
@@ -27,6 +30,12 @@ void PhraseTable::Load(Store *store, const string &filename) {
   // Initialize entity table.
   entity_index_.Initialize(repository_);
 
+  // Initialize phrase filter if present.
+  char *filter = repository_.GetMutableBlock("PhraseFilter");
+  if (filter != nullptr) {
+    phrase_filter_.Init(filter, repository_.GetBlockSize("PhraseFilter"));
+  }
+
   // Get text normalization flags.
   normalization_ = repository_.GetBlockString("normalization");
 
@@ -34,22 +43,50 @@ void PhraseTable::Load(Store *store, const string &filename) {
   store_ = store;
   entity_table_ = new Handles(store);
   entity_table_->resize(entity_index_.size());
+
+  // Optionally resolve all entities up front.
+  if (resolve_threads > 0) ResolveEntities(resolve_threads);
+}
+
+void PhraseTable::ResolveEntities(int num_threads) {
+  // Each worker resolves an interleaved subset of the entities. The store is
+  // only read by the workers, so no locking is needed.
+  int num_entities = entity_index_.size();
+  if (num_threads > num_entities) num_threads = num_entities;
+  if (num_threads < 1) num_threads = 1;
+  WorkerPool pool;
+  pool.Start(num_threads, [this, num_entities, num_threads](int worker) {
+    for (int i = worker; i < num_entities; i += num_threads) {
+      Word *slot = &(*entity_table_)[i].bits;
+      __atomic_store_n(slot, ResolveEntity(i).bits, __ATOMIC_RELEASE);
+    }
+  });
+  pool.Join();
+}
+
+Handle PhraseTable::ResolveEntity(int index) const {
+  const EntityItem *entity = entity_index_.GetEntity(index);
+  Handle handle = store_->LookupExisting(entity->id());
+  if (handle.IsNil()) {
+    VLOG(1) << "Cannot resolve " << entity->id() << " in phrase table";
+  }
+  return handle;
 }
 
 Handle PhraseTable::GetEntityHandle(int index) const {
-  Handle handle = (*entity_table_)[index];
+  // Resolving the same entity concurrently in different threads yields the
+  // same handle, so racing writers will store identical values.
+  Word *slot = &(*entity_table_)[index].bits;
+  Handle handle{__atomic_load_n(slot, __ATOMIC_ACQUIRE)};
   if (handle.IsNil()) {
-    const EntityItem *entity = entity_index_.GetEntity(index);
-    handle = store_->LookupExisting(entity->id());
-    if (handle.IsNil()) {
-      VLOG(1) << "Cannot resolve " << entity->id() << " in phrase table";
-    }
-    (*entity_table_)[index] = handle;
+    handle = ResolveEntity(index);
+    __atomic_store_n(slot, handle.bits, __ATOMIC_RELEASE);
   }
   return handle;
 }
 
 const PhraseTable::Phrase *PhraseTable::Find(uint64 fp) const {
+  if (!phrase_filter_.contains(fp)) return nullptr;
   int bucket = fp % phrase_index_.num_buckets();
   const PhraseItem *phrase = phrase_index_.GetBucket(bucket);
   const PhraseItem *end = phrase_index_.GetBucket(bucket + 1);
@@ -60,6 +97,38 @@ const PhraseTable::Phrase *PhraseTable::Find(uint64 fp) const {
   return nullptr;
 }
 
+void PhraseTable::Find(const uint64 *fps, int n,
+                       const Phrase **phrases) const {
+  // Check filter and prefetch phrase buckets for candidates.
+  for (int i = 0; i < n; ++i) phrase_filter_.prefetch(fps[i]);
+  for (int i = 0; i < n; ++i) {
+    if (phrase_filter_.contains(fps[i])) {
+      int bucket = fps[i] % phrase_index_.num_buckets();
+      __builtin_prefetch(phrase_index_.GetBucket(bucket));
+      phrases[i] = phrase_index_.GetBucket(bucket);
+    } else {
+      phrases[i] = nullptr;
+    }
+  }
+
+  // Search phrase buckets.
+  for (int i = 0; i < n; ++i) {
+    const PhraseItem *phrase = phrases[i];
+    if (phrase == nullptr) continue;
+    uint64 fp = fps[i];
+    int bucket = fp % phrase_index_.num_buckets();
+    const PhraseItem *end = phrase_index_.GetBucket(bucket + 1);
+    phrases[i] = nullptr;
+    while (phrase < end) {
+      if (phrase->fingerprint() == fp) {
+        phrases[i] = phrase;
+        break;
+      }
+      phrase = phrase->next();
+    }
+  }
+}
+
 void PhraseTable::GetMatches(const Phrase *phrase, Handles *matches) const {
   if (phrase == nullptr) {
     matches->clear();
@@ -102,10 +171,11 @@ void PhraseTable::Lookup(uint64 fp, MatchList *matches) const {
 
 const PhraseTable *PhraseTable::Acquire(AssetManager *assets,
                                         Store *store,
-                                        const string &filename) {
+                                        const string &filename,
+                                        int resolve_threads) {
   return assets->Acquire<PhraseTable>(filename, [&]() {
     PhraseTable *aliases = new PhraseTable();
-    aliases->Load(store, filename);
+    aliases->Load(store, filename, resolve_threads);
     return aliases;
   });
 }
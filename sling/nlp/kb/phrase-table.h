@@ -25,6 +25,7 @@
 #include "sling/frame/object.h"
 #include "sling/string/text.h"
 #include "sling/util/asset.h"
+#include "sling/util/bloom.h"
 
 namespace sling {
 namespace nlp {
@@ -44,8 +45,13 @@ class PhraseTable : public Asset {
 
   ~PhraseTable() override { delete entity_table_; }
 
-  // Load phrase repository from file.
-  void Load(Store *store, const string &filename);
+  // Load phrase repository from file. If resolve_threads is non-zero, all the
+  // entity handles are resolved at load time using this number of threads.
+  // Otherwise, entity handles are resolved lazily on first use.
+  void Load(Store *store, const string &filename, int resolve_threads = 0);
+
+  // Resolve handles for all entities in the phrase table in parallel.
+  void ResolveEntities(int num_threads);
 
   // Find all entities matching a phrase fingerprint.
   void Lookup(uint64 fp, Handles *matches) const;
@@ -59,12 +65,18 @@ class PhraseTable : public Asset {
   // Acquire shared phrase table.
   static const PhraseTable *Acquire(AssetManager *assets,
                                     Store *store,
-                                    const string &filename);
+                                    const string &filename,
+                                    int resolve_threads = 0);
 
  private:
-  // Get handle for entity.
+  // Get handle for entity. Unresolved entities are looked up in the store
+  // and the entity table slot is updated atomically, so this is safe to call
+  // concurrently from multiple threads.
   Handle GetEntityHandle(int index) const;
 
+  // Look up handle for entity in store.
+  Handle ResolveEntity(int index) const;
+
   // Entity phrase with entity index and frequency. The count_and_flags field
   // contains the count in the lower 29 bit. Bit 29 and 30 contain the case
   // form, and bit 31 contains the reliable source flag.
@@ -161,6 +173,11 @@ class PhraseTable : public Asset {
   // Find matching phrase in phrase table. Return null if phrase is not found.
   const Phrase *Find(uint64 fp) const;
 
+  // Find matching phrases for a batch of phrase fingerprints. The phrase
+  // buckets for all the fingerprints that pass the phrase filter are
+  // prefetched before the buckets are searched.
+  void Find(const uint64 *fps, int n, const Phrase **phrases) const;
+
   // Get matching handles for phrase.
   void GetMatches(const Phrase *phrase, Handles *matches) const;
 
@@ -177,10 +194,15 @@ class PhraseTable : public Asset {
   // Entity index.
   EntityIndex entity_index_;
 
+  // Optional Bloom filter for rejecting fingerprints that are not in the
+  // phrase table without searching the phrase buckets.
+  BlockedBloomFilter phrase_filter_;
+
   // Store for resolving entity ids.
   Store *store_ = nullptr;
 
-  // Entities resolved to frame handles.
+  // Entities resolved to frame handles. Slots are accessed atomically, and
+  // nil slots have not been resolved yet.
   Handles *entity_table_ = nullptr;
 
   // Text normalization flags.
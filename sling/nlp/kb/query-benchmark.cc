@@ -0,0 +1,217 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/frame/serialization.h"
+#include "sling/frame/store.h"
+#include "sling/net/http-server.h"
+#include "sling/net/http-stats.h"
+#include "sling/nlp/kb/knowledge-service.h"
+#include "sling/util/thread.h"
+
+DEFINE_string(kb, "data/e/kb/kb.sling", "Knowledge base");
+DEFINE_string(names, "data/e/kb/en/name-table.repo", "Name table");
+DEFINE_string(xref, "", "Cross-reference table");
+DEFINE_string(items, "", "Off-line items");
+DEFINE_string(itemdb, "localhost:7070/items", "Database for off-line items");
+DEFINE_string(queries, "", "File with one name query per line");
+DEFINE_int32(port, 8090, "Port for benchmark HTTP server");
+DEFINE_int32(threads, 4, "Number of client threads");
+DEFINE_int32(requests, 1000, "Number of queries per client thread");
+DEFINE_int32(limit, 50, "Maximum number of matches per query");
+
+using namespace sling;
+using namespace sling::nlp;
+
+// Queries used if no query file is given.
+static const char *sample_queries[] = {
+  "Douglas Adams", "Paris", "Albert Einstein", "Copenhagen", "Barack Obama",
+  "Python", "Mars", "Beethoven", "New York", "Denmark", "Ada Lovelace",
+  "Amazon", "Mercury", "John Smith", "Berlin", "Marie Curie",
+};
+
+// URL-encode query parameter.
+static string EncodeQuery(const string &str) {
+  static const char hex[] = "0123456789ABCDEF";
+  string encoded;
+  for (unsigned char c : str) {
+    if (isalnum(c) || c == '-' || c == '_' || c == '.') {
+      encoded.push_back(c);
+    } else {
+      encoded.push_back('%');
+      encoded.push_back(hex[c >> 4]);
+      encoded.push_back(hex[c & 0x0F]);
+    }
+  }
+  return encoded;
+}
+
+// HTTP client connection to the benchmark server. Queries are sent one at a
+// time on a keep-alive connection.
+class QueryClient {
+ public:
+  explicit QueryClient(int port) {
+    sock_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(sock_ != -1);
+    int on = 1;
+    setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+    CHECK(connect(sock_, reinterpret_cast<sockaddr *>(&sin), sizeof(sin)) == 0)
+        << "Unable to connect to port " << port;
+  }
+
+  ~QueryClient() { close(sock_); }
+
+  // Send name query and wait for the response. Returns the size of the
+  // response body.
+  int Query(const string &query) {
+    string request = "GET /query?q=" + EncodeQuery(query) +
+                     "&limit=" + std::to_string(FLAGS_limit) +
+                     " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    CHECK_EQ(write(sock_, request.data(), request.size()), request.size());
+
+    // Read response header.
+    buffer_.clear();
+    size_t eoh;
+    while ((eoh = buffer_.find("\r\n\r\n")) == string::npos) Receive();
+    CHECK_EQ(buffer_.compare(0, 12, "HTTP/1.1 200"), 0)
+        << buffer_.substr(0, buffer_.find("\r\n"));
+    size_t length = 0;
+    size_t pos = buffer_.find("Content-Length: ");
+    if (pos != string::npos && pos < eoh) length = atol(&buffer_[pos + 16]);
+
+    // Read response body.
+    size_t end = eoh + 4 + length;
+    while (buffer_.size() < end) Receive();
+    return length;
+  }
+
+ private:
+  // Receive more data from server.
+  void Receive() {
+    char data[4096];
+    int rc = read(sock_, data, sizeof(data));
+    CHECK_GT(rc, 0) << "Connection closed";
+    buffer_.append(data, rc);
+  }
+
+  int sock_;
+  string buffer_;
+};
+
+// Time name queries against the knowledge service with offline items fetched
+// from a local item database, and report query latencies. Queries go through
+// the HTTP server but bypass the response cache, so every query calls
+// HandleQuery.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Read queries.
+  std::vector<string> queries;
+  if (FLAGS_queries.empty()) {
+    for (const char *q : sample_queries) queries.push_back(q);
+  } else {
+    string data;
+    CHECK(File::ReadContents(FLAGS_queries, &data));
+    size_t start = 0;
+    while (start < data.size()) {
+      size_t end = data.find('\n', start);
+      if (end == string::npos) end = data.size();
+      if (end > start) queries.push_back(data.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+  CHECK(!queries.empty());
+
+  // Initialize knowledge service.
+  LOG(INFO) << "Loading knowledge base from " << FLAGS_kb;
+  Store commons;
+  LoadStore(FLAGS_kb, &commons);
+  KnowledgeService kb;
+  kb.Load(&commons, FLAGS_names);
+  if (!FLAGS_xref.empty()) kb.LoadXref(FLAGS_xref);
+  if (!FLAGS_items.empty()) kb.OpenItems(FLAGS_items);
+  if (!FLAGS_itemdb.empty()) kb.OpenItemDatabase(FLAGS_itemdb);
+  commons.Freeze();
+
+  // Start HTTP server for name queries.
+  SocketServerOptions options;
+  HTTPServer http(options, "127.0.0.1", FLAGS_port);
+  http.Register("/query", &kb, &KnowledgeService::HandleQuery);
+  CHECK(http.Start());
+
+  // Warm up knowledge service and item database.
+  {
+    QueryClient client(FLAGS_port);
+    for (const string &query : queries) client.Query(query);
+  }
+
+  // Send queries from client threads.
+  LatencyHistogram latency;
+  std::vector<int64> bytes(FLAGS_threads);
+  std::vector<ClosureThread *> clients;
+  Clock clock;
+  clock.start();
+  for (int t = 0; t < FLAGS_threads; ++t) {
+    clients.push_back(new ClosureThread([&, t]() {
+      QueryClient client(FLAGS_port);
+      for (int i = 0; i < FLAGS_requests; ++i) {
+        const string &query = queries[(t + i * FLAGS_threads) % queries.size()];
+        Clock timer;
+        timer.start();
+        bytes[t] += client.Query(query);
+        timer.stop();
+        latency.Add(timer.us());
+      }
+    }));
+    clients.back()->SetJoinable(true);
+    clients.back()->Start();
+  }
+  for (ClosureThread *client : clients) {
+    client->Join();
+    delete client;
+  }
+  clock.stop();
+
+  int64 total_bytes = 0;
+  for (int64 b : bytes) total_bytes += b;
+  int64 n = latency.count();
+  std::cout << n << " queries, " << n / clock.secs() << " queries/sec, "
+            << total_bytes / n << " bytes/query\n"
+            << "latency: mean " << latency.sum() / n << " us"
+            << ", p50 " << latency.Percentile(0.5) << " us"
+            << ", p90 " << latency.Percentile(0.9) << " us"
+            << ", p99 " << latency.Percentile(0.99) << " us\n";
+
+  http.Shutdown();
+  http.Wait();
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/nlp/kb/response-cache.h"
+
+#include "sling/string/strcat.h"
+#include "sling/util/fingerprint.h"
+
+namespace sling {
+namespace nlp {
+
+ResponseCache::ResponseCache(size_t capacity, int num_shards)
+    : capacity_(capacity) {
+  shard_capacity_ = capacity / num_shards;
+  for (int i = 0; i < num_shards; ++i) shards_.push_back(new Shard());
+}
+
+ResponseCache::~ResponseCache() {
+  for (Shard *shard : shards_) delete shard;
+}
+
+ResponseCache::Shard *ResponseCache::GetShard(const string &key) const {
+  uint64 fp = Fingerprint(key.data(), key.size());
+  return shards_[fp % shards_.size()];
+}
+
+ResponseCache::Entry ResponseCache::Lookup(const string &key,
+                                           uint64 generation) {
+  if (!enabled()) return nullptr;
+  Shard *shard = GetShard(key);
+  MutexLock lock(&shard->mu);
+  auto f = shard->index.find(key);
+  if (f == shard->index.end()) {
+    misses_++;
+    return nullptr;
+  }
+
+  // Drop responses from older generations.
+  Shard::LRUList::iterator it = f->second;
+  if ((*it)->generation != generation) {
+    Remove(shard, it);
+    stale_++;
+    misses_++;
+    return nullptr;
+  }
+
+  // Move response to the front of the LRU list.
+  shard->lru.splice(shard->lru.begin(), shard->lru, it);
+  hits_++;
+  return *it;
+}
+
+void ResponseCache::Insert(Entry entry) {
+  if (!enabled()) return;
+  size_t size = entry->size();
+  if (size > shard_capacity_) return;
+
+  Shard *shard = GetShard(entry->key);
+  MutexLock lock(&shard->mu);
+
+  // Replace existing response for key.
+  auto f = shard->index.find(entry->key);
+  if (f != shard->index.end()) Remove(shard, f->second);
+
+  // Evict least recently used responses until there is room for the new one.
+  while (!shard->lru.empty() && shard->size + size > shard_capacity_) {
+    Remove(shard, std::prev(shard->lru.end()));
+    evictions_++;
+  }
+
+  // Add response to the front of the LRU list.
+  shard->lru.push_front(entry);
+  shard->index[entry->key] = shard->lru.begin();
+  shard->size += size;
+  insertions_++;
+}
+
+void ResponseCache::Remove(Shard *shard, Shard::LRUList::iterator it) {
+  shard->size -= (*it)->size();
+  shard->index.erase((*it)->key);
+  shard->lru.erase(it);
+}
+
+void ResponseCache::Clear() {
+  for (Shard *shard : shards_) {
+    MutexLock lock(&shard->mu);
+    shard->lru.clear();
+    shard->index.clear();
+    shard->size = 0;
+  }
+}
+
+void ResponseCache::OutputStats(IOBuffer *output) const {
+  size_t entries = 0;
+  size_t size = 0;
+  for (Shard *shard : shards_) {
+    MutexLock lock(&shard->mu);
+    entries += shard->index.size();
+    size += shard->size;
+  }
+
+  int64 hits = hits_;
+  int64 misses = misses_;
+  int64 lookups = hits + misses;
+  double hit_rate = lookups > 0 ? hits * 100.0 / lookups : 0.0;
+
+  output->Write(StrCat(
+    "{\"capacity\": ", capacity_,
+    ", \"size\": ", size,
+    ", \"entries\": ", entries,
+    ", \"shards\": ", shards_.size(),
+    ", \"hits\": ", hits,
+    ", \"misses\": ", misses,
+    ", \"stale\": ", stale_.load(),
+    ", \"hit_rate\": ", hit_rate,
+    ", \"insertions\": ", insertions_.load(),
+    ", \"evictions\": ", evictions_.load(),
+    "}\n"));
+}
+
+}  // namespace nlp
+}  // namespace sling
@@ -0,0 +1,112 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_NLP_KB_RESPONSE_CACHE_H_
+#define SLING_NLP_KB_RESPONSE_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sling/base/types.h"
+#include "sling/util/iobuffer.h"
+#include "sling/util/mutex.h"
+
+namespace sling {
+namespace nlp {
+
+// Size-bounded cache for HTTP responses. The cache is split into a number of
+// shards, each with its own lock and LRU list, to reduce lock contention
+// between concurrent requests. Each entry is tagged with a generation number,
+// and entries from older generations are treated as misses.
+class ResponseCache {
+ public:
+  // Cached response.
+  struct Response {
+    string key;             // cache key
+    uint64 generation;      // generation when the response was generated
+    string content_type;    // response content type
+    string encoding;        // response content encoding
+    string etag;            // entity tag for response
+    string body;            // response body
+
+    // Memory used by the response.
+    size_t size() const {
+      return sizeof(Response) + key.size() + content_type.size() +
+             encoding.size() + etag.size() + body.size();
+    }
+  };
+
+  typedef std::shared_ptr<const Response> Entry;
+
+  // Initialize cache with a total capacity in bytes.
+  ResponseCache(size_t capacity, int num_shards = 16);
+  ~ResponseCache();
+
+  // Look up response in cache. Returns null if the key is not in the cache or
+  // the cached response is from another generation.
+  Entry Lookup(const string &key, uint64 generation);
+
+  // Add response to cache, evicting the least recently used responses from
+  // the shard if needed.
+  void Insert(Entry entry);
+
+  // Remove all responses from cache.
+  void Clear();
+
+  // Output cache statistics in JSON format.
+  void OutputStats(IOBuffer *output) const;
+
+  // Check if caching is enabled.
+  bool enabled() const { return capacity_ > 0; }
+
+ private:
+  // Cache shard with LRU list of responses. The most recently used response
+  // is at the front of the list.
+  struct Shard {
+    typedef std::list<Entry> LRUList;
+    LRUList lru;
+    std::unordered_map<string, LRUList::iterator> index;
+    size_t size = 0;
+    Mutex mu;
+  };
+
+  // Get shard for key.
+  Shard *GetShard(const string &key) const;
+
+  // Remove response from shard.
+  void Remove(Shard *shard, Shard::LRUList::iterator it);
+
+  // Cache shards.
+  std::vector<Shard *> shards_;
+
+  // Total cache capacity and capacity per shard in bytes.
+  size_t capacity_;
+  size_t shard_capacity_;
+
+  // Cache statistics.
+  std::atomic<int64> hits_{0};
+  std::atomic<int64> misses_{0};
+  std::atomic<int64> stale_{0};
+  std::atomic<int64> insertions_{0};
+  std::atomic<int64> evictions_{0};
+};
+
+}  // namespace nlp
+}  // namespace sling
+
+#endif  // SLING_NLP_KB_RESPONSE_CACHE_H_
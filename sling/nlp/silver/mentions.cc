@@ -51,10 +51,15 @@ void SpanPopulator::Annotate(const PhraseTable *aliases,
   }
 
   // Find all matching spans up to the maximum length.
+  std::vector<uint64> fps(chart->maxlen());
+  std::vector<int> ends(chart->maxlen());
+  std::vector<const PhraseTable::Phrase *> phrases(chart->maxlen());
   for (int b = begin; b < end; ++b) {
     // Span cannot start on a skipped token.
     if (skip[b - begin]) continue;
 
+    // Collect candidate phrases starting at this token.
+    int n = 0;
     for (int e = b + 1; e <= std::min(b + chart->maxlen(), end); ++e) {
       // Span cannot end on a skipped token. This does not apply to upper case
       // tokens.
@@ -67,9 +72,16 @@ void SpanPopulator::Annotate(const PhraseTable *aliases,
       uint64 fp = chart->document()->PhraseFingerprint(b, e);
       if (blacklist_.count(fp) > 0) continue;
 
-      // Find matches in phrase table.
-      SpanChart::Item &span = chart->item(b - begin, e - begin);
-      span.matches = aliases->Find(fp);
+      fps[n] = fp;
+      ends[n] = e;
+      n++;
+    }
+
+    // Find matches in phrase table for all the candidates.
+    aliases->Find(fps.data(), n, phrases.data());
+    for (int i = 0; i < n; ++i) {
+      SpanChart::Item &span = chart->item(b - begin, ends[i] - begin);
+      span.matches = phrases[i];
 
       // Set the span cost to one if there are any matches.
       if (span.matches != nullptr) {
@@ -1480,7 +1492,9 @@ class MentionAnnotator : public Annotator {
     resources.language = task->Get("language", "en");
 
     string alias_file = task->GetInputFile("aliases");
-    resources.aliases = PhraseTable::Acquire(task, commons, alias_file);
+    int resolve_threads = task->Get("alias_resolve_threads", 0);
+    resources.aliases = PhraseTable::Acquire(task, commons, alias_file,
+                                             resolve_threads);
     CHECK(resources.aliases != nullptr);
 
     annotator_.Init(commons, resources);
@@ -39,7 +39,9 @@ class PhraseStructureAnnotator : public Annotator {
   void Init(Task *task, Store *commons) override {
     // Load phrase table.
     string alias_file = task->GetInputFile("aliases");
-    aliases_ = PhraseTable::Acquire(task, commons, alias_file);
+    int resolve_threads = task->Get("alias_resolve_threads", 0);
+    aliases_ = PhraseTable::Acquire(task, commons, alias_file,
+                                    resolve_threads);
 
     // Initialize fact extractor.
     catalog_.Init(commons);
@@ -18,6 +18,7 @@
 #include "sling/pyapi/pybase.h"
 #include "sling/pyapi/pydatabase.h"
 #include "sling/pyapi/pydate.h"
+#include "sling/pyapi/pyembedding.h"
 #include "sling/pyapi/pyframe.h"
 #include "sling/pyapi/pymyelin.h"
 #include "sling/pyapi/pynet.h"
@@ -93,6 +94,7 @@ static PyObject *RegisterPythonModule() {
   PyFactExtractor::Define(module);
   PyTaxonomy::Define(module);
   PyPlausibility::Define(module);
+  PyEmbeddingIndex::Define(module);
 
   PyCompiler::Define(module);
   PyNetwork::Define(module);
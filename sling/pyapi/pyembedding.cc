@@ -0,0 +1,194 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/pyapi/pyembedding.h"
+
+namespace sling {
+
+// Python type declarations.
+PyTypeObject PyEmbeddingIndex::type;
+PyMethodTable PyEmbeddingIndex::methods;
+PySequenceMethods PyEmbeddingIndex::sequence;
+
+void PyEmbeddingIndex::Define(PyObject *module) {
+  InitType(&type, "sling.EmbeddingIndex", sizeof(PyEmbeddingIndex), true);
+  type.tp_init = method_cast<initproc>(&PyEmbeddingIndex::Init);
+  type.tp_dealloc = method_cast<destructor>(&PyEmbeddingIndex::Dealloc);
+
+  type.tp_as_sequence = &sequence;
+  sequence.sq_length = method_cast<lenfunc>(&PyEmbeddingIndex::Size);
+  sequence.sq_contains = method_cast<objobjproc>(&PyEmbeddingIndex::Contains);
+
+  methods.AddO("vector", &PyEmbeddingIndex::Vector);
+  methods.Add("search", &PyEmbeddingIndex::Search);
+  methods.Add("batch_search", &PyEmbeddingIndex::BatchSearch);
+  type.tp_methods = methods.table();
+
+  RegisterType(&type, module, "EmbeddingIndex");
+}
+
+int PyEmbeddingIndex::Init(PyObject *args, PyObject *kwds) {
+  // Get index file name.
+  index = nullptr;
+  const char *filename = nullptr;
+  if (!PyArg_ParseTuple(args, "s", &filename)) return -1;
+
+  // Load embedding index.
+  index = new nlp::EmbeddingIndex();
+  index->Load(filename);
+
+  return 0;
+}
+
+void PyEmbeddingIndex::Dealloc() {
+  delete index;
+  Free();
+}
+
+Py_ssize_t PyEmbeddingIndex::Size() {
+  return index->size();
+}
+
+int PyEmbeddingIndex::Contains(PyObject *key) {
+  Text word = GetText(key);
+  if (word.data() == nullptr) return -1;
+  return index->Lookup(word) != -1;
+}
+
+PyObject *PyEmbeddingIndex::Vector(PyObject *obj) {
+  // Look up word.
+  Text word = GetText(obj);
+  if (word.data() == nullptr) return nullptr;
+  int id = index->Lookup(word);
+  if (id == -1) Py_RETURN_NONE;
+
+  // Return embedding vector.
+  const float *v = index->vector(id);
+  PyObject *result = PyList_New(index->dim());
+  for (int i = 0; i < index->dim(); ++i) {
+    PyList_SetItem(result, i, PyFloat_FromDouble(v[i]));
+  }
+  return result;
+}
+
+bool PyEmbeddingIndex::GetQuery(PyObject *obj, std::vector<float> *query) {
+  if (PyUnicode_Check(obj) || PyBytes_Check(obj)) {
+    // Use embedding vector for word as query.
+    int id = index->Lookup(GetText(obj));
+    if (id == -1) {
+      PyErr_SetString(PyExc_KeyError, "Unknown word");
+      return false;
+    }
+    const float *v = index->vector(id);
+    query->insert(query->end(), v, v + index->dim());
+    return true;
+  }
+
+  // Get query vector from sequence.
+  PyObject *seq = PySequence_Fast(obj, "Word or sequence expected");
+  if (seq == nullptr) return false;
+  int size = PySequence_Fast_GET_SIZE(seq);
+  if (size != index->dim()) {
+    PyErr_SetString(PyExc_ValueError, "Query vector has wrong dimension");
+    Py_DECREF(seq);
+    return false;
+  }
+  PyObject **items = PySequence_Fast_ITEMS(seq);
+  for (int i = 0; i < size; ++i) {
+    double value = PyFloat_AsDouble(items[i]);
+    if (value == -1.0 && PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return false;
+    }
+    query->push_back(value);
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+PyObject *PyEmbeddingIndex::PyHits(const nlp::EmbeddingIndex::Hits &hits) {
+  PyObject *result = PyList_New(hits.size());
+  for (int i = 0; i < hits.size(); ++i) {
+    PyObject *hit = PyTuple_New(2);
+    PyTuple_SetItem(hit, 0, AllocateString(index->word(hits[i].id)));
+    PyTuple_SetItem(hit, 1, PyFloat_FromDouble(hits[i].score));
+    PyList_SetItem(result, i, hit);
+  }
+  return result;
+}
+
+PyObject *PyEmbeddingIndex::Search(PyObject *args, PyObject *kw) {
+  // Get arguments.
+  static const char *kwlist[] = {"query", "k", "probes", nullptr};
+  PyObject *pyquery = nullptr;
+  int k = 10;
+  int probes = 16;
+  bool ok = PyArg_ParseTupleAndKeywords(
+                args, kw, "O|ii", const_cast<char **>(kwlist),
+                &pyquery, &k, &probes);
+  if (!ok) return nullptr;
+
+  // Get query vector.
+  std::vector<float> query;
+  if (!GetQuery(pyquery, &query)) return nullptr;
+
+  // Search index.
+  nlp::EmbeddingIndex::Hits hits;
+  index->Search(query.data(), k, probes, &hits);
+
+  return PyHits(hits);
+}
+
+PyObject *PyEmbeddingIndex::BatchSearch(PyObject *args, PyObject *kw) {
+  // Get arguments.
+  static const char *kwlist[] = {"queries", "k", "probes", "threads", nullptr};
+  PyObject *pyqueries = nullptr;
+  int k = 10;
+  int probes = 16;
+  int threads = 1;
+  bool ok = PyArg_ParseTupleAndKeywords(
+                args, kw, "O|iii", const_cast<char **>(kwlist),
+                &pyqueries, &k, &probes, &threads);
+  if (!ok) return nullptr;
+
+  // Get query vectors.
+  PyObject *seq = PySequence_Fast(pyqueries, "Sequence of queries expected");
+  if (seq == nullptr) return nullptr;
+  int num_queries = PySequence_Fast_GET_SIZE(seq);
+  PyObject **items = PySequence_Fast_ITEMS(seq);
+  std::vector<float> queries;
+  queries.reserve(num_queries * index->dim());
+  for (int i = 0; i < num_queries; ++i) {
+    if (!GetQuery(items[i], &queries)) {
+      Py_DECREF(seq);
+      return nullptr;
+    }
+  }
+  Py_DECREF(seq);
+
+  // Search index without holding the interpreter lock.
+  std::vector<nlp::EmbeddingIndex::Hits> results;
+  Py_BEGIN_ALLOW_THREADS;
+  index->Search(queries.data(), num_queries, k, probes, &results, threads);
+  Py_END_ALLOW_THREADS;
+
+  // Return list of hits for each query.
+  PyObject *result = PyList_New(num_queries);
+  for (int i = 0; i < num_queries; ++i) {
+    PyList_SetItem(result, i, PyHits(results[i]));
+  }
+  return result;
+}
+
+}  // namespace sling
@@ -0,0 +1,67 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_PYAPI_PYEMBEDDING_H_
+#define SLING_PYAPI_PYEMBEDDING_H_
+
+#include <vector>
+
+#include "sling/nlp/embedding/embedding-index.h"
+#include "sling/pyapi/pybase.h"
+
+namespace sling {
+
+// Python wrapper for approximate nearest-neighbor embedding index.
+struct PyEmbeddingIndex : public PyBase {
+  // Initialize embedding index wrapper.
+  int Init(PyObject *args, PyObject *kwds);
+
+  // Deallocate embedding index wrapper.
+  void Dealloc();
+
+  // Return the number of vectors in the index.
+  Py_ssize_t Size();
+
+  // Check if word is in index.
+  int Contains(PyObject *key);
+
+  // Return embedding vector for word as list of floats.
+  PyObject *Vector(PyObject *obj);
+
+  // Search for the top-k most similar words to a query word or vector.
+  PyObject *Search(PyObject *args, PyObject *kw);
+
+  // Search for the top-k most similar words for a list of queries.
+  PyObject *BatchSearch(PyObject *args, PyObject *kw);
+
+  // Get query vector from word or sequence of floats. Return false and set
+  // Python error if the query is invalid.
+  bool GetQuery(PyObject *obj, std::vector<float> *query);
+
+  // Return list of (word, score) tuples for search hits.
+  PyObject *PyHits(const nlp::EmbeddingIndex::Hits &hits);
+
+  // Embedding index.
+  nlp::EmbeddingIndex *index;
+
+  // Registration.
+  static PyTypeObject type;
+  static PyMethodTable methods;
+  static PySequenceMethods sequence;
+  static void Define(PyObject *module);
+};
+
+}  // namespace sling
+
+#endif  // SLING_PYAPI_PYEMBEDDING_H_
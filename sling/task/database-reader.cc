@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -19,11 +22,19 @@
 #include "sling/db/dbclient.h"
 #include "sling/task/process.h"
 #include "sling/task/task.h"
+#include "sling/util/mutex.h"
+#include "sling/util/thread.h"
 
 namespace sling {
 namespace task {
 
-// Read records from database and output to channel.
+// Read records from database and output to channel. The database can be
+// scanned in several partitions concurrently over separate connections. Each
+// partition covers a range of data shards in the record id space, and a
+// prefetch thread for the partition reads ahead up to db_read_prefetch batches
+// of records while the current batch is sent to the output. If there are
+// multiple output channels, each partition sends its records to one of the
+// output channels.
 class DatabaseReader : public Process {
  public:
   // Process database records.
@@ -31,60 +42,202 @@ class DatabaseReader : public Process {
     // Get input database(s).
     auto inputs = task->GetInputs("input");
 
-    // Get output channel.
-    Channel *output = task->GetSink("output");
-    if (output == nullptr) {
+    // Get output channel(s).
+    outputs_ = task->GetSinks("output");
+    if (outputs_.empty()) {
       LOG(ERROR) << "No output channel";
       return;
     }
+    locks_ = std::vector<Mutex>(outputs_.size());
+
+    // Get parameters.
+    agent_ = task->name();
+    task->Fetch("db_read_batch", &batch_);
+    task->Fetch("db_read_partitions", &partitions_);
+    task->Fetch("db_read_prefetch", &prefetch_);
+    if (prefetch_ < 1) prefetch_ = 1;
 
     // Statistics counters.
-    Counter *db_records_read = task->GetCounter("db_records_read");
-    Counter *db_bytes_read = task->GetCounter("db_bytes_read");
+    db_records_read_ = task->GetCounter("db_records_read");
+    db_bytes_read_ = task->GetCounter("db_bytes_read");
 
     for (Binding *input : inputs) {
-      // Connect to database.
+      const string &dbname = input->resource()->name();
+      uint64 serial = input->resource()->serial();
+
+      // Split database into partitions.
+      std::vector<uint64> bounds;
+      Partition(dbname, &bounds);
+
+      // Scan the partitions in parallel.
+      int num_partitions = bounds.size() - 1;
+      WorkerPool pool;
+      pool.Start(num_partitions, [&](int index) {
+        Scan(dbname, serial, bounds[index], bounds[index + 1],
+             index % outputs_.size());
+      });
+      pool.Join();
+    }
+
+    // Close output channels.
+    for (Channel *output : outputs_) output->Close();
+  }
+
+ private:
+  // Batch of records read from database.
+  struct Batch {
+    IOBuffer buffer;
+    std::vector<DBRecord> records;
+    Status status;
+  };
+
+  // Connect to database.
+  void Connect(DBClient *db, const string &dbname) {
+    Status st = db->Connect(dbname, agent_);
+    if (!st.ok()) {
+      LOG(FATAL) << "Error connecting to database " << dbname << ": " << st;
+    }
+  }
+
+  // Split the record id space of the database into partitions of whole data
+  // shards. Record ids have the data shard number in the upper 16 bits, and
+  // the current epoch is in the last data shard. The partition boundaries are
+  // returned with -1 marking the end of the database.
+  void Partition(const string &dbname, std::vector<uint64> *bounds) {
+    bounds->clear();
+    bounds->push_back(0);
+    if (partitions_ > 1) {
       DBClient db;
-      string dbname = input->resource()->name();
-      Status st = db.Connect(dbname, task->name());
-      if (!st.ok()) {
-        LOG(FATAL) << "Error connecting to database " << dbname << ": " << st;
+      Connect(&db, dbname);
+      uint64 epoch;
+      Status st = db.Epoch(&epoch);
+      if (st.ok()) {
+        int shards = (epoch >> 48) + 1;
+        int n = std::min(partitions_, shards);
+        for (int p = 1; p < n; ++p) {
+          uint64 shard = static_cast<uint64>(p) * shards / n;
+          bounds->push_back(shard << 48);
+        }
+      } else {
+        LOG(WARNING) << "Cannot partition database " << dbname << ": " << st;
       }
-      uint64 serial = input->resource()->serial();
+      CHECK(db.Close());
+    }
+    bounds->push_back(-1);
+  }
 
-      // Read records from database and output to output channel.
+  // Scan the records in a partition of the database and output them to an
+  // output channel.
+  void Scan(const string &dbname, uint64 serial,
+            uint64 begin, uint64 end, int channel) {
+    DBClient db;
+    Connect(&db, dbname);
+
+    // A prefetch thread reads batches of records into a pool of buffers and
+    // queues them for sending, so the next batches can be fetched while the
+    // current batch is being sent.
+    std::vector<Batch> batches(prefetch_ + 1);
+    std::deque<Batch *> free;
+    std::deque<Batch *> ready;
+    for (Batch &batch : batches) free.push_back(&batch);
+    Mutex mu;
+    std::condition_variable nonempty;
+    std::condition_variable nonfull;
+
+    ClosureThread prefetcher([&]() {
       DBIterator iterator;
-      iterator.batch = task->Get("db_read_batch", 128);
-      std::vector<DBRecord> records;
+      iterator.position = begin;
+      iterator.limit = end;
+      iterator.batch = batch_;
       for (;;) {
-        // Read next batch.
-        st = db.Next(&iterator, &records);
-        if (!st.ok()) {
-          if (st.code() == ENOENT) break;
-          LOG(FATAL) << "Error reading from database " << dbname << ": " << st;
+        // Get free buffer.
+        Batch *batch;
+        {
+          std::unique_lock<std::mutex> lock(mu);
+          while (free.empty()) nonfull.wait(lock);
+          batch = free.front();
+          free.pop_front();
         }
 
-        // Send messages on output channel.
-        for (DBRecord &rec : records) {
-          // Update stats.
-          db_records_read->Increment();
-          db_bytes_read->Increment(rec.key.size() + rec.value.size());
-
-          // Send message with record to output channel.
-          Message *message = new Message(rec.key,
-                                         serial ? serial : rec.version,
-                                         rec.value);
-          output->Send(message);
+        // Read next batch of records.
+        iterator.buffer = &batch->buffer;
+        batch->status = db.Next(&iterator, &batch->records);
+        bool done = !batch->status.ok();
+
+        // Queue batch for sending.
+        {
+          std::unique_lock<std::mutex> lock(mu);
+          ready.push_back(batch);
         }
+        nonempty.notify_one();
+        if (done) break;
       }
+    });
+    prefetcher.SetJoinable(true);
+    prefetcher.Start();
 
-      // Close database connection.
-      CHECK(db.Close());
+    for (;;) {
+      // Get next batch from prefetch thread.
+      Batch *batch;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        while (ready.empty()) nonempty.wait(lock);
+        batch = ready.front();
+        ready.pop_front();
+      }
+      const Status &st = batch->status;
+      if (!st.ok()) {
+        if (st.code() == ENOENT) break;
+        LOG(FATAL) << "Error reading from database " << dbname << ": " << st;
+      }
+
+      // Send messages with records in batch to output channel.
+      Send(batch->records, serial, channel);
+
+      // Return buffer to prefetch thread.
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        free.push_back(batch);
+      }
+      nonfull.notify_one();
     }
+    prefetcher.Join();
+
+    // Close database connection.
+    CHECK(db.Close());
+  }
 
-    // Close output channel.
-    output->Close();
+  // Send records to output channel.
+  void Send(const std::vector<DBRecord> &records, uint64 serial, int channel) {
+    MutexLock lock(&locks_[channel]);
+    for (const DBRecord &rec : records) {
+      // Update stats.
+      db_records_read_->Increment();
+      db_bytes_read_->Increment(rec.key.size() + rec.value.size());
+
+      // Send message with record to output channel.
+      Message *message = new Message(rec.key,
+                                     serial ? serial : rec.version,
+                                     rec.value);
+      outputs_[channel]->Send(message);
+    }
   }
+
+  // Output channels.
+  std::vector<Channel *> outputs_;
+
+  // Locks for serializing access to output channels.
+  std::vector<Mutex> locks_;
+
+  // Parameters.
+  string agent_;
+  int batch_ = 128;
+  int partitions_ = 1;
+  int prefetch_ = 2;
+
+  // Statistics counters.
+  Counter *db_records_read_ = nullptr;
+  Counter *db_bytes_read_ = nullptr;
 };
 
 REGISTER_TASK_PROCESSOR("database-reader", DatabaseReader);
@@ -72,6 +72,7 @@ class FrameStoreWriter : public Processor {
     Output output(&stream);
     Encoder encoder(store_, &output);
     encoder.set_shallow(true);
+    encoder.set_segment_size(task->Get("segment_size", 0));
     encoder.EncodeAll();
     output.Flush();
     CHECK(stream.Close());
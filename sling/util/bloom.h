@@ -82,6 +82,86 @@ class BloomFilter {
   int hashes_;
 };
 
+// Blocked Bloom filter where each element is mapped to a single 512-bit block,
+// i.e. one cache line, and all the probe bits for the element are set within
+// this block. A membership test therefore touches at most one cache line. The
+// filter does not own its memory, so it can be used directly on data blocks
+// loaded from a repository.
+class BlockedBloomFilter {
+ public:
+  // Number of 64-bit words in each filter block.
+  static const int kBlockWords = 8;
+
+  // Number of bits probed for each element.
+  static const int kHashes = 6;
+
+  // Initialize filter on memory area. The size is in bytes.
+  void Init(void *data, size_t size) {
+    blocks_ = reinterpret_cast<uint64 *>(data);
+    num_blocks_ = size / (kBlockWords * sizeof(uint64));
+  }
+
+  // Return filter size in bytes for a set of n elements using a number of
+  // bits per element.
+  static size_t FilterSize(size_t n, int bits_per_element) {
+    size_t bits = n * bits_per_element;
+    size_t blocks = (bits + kBlockWords * 64 - 1) / (kBlockWords * 64);
+    if (blocks == 0) blocks = 1;
+    return blocks * kBlockWords * sizeof(uint64);
+  }
+
+  // Insert element in set.
+  void insert(uint64 fp) {
+    uint64 *block = Block(fp);
+    uint64 h = Mix(fp);
+    for (int n = 0; n < kHashes; ++n) {
+      block[(h >> 6) & 7] |= 1ULL << (h & 63);
+      h >>= 9;
+    }
+  }
+
+  // Check if element is possibly in the set. An empty filter contains all
+  // elements.
+  bool contains(uint64 fp) const {
+    if (num_blocks_ == 0) return true;
+    const uint64 *block = Block(fp);
+    uint64 h = Mix(fp);
+    for (int n = 0; n < kHashes; ++n) {
+      if ((block[(h >> 6) & 7] & (1ULL << (h & 63))) == 0) return false;
+      h >>= 9;
+    }
+    return true;
+  }
+
+  // Prefetch filter block for element.
+  void prefetch(uint64 fp) const {
+    if (num_blocks_ > 0) __builtin_prefetch(Block(fp));
+  }
+
+  // Check if filter has been initialized.
+  bool empty() const { return num_blocks_ == 0; }
+
+ private:
+  // Get filter block for element. This uses the high bits of the fingerprint,
+  // since the low bits are often used for hash bucket selection.
+  uint64 *Block(uint64 fp) const {
+    return blocks_ + ((fp >> 32) % num_blocks_) * kBlockWords;
+  }
+
+  // Mix fingerprint bits for selecting the bits within a block. Only the
+  // upper 54 bits of the product are used, since these depend on all the bits
+  // in the fingerprint.
+  static uint64 Mix(uint64 fp) {
+    return (fp * 0x9E3779B97F4A7C15ULL) >> 10;
+  }
+
+  // Filter blocks.
+  uint64 *blocks_ = nullptr;
+
+  // Number of blocks in filter.
+  size_t num_blocks_ = 0;
+};
+
 }  // namespace sling
 
 #endif  // SLING_UTIL_BLOOM_H_
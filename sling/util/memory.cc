@@ -0,0 +1,132 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sling/util/memory.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string>
+
+#include "sling/base/logging.h"
+#include "sling/base/types.h"
+
+namespace sling {
+
+// NUMA memory policies for mbind(2). These are defined here to avoid a
+// dependency on libnuma.
+static const int kMemPolicyBind = 2;
+static const int kMemPolicyInterleave = 3;
+
+// Maximum number of NUMA nodes supported.
+static const int kMaxNumaNodes = 64;
+
+// Round size up to a multiple of the huge page size.
+static size_t HugePageAlign(size_t size) {
+  return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+void *AllocateMemory(size_t size, bool huge_pages) {
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (huge_pages) {
+    // Try to use explicit huge pages first. This fails if no huge pages have
+    // been reserved.
+    data = mmap(nullptr, HugePageAlign(size), prot, flags | MAP_HUGETLB,
+                -1, 0);
+    if (data != MAP_FAILED) return data;
+    VLOG(1) << "No explicit huge pages available for " << size << " bytes";
+  }
+#endif
+  data = mmap(nullptr, HugePageAlign(size), prot, flags, -1, 0);
+  if (data == MAP_FAILED) return nullptr;
+  if (huge_pages) AdviseHugePages(data, size);
+  return data;
+}
+
+void FreeMemory(void *data, size_t size) {
+  if (data != nullptr) munmap(data, HugePageAlign(size));
+}
+
+bool AdviseHugePages(void *data, size_t size) {
+#ifdef MADV_HUGEPAGE
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  uintptr_t end = begin + size;
+  begin = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  end &= ~(kHugePageSize - 1);
+  if (begin >= end) return false;
+  return madvise(reinterpret_cast<void *>(begin), end - begin,
+                 MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
+int NumaNodes() {
+  static int nodes = 0;
+  if (nodes == 0) {
+    int n = 0;
+    while (n < kMaxNumaNodes) {
+      string dir = "/sys/devices/system/node/node" + std::to_string(n);
+      if (access(dir.c_str(), F_OK) != 0) break;
+      n++;
+    }
+    nodes = n > 0 ? n : 1;
+  }
+  return nodes;
+}
+
+bool PlaceMemory(void *data, size_t size, int placement) {
+#ifdef SYS_mbind
+  if (placement == NUMA_DEFAULT) return true;
+
+  // Compute node mask for policy.
+  int nodes = NumaNodes();
+  uint64 mask;
+  int mode;
+  if (placement == NUMA_INTERLEAVE) {
+    if (nodes == 1) return true;
+    mask = nodes == 64 ? ~0ULL : (1ULL << nodes) - 1;
+    mode = kMemPolicyInterleave;
+  } else if (placement >= 0 && placement < nodes) {
+    mask = 1ULL << placement;
+    mode = kMemPolicyBind;
+  } else {
+    LOG(WARNING) << "Invalid NUMA node: " << placement;
+    return false;
+  }
+
+  // Set policy for the whole pages in the range.
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  uintptr_t end = begin + size;
+  begin = (begin + page_size - 1) & ~(page_size - 1);
+  end &= ~(page_size - 1);
+  if (begin >= end) return false;
+  long rc = syscall(SYS_mbind, begin, end - begin, mode, &mask,
+                    kMaxNumaNodes + 1, 0);
+  if (rc != 0) {
+    VLOG(1) << "Unable to set NUMA policy: " << errno;
+    return false;
+  }
+  return true;
+#else
+  return placement == NUMA_DEFAULT;
+#endif
+}
+
+}  // namespace sling
@@ -0,0 +1,61 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SLING_UTIL_MEMORY_H_
+#define SLING_UTIL_MEMORY_H_
+
+#include <stddef.h>
+
+namespace sling {
+
+// Memory placement for large memory areas. Random access to multi-gigabyte
+// tables is dominated by TLB misses, which can be reduced by backing the
+// memory with huge pages. On multi-socket machines, the pages can also be
+// interleaved over the NUMA nodes or bound to a specific node. All of these
+// are hints; if the kernel does not support them, the memory is just backed by
+// normal pages.
+
+// Size of huge pages.
+static const size_t kHugePageSize = 2 << 20;
+
+// NUMA placement policies. Non-negative values bind memory to a node.
+enum NumaPlacement {
+  NUMA_DEFAULT = -1,     // first-touch placement
+  NUMA_INTERLEAVE = -2,  // interleave pages over all nodes
+};
+
+// Allocate zero-initialized anonymous memory mapping. If huge pages are
+// requested, explicit huge pages (MAP_HUGETLB) are tried first, falling back
+// to normal pages with transparent huge pages enabled. Returns null if the
+// memory cannot be allocated. The memory must be freed with FreeMemory().
+void *AllocateMemory(size_t size, bool huge_pages);
+
+// Free memory allocated with AllocateMemory().
+void FreeMemory(void *data, size_t size);
+
+// Enable transparent huge pages for the huge-page aligned part of a memory
+// range. Returns false if this is not supported.
+bool AdviseHugePages(void *data, size_t size);
+
+// Return the number of NUMA nodes. Returns 1 if NUMA is not supported.
+int NumaNodes();
+
+// Set NUMA placement policy for the page-aligned part of a memory range. This
+// only affects pages that have not been touched yet. Returns false if this is
+// not supported.
+bool PlaceMemory(void *data, size_t size, int placement);
+
+}  // namespace sling
+
+#endif  // SLING_UTIL_MEMORY_H_
@@ -0,0 +1,101 @@
+// Copyright 2020 Ringgaard Research ApS
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sling/base/clock.h"
+#include "sling/base/flags.h"
+#include "sling/base/init.h"
+#include "sling/base/logging.h"
+#include "sling/file/file.h"
+#include "sling/util/unicode.h"
+
+DEFINE_string(input, "", "Text file with one text per line");
+DEFINE_string(normalization, "lcn", "Normalization flags");
+DEFINE_int32(repeat, 100, "Number of passes over the input");
+
+using namespace sling;
+
+// Mixed-script sample text used if no input file is given.
+static const char *sample[] = {
+  "Douglas Noël Adams (11 March 1952 – 11 May 2001) was an English author, "
+  "screenwriter, essayist, humorist, satirist and dramatist.",
+  "Adams was born in Cambridge, England, and educated at Brentwood School "
+  "in Essex before attending St John's College, Cambridge.",
+  "Дуглас Ноэль Адамс — английский писатель, драматург и сценарист, автор "
+  "юмористических фантастических произведений.",
+  "ダグラス・アダムズはイギリスの脚本家、SF作家である。",
+  "道格拉斯·亚当斯是英国的广播剧作家、音乐家，尤其以《银河便车指南》系列作品出名。",
+  "Ο Ντάγκλας Άνταμς ήταν Άγγλος συγγραφέας και σεναριογράφος.",
+  "Douglas Adams war ein britischer Schriftsteller. Er wurde vor allem "
+  "durch Per Anhalter durch die Galaxis bekannt.",
+  "Douglas Adams était un écrivain britannique, auteur du Guide du voyageur "
+  "galactique, créé à l'origine pour la radio de la BBC en 1978.",
+};
+
+// Time function over all texts and return the cost in nanoseconds per byte.
+template <typename F>
+double Time(const std::vector<string> &texts, F func) {
+  uint64 bytes = 0;
+  for (const string &text : texts) bytes += text.size();
+  Clock clock;
+  clock.start();
+  for (int r = 0; r < FLAGS_repeat; ++r) {
+    for (const string &text : texts) func(text);
+  }
+  clock.stop();
+  return clock.ns() / (bytes * FLAGS_repeat);
+}
+
+// Compare the cost of UTF8 normalization and lowercasing with and without
+// the vectorized fast paths.
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  // Read input texts.
+  std::vector<string> texts;
+  if (FLAGS_input.empty()) {
+    for (const char *text : sample) texts.push_back(text);
+  } else {
+    string data;
+    CHECK(File::ReadContents(FLAGS_input, &data));
+    size_t start = 0;
+    while (start < data.size()) {
+      size_t end = data.find('\n', start);
+      if (end == string::npos) end = data.size();
+      if (end > start) texts.push_back(data.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+  int flags = ParseNormalization(FLAGS_normalization);
+
+  string result;
+  for (bool vectorized : {false, true}) {
+    UTF8::SetVectorized(vectorized);
+    double normalize = Time(texts, [&](const string &text) {
+      UTF8::Normalize(text, flags, &result);
+    });
+    double lowercase = Time(texts, [&](const string &text) {
+      UTF8::Lowercase(text, &result);
+    });
+    std::cout << (vectorized ? "vectorized" : "scalar")
+              << ": normalize " << normalize << " ns/byte"
+              << ", lowercase " << lowercase << " ns/byte\n";
+  }
+  UTF8::SetVectorized(true);
+
+  return 0;
+}
@@ -15,6 +15,9 @@
 #include "sling/util/unicode.h"
 
 #include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "sling/base/logging.h"
 #include "sling/base/types.h"
@@ -40,6 +43,71 @@ const uint8 utf8_skip_tab[256] = {
   3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,
 };
 
+// Use vectorized fast paths for ASCII characters.
+static bool vectorized = true;
+
+#ifdef __SSE2__
+
+// Load up to 16 bytes into SSE register. Bytes beyond the end of the input are
+// zero.
+static inline __m128i LoadBlock(const char *s, int len) {
+  if (len >= 16) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+  } else {
+    char buffer[16] = {0};
+    memcpy(buffer, s, len);
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer));
+  }
+}
+
+// Return mask for bytes in the range [lo;hi]. Bytes above 127 are negative and
+// are never in range.
+static inline __m128i InRange(__m128i v, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+// Return the number of leading one bits in a 16-bit mask.
+static inline int LeadingOnes(int mask, int len) {
+  int n = mask == 0xffff ? 16 : __builtin_ctz(~mask);
+  return n < len ? n : len;
+}
+
+// Lowercase the leading characters below 128 in a block of up to 16 bytes.
+// Returns the number of characters converted into the output block.
+static int LowercaseASCII(const char *s, int len, char *out) {
+  __m128i v = LoadBlock(s, len);
+  int n = LeadingOnes(~_mm_movemask_epi8(v) & 0xffff, len);
+  if (n == 0) return 0;
+  __m128i upper = InRange(v, 'A', 'Z');
+  v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), v);
+  return n;
+}
+
+// Normalize the leading ASCII letters and digits in a block of up to 16 bytes.
+// Returns the number of characters normalized into the output block.
+static int NormalizeAlnumASCII(const char *s, int len, int flags, char *out) {
+  __m128i v = LoadBlock(s, len);
+  __m128i upper = InRange(v, 'A', 'Z');
+  __m128i lower = InRange(v, 'a', 'z');
+  __m128i digit = InRange(v, '0', '9');
+  __m128i alnum = _mm_or_si128(_mm_or_si128(upper, lower), digit);
+  int n = LeadingOnes(_mm_movemask_epi8(alnum), len);
+  if (n == 0) return 0;
+  if (flags & NORMALIZE_CASE) {
+    v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+  }
+  if (flags & NORMALIZE_DIGITS) {
+    v = _mm_or_si128(_mm_andnot_si128(digit, v),
+                     _mm_and_si128(digit, _mm_set1_epi8('9')));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), v);
+  return n;
+}
+
+#endif
+
 Normalization ParseNormalization(const string &spec) {
   int flags = NORMALIZE_NONE;
   for (char c : spec) {
@@ -418,23 +486,33 @@ void UTF8::Lowercase(const char *s, int len, string *result) {
   result->clear();
   result->reserve(len);
 
-  // Try fast conversion where all characters are below 128. All characters
-  // below 128 are converted to one byte codes.
   const char *end = s + len;
   while (s < end) {
-    uint8 c = *reinterpret_cast<const uint8 *>(s);
-    if (c & 0x80) break;
-    result->push_back(unicode_lower_tab[c]);
-    s++;
-  }
+#ifdef __SSE2__
+    // Convert runs of characters below 128 in blocks of 16 bytes.
+    if (vectorized) {
+      char block[16];
+      int n = LowercaseASCII(s, end - s, block);
+      if (n > 0) {
+        result->append(block, n);
+        s += n;
+        continue;
+      }
+    }
+#endif
 
-  // Handle any remaining part of the string which can contain multi-byte
-  // characters.
-  while (s < end) {
-    int code = Decode(s);
-    int lower = Unicode::ToLower(code);
-    Encode(lower, result);
-    s = Next(s);
+    uint8 c = *reinterpret_cast<const uint8 *>(s);
+    if (c & 0x80) {
+      // Multi-byte character.
+      int code = Decode(s);
+      int lower = Unicode::ToLower(code);
+      Encode(lower, result);
+      s = Next(s);
+    } else {
+      // All characters below 128 are converted to one byte codes.
+      result->push_back(unicode_lower_tab[c]);
+      s++;
+    }
   }
 }
 
@@ -442,44 +520,48 @@ void UTF8::Normalize(const char *s, int len, int flags, string *normalized) {
   // Clear output string.
   normalized->clear();
 
-  // Try fast conversion where all characters are below 128. All characters
-  // below 128 are normalized to one byte codes.
   bool brk = false;
   const char *end = s + len;
   int last = 0;
   while (s < end) {
-    uint8 c = *reinterpret_cast<const uint8 *>(s);
-    if (c & 0x80) break;
-    int ch = Unicode::Normalize(c, flags);
-    if (ch == last && (flags & NORMALIZE_DOUBLES)) {
-      s++;
-      continue;
-    }
-    last = ch;
-    if (ch > 0) {
-      if (ch == ' ') {
-        brk = true;
-      } else {
+#ifdef __SSE2__
+    // Normalize runs of ASCII letters and digits in blocks of 16 bytes. These
+    // are never removed or replaced by spaces, so they can be copied to the
+    // output directly. Double letter removal is not supported in the fast
+    // path.
+    if (vectorized && (flags & NORMALIZE_DOUBLES) == 0) {
+      char block[16];
+      int n = NormalizeAlnumASCII(s, end - s, flags, block);
+      if (n > 0) {
         if (brk) {
           if ((flags & NORMALIZE_WHITESPACE) == 0) {
             normalized->push_back(' ');
           }
           brk = false;
         }
-        normalized->push_back(ch);
+        normalized->append(block, n);
+        last = block[n - 1];
+        s += n;
+        continue;
       }
-    } else if (flags & NORMALIZE_PHRASE) {
-      brk = true;
     }
-    s++;
-  }
+#endif
+
+    // Normalize next character. All characters below 128 are normalized to
+    // one byte codes.
+    int ch;
+    const char *next;
+    uint8 c = *reinterpret_cast<const uint8 *>(s);
+    if (c & 0x80) {
+      ch = Unicode::Normalize(Decode(s), flags);
+      next = Next(s);
+    } else {
+      ch = Unicode::Normalize(c, flags);
+      next = s + 1;
+    }
 
-  // Handle any remaining part of the string which can contain multi-byte
-  // characters.
-  while (s < end) {
-    int ch = Unicode::Normalize(Decode(s), flags);
     if (ch == last && (flags & NORMALIZE_DOUBLES)) {
-      s = Next(s);
+      s = next;
       continue;
     }
     last = ch;
@@ -498,10 +580,14 @@ void UTF8::Normalize(const char *s, int len, int flags, string *normalized) {
     } else if (flags & NORMALIZE_PHRASE) {
       brk = true;
     }
-    s = Next(s);
+    s = next;
   }
 }
 
+void UTF8::SetVectorized(bool enabled) {
+  vectorized = enabled;
+}
+
 void UTF8::ToTitleCase(const char *s, int len, string *titlecased) {
   if (len == 0) {
     titlecased->clear();
@@ -308,6 +308,11 @@ class UTF8 {
     return result;
   }
 
+  // Enable or disable the vectorized fast paths for ASCII characters in
+  // Lowercase() and Normalize(). The fast paths are enabled by default when
+  // supported by the CPU, and this is mostly used for benchmarking.
+  static void SetVectorized(bool enabled);
+
   // Convert string to title case, i.e. make the first letter uppercase.
   static void ToTitleCase(const char *s, int len, string *titlecased);
   static void ToTitleCase(const string &str, string *titlecased) {
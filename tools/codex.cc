@@ -45,7 +45,7 @@ DEFINE_bool(utf8, true, "Allow UTF8-encoded output");
 DEFINE_bool(db, false, "Read input from database");
 DEFINE_bool(version, false, "Output record version");
 DEFINE_bool(follow, false, "Incrementally fetch new changes");
-DEFINE_int32(poll, 1000, "Poll interval (in ms) for incremental fetching");
+DEFINE_int32(poll, 1000, "Poll interval (in ms) if server cannot push changes");
 DEFINE_string(field, "", "Only display a single field from frame");
 DEFINE_bool(timestamp, false, "Output version as timestamp");
 DEFINE_bool(position, false, "Output file position");
@@ -148,9 +148,21 @@ void DisplayDatabase(const string &filename) {
     DBIterator iterator;
     iterator.batch = FLAGS_batch;
     iterator.novalue = FLAGS_keys;
-    if (FLAGS_follow) CHECK(db.Epoch(&iterator.position));
+    bool subscribed = false;
+    if (FLAGS_follow) {
+      // Subscribe to changes pushed from the server. Fall back to polling if
+      // the server does not support subscriptions.
+      CHECK(db.Epoch(&iterator.position));
+      Status st = db.Subscribe(&iterator);
+      if (st.ok()) {
+        subscribed = true;
+      } else {
+        LOG(WARNING) << "Subscription failed, polling for changes: " << st;
+      }
+    }
     for (;;) {
-      Status st = db.Next(&iterator, &records);
+      Status st = subscribed ? db.Changes(&iterator, &records)
+                             : db.Next(&iterator, &records);
       if (!st.ok()) {
         if (st.code() == ENOENT) {
           if (!FLAGS_follow) break;
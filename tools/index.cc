@@ -16,13 +16,18 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "sling/base/clock.h"
 #include "sling/base/init.h"
 #include "sling/base/flags.h"
 #include "sling/base/logging.h"
 #include "sling/base/types.h"
 #include "sling/file/file.h"
 #include "sling/file/recordio.h"
+#include "sling/util/mutex.h"
+#include "sling/util/random.h"
+#include "sling/util/thread.h"
 
 sling::RecordFileOptions options;
 
@@ -38,9 +43,153 @@ DEFINE_int32(index_page_size, options.index_page_size,
              "Number of entries in each index record");
 DEFINE_int32(index_cache_size, options.index_cache_size,
              "Size of index page cache");
+DEFINE_int32(compression_level, options.compression_level,
+             "Compression level for DEFLATE compression");
+DEFINE_string(dictionary, "", "File with DEFLATE compression dictionary");
+DEFINE_string(train_dictionary, "",
+              "Train compression dictionary on records and write to file");
+DEFINE_bool(compare, false,
+            "Compare compression ratio and decoding speed for records");
+DEFINE_int32(samples, 100000,
+             "Number of records for dictionary training and comparison");
+DEFINE_int32(benchmark, 0,
+             "Number of random lookups for record database benchmark");
+DEFINE_int32(threads, 8, "Maximum number of threads for benchmark");
 
 using namespace sling;
 
+// Read sample of record values from files.
+void ReadSamples(const std::vector<string> &files,
+                 std::vector<string> *values) {
+  for (const string &file : files) {
+    RecordReader reader(file, options);
+    Record record;
+    while (!reader.Done() && values->size() < FLAGS_samples) {
+      CHECK(reader.Read(&record));
+      values->emplace_back(record.value.data(), record.value.size());
+    }
+  }
+}
+
+// Write sample records with compression options and report the compression
+// ratio and decoding speed.
+void Compare(const std::vector<string> &files) {
+  std::vector<string> values;
+  ReadSamples(files, &values);
+  CHECK(!values.empty());
+  int64 raw = 0;
+  for (const string &value : values) raw += value.size();
+
+  // Train dictionary on the first half of the samples and compare on the
+  // second half.
+  std::vector<string> training(values.begin(),
+                               values.begin() + values.size() / 2);
+  string dictionary = RecordFile::TrainDictionary(training);
+  std::cout << values.size() << " records, " << raw << " bytes, "
+            << dictionary.size() << " bytes dictionary\n";
+
+  string dir;
+  CHECK(File::CreateTempDir(&dir));
+  string filename = dir + "/compare.rec";
+  struct Method {
+    const char *name;
+    RecordFile::CompressionType compression;
+    bool dictionary;
+  };
+  Method methods[] = {
+    {"uncompressed", RecordFile::UNCOMPRESSED, false},
+    {"snappy", RecordFile::SNAPPY, false},
+    {"deflate", RecordFile::DEFLATE, false},
+    {"deflate+dict", RecordFile::DEFLATE, true},
+  };
+  for (const Method &method : methods) {
+    // Write records.
+    RecordFileOptions opts = options;
+    opts.compression = method.compression;
+    if (method.dictionary) opts.dictionary = dictionary;
+    RecordWriter writer(filename, opts);
+    for (int i = values.size() / 2; i < values.size(); ++i) {
+      CHECK(writer.Write(values[i]));
+    }
+    CHECK(writer.Close());
+
+    // Read records back.
+    Clock clock;
+    clock.start();
+    RecordReader reader(filename, opts);
+    Record record;
+    int64 bytes = 0;
+    while (!reader.Done()) {
+      CHECK(reader.Read(&record));
+      bytes += record.value.size();
+    }
+    clock.stop();
+
+    std::cout << method.name
+              << ": ratio " << (bytes * 1.0 / reader.size())
+              << ", decode " << (bytes / clock.us()) << " MB/s\n";
+  }
+  CHECK(File::Delete(filename));
+}
+
+// Benchmark random key lookups in record database with seek-based lookups
+// serialized by a mutex and with concurrent lookups in memory-mapped shards.
+void Benchmark(const std::vector<string> &files) {
+  // Open database with and without memory-mapped shards.
+  RecordDatabase db(files, options);
+  RecordFileOptions mapopts = options;
+  mapopts.memory_mapped = true;
+  RecordDatabase mapdb(files, mapopts);
+
+  // Collect keys for all records.
+  std::vector<string> keys;
+  Record record;
+  while (!db.Done()) {
+    CHECK(db.Next(&record));
+    keys.emplace_back(record.key.data(), record.key.size());
+  }
+  CHECK(!keys.empty());
+  std::cout << keys.size() << " records in " << files.size() << " shards\n";
+
+  // Select random keys for lookup.
+  Random rnd;
+  std::vector<int> sample(FLAGS_benchmark);
+  for (int &s : sample) s = rnd.UniformInt(keys.size());
+
+  for (int threads = 1; threads <= FLAGS_threads; threads *= 2) {
+    int chunk = (sample.size() + threads - 1) / threads;
+    for (bool mapped : {false, true}) {
+      Mutex mu;
+      Clock clock;
+      clock.start();
+      WorkerPool pool;
+      pool.Start(threads, [&](int index) {
+        Record rec;
+        IOBuffer buffer;
+        int begin = index * chunk;
+        int end = std::min<int>(begin + chunk, sample.size());
+        for (int i = begin; i < end; ++i) {
+          const string &key = keys[sample[i]];
+          if (mapped) {
+            CHECK(mapdb.Lookup(key, &rec, &buffer)) << key;
+          } else {
+            MutexLock lock(&mu);
+            CHECK(db.Lookup(key, &rec)) << key;
+          }
+        }
+      });
+      pool.Join();
+      clock.stop();
+
+      std::cout << (mapped ? "mapped" : "seek")
+                << " threads: " << threads
+                << ", lookups/sec: "
+                << static_cast<int64>(sample.size() / clock.secs())
+                << "\n";
+    }
+  }
+}
+
 int main(int argc, char *argv[]) {
   InitProgram(&argc, &argv);
 
@@ -51,6 +200,10 @@ int main(int argc, char *argv[]) {
       static_cast<RecordFile::CompressionType>(FLAGS_compression);
   options.index_page_size = FLAGS_index_page_size;
   options.index_cache_size = FLAGS_index_cache_size;
+  options.compression_level = FLAGS_compression_level;
+  if (!FLAGS_dictionary.empty()) {
+    CHECK(File::ReadContents(FLAGS_dictionary, &options.dictionary));
+  }
   options.indexed = true;
 
   // Get files to index.
@@ -59,7 +212,19 @@ int main(int argc, char *argv[]) {
     File::Match(argv[i], &files);
   }
 
-  if (FLAGS_check) {
+  if (FLAGS_benchmark > 0) {
+    Benchmark(files);
+  } else if (FLAGS_compare) {
+    Compare(files);
+  } else if (!FLAGS_train_dictionary.empty()) {
+    // Train compression dictionary on sample of records.
+    std::vector<string> values;
+    ReadSamples(files, &values);
+    string dictionary = RecordFile::TrainDictionary(values);
+    CHECK(File::WriteContents(FLAGS_train_dictionary, dictionary));
+    std::cout << "Wrote " << dictionary.size() << " bytes dictionary to "
+              << FLAGS_train_dictionary << "\n";
+  } else if (FLAGS_check) {
     // Output information for each record file.
     for (const string &file : files) {
       RecordReader reader(file, options);
@@ -72,6 +237,7 @@ int main(int argc, char *argv[]) {
                 << " version " << version
                 << " data size: " << reader.size()
                 << " compression: " << static_cast<int>(info.compression)
+                << " dictionary: " << reader.dictionary().size()
                 << " chunk size: " << info.chunk_size
                 << " indexed: " << (info.index_root != 0 ? "yes" : "no");
       if (info.index_root != 0) {